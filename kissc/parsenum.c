@@ -32,7 +32,7 @@
  \
     ParseNumError strnto## type(const char *nptr, const char * const end, char **endptr, int base, type *min, type *max, type *ret) { \
         char c; \
-        char ***spp; \
+        char **sp, ***spp; \
         bool negative; \
         int any, cutlim; \
         ParseNumError err; \
@@ -42,8 +42,6 @@
         negative = false; \
         err = PARSE_NUM_NO_ERR; \
         if (NULL == endptr) { \
-            char **sp; \
- \
             sp = (char **) &nptr; \
             spp = &sp; \
         } else { \
@@ -143,7 +141,7 @@ parse_signed(int64_t, uint64_t, INT64_MIN, INT64_MAX);
  \
     ParseNumError strnto## type(const char *nptr, const char * const end, char **endptr, int base, type *min, type *max, type *ret) { \
         char c; \
-        char ***spp; \
+        char **sp, ***spp; \
         bool negative; \
         int any, cutlim; \
         type cutoff, acc; \
@@ -153,8 +151,6 @@ parse_signed(int64_t, uint64_t, INT64_MIN, INT64_MAX);
         negative = false; \
         err = PARSE_NUM_NO_ERR; \
         if (NULL == endptr) { \
-            char **sp; \
- \
             sp = (char **) &nptr; \
             spp = &sp; \
         } else { \
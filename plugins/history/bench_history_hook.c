@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h> /* PATH_MAX */
+#include <unistd.h>
+#include <time.h>
+
+#include "common.h"
+#include "error/error.h"
+#include "history_db.h"
+#include "history_testing.h"
+
+/**
+ * Measures the time spent by the hooks to record a pkg command into the
+ * database in function of its count of jobs (package operations), for both
+ * the batched path (history_db_record) and the former one-INSERT-per-job.
+ *
+ * usage: bench_history_hook [jobs count ...]
+ */
+
+#define ROUNDS 5
+
+static const size_t default_jobs_counts[] = { 1, 10, 100, 500, 1500, 5000, 20000, };
+
+static history_line_t *generate_lines(size_t count, char **names)
+{
+    size_t i;
+    history_line_t *lines;
+
+    lines = calloc(count, sizeof(*lines));
+    assert(NULL != lines);
+    for (i = 0; i < count; i++) {
+        names[i] = malloc(STR_SIZE("package-18446744073709551615"));
+        assert(NULL != names[i]);
+        sprintf(names[i], "package-%zu", i);
+        lines[i].operation = PKG_OP_UPGRADE;
+        lines[i].repo = "FreeBSD";
+        lines[i].name = names[i];
+        lines[i].origin = "category/port";
+        lines[i].old_version = "1.2.3_1";
+        lines[i].new_version = "1.2.4";
+        lines[i].new_flatsize = 1048576;
+        lines[i].old_flatsize = 1044480;
+    }
+
+    return lines;
+}
+
+static bool record_row_by_row(sqlite_db_t *db, const char *command, const history_line_t *lines, size_t lines_count, char **error)
+{
+    bool ok;
+    size_t i;
+    int command_id;
+    history_line_ids_t *ids;
+
+    ids = malloc(sizeof(*ids) * lines_count);
+    assert(NULL != ids);
+    ok = false;
+    do {
+        if (!sqlite_transaction_begin(db, error)) {
+            break;
+        }
+        statement_bind(&history_statements[STMT_CREATE_COMMAND], time(NULL), command);
+        if (-1 == statement_fetch(db, &history_statements[STMT_CREATE_COMMAND], error)) {
+            break;
+        }
+        command_id = sqlite_last_insert_id(db);
+        if (!history_db_resolve_lines(db, lines, lines_count, ids, error)) {
+            break;
+        }
+        for (i = 0; i < lines_count; i++) {
+            statement_bind(&history_statements[STMT_CREATE_LINE], ids[i].repo, ids[i].name, ids[i].origin, ids[i].old_version, ids[i].new_version, lines[i].operation, command_id, lines[i].new_flatsize, lines[i].old_flatsize);
+            if (-1 == statement_fetch(db, &history_statements[STMT_CREATE_LINE], error)) {
+                break;
+            }
+        }
+        ok = i == lines_count && sqlite_transaction_commit(db, error);
+    } while (false);
+    free(ids);
+
+    return ok;
+}
+
+static bool bench(const char *path, size_t jobs_count, bool batched, double *elapsed, char **error)
+{
+    bool ok;
+    size_t i;
+    char **names;
+    history_line_t *lines;
+    sqlite_open_options_t options = { .busy_timeout = 0, .wal = true };
+
+    ok = true;
+    *elapsed = 0;
+    names = calloc(jobs_count, sizeof(*names));
+    assert(NULL != names);
+    lines = generate_lines(jobs_count, names);
+    for (i = 0; ok && i < ROUNDS; i++) {
+        double start;
+        sqlite_db_t *db;
+
+        remove_database(path);
+        start = now_ms();
+        // open is part of the cost paid by each hook
+        if (EPKG_OK != history_db_open(path, PKGDB_MODE_READ | PKGDB_MODE_WRITE | PKGDB_MODE_CREATE, &options, &db, error)) {
+            ok = false;
+            break;
+        }
+        if (batched) {
+            ok = history_db_record(db, "pkg upgrade -y", NULL, lines, jobs_count, error);
+        } else {
+            ok = record_row_by_row(db, "pkg upgrade -y", lines, jobs_count, error);
+        }
+        history_db_close(db);
+        *elapsed += now_ms() - start;
+    }
+    *elapsed /= ROUNDS;
+    for (i = 0; i < jobs_count; i++) {
+        free(names[i]);
+    }
+    free(names);
+    free(lines);
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int i, ret;
+    char *error;
+    char path[] = "/tmp/bench_history_hook.XXXXXX";
+    size_t jobs_counts[ARRAY_SIZE(default_jobs_counts)];
+    size_t jobs_counts_len;
+
+    error = NULL;
+    ret = EXIT_FAILURE;
+    if (argc > 1) {
+        jobs_counts_len = 0;
+        for (i = 1; i < argc && jobs_counts_len < ARRAY_SIZE(jobs_counts); i++) {
+            jobs_counts[jobs_counts_len++] = strtoul(argv[i], NULL, 10);
+        }
+    } else {
+        jobs_counts_len = ARRAY_SIZE(default_jobs_counts);
+        memcpy(jobs_counts, default_jobs_counts, sizeof(default_jobs_counts));
+    }
+    do {
+        int fd;
+        size_t j;
+
+        if (-1 == (fd = mkstemp(path))) {
+            set_system_error(&error, "mkstemp(3) failed");
+            break;
+        }
+        close(fd);
+        printf("%10s %15s %15s %10s\n", "jobs", "row by row (ms)", "batched (ms)", "speedup");
+        for (j = 0; j < jobs_counts_len; j++) {
+            double row_by_row, batched;
+
+            if (!bench(path, jobs_counts[j], false, &row_by_row, &error)) {
+                break;
+            }
+            if (!bench(path, jobs_counts[j], true, &batched, &error)) {
+                break;
+            }
+            printf("%10zu %15.3f %15.3f %9.2fx\n", jobs_counts[j], row_by_row, batched, row_by_row / batched);
+        }
+        if (j == jobs_counts_len) {
+            ret = EXIT_SUCCESS;
+        }
+    } while (false);
+    remove_database(path);
+    if (NULL != error) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+    }
+
+    return ret;
+}
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h> /* PATH_MAX */
+#include <unistd.h>
+#include <time.h>
+
+#include "common.h"
+#include "error/error.h"
+#include "history_db.h"
+#include "history_testing.h"
+
+/**
+ * Measures the time spent by history_db_open (followed by
+ * history_db_close) as done at the start of each hook (read/write) and of
+ * each pkg history (read-only), depending on the state of the database:
+ * - created: the database doesn't exist yet
+ * - checked: the existence of each table is checked (HISTORY_CHECK_SCHEMA
+ *   forces it, as when the schema has to be migrated)
+ * - version matches: the database is at the current version of the schema,
+ *   the checks are skipped
+ *
+ * For a breakdown of a single open, set HISTORY_TIMINGS in the environment
+ * of the plugin instead.
+ *
+ * usage: bench_history_open [rounds]
+ */
+
+#define DEFAULT_ROUNDS 200
+
+static const struct {
+    const char *name;
+    int mode;
+    bool create, check;
+} scenarios[] = {
+    { "created", PKGDB_MODE_READ | PKGDB_MODE_WRITE, true, true },
+    { "checked (read/write)", PKGDB_MODE_READ | PKGDB_MODE_WRITE, false, true },
+    { "checked (read-only)", PKGDB_MODE_READ, false, true },
+    { "version matches (read/write)", PKGDB_MODE_READ | PKGDB_MODE_WRITE, false, false },
+    { "version matches (read-only)", PKGDB_MODE_READ, false, false },
+};
+
+static bool bench(const char *path, size_t scenario, size_t rounds, double *average, double *best, char **error)
+{
+    bool ok;
+    size_t i;
+    sqlite_open_options_t options = { .busy_timeout = 0, .wal = true };
+
+    ok = true;
+    *average = 0;
+    *best = 0;
+    if (scenarios[scenario].check) {
+        setenv("HISTORY_CHECK_SCHEMA", "1", 1);
+    } else {
+        unsetenv("HISTORY_CHECK_SCHEMA");
+    }
+    for (i = 0; ok && i < rounds; i++) {
+        double start, elapsed;
+        sqlite_db_t *db;
+
+        if (scenarios[scenario].create) {
+            remove_database(path);
+        }
+        start = now_ms();
+        if (EPKG_OK != history_db_open(path, scenarios[scenario].mode | (scenarios[scenario].create ? PKGDB_MODE_CREATE : 0), &options, &db, error)) {
+            ok = false;
+            break;
+        }
+        history_db_close(db);
+        elapsed = now_ms() - start;
+        *average += elapsed;
+        if (0 == i || elapsed < *best) {
+            *best = elapsed;
+        }
+    }
+    *average /= rounds;
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+    char *error;
+    size_t rounds;
+    char path[] = "/tmp/bench_history_open.XXXXXX";
+
+    error = NULL;
+    ret = EXIT_FAILURE;
+    rounds = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ROUNDS;
+    do {
+        int fd;
+        size_t i;
+
+        if (0 == rounds) {
+            set_generic_error(&error, "invalid count of rounds: %s", argv[1]);
+            break;
+        }
+        if (-1 == (fd = mkstemp(path))) {
+            set_system_error(&error, "mkstemp(3) failed");
+            break;
+        }
+        close(fd);
+        printf("%30s %15s %15s\n", "database", "average (ms)", "best (ms)");
+        // the first scenario leaves a database at the current version for the next ones
+        for (i = 0; i < ARRAY_SIZE(scenarios); i++) {
+            double average, best;
+
+            if (!bench(path, i, rounds, &average, &best, &error)) {
+                break;
+            }
+            printf("%30s %15.3f %15.3f\n", scenarios[i].name, average, best);
+            fflush(stdout);
+        }
+        if (i == ARRAY_SIZE(scenarios)) {
+            ret = EXIT_SUCCESS;
+        }
+    } while (false);
+    remove_database(path);
+    if (NULL != error) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+    }
+
+    return ret;
+}
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h> /* PATH_MAX */
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "common.h"
+#include "error/error.h"
+#include "history_db.h"
+#include "history_generator.h"
+#include "history_output.h"
+#include "history_testing.h"
+
+/**
+ * Measures the time spent to render the whole history of a synthetic
+ * database (about 1 million package operations by default, generated by
+ * history_generate) by each output format:
+ * - end to end: fetch and render, the fetch alone (no rendering) gives
+ *   the baseline
+ * - render only: the first SAMPLE_SIZE rows, copied in memory, rendered
+ *   over and over until the count of rows of the database is reached
+ *
+ * Rendered output goes to /dev/null, timings are printed on stdout.
+ *
+ * usage: bench_history_output [rows count]
+ */
+
+#define ROUNDS 3
+#define DEFAULT_ROWS_COUNT 1000000
+#define SAMPLE_SIZE 10000
+
+/**
+ * Rows copied from the database, the strings are stored in pool
+ */
+typedef struct {
+    size_t rows_count;
+    history_row_t rows[SAMPLE_SIZE];
+    char *pool, *pool_w, *pool_end;
+} sample_t;
+
+#define POOL_SIZE (SAMPLE_SIZE * 256)
+
+static const char *sample_strdup(sample_t *sample, const char *string)
+{
+    char *copy;
+    size_t string_size;
+
+    if (NULL == string) {
+        return NULL;
+    }
+    string_size = strlen(string) + 1;
+    assert(sample->pool_end - sample->pool_w >= (ptrdiff_t) string_size);
+    copy = memcpy(sample->pool_w, string, string_size);
+    sample->pool_w += string_size;
+
+    return copy;
+}
+
+static void fetch_sample(sample_t *sample)
+{
+    Iterator it;
+    history_row_t row;
+    sqlite_statement_t *stmt;
+
+    sample->rows_count = 0;
+    sample->pool = sample->pool_w = malloc(POOL_SIZE);
+    assert(NULL != sample->pool);
+    sample->pool_end = sample->pool + POOL_SIZE;
+    stmt = &history_statements[STMT_LIST_LINE];
+    statement_bind(stmt, (time_t) 0, time(NULL), PKG_OP_ALL, true, time(NULL), INT_MAX, SAMPLE_SIZE);
+    statement_to_iterator(&it, stmt, &row.command_id, &row.inserted_at, &row.command, &row.line_id, &row.name, &row.origin, &row.repo, &row.old_version, &row.new_version, &row.operation);
+    for (iterator_first(&it); iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+        history_row_t *copy;
+
+        copy = &sample->rows[sample->rows_count++];
+        *copy = row;
+        copy->command = sample_strdup(sample, row.command);
+        copy->name = sample_strdup(sample, row.name);
+        copy->origin = sample_strdup(sample, row.origin);
+        copy->repo = sample_strdup(sample, row.repo);
+        copy->old_version = sample_strdup(sample, row.old_version);
+        copy->new_version = sample_strdup(sample, row.new_version);
+    }
+    iterator_close(&it);
+}
+
+static const struct {
+    const char *name;
+    bool render;
+    history_format_t format;
+} renderers[] = {
+    { "fetch only", false, HISTORY_FORMAT_TABLE },
+    { "table", true, HISTORY_FORMAT_TABLE },
+    { "jsonl", true, HISTORY_FORMAT_JSONL },
+    { "csv", true, HISTORY_FORMAT_CSV },
+    { "tsv", true, HISTORY_FORMAT_TSV },
+};
+
+static bool bench(size_t renderer, size_t *rows, double *elapsed, char **error)
+{
+    bool ok;
+    size_t i;
+    history_output_t output;
+
+    ok = true;
+    *elapsed = 0;
+    for (i = 0; ok && i < ROUNDS; i++) {
+        Iterator it;
+        double start;
+        history_row_t row;
+        sqlite_statement_t *stmt;
+
+        *rows = 0;
+        start = now_ms();
+        if (!history_output_init(&output, renderers[renderer].format, STDOUT_FILENO, false, false, error)) {
+            ok = false;
+            break;
+        }
+        stmt = &history_statements[STMT_LIST_LINE];
+        statement_bind(stmt, (time_t) 0, time(NULL), PKG_OP_ALL, true, time(NULL), INT_MAX, INT_MAX);
+        statement_to_iterator(&it, stmt, &row.command_id, &row.inserted_at, &row.command, &row.line_id, &row.name, &row.origin, &row.repo, &row.old_version, &row.new_version, &row.operation);
+        for (iterator_first(&it); ok && iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+            if (renderers[renderer].render) {
+                ok = history_output_row(&output, &row, error);
+            }
+            ++*rows;
+        }
+        iterator_close(&it);
+        ok = ok && history_output_flush(&output, error);
+        history_output_close(&output);
+        *elapsed += now_ms() - start;
+    }
+    *elapsed /= ROUNDS;
+
+    return ok;
+}
+
+static bool bench_render(size_t renderer, const sample_t *sample, size_t rows_count, double *elapsed, char **error)
+{
+    bool ok;
+    size_t i, rows;
+    history_output_t output;
+
+    ok = true;
+    *elapsed = 0;
+    for (i = 0; ok && i < ROUNDS; i++) {
+        double start;
+
+        start = now_ms();
+        if (!history_output_init(&output, renderers[renderer].format, STDOUT_FILENO, false, false, error)) {
+            ok = false;
+            break;
+        }
+        for (rows = 0; ok && rows < rows_count; rows++) {
+            if (renderers[renderer].render) {
+                ok = history_output_row(&output, &sample->rows[rows % sample->rows_count], error);
+            }
+        }
+        ok = ok && history_output_flush(&output, error);
+        history_output_close(&output);
+        *elapsed += now_ms() - start;
+    }
+    *elapsed /= ROUNDS;
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+    char *error;
+    size_t rows_count;
+    char path[] = "/tmp/bench_history_output.XXXXXX";
+
+    error = NULL;
+    ret = EXIT_FAILURE;
+    rows_count = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ROWS_COUNT;
+    do {
+        int fd;
+        size_t i;
+        FILE *report;
+        double start;
+        static sample_t sample;
+        sqlite_db_t *db;
+        sqlite_open_options_t options = { .busy_timeout = 0, .wal = true };
+        history_generator_stats_t stats;
+        history_generator_options_t generator_options = HISTORY_GENERATOR_DEFAULTS;
+
+        if (-1 == (fd = mkstemp(path))) {
+            set_system_error(&error, "mkstemp(3) failed");
+            break;
+        }
+        close(fd);
+        // keep the real stdout for the report, the renderers write to /dev/null
+        if (NULL == (report = fdopen(dup(STDOUT_FILENO), "w"))) {
+            set_system_error(&error, "fdopen(3) failed");
+            break;
+        }
+        if (-1 == (fd = open("/dev/null", O_WRONLY)) || -1 == dup2(fd, STDOUT_FILENO)) {
+            set_system_error(&error, "failed to redirect stdout to /dev/null");
+            fclose(report);
+            break;
+        }
+        close(fd);
+        if (EPKG_OK != history_db_open(path, PKGDB_MODE_READ | PKGDB_MODE_WRITE | PKGDB_MODE_CREATE, &options, &db, &error)) {
+            fclose(report);
+            break;
+        }
+        // the rows are operations, about generator_options.lines per command
+        generator_options.commands = MAX((size_t) 1, rows_count / generator_options.lines);
+        start = now_ms();
+        if (!history_generate(db, &generator_options, &stats, &error)) {
+            history_db_close(db);
+            fclose(report);
+            break;
+        }
+        fprintf(report, "%zu rows inserted in %.3f ms\n\n", stats.operations, now_ms() - start);
+        fetch_sample(&sample);
+        fprintf(report, "%10s %10s %20s %15s %20s %15s\n", "format", "rows", "end to end (ms)", "rows/s", "render only (ms)", "rows/s");
+        for (i = 0; i < ARRAY_SIZE(renderers); i++) {
+            size_t rows;
+            double elapsed, render_elapsed;
+
+            // warm the page cache up before the first measure
+            if (0 == i && !bench(i, &rows, &elapsed, &error)) {
+                break;
+            }
+            if (!bench(i, &rows, &elapsed, &error)) {
+                break;
+            }
+            if (!bench_render(i, &sample, rows, &render_elapsed, &error)) {
+                break;
+            }
+            fprintf(report, "%10s %10zu %20.3f %15.0f %20.3f %15.0f\n", renderers[i].name, rows, elapsed, rows / (elapsed / 1e3), render_elapsed, rows / (render_elapsed / 1e3));
+            fflush(report);
+        }
+        free(sample.pool);
+        if (i == ARRAY_SIZE(renderers)) {
+            ret = EXIT_SUCCESS;
+        }
+        history_db_close(db);
+        fclose(report);
+    } while (false);
+    remove_database(path);
+    if (NULL != error) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+    }
+
+    return ret;
+}
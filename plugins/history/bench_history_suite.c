@@ -0,0 +1,1203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h> /* PRIu64 */
+#include <limits.h> /* PATH_MAX */
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "error/error.h"
+#include "history_db.h"
+#include "history_generator.h"
+#include "history_jails.h"
+#include "history_output.h"
+#include "history_spool.h"
+#include "history_testing.h"
+
+/**
+ * Generates a synthetic history (see history_generate) then times, on it:
+ * - each statement of history_statements: the ones which write in a
+ *   transaction rolled back after each round, so they all run on the same
+ *   database
+ * - the hooks: history_db_record (opening and closing the database, as
+ *   each pkg command does) and the spool (history_spool_append then
+ *   history_spool_fold), for a few counts of jobs
+ * - each output format, end to end (fetch and render to /dev/null)
+ * - the rendering of the dates of the commands in local time, by
+ *   timestamp_to_localtime (localtime_r and strftime for each of them)
+ *   then by timestamp_cache_render, checked to be byte identical (in the
+ *   buffers of the listings, for the default format and the ones of the
+ *   locales with a 4 digits year)
+ * - a page of pkg history --jails, the history being attached as each of
+ *   the jails, for a few counts of jails
+ *
+ * Each measure is the result of a number of rounds (after a warm up one):
+ * the minimum, the median and the mean are reported, as a table or as
+ * JSON lines (-F jsonl) to be compared from a run to another: the first
+ * record (type "meta") describes the database, the next ones (type
+ * "statement", "hook", "renderer", "localtime" or "jails") the measures.
+ *
+ * usage: bench_history_suite [-c commands] [-l lines by command] [-p packages]
+ *                            [-d days] [-s seed] [-r rounds] [-n rows] [-F table|jsonl]
+ *                            [-k path] [-g]
+ *
+ * -k keeps the database at path instead of a temporary file, -g only
+ * generates it.
+ */
+
+#define DEFAULT_ROUNDS 10
+// rows rendered by each output format
+#define DEFAULT_ROWS_COUNT 100000
+// limit of the listings, as a page of pkg history
+#define PAGE_SIZE 100
+
+static const size_t hook_jobs_counts[] = { 1, 10, 100, 1000, };
+
+static const size_t jails_counts[] = { 1, 10, 40, };
+
+typedef enum {
+    REPORT_TABLE,
+    REPORT_JSONL,
+} report_format_t;
+
+/**
+ * Where the measures go: the real stdout, the output formats write theirs
+ * to /dev/null
+ */
+typedef struct {
+    FILE *fp;
+    report_format_t format;
+} report_t;
+
+typedef struct {
+    size_t count;
+    double *elapsed;
+} samples_t;
+
+static int compare_double(const void *a, const void *b)
+{
+    double x, y;
+
+    x = *(const double *) a;
+    y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Prints a measure: what is measured (kind and name), for a count of jobs
+ * (hooks only, 0 otherwise) and the count of rows it produced
+ */
+static void report_measure(report_t *report, const char *kind, const char *name, size_t jobs, size_t rows, samples_t *samples)
+{
+    size_t i;
+    double mean, median;
+
+    mean = 0.0;
+    for (i = 0; i < samples->count; i++) {
+        mean += samples->elapsed[i];
+    }
+    mean /= samples->count;
+    qsort(samples->elapsed, samples->count, sizeof(*samples->elapsed), compare_double);
+    if (0 == samples->count % 2) {
+        median = (samples->elapsed[samples->count / 2 - 1] + samples->elapsed[samples->count / 2]) / 2.0;
+    } else {
+        median = samples->elapsed[samples->count / 2];
+    }
+    if (REPORT_JSONL == report->format) {
+        fprintf(
+            report->fp,
+            "{\"type\":\"%s\",\"name\":\"%s\",\"jobs\":%zu,\"rows\":%zu,\"rounds\":%zu,\"min_ms\":%.4f,\"median_ms\":%.4f,\"mean_ms\":%.4f,\"max_ms\":%.4f}\n",
+            kind, name, jobs, rows, samples->count, samples->elapsed[0], median, mean, samples->elapsed[samples->count - 1]
+        );
+    } else {
+        char label[128];
+
+        if (0 == jobs) {
+            snprintf(label, STR_SIZE(label), "%s", name);
+        } else {
+            snprintf(label, STR_SIZE(label), "%s (%zu jobs)", name, jobs);
+        }
+        fprintf(report->fp, "%-10s %-42s %10zu %12.3f %12.3f %12.3f\n", kind, label, rows, samples->elapsed[0], median, mean);
+    }
+    fflush(report->fp);
+}
+
+/**
+ * Values the statements are bound to, taken from the generated history:
+ * a line of the command in the middle of it, the checkpoint preceding
+ * this command and the line 100 lines before the last one
+ */
+typedef struct {
+    sqlite3 *db;
+    time_t now, middle;
+    int command, recent_line;
+    int repo_id, name_id, origin_id, version_id;
+    char name[128], origin[128], version[64], repo[64];
+    // patterns matching name for each kind of search
+    char glob[128], substring[128], regex[128];
+    history_checkpoint_t checkpoint;
+    // a path changed by a line from the middle (split as by history_files_record) and the changes of this line
+    char directory[256], directory_end[257], file[128];
+    unsigned char files[8192];
+    size_t files_size;
+} fixture_t;
+
+#define FIXTURE_QUERY \
+    "SELECT c.inserted_at, c.id, l.repo_id, l.name_id, l.origin_id, l.new_version_id, n.value, o.value, v.value, r.value," \
+    " (SELECT MAX(id) - 100 FROM " TABLE_PACKAGES ")" \
+    " FROM " TABLE_COMMANDS " c" \
+    " JOIN " TABLE_PACKAGES " l ON l.command_id = c.id" \
+    " JOIN " TABLE_NAMES " n ON n.id = l.name_id" \
+    " JOIN " TABLE_ORIGINS " o ON o.id = l.origin_id" \
+    " JOIN " TABLE_VERSIONS " v ON v.id = l.new_version_id" \
+    " JOIN " TABLE_REPOSITORIES " r ON r.id = l.repo_id" \
+    " WHERE c.id >= (SELECT (MIN(id) + MAX(id)) / 2 FROM " TABLE_COMMANDS ")" \
+    " ORDER BY c.id, l.id LIMIT 1"
+
+#define FIXTURE_FILES_QUERY \
+    "SELECT d.value, p.name, f.data FROM " TABLE_FILES " f" \
+    " JOIN " TABLE_PATH_LINES " pl ON pl.line_id = f.line_id" \
+    " JOIN " TABLE_PATHS " p ON p.id = pl.path_id" \
+    " JOIN " TABLE_DIRECTORIES " d ON d.id = p.directory_id" \
+    " WHERE f.line_id >= (SELECT MIN(id) FROM " TABLE_PACKAGES " WHERE command_id = ?)" \
+    " ORDER BY f.line_id LIMIT 1"
+
+#define FIXTURE_CHECKPOINT_QUERY \
+    "SELECT id, inserted_at, command_id FROM " TABLE_CHECKPOINTS \
+    " WHERE (inserted_at, command_id) <= (?, ?)" \
+    " ORDER BY inserted_at DESC, command_id DESC LIMIT 1"
+
+static bool fixture_init(fixture_t *fixture, sqlite3 *db, char **error)
+{
+    bool ok;
+    size_t len;
+    sqlite3_stmt *stmt;
+
+    ok = false;
+    fixture->db = db;
+    fixture->now = time(NULL);
+    if (SQLITE_OK != sqlite3_prepare_v2(db, FIXTURE_QUERY, -1, &stmt, NULL)) {
+        set_generic_error(error, "%s", sqlite3_errmsg(db));
+        return false;
+    }
+    if (SQLITE_ROW == sqlite3_step(stmt)) {
+        fixture->middle = (time_t) sqlite3_column_int64(stmt, 0);
+        fixture->command = sqlite3_column_int(stmt, 1);
+        fixture->repo_id = sqlite3_column_int(stmt, 2);
+        fixture->name_id = sqlite3_column_int(stmt, 3);
+        fixture->origin_id = sqlite3_column_int(stmt, 4);
+        fixture->version_id = sqlite3_column_int(stmt, 5);
+        snprintf(fixture->name, STR_SIZE(fixture->name), "%s", sqlite3_column_text(stmt, 6));
+        snprintf(fixture->origin, STR_SIZE(fixture->origin), "%s", sqlite3_column_text(stmt, 7));
+        snprintf(fixture->version, STR_SIZE(fixture->version), "%s", sqlite3_column_text(stmt, 8));
+        snprintf(fixture->repo, STR_SIZE(fixture->repo), "%s", sqlite3_column_text(stmt, 9));
+        fixture->recent_line = sqlite3_column_int(stmt, 10);
+        ok = true;
+    } else {
+        set_generic_error(error, "the history is empty");
+    }
+    sqlite3_finalize(stmt);
+    if (!ok) {
+        return false;
+    }
+    // the first half of the name for the glob, its middle for the substring
+    len = strlen(fixture->name);
+    snprintf(fixture->glob, STR_SIZE(fixture->glob), "%.*s*", (int) (len / 2), fixture->name);
+    snprintf(fixture->substring, STR_SIZE(fixture->substring), "%.*s", (int) MIN(len, (size_t) 4), fixture->name + (len > 4 ? (len - 4) / 2 : 0));
+    snprintf(fixture->regex, STR_SIZE(fixture->regex), "^%.*s.*$", (int) (len / 2), fixture->name);
+    fixture->checkpoint.id = 0;
+    fixture->checkpoint.inserted_at = 0;
+    fixture->checkpoint.command_id = 0;
+    if (SQLITE_OK != sqlite3_prepare_v2(db, FIXTURE_CHECKPOINT_QUERY, -1, &stmt, NULL)) {
+        set_generic_error(error, "%s", sqlite3_errmsg(db));
+        return false;
+    }
+    sqlite3_bind_int64(stmt, 1, (sqlite3_int64) fixture->middle);
+    sqlite3_bind_int(stmt, 2, fixture->command);
+    if (SQLITE_ROW == sqlite3_step(stmt)) {
+        fixture->checkpoint.id = sqlite3_column_int(stmt, 0);
+        fixture->checkpoint.inserted_at = (time_t) sqlite3_column_int64(stmt, 1);
+        fixture->checkpoint.command_id = sqlite3_column_int(stmt, 2);
+    }
+    sqlite3_finalize(stmt);
+    *fixture->directory = *fixture->file = '\0';
+    fixture->files_size = 0;
+    if (SQLITE_OK != sqlite3_prepare_v2(db, FIXTURE_FILES_QUERY, -1, &stmt, NULL)) {
+        set_generic_error(error, "%s", sqlite3_errmsg(db));
+        return false;
+    }
+    sqlite3_bind_int(stmt, 1, fixture->command);
+    if (SQLITE_ROW == sqlite3_step(stmt)) {
+        snprintf(fixture->directory, STR_SIZE(fixture->directory), "%s", sqlite3_column_text(stmt, 0));
+        snprintf(fixture->file, STR_SIZE(fixture->file), "%s", sqlite3_column_text(stmt, 1));
+        fixture->files_size = MIN((size_t) sqlite3_column_bytes(stmt, 2), sizeof(fixture->files));
+        memcpy(fixture->files, sqlite3_column_blob(stmt, 2), fixture->files_size);
+    }
+    sqlite3_finalize(stmt);
+    snprintf(fixture->directory_end, STR_SIZE(fixture->directory_end), "%s\xFF", fixture->directory);
+
+    return true;
+}
+
+/**
+ * The statements are bound to a list of space separated tokens, repeated
+ * if the statement has more parameters (the multi-row INSERTs):
+ * - an integer
+ * - null
+ * - files: the changes to the files of the line of the fixture
+ * - one of the symbols of bind_symbol below
+ */
+static bool bind_token(sqlite3_stmt *stmt, int index, const char *token, size_t token_len, const fixture_t *fixture)
+{
+    size_t i;
+    struct {
+        const char *symbol;
+        bool text;
+        sqlite3_int64 integer;
+        const char *string;
+    } symbols[] = {
+        { "now", false, (sqlite3_int64) fixture->now, NULL },
+        { "middle", false, (sqlite3_int64) fixture->middle, NULL },
+        { "command", false, fixture->command, NULL },
+        { "repo_id", false, fixture->repo_id, NULL },
+        { "name_id", false, fixture->name_id, NULL },
+        { "origin_id", false, fixture->origin_id, NULL },
+        { "version_id", false, fixture->version_id, NULL },
+        { "recent_line", false, fixture->recent_line, NULL },
+        { "checkpoint", false, fixture->checkpoint.id, NULL },
+        { "checkpoint_at", false, (sqlite3_int64) fixture->checkpoint.inserted_at, NULL },
+        { "checkpoint_command", false, fixture->checkpoint.command_id, NULL },
+        // the row inserted by the setup of the case
+        { "inserted", false, sqlite3_last_insert_rowid(fixture->db), NULL },
+        { "all", false, PKG_OP_ALL, NULL },
+        { "upgrade", false, PKG_OP_UPGRADE, NULL },
+        { "page", false, PAGE_SIZE, NULL },
+        { "max", false, INT_MAX, NULL },
+        { "name", true, 0, fixture->name },
+        { "origin", true, 0, fixture->origin },
+        { "version", true, 0, fixture->version },
+        { "repo", true, 0, fixture->repo },
+        { "directory", true, 0, fixture->directory },
+        { "directory_end", true, 0, fixture->directory_end },
+        { "file", true, 0, fixture->file },
+        { "command_line", true, 0, "pkg upgrade -y" },
+        // a string which is not in the dictionaries
+        { "new", true, 0, "bench_history_suite" },
+    };
+
+    if (token_len == STR_LEN("null") && 0 == strncmp(token, "null", token_len)) {
+        return SQLITE_OK == sqlite3_bind_null(stmt, index);
+    }
+    if (token_len == STR_LEN("files") && 0 == strncmp(token, "files", token_len)) {
+        return SQLITE_OK == sqlite3_bind_blob(stmt, index, fixture->files, (int) fixture->files_size, SQLITE_TRANSIENT);
+    }
+    if ('-' == *token || (*token >= '0' && *token <= '9')) {
+        return SQLITE_OK == sqlite3_bind_int64(stmt, index, strtoll(token, NULL, 10));
+    }
+    for (i = 0; i < ARRAY_SIZE(symbols); i++) {
+        if (token_len == strlen(symbols[i].symbol) && 0 == strncmp(token, symbols[i].symbol, token_len)) {
+            if (symbols[i].text) {
+                return SQLITE_OK == sqlite3_bind_text(stmt, index, symbols[i].string, -1, SQLITE_TRANSIENT);
+            } else {
+                return SQLITE_OK == sqlite3_bind_int64(stmt, index, symbols[i].integer);
+            }
+        }
+    }
+
+    return false;
+}
+
+static bool bind_tokens(sqlite3_stmt *stmt, const char *tokens, const fixture_t *fixture, char **error)
+{
+    const char *p;
+    int index, count, tokens_count;
+
+    tokens_count = 0;
+    for (p = tokens; '\0' != *p; p += strcspn(p, " ")) {
+        p += strspn(p, " ");
+        if ('\0' != *p) {
+            ++tokens_count;
+        }
+    }
+    p = tokens;
+    // the statements of history_db are reset before their next use, not after
+    sqlite3_reset(stmt);
+    count = sqlite3_bind_parameter_count(stmt);
+    if (count != tokens_count && (0 == tokens_count || 0 == count || 0 != count % tokens_count)) {
+        set_generic_error(error, "%d values for the %d parameters of %s", tokens_count, count, sqlite3_sql(stmt));
+        return false;
+    }
+    for (index = 1; index <= count; index++) {
+        size_t len;
+
+        while (' ' == *p) {
+            ++p;
+        }
+        if ('\0' == *p) {
+            p = tokens;
+            while (' ' == *p) {
+                ++p;
+            }
+        }
+        len = strcspn(p, " ");
+        if (!bind_token(stmt, index, p, len, fixture)) {
+            set_generic_error(error, "can't bind '%.*s' to parameter %d of %s", (int) len, p, index, sqlite3_sql(stmt));
+            return false;
+        }
+        p += len;
+    }
+
+    return true;
+}
+
+#define CASE_WRITE (1<<0)
+
+typedef struct {
+    const char *name;
+    // values of the parameters (see bind_tokens)
+    const char *binds;
+    // the symbol (see bind_token) of the package searched, NULL to keep the table of the searched packages as is
+    const char *searched;
+    // SQL run (untimed) before the statement, in the transaction of the writes
+    const char *setup;
+    int flags;
+} statement_case_t;
+
+#define CASE(statement, binds, searched, setup, flags) \
+    [ statement ] = { #statement, binds, searched, setup, flags }
+
+// the older rows from a cursor in the middle of the history then the newer ones
+#define KEYSET_CASE(statement, binds, searched) \
+    CASE(statement, binds, searched, NULL, 0), \
+    CASE(statement ## _BEFORE, binds, searched, NULL, 0)
+
+#define LINE_BINDS "repo_id name_id origin_id version_id version_id upgrade command 1048576 1044480"
+
+// a copy of the last line, for its files
+#define COPY_LAST_LINE \
+    "INSERT INTO " TABLE_PACKAGES "(repo_id, name_id, origin_id, old_version_id, new_version_id, operation_id, command_id, new_flatsize, old_flatsize)" \
+    " SELECT repo_id, name_id, origin_id, old_version_id, new_version_id, operation_id, command_id, new_flatsize, old_flatsize" \
+    " FROM " TABLE_PACKAGES " WHERE id = (SELECT MAX(id) FROM " TABLE_PACKAGES ")"
+
+// the paths changed by the last 100 lines, moved to new directories, as changed by a command
+#define FILL_CHANGED_PATHS \
+    "INSERT INTO temp." TABLE_CHANGED_PATHS "(line_id, directory, name)" \
+    " SELECT pl.line_id, d.value || 'bench/', p.name FROM " TABLE_PATH_LINES " pl" \
+    " JOIN " TABLE_PATHS " p ON p.id = pl.path_id" \
+    " JOIN " TABLE_DIRECTORIES " d ON d.id = p.directory_id" \
+    " WHERE pl.line_id > (SELECT MAX(line_id) - 100 FROM " TABLE_FILES ");"
+
+#define ADD_CHANGED_DIRECTORIES \
+    "INSERT INTO " TABLE_DIRECTORIES "(value) SELECT DISTINCT directory FROM temp." TABLE_CHANGED_PATHS ";"
+
+#define ADD_CHANGED_PATHS \
+    "INSERT INTO " TABLE_PATHS "(directory_id, name) SELECT DISTINCT d.id, cp.name FROM temp." TABLE_CHANGED_PATHS " cp" \
+    " JOIN " TABLE_DIRECTORIES " d ON d.value = cp.directory;"
+// the 1000 most recent lines, as collected from the jails (see history_jails_collect)
+#define FILL_JAIL_LINES \
+    "INSERT INTO temp." TABLE_JAIL_LINES "(" JAIL_LINES_COLUMNS ")" \
+    " SELECT 0, c.id, c.inserted_at, c.command, l.id, n.value, o.value, NULL, NULL, v.value, l.operation_id" \
+    " FROM " TABLE_COMMANDS " c JOIN " TABLE_PACKAGES " l ON l.command_id = c.id" \
+    " JOIN " TABLE_NAMES " n ON n.id = l.name_id" \
+    " JOIN " TABLE_ORIGINS " o ON o.id = l.origin_id" \
+    " JOIN " TABLE_VERSIONS " v ON v.id = l.new_version_id" \
+    " ORDER BY c.inserted_at DESC, l.id DESC LIMIT 1000"
+
+#define LIST_BINDS "0 now all 1 middle command page"
+#define SEARCH_BINDS "all 0 now 1 middle command page"
+
+static const statement_case_t statement_cases[STMT_COUNT] = {
+    CASE(STMT_CREATE_COMMAND, "now command_line 0 0 -1 1", NULL, NULL, CASE_WRITE),
+    CASE(STMT_CREATE_LINE, LINE_BINDS, NULL, NULL, CASE_WRITE),
+    CASE(STMT_CREATE_LINES_8, LINE_BINDS, NULL, NULL, CASE_WRITE),
+    CASE(STMT_CREATE_LINES_64, LINE_BINDS, NULL, NULL, CASE_WRITE),
+    CASE(STMT_FIND_REPOSITORY, "repo", NULL, NULL, 0),
+    CASE(STMT_CREATE_REPOSITORY, "new", NULL, NULL, CASE_WRITE),
+    CASE(STMT_FIND_NAME, "name", NULL, NULL, 0),
+    CASE(STMT_CREATE_NAME, "new", NULL, NULL, CASE_WRITE),
+    CASE(STMT_FIND_ORIGIN, "origin", NULL, NULL, 0),
+    CASE(STMT_CREATE_ORIGIN, "new", NULL, NULL, CASE_WRITE),
+    CASE(STMT_FIND_VERSION, "version", NULL, NULL, 0),
+    CASE(STMT_CREATE_VERSION, "new", NULL, NULL, CASE_WRITE),
+    CASE(STMT_CLEAR_SEARCHED, "", "name", NULL, CASE_WRITE),
+    CASE(STMT_CREATE_SEARCHED, "new new new", NULL, NULL, CASE_WRITE),
+    CASE(
+        STMT_CLEAR_MATCHED_VERSIONS,
+        "",
+        NULL,
+        "INSERT INTO temp." TABLE_MATCHED_VERSIONS "(version_id) SELECT id FROM " TABLE_VERSIONS,
+        CASE_WRITE
+    ),
+    CASE(STMT_MATCH_VERSIONS_LT, "version", NULL, NULL, CASE_WRITE),
+    CASE(STMT_MATCH_VERSIONS_LE, "version", NULL, NULL, CASE_WRITE),
+    CASE(STMT_MATCH_VERSIONS_EQ, "version", NULL, NULL, CASE_WRITE),
+    CASE(STMT_MATCH_VERSIONS_GE, "version", NULL, NULL, CASE_WRITE),
+    CASE(STMT_MATCH_VERSIONS_GT, "version", NULL, NULL, CASE_WRITE),
+    KEYSET_CASE(STMT_LIST_LINE, LIST_BINDS, NULL),
+    CASE(STMT_LIST_JAIL_LINES, "page", NULL, FILL_JAIL_LINES, CASE_WRITE),
+    CASE(STMT_LAST_LINE, "", NULL, NULL, 0),
+    CASE(STMT_FOLLOW_LINE, "recent_line all 1 0 1", NULL, NULL, 0),
+    KEYSET_CASE(STMT_SEARCH_LINE_EXACT, SEARCH_BINDS, "name"),
+    KEYSET_CASE(STMT_SEARCH_LINE_EXACT_CI, SEARCH_BINDS, "name"),
+    KEYSET_CASE(STMT_SEARCH_LINE_GLOB, SEARCH_BINDS, "glob"),
+#ifdef WITH_FTS
+    KEYSET_CASE(STMT_SEARCH_LINE_SUBSTRING, SEARCH_BINDS, "substring"),
+#endif /* WITH_FTS */
+#ifdef WITH_REGEX
+    KEYSET_CASE(STMT_SEARCH_LINE_REGEX, SEARCH_BINDS, "regex"),
+#endif /* WITH_REGEX */
+    CASE(STMT_STATS_BY_DAY, "0 now max", NULL, NULL, 0),
+    CASE(STMT_STATS_BY_WEEK, "0 now max", NULL, NULL, 0),
+    CASE(STMT_STATS_BY_MONTH, "0 now max", NULL, NULL, 0),
+    CASE(STMT_SLOWEST_COMMANDS, "0 now all 10", NULL, NULL, 0),
+    CASE(STMT_GROWTH_BY_PACKAGE, "middle now 10", NULL, NULL, 0),
+    CASE(STMT_GROWTH_BY_COMMAND, "middle now 10", NULL, NULL, 0),
+    CASE(STMT_STATS_TOP_PACKAGES, "upgrade 10", NULL, NULL, 0),
+    CASE(STMT_STATS_REPOSITORIES, "", NULL, NULL, 0),
+    CASE(STMT_RETENTION_BY_AGE, "middle 100", NULL, NULL, 0),
+    CASE(STMT_RETENTION_BY_COUNT, "1000 100", NULL, NULL, 0),
+    // the seek of the oldest commands (none is that old: the case is repeated)
+    CASE(STMT_RETENTION_DELETE, "0 max", NULL, NULL, CASE_WRITE),
+    CASE(STMT_RETENTION_CHECKPOINTS, "checkpoint_at checkpoint_command", NULL, NULL, CASE_WRITE),
+    CASE(STMT_INCREMENTAL_VACUUM, "", NULL, NULL, CASE_WRITE),
+    CASE(STMT_OLDEST_COMMAND, "", NULL, NULL, 0),
+    CASE(STMT_FIRST_COMMAND, "", NULL, NULL, 0),
+    CASE(STMT_LAST_CHECKPOINT, "", NULL, NULL, 0),
+    CASE(STMT_CHECKPOINT_BEFORE, "middle max", NULL, NULL, 0),
+    CASE(STMT_NEXT_CHECKPOINT, "checkpoint_at checkpoint_command 100", NULL, NULL, 0),
+    CASE(STMT_CREATE_CHECKPOINT, "now command", NULL, NULL, CASE_WRITE),
+    // from the checkpoint preceding the command in the middle to this command, into a new checkpoint
+    CASE(
+        STMT_CREATE_CHECKPOINT_PACKAGES,
+        "checkpoint_at checkpoint_command middle command checkpoint inserted",
+        NULL,
+        "INSERT INTO " TABLE_CHECKPOINTS "(inserted_at, command_id) VALUES(-1, -1)",
+        CASE_WRITE
+    ),
+    CASE(STMT_INSTALLED_AT, "checkpoint_at checkpoint_command middle command checkpoint", NULL, NULL, 0),
+    CASE(STMT_HOSTS_RUNNING, "1", "name", NULL, 0),
+    CASE(STMT_FILES_OF_NAME, "name_id", NULL, NULL, 0),
+    CASE(STMT_LAST_FILES_OF_NAME, "name_id", NULL, NULL, 0),
+    CASE(STMT_SET_LAST_FILES, "name_id files", NULL, NULL, CASE_WRITE),
+    CASE(STMT_CREATE_FILES, "inserted 1 1 files", NULL, COPY_LAST_LINE, CASE_WRITE),
+    CASE(STMT_CREATE_CHANGED_PATH, "command directory new", NULL, NULL, CASE_WRITE),
+    CASE(STMT_CREATE_CHANGED_DIRECTORIES, "", NULL, FILL_CHANGED_PATHS, CASE_WRITE),
+    CASE(STMT_CREATE_CHANGED_PATHS, "", NULL, FILL_CHANGED_PATHS ADD_CHANGED_DIRECTORIES, CASE_WRITE),
+    CASE(STMT_CREATE_PATH_LINES, "", NULL, FILL_CHANGED_PATHS ADD_CHANGED_DIRECTORIES ADD_CHANGED_PATHS, CASE_WRITE),
+    CASE(STMT_CLEAR_CHANGED_PATHS, "", NULL, FILL_CHANGED_PATHS, CASE_WRITE),
+    CASE(STMT_WHICH, "directory file", NULL, NULL, 0),
+    CASE(STMT_WHICH_PREFIX, "directory directory_end", NULL, NULL, 0),
+    CASE(STMT_SPOOL_FOLDED, "", NULL, NULL, 0),
+    CASE(STMT_SPOOL_SET_FOLDED, "1000 1", NULL, NULL, CASE_WRITE),
+    CASE(STMT_SPOOL_CLEAR, "", NULL, NULL, CASE_WRITE),
+};
+
+static bool exec(sqlite3 *db, const char *sql, char **error)
+{
+    if (SQLITE_OK != sqlite3_exec(db, sql, NULL, NULL, NULL)) {
+        set_generic_error(error, "%s: %s", sql, sqlite3_errmsg(db));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Runs once the statement of the case, returns the count of rows it
+ * produced (fetched or modified)
+ */
+static bool run_case(sqlite3 *db, size_t statement, const fixture_t *fixture, size_t *rows, double *elapsed, char **error)
+{
+    int ret;
+    bool ok;
+    double start;
+    sqlite3_stmt *stmt;
+    const statement_case_t *c;
+
+    ok = false;
+    *rows = 0;
+    c = &statement_cases[statement];
+    stmt = history_statements[statement].prepared;
+    if (HAS_FLAG(c->flags, CASE_WRITE) && !exec(db, "BEGIN", error)) {
+        return false;
+    }
+    do {
+        if (NULL != c->setup && !exec(db, c->setup, error)) {
+            break;
+        }
+        start = now_ms();
+        if (!bind_tokens(stmt, c->binds, fixture, error)) {
+            break;
+        }
+        while (SQLITE_ROW == (ret = sqlite3_step(stmt))) {
+            ++*rows;
+        }
+        *elapsed = now_ms() - start;
+        if (SQLITE_DONE != ret) {
+            set_generic_error(error, "%s: %s", c->name, sqlite3_errmsg(db));
+            break;
+        }
+        if (HAS_FLAG(c->flags, CASE_WRITE) && 0 == *rows) {
+            *rows = (size_t) sqlite3_changes(db);
+        }
+        ok = true;
+    } while (false);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    if (HAS_FLAG(c->flags, CASE_WRITE)) {
+        exec(db, "ROLLBACK", NULL);
+    }
+
+    return ok;
+}
+
+static bool bench_statements(sqlite_db_t *db, const fixture_t *fixture, report_t *report, samples_t *samples, char **error)
+{
+    bool ok;
+    size_t i;
+
+    ok = true;
+    for (i = 0; ok && i < STMT_COUNT; i++) {
+        size_t j, rows;
+        double elapsed;
+        const statement_case_t *c;
+
+        c = &statement_cases[i];
+        if (NULL == c->name) {
+            set_generic_error(error, "no benchmark for the statement %zu: %s", i, history_statements[i].statement);
+            ok = false;
+            break;
+        }
+        if (NULL != c->searched) {
+            const char *searched;
+
+            searched = 0 == strcmp(c->searched, "name") ? fixture->name : 0 == strcmp(c->searched, "glob") ? fixture->glob : 0 == strcmp(c->searched, "substring") ? fixture->substring : fixture->regex;
+            if (!(ok = history_db_set_searched(db, &searched, 1, error))) {
+                break;
+            }
+        }
+        // warm up
+        if (!(ok = run_case(fixture->db, i, fixture, &rows, &elapsed, error))) {
+            break;
+        }
+        for (j = 0; ok && j < samples->count; j++) {
+            ok = run_case(fixture->db, i, fixture, &rows, &samples->elapsed[j], error);
+        }
+        if (ok) {
+            report_measure(report, "statement", c->name, 0, rows, samples);
+        }
+    }
+
+    return ok;
+}
+
+// files of each package of the hooks, the first one is a library versioned by the round
+#define HOOK_FILES_COUNT 8
+#define HOOK_PATH_SIZE STR_SIZE("/usr/local/share/bench-package-18446744073709551615/libbench.so.18446744073709551615")
+
+typedef char hook_path_t[HOOK_PATH_SIZE];
+
+static history_line_t *hook_lines(size_t count, char (*names)[STR_SIZE("bench-package-18446744073709551615")], hook_path_t *paths, const char **files)
+{
+    size_t i, j;
+    history_line_t *lines;
+
+    lines = calloc(count, sizeof(*lines));
+    assert(NULL != lines);
+    for (i = 0; i < count; i++) {
+        snprintf(names[i], STR_SIZE(names[i]), "bench-package-%zu", i);
+        lines[i].operation = PKG_OP_UPGRADE;
+        lines[i].repo = "FreeBSD";
+        lines[i].name = names[i];
+        lines[i].origin = "benchmarks/bench-package";
+        lines[i].old_version = "1.2.3_1";
+        lines[i].new_version = "1.2.4";
+        lines[i].new_flatsize = 1048576;
+        lines[i].old_flatsize = 1044480;
+        for (j = 0; j < HOOK_FILES_COUNT; j++) {
+            files[i * HOOK_FILES_COUNT + j] = paths[i * HOOK_FILES_COUNT + j];
+            if (j > 0) {
+                snprintf(paths[i * HOOK_FILES_COUNT + j], HOOK_PATH_SIZE, "/usr/local/share/%s/file%zu", names[i], j);
+            }
+        }
+        lines[i].files = files + i * HOOK_FILES_COUNT;
+        lines[i].files_count = HOOK_FILES_COUNT;
+    }
+
+    return lines;
+}
+
+/**
+ * Bumps the library of each package: each record of the hooks adds and
+ * removes a file by package, as an upgrade does
+ */
+static void hook_files_round(hook_path_t *paths, char (*names)[STR_SIZE("bench-package-18446744073709551615")], size_t count, size_t round)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        snprintf(paths[i * HOOK_FILES_COUNT], HOOK_PATH_SIZE, "/usr/local/share/%s/libbench.so.%zu", names[i], round);
+    }
+}
+
+/**
+ * The hooks, on the generated database: they add commands to it so they
+ * come after the statements
+ */
+static bool bench_hooks(const char *path, report_t *report, samples_t *samples, char **error)
+{
+    bool ok;
+    size_t i;
+    char spool[PATH_MAX];
+    sqlite_open_options_t options = { .busy_timeout = 0, .wal = true };
+
+    ok = true;
+    snprintf(spool, STR_SIZE(spool), "%s.spool", path);
+    for (i = 0; ok && i < ARRAY_SIZE(hook_jobs_counts); i++) {
+        size_t j, jobs;
+        char (*names)[STR_SIZE("bench-package-18446744073709551615")];
+        hook_path_t *paths;
+        const char **files;
+        history_line_t *lines;
+        history_timings_t timings = HISTORY_TIMINGS_UNKNOWN;
+        samples_t fold_samples = { samples->count, NULL };
+
+        jobs = hook_jobs_counts[i];
+        names = malloc(sizeof(*names) * jobs);
+        assert(NULL != names);
+        paths = malloc(sizeof(*paths) * jobs * HOOK_FILES_COUNT);
+        assert(NULL != paths);
+        files = malloc(sizeof(*files) * jobs * HOOK_FILES_COUNT);
+        assert(NULL != files);
+        fold_samples.elapsed = malloc(sizeof(*fold_samples.elapsed) * samples->count);
+        assert(NULL != fold_samples.elapsed);
+        lines = hook_lines(jobs, names, paths, files);
+        // direct: open, record, close as the hook of each command does
+        for (j = 0; ok && j <= samples->count; j++) {
+            double start;
+            sqlite_db_t *db;
+
+            hook_files_round(paths, names, jobs, j);
+            start = now_ms();
+            if (!(ok = EPKG_OK == history_db_open(path, PKGDB_MODE_READ | PKGDB_MODE_WRITE, &options, &db, error))) {
+                break;
+            }
+            ok = history_db_record(db, "pkg upgrade -y", &timings, lines, jobs, error);
+            history_db_close(db);
+            // the first round warms up
+            if (j > 0) {
+                samples->elapsed[j - 1] = now_ms() - start;
+            }
+        }
+        if (ok) {
+            report_measure(report, "hook", "record", jobs, jobs, samples);
+        }
+        // spooled: an append by the hook, folded by the next pkg history
+        for (j = 0; ok && j <= samples->count; j++) {
+            double start;
+            sqlite_db_t *db;
+            history_spool_stats_t stats;
+
+            start = now_ms();
+            if (!(ok = history_spool_append(spool, time(NULL), "pkg upgrade -y", &timings, lines, jobs, error))) {
+                break;
+            }
+            if (j > 0) {
+                samples->elapsed[j - 1] = now_ms() - start;
+            }
+            start = now_ms();
+            if (!(ok = EPKG_OK == history_db_open(path, PKGDB_MODE_READ | PKGDB_MODE_WRITE, &options, &db, error))) {
+                break;
+            }
+            ok = history_spool_fold(db, spool, &stats, error);
+            history_db_close(db);
+            if (j > 0) {
+                fold_samples.elapsed[j - 1] = now_ms() - start;
+            }
+        }
+        if (ok) {
+            report_measure(report, "hook", "spool append", jobs, jobs, samples);
+            report_measure(report, "hook", "spool fold", jobs, jobs, &fold_samples);
+        }
+        free(fold_samples.elapsed);
+        free(lines);
+        free(files);
+        free(paths);
+        free(names);
+    }
+    unlink(spool);
+
+    return ok;
+}
+
+static const struct {
+    const char *name;
+    history_format_t format;
+} renderers[] = {
+    { "table", HISTORY_FORMAT_TABLE },
+    { "jsonl", HISTORY_FORMAT_JSONL },
+    { "csv", HISTORY_FORMAT_CSV },
+    { "tsv", HISTORY_FORMAT_TSV },
+};
+
+static bool render(history_format_t format, size_t rows_count, size_t *rows, char **error)
+{
+    bool ok;
+    Iterator it;
+    history_row_t row;
+    sqlite_statement_t *stmt;
+    history_output_t output;
+
+    *rows = 0;
+    if (!history_output_init(&output, format, STDOUT_FILENO, false, false, error)) {
+        return false;
+    }
+    ok = true;
+    stmt = &history_statements[STMT_LIST_LINE];
+    statement_bind(stmt, (time_t) 0, time(NULL), PKG_OP_ALL, true, time(NULL), INT_MAX, (int) MIN(rows_count, (size_t) INT_MAX));
+    statement_to_iterator(&it, stmt, &row.command_id, &row.inserted_at, &row.command, &row.line_id, &row.name, &row.origin, &row.repo, &row.old_version, &row.new_version, &row.operation);
+    for (iterator_first(&it); ok && iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+        ok = history_output_row(&output, &row, error);
+        ++*rows;
+    }
+    iterator_close(&it);
+    ok = ok && history_output_flush(&output, error);
+    history_output_close(&output);
+
+    return ok;
+}
+
+static bool bench_renderers(size_t rows_count, report_t *report, samples_t *samples, char **error)
+{
+    bool ok;
+    size_t i;
+
+    ok = true;
+    for (i = 0; ok && i < ARRAY_SIZE(renderers); i++) {
+        size_t j, rows;
+
+        ok = render(renderers[i].format, rows_count, &rows, error);
+        for (j = 0; ok && j < samples->count; j++) {
+            double start;
+
+            start = now_ms();
+            ok = render(renderers[i].format, rows_count, &rows, error);
+            samples->elapsed[j] = now_ms() - start;
+        }
+        if (ok) {
+            report_measure(report, "renderer", renderers[i].name, 0, rows, samples);
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * Renders the count timestamps in format, by the cache if not NULL (then
+ * initialized with the same format), by timestamp_to_localtime otherwise,
+ * into buffer (rendered_size bytes per timestamp)
+ */
+static bool render_timestamps(const time_t *timestamps, size_t count, const char *format, timestamp_cache_t *cache, char *buffer, size_t rendered_size, char **error)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        char *w, *end;
+
+        w = buffer + i * rendered_size;
+        end = w + rendered_size;
+        if (NULL == (NULL == cache ? timestamp_to_localtime(timestamps[i], format, w, end, error) : timestamp_cache_render(cache, timestamps[i], w, end, error))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * The size of the buffers the listings render the dates into: the cache
+ * has to render, byte for byte, what strftime fits in them
+ */
+#define RENDERED_TIMESTAMP_SIZE STR_SIZE("dd/mm/YYYY HH:ii:ss")
+
+/**
+ * Formats checked besides the default one: expansions of %x %X with a 4
+ * digits year (the one of fr_FR, ...), filling the buffers of the listings
+ * (test_timestamp_cache checks the ones which don't fit)
+ */
+static const char *checked_timestamp_formats[] = {
+    NULL,
+    "%d/%m/%Y %H:%M:%S",
+    "%Y-%m-%d %H:%M:%S",
+};
+
+/**
+ * Checks that the count timestamps are rendered the same in format by
+ * timestamp_to_localtime and by timestamp_cache_render
+ */
+static bool check_timestamps(const time_t *timestamps, size_t count, const char *format, char *expected, char *rendered, char **error)
+{
+    size_t i;
+    timestamp_cache_t cache;
+
+    timestamp_cache_init(&cache, format);
+    if (!render_timestamps(timestamps, count, format, NULL, expected, RENDERED_TIMESTAMP_SIZE, error) || !render_timestamps(timestamps, count, format, &cache, rendered, RENDERED_TIMESTAMP_SIZE, error)) {
+        return false;
+    }
+    for (i = 0; i < count; i++) {
+        if (0 != strcmp(expected + i * RENDERED_TIMESTAMP_SIZE, rendered + i * RENDERED_TIMESTAMP_SIZE)) {
+            set_generic_error(error, "%jd is rendered '%s' by the cache instead of '%s' (format: %s)", (intmax_t) timestamps[i], rendered + i * RENDERED_TIMESTAMP_SIZE, expected + i * RENDERED_TIMESTAMP_SIZE, NULL == format ? "default" : format);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * The dates of the commands, newest first as listed by pkg history, over
+ * and over up to rows_count, rendered by timestamp_to_localtime then by
+ * timestamp_cache_render (a fresh cache each round), then checked to be
+ * the same in each of checked_timestamp_formats
+ */
+static bool bench_localtime(sqlite3 *db, size_t rows_count, report_t *report, samples_t *samples, char **error)
+{
+    int ret;
+    bool ok;
+    size_t i, count;
+    time_t *timestamps;
+    sqlite3_stmt *stmt;
+    char *expected, *rendered;
+
+    ok = false;
+    count = 0;
+    ret = SQLITE_DONE;
+    stmt = NULL;
+    timestamps = NULL;
+    expected = rendered = NULL;
+    do {
+        if (NULL == (timestamps = malloc(sizeof(*timestamps) * rows_count))) {
+            set_malloc_error(error, sizeof(*timestamps) * rows_count);
+            break;
+        }
+        if (NULL == (expected = malloc(RENDERED_TIMESTAMP_SIZE * rows_count)) || NULL == (rendered = malloc(RENDERED_TIMESTAMP_SIZE * rows_count))) {
+            set_malloc_error(error, RENDERED_TIMESTAMP_SIZE * rows_count);
+            break;
+        }
+        if (SQLITE_OK != sqlite3_prepare_v2(db, "SELECT inserted_at FROM " TABLE_COMMANDS " ORDER BY inserted_at DESC", -1, &stmt, NULL)) {
+            set_generic_error(error, "%s", sqlite3_errmsg(db));
+            break;
+        }
+        while (count < rows_count) {
+            if (SQLITE_ROW == (ret = sqlite3_step(stmt))) {
+                timestamps[count++] = (time_t) sqlite3_column_int64(stmt, 0);
+            } else if (SQLITE_DONE == ret && 0 != count) {
+                sqlite3_reset(stmt);
+            } else {
+                break;
+            }
+        }
+        if (count < rows_count) {
+            set_generic_error(error, "%s", SQLITE_DONE == ret ? "the history is empty" : sqlite3_errmsg(db));
+            break;
+        }
+        ok = true;
+        for (i = 0; ok && i < 2; i++) {
+            size_t j;
+            timestamp_cache_t cache;
+
+            timestamp_cache_init(&cache, NULL);
+            ok = render_timestamps(timestamps, count, NULL, 0 == i ? NULL : &cache, rendered, RENDERED_TIMESTAMP_SIZE, error);
+            for (j = 0; ok && j < samples->count; j++) {
+                double start;
+
+                timestamp_cache_init(&cache, NULL);
+                start = now_ms();
+                ok = render_timestamps(timestamps, count, NULL, 0 == i ? NULL : &cache, rendered, RENDERED_TIMESTAMP_SIZE, error);
+                samples->elapsed[j] = now_ms() - start;
+            }
+            if (ok) {
+                report_measure(report, "localtime", 0 == i ? "strftime" : "cache", 0, count, samples);
+            }
+        }
+        for (i = 0; ok && i < ARRAY_SIZE(checked_timestamp_formats); i++) {
+            ok = check_timestamps(timestamps, count, checked_timestamp_formats[i], expected, rendered, error);
+        }
+    } while (false);
+    sqlite3_finalize(stmt);
+    free(timestamps);
+    free(expected);
+    free(rendered);
+
+    return ok;
+}
+
+/**
+ * A page of PAGE_SIZE lines of pkg history --jails: collected from the jails
+ * (see history_jails_collect) then read, end to end
+ */
+static bool list_jails(sqlite_db_t *db, const history_jail_t *jails, size_t count, size_t *rows, char **error)
+{
+    int jail_id;
+    Iterator it;
+    history_row_t row;
+    history_jails_filter_t filter;
+
+    *rows = 0;
+    filter.operations = PKG_OP_ALL;
+    filter.from = (time_t) 0;
+    filter.to = time(NULL);
+    filter.limit = PAGE_SIZE;
+    filter.searched = filter.case_sensitive = false;
+    if (!history_jails_collect(db, jails, count, &filter, error)) {
+        return false;
+    }
+    statement_bind(&history_statements[STMT_LIST_JAIL_LINES], PAGE_SIZE);
+    statement_to_iterator(&it, &history_statements[STMT_LIST_JAIL_LINES], &jail_id, &row.command_id, &row.inserted_at, &row.command, &row.line_id, &row.name, &row.origin, &row.repo, &row.old_version, &row.new_version, &row.operation);
+    for (iterator_first(&it); iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+        ++*rows;
+    }
+    iterator_close(&it);
+
+    return true;
+}
+
+static bool bench_jails(sqlite_db_t *db, const char *path, report_t *report, samples_t *samples, char **error)
+{
+    bool ok;
+    size_t i;
+    history_jail_t *jails;
+
+    if (NULL == (jails = malloc(sizeof(*jails) * jails_counts[ARRAY_SIZE(jails_counts) - 1]))) {
+        set_malloc_error(error, sizeof(*jails) * jails_counts[ARRAY_SIZE(jails_counts) - 1]);
+        return false;
+    }
+    for (i = 0; i < jails_counts[ARRAY_SIZE(jails_counts) - 1]; i++) {
+        jails[i].jid = (int) i + 1;
+        snprintf(jails[i].name, STR_SIZE(jails[i].name), "jail%zu", i + 1);
+        snprintf(jails[i].path, STR_SIZE(jails[i].path), "%s", path);
+    }
+    ok = true;
+    for (i = 0; ok && i < ARRAY_SIZE(jails_counts); i++) {
+        size_t j, rows;
+        char name[64];
+
+        ok = list_jails(db, jails, jails_counts[i], &rows, error);
+        for (j = 0; ok && j < samples->count; j++) {
+            double start;
+
+            start = now_ms();
+            ok = list_jails(db, jails, jails_counts[i], &rows, error);
+            samples->elapsed[j] = now_ms() - start;
+        }
+        if (ok) {
+            snprintf(name, STR_SIZE(name), "page of %zu jails", jails_counts[i]);
+            report_measure(report, "jails", name, 0, rows, samples);
+        }
+    }
+    free(jails);
+
+    return ok;
+}
+
+static bool parse_size(const char *string, size_t *value)
+{
+    char *end;
+    unsigned long long v;
+
+    v = strtoull(string, &end, 10);
+    *value = (size_t) v;
+
+    return '\0' != *string && '\0' == *end;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: bench_history_suite [-c commands] [-l lines by command] [-p packages] [-d days] [-s seed] [-r rounds] [-n rows] [-F table|jsonl] [-k path] [-g]\n");
+}
+
+int main(int argc, char **argv)
+{
+    int ch, ret;
+    char *error;
+    const char *kept;
+    bool generate_only;
+    size_t days, rows_count;
+    report_t report;
+    samples_t samples = { DEFAULT_ROUNDS, NULL };
+    char path[PATH_MAX] = "/tmp/bench_history_suite.XXXXXX";
+    history_generator_options_t generator_options = HISTORY_GENERATOR_DEFAULTS;
+
+    days = 0;
+    error = NULL;
+    kept = NULL;
+    ret = EXIT_FAILURE;
+    generate_only = false;
+    report.fp = NULL;
+    report.format = REPORT_TABLE;
+    rows_count = DEFAULT_ROWS_COUNT;
+    while (-1 != (ch = getopt(argc, argv, "c:l:p:d:s:r:n:F:k:g"))) {
+        bool valid;
+        size_t value;
+
+        valid = true;
+        switch (ch) {
+            case 'c':
+                valid = parse_size(optarg, &generator_options.commands);
+                break;
+            case 'l':
+                valid = parse_size(optarg, &generator_options.lines);
+                break;
+            case 'p':
+                valid = parse_size(optarg, &generator_options.packages) && generator_options.packages > 0;
+                break;
+            case 'd':
+                valid = parse_size(optarg, &days) && days > 0;
+                break;
+            case 's':
+                valid = parse_size(optarg, &value);
+                generator_options.seed = (uint64_t) value;
+                break;
+            case 'r':
+                valid = parse_size(optarg, &samples.count) && samples.count > 0;
+                break;
+            case 'n':
+                valid = parse_size(optarg, &rows_count);
+                break;
+            case 'F':
+                if (0 == strcmp(optarg, "jsonl")) {
+                    report.format = REPORT_JSONL;
+                } else {
+                    valid = 0 == strcmp(optarg, "table");
+                }
+                break;
+            case 'k':
+                kept = optarg;
+                break;
+            case 'g':
+                generate_only = true;
+                break;
+            default:
+                valid = false;
+                break;
+        }
+        if (!valid) {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (0 != days) {
+        generator_options.to = time(NULL);
+        generator_options.from = generator_options.to - (time_t) days * 86400;
+    }
+    do {
+        int fd;
+        double start;
+        struct stat st;
+        sqlite_db_t *db;
+        fixture_t fixture;
+        history_generator_stats_t stats;
+        sqlite_open_options_t options = { .busy_timeout = 0, .wal = true };
+
+        if (NULL == kept) {
+            if (-1 == (fd = mkstemp(path))) {
+                set_system_error(&error, "mkstemp(3) failed");
+                break;
+            }
+            close(fd);
+        } else {
+            snprintf(path, STR_SIZE(path), "%s", kept);
+        }
+        remove_database(path);
+        // keep the real stdout for the report, the output formats write to /dev/null
+        if (NULL == (report.fp = fdopen(dup(STDOUT_FILENO), "w"))) {
+            set_system_error(&error, "fdopen(3) failed");
+            break;
+        }
+        if (-1 == (fd = open("/dev/null", O_WRONLY)) || -1 == dup2(fd, STDOUT_FILENO)) {
+            set_system_error(&error, "failed to redirect stdout to /dev/null");
+            break;
+        }
+        close(fd);
+        if (NULL == (samples.elapsed = malloc(sizeof(*samples.elapsed) * samples.count))) {
+            set_malloc_error(&error, sizeof(*samples.elapsed) * samples.count);
+            break;
+        }
+        if (EPKG_OK != history_db_open(path, PKGDB_MODE_READ | PKGDB_MODE_WRITE | PKGDB_MODE_CREATE, &options, &db, &error)) {
+            break;
+        }
+        start = now_ms();
+        if (!history_generate(db, &generator_options, &stats, &error)) {
+            history_db_close(db);
+            break;
+        }
+        // closing checkpoints the WAL: the size is the one of the whole database
+        history_db_close(db);
+        stat(path, &st);
+        if (REPORT_JSONL == report.format) {
+            fprintf(
+                report.fp,
+                "{\"type\":\"meta\",\"version\":\"%s\",\"sqlite\":\"%s\",\"commands\":%zu,\"operations\":%zu,\"packages\":%zu,\"seed\":%" PRIu64 ",\"rounds\":%zu,\"generation_ms\":%.1f,\"size\":%lld}\n",
+                HISTORY_VERSION_STRING, sqlite3_libversion(), stats.commands, stats.operations, generator_options.packages, generator_options.seed, samples.count, now_ms() - start, (long long) st.st_size
+            );
+        } else {
+            fprintf(
+                report.fp,
+                "history %s, sqlite %s: %zu commands, %zu operations (%zu installs, %zu upgrades, %zu deinstalls) on %zu packages generated in %.1f ms, %lld bytes\n\n",
+                HISTORY_VERSION_STRING, sqlite3_libversion(), stats.commands, stats.operations, stats.installs, stats.upgrades, stats.deinstalls, generator_options.packages, now_ms() - start, (long long) st.st_size
+            );
+            fprintf(report.fp, "%-10s %-42s %10s %12s %12s %12s\n", "kind", "name", "rows", "min (ms)", "median (ms)", "mean (ms)");
+        }
+        fflush(report.fp);
+        if (generate_only) {
+            ret = EXIT_SUCCESS;
+            break;
+        }
+        if (EPKG_OK != history_db_open(path, PKGDB_MODE_READ | PKGDB_MODE_WRITE, &options, &db, &error)) {
+            break;
+        }
+        if (!fixture_init(&fixture, sqlite3_db_handle(history_statements[0].prepared), &error)) {
+            history_db_close(db);
+            break;
+        }
+        if (!bench_statements(db, &fixture, &report, &samples, &error)) {
+            history_db_close(db);
+            break;
+        }
+        if (!bench_renderers(rows_count, &report, &samples, &error)) {
+            history_db_close(db);
+            break;
+        }
+        if (!bench_localtime(fixture.db, rows_count, &report, &samples, &error)) {
+            history_db_close(db);
+            break;
+        }
+        if (!bench_jails(db, path, &report, &samples, &error)) {
+            history_db_close(db);
+            break;
+        }
+        history_db_close(db);
+        if (!bench_hooks(path, &report, &samples, &error)) {
+            break;
+        }
+        ret = EXIT_SUCCESS;
+    } while (false);
+    free(samples.elapsed);
+    if (NULL != report.fp) {
+        fclose(report.fp);
+    }
+    if (NULL == kept) {
+        remove_database(path);
+    }
+    if (NULL != error) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+    }
+
+    return ret;
+}
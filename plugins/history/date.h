@@ -4,3 +4,4 @@
 #include <time.h>
 
 bool parse_date(const char *, time_t *, char **);
+bool parse_date_tm(const char *, struct tm *, char **);
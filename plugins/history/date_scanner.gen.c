@@ -110,39 +110,54 @@ static bool is_date_valid(struct tm *tm, char **error)
     return valid;
 }
 
-bool parse_date(const char *date, time_t *t, char **error)
+/**
+ * Parses date into its broken-down time, the missing components are the
+ * ones of the current day (UTC) at midnight. Unlike parse_date, the result
+ * is left to the caller to interpret (timegm or mktime).
+ *
+ * NOTE: reentrant, it can be called concurrently by several threads
+ */
+bool parse_date_tm(const char *date, struct tm *tm, char **error)
 {
     bool ok;
 
     ok = false;
     do {
-        struct tm tm;
         time_t time_now;
-        struct tm *tm_now;
 
         if (((time_t) -1) == (time_now = time(NULL))) {
             set_generic_error(error, "time(3) failed");
             break;
         }
-        if (NULL == (tm_now = gmtime(&time_now))) {
-            set_generic_error(error, "gmtime(3) failed");
+        if (NULL == gmtime_r(&time_now, tm)) {
+            set_generic_error(error, "gmtime_r(3) failed");
             break;
         }
-        memcpy(&tm, tm_now, sizeof(tm));
-        tm.tm_sec = tm.tm_min = tm.tm_hour = 0;
-        if (!yylex(date, &tm, error)) {
+        tm->tm_sec = tm->tm_min = tm->tm_hour = 0;
+        if (!yylex(date, tm, error)) {
             break;
         }
-        if (!is_date_valid(&tm, error)) {
+        if (!is_date_valid(tm, error)) {
             break;
         }
-        *t = timegm(&tm);
         ok = true;
     } while (false);
 
     return ok;
 }
 
+bool parse_date(const char *date, time_t *t, char **error)
+{
+    struct tm tm;
+
+    if (!parse_date_tm(date, &tm, error)) {
+        return false;
+    }
+    *t = timegm(&tm);
+
+    return true;
+}
+
 static int month_value_from_name(const char *name, size_t name_len)
 {
     size_t i;
@@ -391,9 +406,9 @@ static bool yylex(const char *string, struct tm *tm, char **error)
         *ys, *ye, *ms, *me, *ds, *de, *ts
     ;
     
-#line 395 "/tmp/pkg_plugins/date_scanner.gen.c"
+#line 410 "/tmp/pkg_plugins/date_scanner.gen.c"
 const uint8_t *yyt1;const uint8_t *yyt10;const uint8_t *yyt11;const uint8_t *yyt12;const uint8_t *yyt2;const uint8_t *yyt3;const uint8_t *yyt4;const uint8_t *yyt5;const uint8_t *yyt6;const uint8_t *yyt7;const uint8_t *yyt8;const uint8_t *yyt9;
-#line 391 "/home/julp/pkg_plugins/plugins/history/date.re"
+#line 406 "/home/julp/pkg_plugins/plugins/history/date.re"
 
 
     ok = false;
@@ -402,7 +417,7 @@ const uint8_t *yyt1;const uint8_t *yyt10;const uint8_t *yyt11;const uint8_t *yyt
     YYMARKER = YYCURSOR = (const YYCTYPE *) string;
     YYLIMIT = YYCURSOR + strlen(string);
 
-#line 406 "/tmp/pkg_plugins/date_scanner.gen.c"
+#line 421 "/tmp/pkg_plugins/date_scanner.gen.c"
 {
 	uint8_t yych;
 	YYDEBUG(0, *YYCURSOR);
@@ -624,13 +639,13 @@ yy2:
 	++YYCURSOR;
 yy3:
 	YYDEBUG(3, *YYCURSOR);
-#line 534 "/home/julp/pkg_plugins/plugins/history/date.re"
+#line 549 "/home/julp/pkg_plugins/plugins/history/date.re"
 	{
     set_generic_error(error, "invalid date");
 
     return false;
 }
-#line 634 "/tmp/pkg_plugins/date_scanner.gen.c"
+#line 649 "/tmp/pkg_plugins/date_scanner.gen.c"
 yy4:
 	YYDEBUG(4, *YYCURSOR);
 	yych = *(YYMARKER = ++YYCURSOR);
@@ -2119,6 +2134,9 @@ yy74:
 	YYDEBUG(74, *YYCURSOR);
 	yych = *++YYCURSOR;
 	switch (yych) {
+		case ' ':
+			yyt2 = YYCURSOR;
+			goto yy100;
 		case 'C':
 		case 'c': goto yy106;
 		default: goto yy1;
@@ -2172,7 +2190,7 @@ yy79:
 	ys = yyt8;
 	ye = yyt9;
 	ts = yyt10;
-#line 456 "/home/julp/pkg_plugins/plugins/history/date.re"
+#line 471 "/home/julp/pkg_plugins/plugins/history/date.re"
 	{
     int *mp, *dp, *u1, *u2;
 
@@ -2210,7 +2228,7 @@ yy79:
 
     return ok;
 }
-#line 2214 "/tmp/pkg_plugins/date_scanner.gen.c"
+#line 2232 "/tmp/pkg_plugins/date_scanner.gen.c"
 yy80:
 	YYDEBUG(80, *YYCURSOR);
 	yych = *++YYCURSOR;
@@ -2467,6 +2485,19 @@ yy93:
 	YYDEBUG(93, *YYCURSOR);
 	yych = *++YYCURSOR;
 	switch (yych) {
+		case 0x00:
+			yyt4 = yyt5 = yyt7 = NULL;
+			yyt3 = YYCURSOR;
+			goto yy123;
+		case ' ':
+			yyt4 = yyt5 = NULL;
+			yyt3 = YYCURSOR;
+			goto yy124;
+		case '-':
+		case '.':
+		case '/':
+			yyt3 = YYCURSOR;
+			goto yy125;
 		case 'C':
 		case 'c': goto yy131;
 		default: goto yy1;
@@ -2848,7 +2879,7 @@ yy117:
 	ds = yyt5;
 	de = yyt3;
 	ts = yyt8;
-#line 520 "/home/julp/pkg_plugins/plugins/history/date.re"
+#line 535 "/home/julp/pkg_plugins/plugins/history/date.re"
 	{
     m = my_atoi(ms, me);
     d = my_atoi(ds, de);
@@ -2862,7 +2893,7 @@ yy117:
 
     return ok;
 }
-#line 2866 "/tmp/pkg_plugins/date_scanner.gen.c"
+#line 2897 "/tmp/pkg_plugins/date_scanner.gen.c"
 yy118:
 	YYDEBUG(118, *YYCURSOR);
 	yych = *++YYCURSOR;
@@ -3005,11 +3036,11 @@ yy123:
 	ys = yyt4;
 	ye = yyt5;
 	ts = yyt7;
-#line 498 "/home/julp/pkg_plugins/plugins/history/date.re"
+#line 513 "/home/julp/pkg_plugins/plugins/history/date.re"
 	{
     goto done;
 }
-#line 3013 "/tmp/pkg_plugins/date_scanner.gen.c"
+#line 3044 "/tmp/pkg_plugins/date_scanner.gen.c"
 yy124:
 	YYDEBUG(124, *YYCURSOR);
 	yych = *++YYCURSOR;
@@ -3264,11 +3295,11 @@ yy141:
 yy142:
 	YYDEBUG(142, *YYCURSOR);
 	++YYCURSOR;
-#line 442 "/home/julp/pkg_plugins/plugins/history/date.re"
+#line 457 "/home/julp/pkg_plugins/plugins/history/date.re"
 	{
     return true;
 }
-#line 3272 "/tmp/pkg_plugins/date_scanner.gen.c"
+#line 3303 "/tmp/pkg_plugins/date_scanner.gen.c"
 yy143:
 	YYDEBUG(143, *YYCURSOR);
 	yych = *++YYCURSOR;
@@ -3408,7 +3439,7 @@ yy150:
 	ds = yyt10;
 	de = yyt12;
 	ts = yyt1;
-#line 504 "/home/julp/pkg_plugins/plugins/history/date.re"
+#line 519 "/home/julp/pkg_plugins/plugins/history/date.re"
 	{
     y = my_atoi(ys, ye);
     m = my_atoi(ms, me);
@@ -3423,7 +3454,7 @@ yy150:
 
     return ok;
 }
-#line 3427 "/tmp/pkg_plugins/date_scanner.gen.c"
+#line 3458 "/tmp/pkg_plugins/date_scanner.gen.c"
 yy151:
 	YYDEBUG(151, *YYCURSOR);
 	yych = *++YYCURSOR;
@@ -3963,11 +3994,11 @@ yy186:
 	ys = yyt5;
 	ye = yyt6;
 	ts = yyt7;
-#line 494 "/home/julp/pkg_plugins/plugins/history/date.re"
+#line 509 "/home/julp/pkg_plugins/plugins/history/date.re"
 	{
     goto done;
 }
-#line 3971 "/tmp/pkg_plugins/date_scanner.gen.c"
+#line 4002 "/tmp/pkg_plugins/date_scanner.gen.c"
 yy187:
 	YYDEBUG(187, *YYCURSOR);
 	yych = *++YYCURSOR;
@@ -5301,6 +5332,9 @@ yy278:
 	YYDEBUG(278, *YYCURSOR);
 	yych = *++YYCURSOR;
 	switch (yych) {
+		case ' ':
+			yyt3 = YYCURSOR;
+			goto yy322;
 		case 'C':
 		case 'c': goto yy328;
 		default: goto yy1;
@@ -5833,11 +5867,11 @@ yy317:
 	de = yyt6;
 	ts = yyt4;
 	ys = yyt1 - 4;
-#line 450 "/home/julp/pkg_plugins/plugins/history/date.re"
+#line 465 "/home/julp/pkg_plugins/plugins/history/date.re"
 	{
     goto done;
 }
-#line 5841 "/tmp/pkg_plugins/date_scanner.gen.c"
+#line 5875 "/tmp/pkg_plugins/date_scanner.gen.c"
 yy318:
 	YYDEBUG(318, *YYCURSOR);
 	yych = *++YYCURSOR;
@@ -7086,11 +7120,11 @@ yy401:
 	de = yyt5;
 	ts = yyt6;
 	ys = yyt1 - 4;
-#line 446 "/home/julp/pkg_plugins/plugins/history/date.re"
+#line 461 "/home/julp/pkg_plugins/plugins/history/date.re"
 	{
     goto done;
 }
-#line 7094 "/tmp/pkg_plugins/date_scanner.gen.c"
+#line 7128 "/tmp/pkg_plugins/date_scanner.gen.c"
 yy402:
 	YYDEBUG(402, *YYCURSOR);
 	yych = *++YYCURSOR;
@@ -7803,7 +7837,7 @@ yy453:
 		default: goto yy1;
 	}
 }
-#line 539 "/home/julp/pkg_plugins/plugins/history/date.re"
+#line 554 "/home/julp/pkg_plugins/plugins/history/date.re"
 
 done:
     {
@@ -0,0 +1,1794 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h> /* geteuid */
+#include <pkg.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "error/error.h"
+#include "hashtable.h"
+#include "history_db.h"
+#include "history_files.h"
+#include "shared/os.h"
+
+#define REPEAT_1(s, separator) s
+#define REPEAT_2(s, separator) s separator s
+#define REPEAT_8(s, separator) REPEAT_2(REPEAT_2(REPEAT_2(s, separator), separator), separator)
+#define REPEAT_64(s, separator) REPEAT_8(REPEAT_8(s, separator), separator)
+
+/**
+ * NOTE:
+ * - 64 rows of 9 parameters stays below the historical
+ *   SQLITE_MAX_VARIABLE_NUMBER of 999 (sqlite < 3.32.0)
+ * - the strings are given by their identifiers in the dictionary tables
+ *   (see history_db_resolve_lines), 0 stands for NULL
+ * - an unknown size (-1) is stored as NULL
+ */
+#define LINE_INPUT_BINDS "iiiiiiiII"
+#define LINE_PLACEHOLDERS "(NULLIF(?, 0), ?, ?, NULLIF(?, 0), ?, ?, ?, NULLIF(?, -1), NULLIF(?, -1))"
+
+#define STMT_CREATE_LINES(repeat) \
+    DECL_STMT( \
+        "INSERT INTO " TABLE_PACKAGES "(repo_id, name_id, origin_id, old_version_id, new_version_id, operation_id, command_id, new_flatsize, old_flatsize) VALUES" repeat(LINE_PLACEHOLDERS, ","), \
+        repeat(LINE_INPUT_BINDS, ), \
+        "" \
+    )
+
+/**
+ * Repositories, names, origins and versions repeat a lot from a line to
+ * another: each distinct string is stored once, in its own table, and
+ * referenced by its identifier
+ */
+#define DECL_DICTIONARY_STMTS(find, create, table) \
+    [ find ] = DECL_STMT("SELECT id FROM " table " WHERE value = ?", "s", "i"), \
+    [ create ] = DECL_STMT("INSERT INTO " table "(value) VALUES(?)", "s", "")
+
+/**
+ * Listings are paginated by keyset on (c.inserted_at, l.id), newest first.
+ * Each of them comes in two flavours: KEYSET_AFTER returns the rows older than
+ * the cursor, KEYSET_BEFORE the ones newer than it (sorted oldest first to
+ * apply LIMIT from the cursor, then put back newest first)
+ *
+ * The lines can also be restricted to the ones whose new version is among
+ * the versions matched by history_db_set_versions, unless the bind before
+ * the cursor is true (no constraint on the versions).
+ *
+ * NOTE: the bounds of the BETWEEN on c.inserted_at are expected to be narrowed
+ * to the cursor by the caller, it's the index range, the row value comparison
+ * only deals with ties on inserted_at
+ */
+#define LINE_OUTPUT_COLUMNS \
+    "c.id, c.inserted_at, c.command, l.id, n.value, o.value, r.value, ov.value, nv.value, l.operation_id"
+
+/**
+ * NOTE: LEFT JOIN (even for the NOT NULL columns) keeps the dictionaries
+ * as lookups by primary key after the lines are found
+ */
+#define LINE_DICTIONARIES \
+    " LEFT JOIN " TABLE_NAMES " n ON n.id = l.name_id" \
+    " LEFT JOIN " TABLE_ORIGINS " o ON o.id = l.origin_id" \
+    " LEFT JOIN " TABLE_REPOSITORIES " r ON r.id = l.repo_id" \
+    " LEFT JOIN " TABLE_VERSIONS " ov ON ov.id = l.old_version_id" \
+    " LEFT JOIN " TABLE_VERSIONS " nv ON nv.id = l.new_version_id"
+
+#define LINE_OUTPUT_BINDS \
+    /* c */ "its" /* l */ "isssssi"
+
+#define MATCHED_VERSIONS \
+    " AND (? OR l.new_version_id IN (SELECT version_id FROM temp." TABLE_MATCHED_VERSIONS "))"
+
+#define KEYSET_AFTER(from_where) \
+    " SELECT " LINE_OUTPUT_COLUMNS \
+    from_where \
+    MATCHED_VERSIONS \
+    " AND (c.inserted_at, l.id) < (?, ?)" \
+    " ORDER BY c.inserted_at DESC, l.id DESC" \
+    " LIMIT ?"
+
+#define KEYSET_BEFORE(from_where) \
+    " SELECT * FROM (" \
+    " SELECT " LINE_OUTPUT_COLUMNS \
+    from_where \
+    MATCHED_VERSIONS \
+    " AND (c.inserted_at, l.id) > (?, ?)" \
+    " ORDER BY c.inserted_at ASC, l.id ASC" \
+    " LIMIT ?" \
+    ") ORDER BY 2 DESC, 4 DESC"
+
+#define DECL_KEYSET_STMTS(name, from_where, input_binds) \
+    [ name ] = DECL_STMT(KEYSET_AFTER(from_where), input_binds "btii", LINE_OUTPUT_BINDS), \
+    [ name ## _BEFORE ] = DECL_STMT(KEYSET_BEFORE(from_where), input_binds "btii", LINE_OUTPUT_BINDS)
+
+/**
+ * Searches match the lines against all the packages of TABLE_SEARCHED in a
+ * single query, so rows come out merged and time-ordered. The names (or
+ * origins) are matched in their dictionary, then the lines by identifier.
+ */
+#define SEARCH_LINE_BY(condition) \
+    " FROM " TABLE_COMMANDS " c JOIN " TABLE_PACKAGES " l ON c.id = l.command_id" \
+    LINE_DICTIONARIES \
+    " WHERE " condition \
+    " AND (l.operation_id & ?) <> 0" \
+    " AND (c.inserted_at BETWEEN ? AND ?)"
+
+#define DECL_SEARCH_LINE_BY(name, condition) \
+    DECL_KEYSET_STMTS(name, SEARCH_LINE_BY(condition), "itt")
+
+/**
+ * The versions compared to ? by operator, as pkg does (collation
+ * pkg_version, see history_db_register): a range of the index on them
+ */
+#define DECL_MATCH_VERSIONS(name, operator) \
+    [ name ] = DECL_STMT( \
+        "INSERT INTO temp." TABLE_MATCHED_VERSIONS "(version_id)" \
+        " SELECT id FROM " TABLE_VERSIONS " WHERE value COLLATE pkg_version " operator " ?", \
+        "s", \
+        "" \
+    )
+
+#define SEARCHED_PATTERNS \
+    "SELECT pattern FROM temp." TABLE_SEARCHED
+
+#ifdef WITH_FTS
+/**
+ * The searched strings turned into a FTS5 query: each of them is enclosed in
+ * double quotes to be taken literally, joined by OR
+ */
+# define SEARCHED_FTS_QUERY \
+    "(SELECT group_concat('\"' || replace(pattern, '\"', '\"\"') || '\"', ' OR ') FROM temp." TABLE_SEARCHED ")"
+#endif /* WITH_FTS */
+
+/**
+ * Statistics are read from the summary tables only (see CREATE_STATS_TABLES):
+ * their cost depends on the count of buckets, not of recorded operations
+ */
+#define SUM_OPERATION(operation) \
+    "SUM(CASE operation_id WHEN " STRINGIFY_EXPAND(operation) " THEN count ELSE 0 END)"
+
+#define SUM_OPERATIONS \
+    SUM_OPERATION(PKG_OP_INSTALL) ", " SUM_OPERATION(PKG_OP_DEINSTALL) ", " SUM_OPERATION(PKG_OP_UPGRADE)
+
+/**
+ * NOTE: days are 'YYYY-MM-DD' strings (in local time) so periods are
+ * prefixes of them or derived by strftime
+ */
+#define DECL_STATS_BY_PERIOD(name, period) \
+    [ name ] = DECL_STMT( \
+        "SELECT " period " AS period, " SUM_OPERATIONS \
+        " FROM " TABLE_STATS_DAYS \
+        " WHERE day BETWEEN date(?, 'unixepoch', 'localtime') AND date(?, 'unixepoch', 'localtime')" \
+        " GROUP BY period HAVING SUM(count) > 0 ORDER BY period DESC LIMIT ?", \
+        "tti", \
+        "siii" \
+    )
+
+/**
+ * Growth, in bytes, of the installed size by a line: the size of the
+ * package installed, less the one of the package it replaced, if any, or
+ * the size of the package removed, as a negative number (see GROWTH_LINES
+ * for the lines of unknown sizes)
+ */
+#define LINE_GROWTH \
+    "CASE" \
+    " WHEN l.operation_id = " STRINGIFY_EXPAND(PKG_OP_DEINSTALL) " THEN -l.new_flatsize" \
+    " WHEN l.old_version_id IS NULL THEN l.new_flatsize" \
+    " ELSE l.new_flatsize - l.old_flatsize" \
+    " END"
+
+/**
+ * The lines of the commands between ? and ? (a range of the index on their
+ * dates, then of the one on the command of the lines) whose sizes are
+ * known: the one of the new package and, if it replaced one, the one of
+ * the old package (else the growth would count its whole size). The order
+ * of the join is forced (CROSS JOIN): grouped by command, the planner would
+ * rather scan the lines in the order of their command.
+ *
+ * NOTE: no index of their own, the sizes are read from the rows of the
+ * lines found through the index on their command
+ */
+#define GROWTH_LINES \
+    " FROM " TABLE_COMMANDS " c CROSS JOIN " TABLE_PACKAGES " l ON c.id = l.command_id" \
+    " WHERE (c.inserted_at BETWEEN ? AND ?) AND l.new_flatsize IS NOT NULL" \
+    " AND (l.old_flatsize IS NOT NULL OR l.old_version_id IS NULL)"
+
+/**
+ * The installed packages after the command (?3, ?4): the ones of the
+ * checkpoint ?5, at position (?1, ?2), updated by replaying the lines of the
+ * commands in between (the last operation on a package wins, a deletion
+ * removes it). Only the commands of the local host count, the ones merged
+ * from others (see history_merge) are ignored.
+ */
+#define INSTALLED_AT_CTE \
+    "WITH replayed AS (" \
+    "SELECT l.name_id, l.origin_id, l.new_version_id AS version_id, l.repo_id, l.operation_id," \
+    " ROW_NUMBER() OVER (PARTITION BY l.name_id ORDER BY c.inserted_at DESC, c.id DESC, l.id DESC) AS rank" \
+    " FROM " TABLE_COMMANDS " c" \
+    " JOIN " TABLE_PACKAGES " l ON l.command_id = c.id" \
+    " WHERE (c.inserted_at, c.id) > (?, ?) AND (c.inserted_at, c.id) <= (?, ?) AND c.host_id IS NULL" \
+    "), installed AS (" \
+    "SELECT name_id, origin_id, version_id, repo_id FROM " TABLE_CHECKPOINT_PACKAGES \
+    " WHERE checkpoint_id = ? AND name_id NOT IN (SELECT name_id FROM replayed)" \
+    " UNION ALL" \
+    " SELECT name_id, origin_id, version_id, repo_id FROM replayed" \
+    " WHERE 1 = rank AND operation_id <> " STRINGIFY_EXPAND(PKG_OP_DEINSTALL) \
+    ")"
+
+#define INSTALLED_AT_INPUT_BINDS "titii"
+
+/**
+ * A path changed by a line (see history_files_record) is found back
+ * through its directory then its name (TABLE_PATHS), then the lines which
+ * added or removed it (TABLE_PATH_LINES): the blobs of the other lines are
+ * not read. The order of these joins is forced (CROSS JOIN): without
+ * statistics, sqlite may prefer to scan all the changes for a range of
+ * directories.
+ */
+#define WHICH_LINES(condition) \
+    "SELECT c.inserted_at, c.command, n.value, ov.value, nv.value, d.value || p.name, f.data" \
+    " FROM " TABLE_DIRECTORIES " d" \
+    " CROSS JOIN " TABLE_PATHS " p ON p.directory_id = d.id" \
+    " CROSS JOIN " TABLE_PATH_LINES " pl ON pl.path_id = p.id" \
+    " JOIN " TABLE_PACKAGES " l ON l.id = pl.line_id" \
+    " JOIN " TABLE_COMMANDS " c ON c.id = l.command_id" \
+    " JOIN " TABLE_FILES " f ON f.line_id = l.id" \
+    " JOIN " TABLE_NAMES " n ON n.id = l.name_id" \
+    " LEFT JOIN " TABLE_VERSIONS " ov ON ov.id = l.old_version_id" \
+    " JOIN " TABLE_VERSIONS " nv ON nv.id = l.new_version_id" \
+    " WHERE " condition \
+    " ORDER BY c.inserted_at, c.id, l.id, 6"
+
+#define WHICH_OUTPUT_BINDS "tsssssB"
+
+sqlite_statement_t history_statements[STMT_COUNT] = {
+    [ STMT_CREATE_COMMAND ] = DECL_STMT(
+        "INSERT INTO " TABLE_COMMANDS "(inserted_at, command, started_at, finished_at, fetch_duration, jobs_count)"
+        " VALUES(?, ?, NULLIF(?, 0), NULLIF(?, 0), NULLIF(?, -1), ?)",
+        "tsIIIi",
+        ""
+    ),
+    [ STMT_CREATE_LINE ] = STMT_CREATE_LINES(REPEAT_1),
+    [ STMT_CREATE_LINES_8 ] = STMT_CREATE_LINES(REPEAT_8),
+    [ STMT_CREATE_LINES_64 ] = STMT_CREATE_LINES(REPEAT_64),
+    DECL_DICTIONARY_STMTS(STMT_FIND_REPOSITORY, STMT_CREATE_REPOSITORY, TABLE_REPOSITORIES),
+    DECL_DICTIONARY_STMTS(STMT_FIND_NAME, STMT_CREATE_NAME, TABLE_NAMES),
+    DECL_DICTIONARY_STMTS(STMT_FIND_ORIGIN, STMT_CREATE_ORIGIN, TABLE_ORIGINS),
+    DECL_DICTIONARY_STMTS(STMT_FIND_VERSION, STMT_CREATE_VERSION, TABLE_VERSIONS),
+    [ STMT_CLEAR_SEARCHED ] = DECL_STMT("DELETE FROM temp." TABLE_SEARCHED, "", ""),
+    [ STMT_CREATE_SEARCHED ] = DECL_STMT(
+        "INSERT OR IGNORE INTO temp." TABLE_SEARCHED "(pattern, lower, upper) VALUES(?, ?, ?)",
+        "sss",
+        ""
+    ),
+    [ STMT_CLEAR_MATCHED_VERSIONS ] = DECL_STMT("DELETE FROM temp." TABLE_MATCHED_VERSIONS, "", ""),
+    DECL_MATCH_VERSIONS(STMT_MATCH_VERSIONS_LT, "<"),
+    DECL_MATCH_VERSIONS(STMT_MATCH_VERSIONS_LE, "<="),
+    DECL_MATCH_VERSIONS(STMT_MATCH_VERSIONS_EQ, "="),
+    DECL_MATCH_VERSIONS(STMT_MATCH_VERSIONS_GE, ">="),
+    DECL_MATCH_VERSIONS(STMT_MATCH_VERSIONS_GT, ">"),
+    DECL_KEYSET_STMTS(
+        STMT_LIST_LINE,
+        " FROM " TABLE_COMMANDS " c"
+        " JOIN " TABLE_PACKAGES " l ON c.id = l.command_id"
+        LINE_DICTIONARIES
+        " WHERE (c.inserted_at BETWEEN ? AND ?) AND (l.operation_id & ?) <> 0",
+        "tti"
+    ),
+    // the lines collected from the jails, all of them having been filtered beforehand (see history_jails.c)
+    [ STMT_LIST_JAIL_LINES ] = DECL_STMT(
+        "SELECT " JAIL_LINES_COLUMNS " FROM temp." TABLE_JAIL_LINES
+        " ORDER BY inserted_at DESC, jail_id, line_id DESC"
+        " LIMIT ?",
+        "i",
+        "i" LINE_OUTPUT_BINDS
+    ),
+    [ STMT_LAST_LINE ] = DECL_STMT("SELECT IFNULL(MAX(id), 0) FROM " TABLE_PACKAGES, "", "i"),
+    /**
+     * The lines recorded after the one of identifier ? (pkg history --follow),
+     * in the order they were: a range of the primary key. Unless the bind
+     * after the operations is true (no package to match), only the packages
+     * of TABLE_SEARCHED, by name, case insensitively too if the next bind is
+     * true.
+     */
+    [ STMT_FOLLOW_LINE ] = DECL_STMT(
+        "SELECT " LINE_OUTPUT_COLUMNS
+        " FROM " TABLE_PACKAGES " l JOIN " TABLE_COMMANDS " c ON c.id = l.command_id"
+        LINE_DICTIONARIES
+        " WHERE l.id > ? AND (l.operation_id & ?) <> 0"
+        " AND (? OR l.name_id IN ("
+        "SELECT id FROM " TABLE_NAMES " WHERE value IN (" SEARCHED_PATTERNS ")"
+        " UNION SELECT id FROM " TABLE_NAMES " WHERE ? AND value COLLATE NOCASE IN (" SEARCHED_PATTERNS ")"
+        "))"
+        MATCHED_VERSIONS
+        " ORDER BY l.id",
+        "iibbb",
+        LINE_OUTPUT_BINDS
+    ),
+    DECL_SEARCH_LINE_BY(STMT_SEARCH_LINE_EXACT, "l.name_id IN (SELECT id FROM " TABLE_NAMES " WHERE value IN (" SEARCHED_PATTERNS "))"),
+    DECL_SEARCH_LINE_BY(STMT_SEARCH_LINE_EXACT_CI, "l.name_id IN (SELECT id FROM " TABLE_NAMES " WHERE value COLLATE NOCASE IN (" SEARCHED_PATTERNS "))"),
+    /**
+     * NOTE: the GLOB operator can only use an index for a constant pattern,
+     * the range of each pattern is given explicitly instead
+     */
+    DECL_SEARCH_LINE_BY(
+        STMT_SEARCH_LINE_GLOB,
+        "l.name_id IN ("
+        "SELECT g.id FROM temp." TABLE_SEARCHED " JOIN " TABLE_NAMES " g"
+        " ON g.value >= lower AND g.value < upper AND g.value GLOB pattern"
+        ")"
+    ),
+#ifdef WITH_FTS
+    /**
+     * NOTE: a line matches if its name or origin contains one of the searched strings or if the command line does
+     */
+    DECL_SEARCH_LINE_BY(
+        STMT_SEARCH_LINE_SUBSTRING,
+        "(l.name_id IN (SELECT rowid FROM " TABLE_NAMES_FTS " WHERE " TABLE_NAMES_FTS " MATCH " SEARCHED_FTS_QUERY ")"
+        " OR l.origin_id IN (SELECT rowid FROM " TABLE_ORIGINS_FTS " WHERE " TABLE_ORIGINS_FTS " MATCH " SEARCHED_FTS_QUERY ")"
+        " OR l.command_id IN (SELECT rowid FROM " TABLE_COMMANDS_FTS " WHERE " TABLE_COMMANDS_FTS " MATCH " SEARCHED_FTS_QUERY "))"
+    ),
+#endif /* WITH_FTS */
+#ifdef WITH_REGEX
+    /**
+     * NOTE: a regular expression can't use an index, the dictionary of the
+     * names (a row per package, not per operation) is scanned instead
+     */
+    DECL_SEARCH_LINE_BY(
+        STMT_SEARCH_LINE_REGEX,
+        "l.name_id IN ("
+        "SELECT r.id FROM temp." TABLE_SEARCHED " JOIN " TABLE_NAMES " r"
+        " ON r.value REGEXP pattern"
+        ")"
+    ),
+#endif /* WITH_REGEX */
+    DECL_STATS_BY_PERIOD(STMT_STATS_BY_DAY, "day"),
+    DECL_STATS_BY_PERIOD(STMT_STATS_BY_WEEK, "strftime('%Y-W%W', day)"),
+    DECL_STATS_BY_PERIOD(STMT_STATS_BY_MONTH, "substr(day, 1, 7)"),
+    /**
+     * NOTE: the index on the duration is walked from the slowest command,
+     * the ones out of the range of dates or of the operations are skipped
+     */
+    [ STMT_SLOWEST_COMMANDS ] = DECL_STMT(
+        "SELECT c.id, c.inserted_at, c.command, c.started_at, " COMMAND_DURATION ", COALESCE(c.fetch_duration, -1), c.jobs_count"
+        " FROM " TABLE_COMMANDS " c"
+        " WHERE c.started_at IS NOT NULL"
+        " AND (c.inserted_at BETWEEN ? AND ?)"
+        " AND EXISTS(SELECT 1 FROM " TABLE_PACKAGES " l WHERE l.command_id = c.id AND (l.operation_id & ?) <> 0)"
+        " ORDER BY " COMMAND_DURATION " DESC"
+        " LIMIT ?",
+        "ttii",
+        "itsIIIi"
+    ),
+    /**
+     * NOTE: the names are looked up once the lines are grouped, for the
+     * packages kept only
+     */
+    [ STMT_GROWTH_BY_PACKAGE ] = DECL_STMT(
+        "SELECT n.value, g.growth, g.count FROM ("
+        "SELECT l.name_id, SUM(" LINE_GROWTH ") AS growth, COUNT(*) AS count"
+        GROWTH_LINES
+        " GROUP BY l.name_id"
+        " ORDER BY growth DESC, l.name_id"
+        " LIMIT ?"
+        ") g"
+        " LEFT JOIN " TABLE_NAMES " n ON n.id = g.name_id"
+        " ORDER BY g.growth DESC, n.value",
+        "tti",
+        "sIi"
+    ),
+    [ STMT_GROWTH_BY_COMMAND ] = DECL_STMT(
+        "SELECT c.id, c.inserted_at, c.command, SUM(" LINE_GROWTH ") AS growth, COUNT(*)"
+        GROWTH_LINES
+        // the order of the index on the dates (its range), c.id alone would be walked in the order of the table
+        " GROUP BY c.inserted_at, c.id"
+        " ORDER BY growth DESC, c.id DESC"
+        " LIMIT ?",
+        "tti",
+        "itsIi"
+    ),
+    [ STMT_STATS_TOP_PACKAGES ] = DECL_STMT(
+        "SELECT name, count FROM " TABLE_STATS_PACKAGES " WHERE operation_id = ? AND count > 0 ORDER BY count DESC, name LIMIT ?",
+        "ii",
+        "si"
+    ),
+    [ STMT_STATS_REPOSITORIES ] = DECL_STMT(
+        "SELECT repo, " SUM_OPERATIONS " FROM " TABLE_STATS_REPOSITORIES " GROUP BY repo HAVING SUM(count) > 0 ORDER BY SUM(count) DESC",
+        "",
+        "siii"
+    ),
+    /**
+     * The last command to delete (of at most ? ones) because it is older
+     * than ?
+     */
+    [ STMT_RETENTION_BY_AGE ] = DECL_STMT(
+        "SELECT inserted_at, id FROM ("
+        "SELECT inserted_at, id FROM " TABLE_COMMANDS " WHERE inserted_at < ? ORDER BY inserted_at, id LIMIT ?"
+        ") ORDER BY inserted_at DESC, id DESC LIMIT 1",
+        "ti",
+        "ti"
+    ),
+    /**
+     * The last command to delete (of at most ? ones) because it precedes the
+     * ? most recent ones
+     *
+     * NOTE: the OFFSET walks the index on inserted_at from the most recent
+     * command down to the oldest to keep
+     */
+    [ STMT_RETENTION_BY_COUNT ] = DECL_STMT(
+        "SELECT inserted_at, id FROM ("
+        "SELECT inserted_at, id FROM " TABLE_COMMANDS " WHERE (inserted_at, id) < ("
+        "SELECT inserted_at, id FROM " TABLE_COMMANDS " ORDER BY inserted_at DESC, id DESC LIMIT 1 OFFSET ?"
+        ") ORDER BY inserted_at, id LIMIT ?"
+        ") ORDER BY inserted_at DESC, id DESC LIMIT 1",
+        "ii",
+        "ti"
+    ),
+    /**
+     * NOTE: the lines are deleted by ON DELETE CASCADE (foreign keys are
+     * enabled by history_db_open)
+     */
+    [ STMT_RETENTION_DELETE ] = DECL_STMT(
+        "DELETE FROM " TABLE_COMMANDS " WHERE (inserted_at, id) <= (?, ?)",
+        "ti",
+        ""
+    ),
+    /**
+     * Once the commands up to a checkpoint are deleted, the previous
+     * checkpoints are useless
+     */
+    [ STMT_RETENTION_CHECKPOINTS ] = DECL_STMT(
+        "DELETE FROM " TABLE_CHECKPOINTS " WHERE (inserted_at, command_id) < (?, ?)",
+        "ti",
+        ""
+    ),
+    // each step (SQLITE_ROW) releases one page
+    [ STMT_INCREMENTAL_VACUUM ] = DECL_STMT("PRAGMA incremental_vacuum(" STRINGIFY_EXPAND(INCREMENTAL_VACUUM_PAGES) ")", "", ""),
+    [ STMT_OLDEST_COMMAND ] = DECL_STMT("SELECT inserted_at FROM " TABLE_COMMANDS " WHERE inserted_at = (SELECT MIN(inserted_at) FROM " TABLE_COMMANDS ") LIMIT 1", "", "t"),
+    [ STMT_FIRST_COMMAND ] = DECL_STMT("SELECT inserted_at, id FROM " TABLE_COMMANDS " ORDER BY inserted_at, id LIMIT 1", "", "ti"),
+    [ STMT_LAST_CHECKPOINT ] = DECL_STMT(
+        "SELECT id, inserted_at, command_id FROM " TABLE_CHECKPOINTS
+        " WHERE inserted_at = (SELECT MAX(inserted_at) FROM " TABLE_CHECKPOINTS ")"
+        " ORDER BY command_id DESC LIMIT 1",
+        "",
+        "iti"
+    ),
+    [ STMT_CHECKPOINT_BEFORE ] = DECL_STMT(
+        "SELECT id, inserted_at, command_id FROM " TABLE_CHECKPOINTS
+        " WHERE (inserted_at, command_id) <= (?, ?)"
+        " ORDER BY inserted_at DESC, command_id DESC LIMIT 1",
+        "ti",
+        "iti"
+    ),
+    // the command closing the next checkpoint: the ?th one after the position (?, ?)
+    [ STMT_NEXT_CHECKPOINT ] = DECL_STMT(
+        "SELECT inserted_at, id FROM " TABLE_COMMANDS
+        " WHERE (inserted_at, id) > (?, ?)"
+        " ORDER BY inserted_at, id LIMIT 1 OFFSET ? - 1",
+        "tii",
+        "ti"
+    ),
+    [ STMT_CREATE_CHECKPOINT ] = DECL_STMT(
+        "INSERT INTO " TABLE_CHECKPOINTS "(inserted_at, command_id) VALUES(?, ?)",
+        "ti",
+        ""
+    ),
+    [ STMT_CREATE_CHECKPOINT_PACKAGES ] = DECL_STMT(
+        INSTALLED_AT_CTE
+        " INSERT INTO " TABLE_CHECKPOINT_PACKAGES "(checkpoint_id, name_id, origin_id, version_id, repo_id)"
+        " SELECT ?, name_id, origin_id, version_id, repo_id FROM installed",
+        INSTALLED_AT_INPUT_BINDS "i",
+        ""
+    ),
+    [ STMT_INSTALLED_AT ] = DECL_STMT(
+        INSTALLED_AT_CTE
+        " SELECT n.value, v.value, o.value, r.value FROM installed i"
+        " JOIN " TABLE_NAMES " n ON n.id = i.name_id"
+        " JOIN " TABLE_VERSIONS " v ON v.id = i.version_id"
+        " JOIN " TABLE_ORIGINS " o ON o.id = i.origin_id"
+        " LEFT JOIN " TABLE_REPOSITORIES " r ON r.id = i.repo_id"
+        " ORDER BY n.value",
+        INSTALLED_AT_INPUT_BINDS,
+        "ssss"
+    ),
+    /**
+     * On a merged database (see history_merge), the hosts on which the
+     * searched packages (exact names) are installed, with their version
+     * (among the matched versions unless ? is true) and since when. The
+     * lines are reached through the name index, not host by host. A NULL
+     * host is the local one.
+     */
+    [ STMT_HOSTS_RUNNING ] = DECL_STMT(
+        "WITH last AS ("
+        "SELECT c.host_id, l.name_id, l.new_version_id AS version_id, l.operation_id, c.inserted_at,"
+        " ROW_NUMBER() OVER (PARTITION BY c.host_id, l.name_id ORDER BY c.inserted_at DESC, c.id DESC, l.id DESC) AS rank"
+        " FROM " TABLE_PACKAGES " l"
+        " JOIN " TABLE_COMMANDS " c ON c.id = l.command_id"
+        " WHERE l.name_id IN (SELECT n.id FROM temp." TABLE_SEARCHED " JOIN " TABLE_NAMES " n ON n.value = pattern)"
+        ")"
+        " SELECT h.value, n.value, v.value, last.inserted_at FROM last"
+        " JOIN " TABLE_NAMES " n ON n.id = last.name_id"
+        " JOIN " TABLE_VERSIONS " v ON v.id = last.version_id"
+        " LEFT JOIN " TABLE_HOSTS " h ON h.id = last.host_id"
+        " WHERE 1 = rank AND operation_id <> " STRINGIFY_EXPAND(PKG_OP_DEINSTALL)
+        " AND (? OR last.version_id IN (SELECT version_id FROM temp." TABLE_MATCHED_VERSIONS "))"
+        " ORDER BY n.value, v.value COLLATE pkg_version, h.value",
+        "b",
+        "ssst"
+    ),
+    /**
+     * The changes to the files of a package, oldest first, to rebuild its
+     * last list when it isn't stored (only the lines of the local host are
+     * tracked)
+     */
+    [ STMT_FILES_OF_NAME ] = DECL_STMT(
+        "SELECT f.data FROM " TABLE_PACKAGES " l"
+        " JOIN " TABLE_COMMANDS " c ON c.id = l.command_id"
+        " JOIN " TABLE_FILES " f ON f.line_id = l.id"
+        " WHERE l.name_id = ? AND c.host_id IS NULL"
+        " ORDER BY l.id",
+        "i",
+        "B"
+    ),
+    [ STMT_LAST_FILES_OF_NAME ] = DECL_STMT("SELECT data FROM " TABLE_LAST_FILES " WHERE name_id = ?", "i", "B"),
+    [ STMT_SET_LAST_FILES ] = DECL_STMT("INSERT OR REPLACE INTO " TABLE_LAST_FILES "(name_id, data) VALUES(?, ?)", "iB", ""),
+    [ STMT_CREATE_FILES ] = DECL_STMT(
+        "INSERT INTO " TABLE_FILES "(line_id, added_count, removed_count, data) VALUES(?, ?, ?, ?)",
+        "iiiB",
+        ""
+    ),
+    [ STMT_CREATE_CHANGED_PATH ] = DECL_STMT(
+        "INSERT INTO temp." TABLE_CHANGED_PATHS "(line_id, directory, name) VALUES(?, ?, ?)",
+        "iss",
+        ""
+    ),
+    /**
+     * The changed paths are added to their dictionaries, then indexed,
+     * set-wise and sorted, once all the lines of a command are recorded
+     */
+    [ STMT_CREATE_CHANGED_DIRECTORIES ] = DECL_STMT(
+        "INSERT OR IGNORE INTO " TABLE_DIRECTORIES "(value)"
+        " SELECT DISTINCT directory FROM temp." TABLE_CHANGED_PATHS " ORDER BY directory",
+        "",
+        ""
+    ),
+    [ STMT_CREATE_CHANGED_PATHS ] = DECL_STMT(
+        "INSERT OR IGNORE INTO " TABLE_PATHS "(directory_id, name)"
+        " SELECT DISTINCT d.id, " TABLE_CHANGED_PATHS ".name FROM temp." TABLE_CHANGED_PATHS
+        " JOIN " TABLE_DIRECTORIES " d ON d.value = " TABLE_CHANGED_PATHS ".directory"
+        " ORDER BY 1, 2",
+        "",
+        ""
+    ),
+    [ STMT_CREATE_PATH_LINES ] = DECL_STMT(
+        "INSERT OR IGNORE INTO " TABLE_PATH_LINES "(path_id, line_id)"
+        " SELECT p.id, " TABLE_CHANGED_PATHS ".line_id FROM temp." TABLE_CHANGED_PATHS
+        " JOIN " TABLE_DIRECTORIES " d ON d.value = " TABLE_CHANGED_PATHS ".directory"
+        " JOIN " TABLE_PATHS " p ON p.directory_id = d.id AND p.name = " TABLE_CHANGED_PATHS ".name"
+        " ORDER BY 1, 2",
+        "",
+        ""
+    ),
+    [ STMT_CLEAR_CHANGED_PATHS ] = DECL_STMT("DELETE FROM temp." TABLE_CHANGED_PATHS, "", ""),
+    [ STMT_WHICH ] = DECL_STMT(WHICH_LINES("d.value = ? AND p.name = ?"), "ss", WHICH_OUTPUT_BINDS),
+    // the paths under a directory: the range [directory ; directory + "\xFF"[ of TABLE_DIRECTORIES
+    [ STMT_WHICH_PREFIX ] = DECL_STMT(WHICH_LINES("d.value >= ? AND d.value < ?"), "ss", WHICH_OUTPUT_BINDS),
+    [ STMT_SPOOL_FOLDED ] = DECL_STMT("SELECT size, checksum FROM " TABLE_SPOOL, "", "II"),
+    [ STMT_SPOOL_SET_FOLDED ] = DECL_STMT("INSERT OR REPLACE INTO " TABLE_SPOOL "(id, size, checksum) VALUES(1, ?, ?)", "II", ""),
+    [ STMT_SPOOL_CLEAR ] = DECL_STMT("DELETE FROM " TABLE_SPOOL, "", ""),
+};
+
+/**
+ * Maximum count of commands deleted by a run of history_db_apply_retention
+ * and of free pages released by it: the history is trimmed a little on each
+ * pkg operation, not all at once when the policy is enabled
+ */
+#define RETENTION_BATCH_SIZE 100
+#define INCREMENTAL_VACUUM_PAGES 128
+
+/**
+ * Multi-row INSERT statements, from the largest to the smallest, used
+ * to write the lines of a command in as few steps as possible
+ */
+static const struct {
+    int statement;
+    size_t rows;
+} line_batches[] = {
+    { STMT_CREATE_LINES_64, 64 },
+    { STMT_CREATE_LINES_8, 8 },
+    { STMT_CREATE_LINE, 1 },
+};
+
+/**
+ * NOTE: on the columns of the lines before their dictionary encoding (0.9.4)
+ */
+#define CREATE_NAME_INDEXES \
+    "CREATE INDEX IF NOT EXISTS " TABLE_PACKAGES "_name_index ON " TABLE_PACKAGES "(name, operation_id, command_id);\n" \
+    "CREATE INDEX IF NOT EXISTS " TABLE_PACKAGES "_name_nocase_index ON " TABLE_PACKAGES "(name COLLATE NOCASE, operation_id, command_id);"
+
+/**
+ * Free pages are released by PRAGMA incremental_vacuum instead of a full
+ * VACUUM. Switching an existing database to it requires a (last) VACUUM
+ * and, for a new one, the journal_mode set to WAL beforehand prevents the
+ * pragma from taking effect until a VACUUM too (which is free on an empty
+ * database).
+ */
+#define ENABLE_INCREMENTAL_VACUUM \
+    "PRAGMA auto_vacuum = INCREMENTAL;\n" \
+    "VACUUM;"
+
+/**
+ * NOTE: started_at is NULL for the commands recorded before 0.9.6, imported
+ * or whose start was missed (plugin installed by the running pkg)
+ */
+#define CREATE_DURATION_INDEX \
+    "CREATE INDEX " TABLE_COMMANDS "_duration_index ON " TABLE_COMMANDS "(" COMMAND_DURATION ") WHERE started_at IS NOT NULL;"
+
+/**
+ * The commands merged from another database are identified by their host
+ * and a hash of their content (see history_merge) to be merged only once
+ *
+ * NOTE: both are NULL for the commands recorded locally
+ */
+#define CREATE_CONTENT_HASH_INDEX \
+    "CREATE UNIQUE INDEX " TABLE_COMMANDS "_content_hash_index ON " TABLE_COMMANDS "(host_id, content_hash) WHERE content_hash IS NOT NULL;"
+
+static sqlite_migration_t commands_migrations[] = {
+    // 0.9.3: auto_vacuum = INCREMENTAL
+    { 903, ENABLE_INCREMENTAL_VACUUM },
+    // 0.9.6: duration of the commands
+    {
+        906,
+        "ALTER TABLE " TABLE_COMMANDS " ADD COLUMN started_at INT NULL;\n"
+        "ALTER TABLE " TABLE_COMMANDS " ADD COLUMN finished_at INT NULL;\n"
+        "ALTER TABLE " TABLE_COMMANDS " ADD COLUMN fetch_duration INT NULL;\n"
+        "ALTER TABLE " TABLE_COMMANDS " ADD COLUMN jobs_count INT NOT NULL DEFAULT 0;\n"
+        "UPDATE " TABLE_COMMANDS " SET jobs_count = (SELECT COUNT(*) FROM " TABLE_PACKAGES " WHERE command_id = " TABLE_COMMANDS ".id);\n"
+        CREATE_DURATION_INDEX
+    },
+    // 0.9.7: merge of the histories of several hosts
+    {
+        907,
+        "ALTER TABLE " TABLE_COMMANDS " ADD COLUMN host_id INT NULL REFERENCES " TABLE_HOSTS "(id);\n"
+        "ALTER TABLE " TABLE_COMMANDS " ADD COLUMN content_hash INT NULL;\n"
+        CREATE_CONTENT_HASH_INDEX
+    },
+};
+
+/**
+ * Dictionary tables: each distinct repository, name, origin and version is
+ * stored once and referenced by TABLE_PACKAGES through its identifier
+ */
+#define CREATE_DICTIONARY(table) \
+    "CREATE TABLE " table "(\n" \
+    "    id INTEGER NOT NULL PRIMARY KEY,\n" \
+    "    value TEXT NOT NULL UNIQUE\n" \
+    ");\n"
+
+#define CREATE_LINES_TABLE(table) \
+    "CREATE TABLE " table "(\n" \
+    "    id INTEGER NOT NULL PRIMARY KEY,\n" \
+    "    -- NOTE: repo_id is NULL on deletion\n" \
+    "    repo_id INT NULL REFERENCES " TABLE_REPOSITORIES "(id),\n" \
+    "    name_id INT NOT NULL REFERENCES " TABLE_NAMES "(id),\n" \
+    "    origin_id INT NOT NULL REFERENCES " TABLE_ORIGINS "(id),\n" \
+    "    old_version_id INT NULL REFERENCES " TABLE_VERSIONS "(id),\n" \
+    "    new_version_id INT NOT NULL REFERENCES " TABLE_VERSIONS "(id),\n" \
+    "    command_id INT NOT NULL REFERENCES " TABLE_COMMANDS "(id) ON UPDATE CASCADE ON DELETE CASCADE,\n" \
+    "    operation_id INT NOT NULL REFERENCES " TABLE_OPERATIONS "(id) ON UPDATE CASCADE ON DELETE CASCADE\n" \
+    ");\n"
+
+/**
+ * NOTE: CREATE_LINES_TABLE is the table as of 0.9.4 (rebuilt by
+ * ENCODE_LINES), the later columns are added to it the same way on
+ * creation and by lines_migrations
+ */
+#define ADD_LINES_FLATSIZES \
+    "ALTER TABLE " TABLE_PACKAGES " ADD COLUMN new_flatsize INT NULL;\n" \
+    "ALTER TABLE " TABLE_PACKAGES " ADD COLUMN old_flatsize INT NULL;\n"
+
+#define CREATE_LINES_INDEXES \
+    "CREATE INDEX " TABLE_PACKAGES "_command_id_index ON " TABLE_PACKAGES "(command_id);\n" \
+    "CREATE INDEX " TABLE_PACKAGES "_operation_id_index ON " TABLE_PACKAGES "(operation_id);\n" \
+    "CREATE INDEX " TABLE_PACKAGES "_name_index ON " TABLE_PACKAGES "(name_id, operation_id, command_id);\n" \
+    "CREATE INDEX " TABLE_PACKAGES "_origin_index ON " TABLE_PACKAGES "(origin_id);\n"
+
+#ifdef WITH_FTS
+// the lines are no longer indexed themselves, their names and origins are (in their dictionaries)
+# define DROP_PACKAGES_FTS \
+    "DROP TABLE IF EXISTS " TABLE_PACKAGES_FTS ";\n"
+#else
+# define DROP_PACKAGES_FTS ""
+#endif /* WITH_FTS */
+
+/**
+ * Rebuilds TABLE_PACKAGES with identifiers in place of the strings (the
+ * dictionaries are created empty before). The trigger on TABLE_COMMANDS
+ * referencing TABLE_PACKAGES is dropped for the table to be renamed, it is
+ * recreated with the ones of TABLE_PACKAGES by stats_migrations.
+ */
+#define ENCODE_LINES \
+    "BEGIN;\n" \
+    "INSERT OR IGNORE INTO " TABLE_REPOSITORIES "(value) SELECT repo FROM " TABLE_PACKAGES " WHERE repo IS NOT NULL;\n" \
+    "INSERT OR IGNORE INTO " TABLE_NAMES "(value) SELECT name FROM " TABLE_PACKAGES ";\n" \
+    "INSERT OR IGNORE INTO " TABLE_ORIGINS "(value) SELECT origin FROM " TABLE_PACKAGES ";\n" \
+    "INSERT OR IGNORE INTO " TABLE_VERSIONS "(value)" \
+    " SELECT old_version FROM " TABLE_PACKAGES " WHERE old_version IS NOT NULL UNION SELECT new_version FROM " TABLE_PACKAGES ";\n" \
+    CREATE_LINES_TABLE(TABLE_PACKAGES "_904") \
+    "INSERT INTO " TABLE_PACKAGES "_904(id, repo_id, name_id, origin_id, old_version_id, new_version_id, command_id, operation_id)" \
+    " SELECT l.id, r.id, n.id, o.id, ov.id, nv.id, l.command_id, l.operation_id FROM " TABLE_PACKAGES " l" \
+    " JOIN " TABLE_NAMES " n ON n.value = l.name" \
+    " JOIN " TABLE_ORIGINS " o ON o.value = l.origin" \
+    " LEFT JOIN " TABLE_REPOSITORIES " r ON r.value = l.repo" \
+    " LEFT JOIN " TABLE_VERSIONS " ov ON ov.value = l.old_version" \
+    " JOIN " TABLE_VERSIONS " nv ON nv.value = l.new_version;\n" \
+    "DROP TRIGGER IF EXISTS " TABLE_STATS_DAYS "_command_delete;\n" \
+    DROP_PACKAGES_FTS \
+    "DROP TABLE " TABLE_PACKAGES ";\n" \
+    "ALTER TABLE " TABLE_PACKAGES "_904 RENAME TO " TABLE_PACKAGES ";\n" \
+    CREATE_LINES_INDEXES \
+    "COMMIT;\n" \
+    "PRAGMA incremental_vacuum;"
+
+static sqlite_migration_t lines_migrations[] = {
+    // 0.9.0: index package names for searches (both case sensitively and insensitively)
+    { 900, CREATE_NAME_INDEXES },
+    // 0.9.4: dictionary encoding of the strings
+    { 904, ENCODE_LINES },
+    // 0.9.10: installed sizes of the packages
+    { 910, ADD_LINES_FLATSIZES },
+};
+
+#ifdef WITH_FTS
+/**
+ * Trigram indexes (external content FTS5 tables) for substring searches,
+ * the rebuild command indexes the rows recorded before their creation
+ */
+# define CREATE_FTS_INDEX(table, fts_table, columns, new_columns, old_columns) \
+    "CREATE VIRTUAL TABLE " fts_table " USING fts5(" columns ", content='" table "', content_rowid='id', tokenize='trigram');\n" \
+    "INSERT INTO " fts_table "(" fts_table ") VALUES('rebuild');\n" \
+    "CREATE TRIGGER " fts_table "_insert AFTER INSERT ON " table " BEGIN\n" \
+    "    INSERT INTO " fts_table "(rowid, " columns ") VALUES(new.id, " new_columns ");\n" \
+    "END;\n" \
+    "CREATE TRIGGER " fts_table "_delete AFTER DELETE ON " table " BEGIN\n" \
+    "    INSERT INTO " fts_table "(" fts_table ", rowid, " columns ") VALUES('delete', old.id, " old_columns ");\n" \
+    "END;\n" \
+    "CREATE TRIGGER " fts_table "_update AFTER UPDATE OF " columns " ON " table " BEGIN\n" \
+    "    INSERT INTO " fts_table "(" fts_table ", rowid, " columns ") VALUES('delete', old.id, " old_columns ");\n" \
+    "    INSERT INTO " fts_table "(rowid, " columns ") VALUES(new.id, " new_columns ");\n" \
+    "END;"
+#endif /* WITH_FTS */
+
+/**
+ * Summary tables, maintained by triggers on TABLE_PACKAGES, counting the
+ * operations by day, package and repository (by their names, not their
+ * identifiers). They are filled from the existing rows on creation.
+ *
+ * NOTE:
+ * - the day of a line is the one of its command, in local time of the
+ *   recording process
+ * - when a command is deleted, its days are decremented by a trigger on the
+ *   command (the lines deleted by ON DELETE CASCADE no longer find it)
+ * - repo is NULL on deletion, it is counted as ''
+ */
+#define DAY_OF(command_id) \
+    "(SELECT date(inserted_at, 'unixepoch', 'localtime') FROM " TABLE_COMMANDS " WHERE id = " command_id ")"
+
+#define VALUE_OF(table, id) \
+    "(SELECT value FROM " table " WHERE id = " id ")"
+
+/**
+ * NOTE: the unary + keeps sqlite from counting the lines through the index
+ * on operation_id (all the lines of an operation) instead of command_id
+ */
+#define CREATE_STATS_COMMAND_DELETE_TRIGGER \
+    "CREATE TRIGGER IF NOT EXISTS " TABLE_STATS_DAYS "_command_delete BEFORE DELETE ON " TABLE_COMMANDS " BEGIN\n" \
+    "    UPDATE " TABLE_STATS_DAYS " SET count = count - (" \
+    "SELECT COUNT(*) FROM " TABLE_PACKAGES " WHERE command_id = old.id AND +operation_id = " TABLE_STATS_DAYS ".operation_id" \
+    ") WHERE day = date(old.inserted_at, 'unixepoch', 'localtime');\n" \
+    "END;"
+
+#define CREATE_STATS_TABLE(table, key) \
+    "CREATE TABLE " table "(\n" \
+    "    " key " TEXT NOT NULL,\n" \
+    "    operation_id INT NOT NULL,\n" \
+    "    count INT NOT NULL,\n" \
+    "    PRIMARY KEY(" key ", operation_id)\n" \
+    ") WITHOUT ROWID;\n"
+
+#define CREATE_STATS_TABLES \
+    CREATE_STATS_TABLE(TABLE_STATS_DAYS, "day") \
+    CREATE_STATS_TABLE(TABLE_STATS_PACKAGES, "name") \
+    "CREATE INDEX " TABLE_STATS_PACKAGES "_count_index ON " TABLE_STATS_PACKAGES "(operation_id, count);\n" \
+    CREATE_STATS_TABLE(TABLE_STATS_REPOSITORIES, "repo") \
+    "INSERT INTO " TABLE_STATS_DAYS "(day, operation_id, count)" \
+    " SELECT date(c.inserted_at, 'unixepoch', 'localtime'), l.operation_id, COUNT(*)" \
+    " FROM " TABLE_PACKAGES " l JOIN " TABLE_COMMANDS " c ON c.id = l.command_id GROUP BY 1, 2;\n" \
+    "INSERT INTO " TABLE_STATS_PACKAGES "(name, operation_id, count)" \
+    " SELECT n.value, l.operation_id, COUNT(*) FROM " TABLE_PACKAGES " l JOIN " TABLE_NAMES " n ON n.id = l.name_id GROUP BY 1, 2;\n" \
+    "INSERT INTO " TABLE_STATS_REPOSITORIES "(repo, operation_id, count)" \
+    " SELECT IFNULL(r.value, ''), l.operation_id, COUNT(*) FROM " TABLE_PACKAGES " l LEFT JOIN " TABLE_REPOSITORIES " r ON r.id = l.repo_id GROUP BY 1, 2;\n" \
+    CREATE_STATS_LINE_TRIGGERS \
+    CREATE_STATS_COMMAND_DELETE_TRIGGER
+
+#define CREATE_STATS_LINE_TRIGGERS \
+    "CREATE TRIGGER " TABLE_STATS_DAYS "_insert AFTER INSERT ON " TABLE_PACKAGES " BEGIN\n" \
+    "    INSERT INTO " TABLE_STATS_DAYS "(day, operation_id, count) SELECT " DAY_OF("new.command_id") ", new.operation_id, 1 WHERE true" \
+    " ON CONFLICT(day, operation_id) DO UPDATE SET count = count + 1;\n" \
+    "    INSERT INTO " TABLE_STATS_PACKAGES "(name, operation_id, count) VALUES(" VALUE_OF(TABLE_NAMES, "new.name_id") ", new.operation_id, 1)" \
+    " ON CONFLICT(name, operation_id) DO UPDATE SET count = count + 1;\n" \
+    "    INSERT INTO " TABLE_STATS_REPOSITORIES "(repo, operation_id, count) VALUES(IFNULL(" VALUE_OF(TABLE_REPOSITORIES, "new.repo_id") ", ''), new.operation_id, 1)" \
+    " ON CONFLICT(repo, operation_id) DO UPDATE SET count = count + 1;\n" \
+    "END;\n" \
+    "CREATE TRIGGER " TABLE_STATS_DAYS "_delete AFTER DELETE ON " TABLE_PACKAGES " BEGIN\n" \
+    "    UPDATE " TABLE_STATS_DAYS " SET count = count - 1 WHERE day = " DAY_OF("old.command_id") " AND operation_id = old.operation_id;\n" \
+    "    UPDATE " TABLE_STATS_PACKAGES " SET count = count - 1 WHERE name = " VALUE_OF(TABLE_NAMES, "old.name_id") " AND operation_id = old.operation_id;\n" \
+    "    UPDATE " TABLE_STATS_REPOSITORIES " SET count = count - 1" \
+    " WHERE repo = IFNULL(" VALUE_OF(TABLE_REPOSITORIES, "old.repo_id") ", '') AND operation_id = old.operation_id;\n" \
+    "END;\n"
+
+/**
+ * Counts, in the statistics, the lines l matching a condition (given as
+ * argument to sqlite_execf), set-wise instead of line by line by the
+ * triggers (see history_db_stats_suspend)
+ */
+#define ADD_STATS(table, key, value, join) \
+    "INSERT INTO " table "(" key ", operation_id, count)" \
+    " SELECT " value ", l.operation_id, COUNT(*) FROM " TABLE_PACKAGES " l " join \
+    " WHERE %s GROUP BY 1, 2" \
+    " ON CONFLICT(" key ", operation_id) DO UPDATE SET count = count + excluded.count;\n"
+
+#define ADD_STATS_DAYS \
+    ADD_STATS(TABLE_STATS_DAYS, "day", "date(c.inserted_at, 'unixepoch', 'localtime')", "JOIN " TABLE_COMMANDS " c ON c.id = l.command_id")
+
+#define ADD_STATS_PACKAGES \
+    ADD_STATS(TABLE_STATS_PACKAGES, "name", "n.value", "JOIN " TABLE_NAMES " n ON n.id = l.name_id")
+
+#define ADD_STATS_REPOSITORIES \
+    ADD_STATS(TABLE_STATS_REPOSITORIES, "repo", "IFNULL(r.value, '')", "LEFT JOIN " TABLE_REPOSITORIES " r ON r.id = l.repo_id")
+
+/**
+ * Checkpoints: full snapshots of the installed packages, taken every N
+ * commands (see history_db_create_checkpoints), from which the installed
+ * packages at any time are rebuilt by replaying only the lines after the
+ * closest one. A command inserted before a checkpoint (by pkg history
+ * import) invalidates it.
+ */
+#define CREATE_CHECKPOINT_TABLES \
+    "CREATE TABLE " TABLE_CHECKPOINTS "(\n" \
+    "    id INTEGER NOT NULL PRIMARY KEY,\n" \
+    "    -- position of the last command replayed into the snapshot\n" \
+    "    inserted_at INT NOT NULL,\n" \
+    "    command_id INT NOT NULL\n" \
+    ");\n" \
+    "CREATE UNIQUE INDEX " TABLE_CHECKPOINTS "_position_index ON " TABLE_CHECKPOINTS "(inserted_at, command_id);\n" \
+    "CREATE TABLE " TABLE_CHECKPOINT_PACKAGES "(\n" \
+    "    checkpoint_id INT NOT NULL REFERENCES " TABLE_CHECKPOINTS "(id) ON UPDATE CASCADE ON DELETE CASCADE,\n" \
+    "    name_id INT NOT NULL REFERENCES " TABLE_NAMES "(id),\n" \
+    "    origin_id INT NOT NULL REFERENCES " TABLE_ORIGINS "(id),\n" \
+    "    version_id INT NOT NULL REFERENCES " TABLE_VERSIONS "(id),\n" \
+    "    repo_id INT NULL REFERENCES " TABLE_REPOSITORIES "(id),\n" \
+    "    PRIMARY KEY(checkpoint_id, name_id)\n" \
+    ") WITHOUT ROWID;\n" \
+    "CREATE TRIGGER " TABLE_CHECKPOINTS "_command_insert AFTER INSERT ON " TABLE_COMMANDS \
+    " WHEN new.inserted_at < (SELECT MAX(inserted_at) FROM " TABLE_CHECKPOINTS ") BEGIN\n" \
+    "    DELETE FROM " TABLE_CHECKPOINTS " WHERE inserted_at > new.inserted_at;\n" \
+    "END;"
+
+/**
+ * The files added and removed by each line (see history_files.c): the
+ * delta is stored, encoded, in TABLE_FILES and its paths indexed by
+ * TABLE_PATH_LINES. The paths are split into a directory and a name, the
+ * directories being a dictionary: the paths under a directory are a range
+ * of it.
+ *
+ * NOTE: both are deleted with their line by ON DELETE CASCADE
+ */
+#define CREATE_FILES_TABLES \
+    CREATE_DICTIONARY(TABLE_DIRECTORIES) \
+    "CREATE TABLE " TABLE_PATHS "(\n" \
+    "    id INTEGER NOT NULL PRIMARY KEY,\n" \
+    "    directory_id INT NOT NULL REFERENCES " TABLE_DIRECTORIES "(id),\n" \
+    "    name TEXT NOT NULL\n" \
+    ");\n" \
+    "CREATE UNIQUE INDEX " TABLE_PATHS "_directory_index ON " TABLE_PATHS "(directory_id, name);\n" \
+    "CREATE TABLE " TABLE_FILES "(\n" \
+    "    line_id INTEGER NOT NULL PRIMARY KEY REFERENCES " TABLE_PACKAGES "(id) ON DELETE CASCADE,\n" \
+    "    added_count INT NOT NULL,\n" \
+    "    removed_count INT NOT NULL,\n" \
+    "    data BLOB NOT NULL\n" \
+    ");\n" \
+    "CREATE TABLE " TABLE_PATH_LINES "(\n" \
+    "    path_id INT NOT NULL REFERENCES " TABLE_PATHS "(id),\n" \
+    "    line_id INT NOT NULL REFERENCES " TABLE_PACKAGES "(id) ON DELETE CASCADE,\n" \
+    "    PRIMARY KEY(path_id, line_id)\n" \
+    ") WITHOUT ROWID;\n" \
+    "CREATE INDEX " TABLE_PATH_LINES "_line_index ON " TABLE_PATH_LINES "(line_id);"
+
+/**
+ * The last list of files of each package (see history_files.c), for the
+ * hook to read a single row instead of replaying all the changes of the
+ * package
+ *
+ * NOTE: created by 0.9.11, the list of a package recorded before is built
+ * from its changes on its next operation
+ */
+#define CREATE_LAST_FILES_TABLE \
+    "CREATE TABLE " TABLE_LAST_FILES "(\n" \
+    "    name_id INTEGER NOT NULL PRIMARY KEY REFERENCES " TABLE_NAMES "(id),\n" \
+    "    data BLOB NOT NULL\n" \
+    ");"
+
+/**
+ * The start of the spool (see history_spool.c) folded by the last run of
+ * history_spool_fold, written in the transaction of the folded commands
+ * and cleared once the spool is truncated: if the truncation didn't
+ * happen, these bytes are not folded again
+ */
+#define CREATE_SPOOL_TABLE \
+    "CREATE TABLE " TABLE_SPOOL "(\n" \
+    "    id INTEGER NOT NULL PRIMARY KEY CHECK(id = 1),\n" \
+    "    size INT NOT NULL,\n" \
+    "    -- FNV-1a of these bytes\n" \
+    "    checksum INT NOT NULL\n" \
+    ");"
+
+/**
+ * The versions sorted as pkg does, for the ranges of versions (see
+ * DECL_MATCH_VERSIONS)
+ *
+ * NOTE: the database can only be written by a connection which knows the
+ * collation pkg_version (history_db_open registers it)
+ */
+#define CREATE_VERSIONS_INDEX \
+    "CREATE INDEX " TABLE_VERSIONS "_pkg_version_index ON " TABLE_VERSIONS "(value COLLATE pkg_version);"
+
+static sqlite_migration_t versions_migrations[] = {
+    // 0.9.9: ranges of versions
+    { 909, CREATE_VERSIONS_INDEX },
+};
+
+static sqlite_migration_t checkpoints_migrations[] = {
+    // 0.9.11: the checkpoints included the commands merged from other hosts, the hook takes them again
+    { 911, "DELETE FROM " TABLE_CHECKPOINT_PACKAGES ";\nDELETE FROM " TABLE_CHECKPOINTS ";" },
+};
+
+static sqlite_migration_t stats_migrations[] = {
+    // 0.9.3: decrement the days on the deletion of a command
+    { 903, CREATE_STATS_COMMAND_DELETE_TRIGGER },
+    // 0.9.4: the triggers are dropped with the table of the lines by ENCODE_LINES
+    { 904, CREATE_STATS_LINE_TRIGGERS CREATE_STATS_COMMAND_DELETE_TRIGGER },
+    // 0.9.5: count the lines of a deleted command through the index on command_id
+    { 905, "DROP TRIGGER IF EXISTS " TABLE_STATS_DAYS "_command_delete;\n" CREATE_STATS_COMMAND_DELETE_TRIGGER },
+};
+
+/**
+ * Creates the tables or upgrades them to the current version of the schema
+ */
+static bool history_db_create_or_migrate(sqlite_db_t *db, char **error)
+{
+    bool ok;
+
+    ok = false;
+    do {
+        if (!sqlite_create_or_migrate(db, TABLE_HOSTS, CREATE_DICTIONARY(TABLE_HOSTS), NULL, 0, error)) {
+            break;
+        }
+        if (!sqlite_create_or_migrate(db, TABLE_COMMANDS, "CREATE TABLE " TABLE_COMMANDS "(\n\
+            id INTEGER NOT NULL PRIMARY KEY,\n\
+            inserted_at INT NOT NULL,\n\
+            command TEXT NOT NULL,\n\
+            -- UNIX timestamps, in milliseconds, of the first PRE_* hook and of the POST_* one\n\
+            started_at INT NULL,\n\
+            finished_at INT NULL,\n\
+            -- milliseconds spent fetching the packages, NULL if nothing was fetched\n\
+            fetch_duration INT NULL,\n\
+            jobs_count INT NOT NULL DEFAULT 0,\n\
+            -- the host of a merged command, NULL for a local one\n\
+            host_id INT NULL REFERENCES " TABLE_HOSTS "(id),\n\
+            content_hash INT NULL\n\
+        );\n\
+        CREATE INDEX " TABLE_COMMANDS "_inserted_at ON " TABLE_COMMANDS "(inserted_at);\n" CREATE_DURATION_INDEX CREATE_CONTENT_HASH_INDEX ENABLE_INCREMENTAL_VACUUM, commands_migrations, ARRAY_SIZE(commands_migrations), error)) {
+            break;
+        }
+        if (!sqlite_create_or_migrate(db, TABLE_OPERATIONS, "CREATE TABLE " TABLE_OPERATIONS "(\n\
+            id INTEGER NOT NULL,\n\
+            name TEXT NOT NULL,\n\
+            PRIMARY KEY(id)\n\
+        );\n\
+        INSERT INTO " TABLE_OPERATIONS "(id, name) VALUES(" STRINGIFY_EXPAND(PKG_OP_INSTALL) ", 'install');\n\
+        INSERT INTO " TABLE_OPERATIONS "(id, name) VALUES(" STRINGIFY_EXPAND(PKG_OP_DEINSTALL) ", 'deinstall');\n\
+        INSERT INTO " TABLE_OPERATIONS "(id, name) VALUES(" STRINGIFY_EXPAND(PKG_OP_UPGRADE) ", 'upgrade');", NULL, 0, error)) {
+            break;
+        }
+        if (!sqlite_create_or_migrate(db, TABLE_REPOSITORIES, CREATE_DICTIONARY(TABLE_REPOSITORIES), NULL, 0, error)) {
+            break;
+        }
+        if (!sqlite_create_or_migrate(db, TABLE_NAMES, CREATE_DICTIONARY(TABLE_NAMES) "CREATE INDEX " TABLE_NAMES "_nocase_index ON " TABLE_NAMES "(value COLLATE NOCASE);", NULL, 0, error)) {
+            break;
+        }
+        if (!sqlite_create_or_migrate(db, TABLE_ORIGINS, CREATE_DICTIONARY(TABLE_ORIGINS), NULL, 0, error)) {
+            break;
+        }
+        if (!sqlite_create_or_migrate(db, TABLE_VERSIONS, CREATE_DICTIONARY(TABLE_VERSIONS) CREATE_VERSIONS_INDEX, versions_migrations, ARRAY_SIZE(versions_migrations), error)) {
+            break;
+        }
+        if (!sqlite_create_or_migrate(db, TABLE_PACKAGES, CREATE_LINES_TABLE(TABLE_PACKAGES) ADD_LINES_FLATSIZES CREATE_LINES_INDEXES, lines_migrations, ARRAY_SIZE(lines_migrations), error)) {
+            break;
+        }
+#ifdef WITH_FTS
+        if (!sqlite_create_or_migrate(db, TABLE_COMMANDS_FTS, CREATE_FTS_INDEX(TABLE_COMMANDS, TABLE_COMMANDS_FTS, "command", "new.command", "old.command"), NULL, 0, error)) {
+            break;
+        }
+        if (!sqlite_create_or_migrate(db, TABLE_NAMES_FTS, CREATE_FTS_INDEX(TABLE_NAMES, TABLE_NAMES_FTS, "value", "new.value", "old.value"), NULL, 0, error)) {
+            break;
+        }
+        if (!sqlite_create_or_migrate(db, TABLE_ORIGINS_FTS, CREATE_FTS_INDEX(TABLE_ORIGINS, TABLE_ORIGINS_FTS, "value", "new.value", "old.value"), NULL, 0, error)) {
+            break;
+        }
+#endif /* WITH_FTS */
+        if (!sqlite_create_or_migrate(db, TABLE_STATS_DAYS, CREATE_STATS_TABLES, stats_migrations, ARRAY_SIZE(stats_migrations), error)) {
+            break;
+        }
+        if (!sqlite_create_or_migrate(db, TABLE_CHECKPOINTS, CREATE_CHECKPOINT_TABLES, checkpoints_migrations, ARRAY_SIZE(checkpoints_migrations), error)) {
+            break;
+        }
+        if (!sqlite_create_or_migrate(db, TABLE_FILES, CREATE_FILES_TABLES, NULL, 0, error)) {
+            break;
+        }
+        if (!sqlite_create_or_migrate(db, TABLE_LAST_FILES, CREATE_LAST_FILES_TABLE, NULL, 0, error)) {
+            break;
+        }
+        if (!sqlite_create_or_migrate(db, TABLE_SPOOL, CREATE_SPOOL_TABLE, NULL, 0, error)) {
+            break;
+        }
+        ok = true;
+    } while (false);
+
+    return ok;
+}
+
+/**
+ * Implements pkg_version_cmp(X, Y) with the function of the same name of
+ * libpkg: -1, 0 or 1 when the version X is older than, the same as or
+ * newer than Y (NULL if one of them is NULL)
+ */
+static void history_pkg_version_cmp(sqlite3_context *context, int UNUSED(argc), sqlite3_value **argv)
+{
+    const char *a, *b;
+
+    if (SQLITE_NULL == sqlite3_value_type(argv[0]) || SQLITE_NULL == sqlite3_value_type(argv[1])) {
+        return;
+    }
+    if (NULL == (a = (const char *) sqlite3_value_text(argv[0])) || NULL == (b = (const char *) sqlite3_value_text(argv[1]))) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    sqlite3_result_int(context, pkg_version_cmp(a, b));
+}
+
+/**
+ * Versions shorter than this are copied on the stack by the collation
+ */
+#define VERSION_BUFFER_SIZE 128
+
+/**
+ * Collation pkg_version: orders the versions as pkg_version_cmp, for an
+ * index on them to answer a range of versions (< 3.0.12). The strings given
+ * by sqlite are not NUL terminated, they are copied first.
+ *
+ * NOTE: a collation can't fail, if a (long) version can't be copied, the
+ * strings are compared bytewise instead
+ */
+static int history_pkg_version_collation(void *UNUSED(data), int a_len, const void *a, int b_len, const void *b)
+{
+    int ret;
+    char a_buffer[VERSION_BUFFER_SIZE], b_buffer[VERSION_BUFFER_SIZE], *a_copy, *b_copy;
+
+    a_copy = a_len < VERSION_BUFFER_SIZE ? a_buffer : malloc(a_len + 1);
+    b_copy = b_len < VERSION_BUFFER_SIZE ? b_buffer : malloc(b_len + 1);
+    if (NULL == a_copy || NULL == b_copy) {
+        if (0 == (ret = memcmp(a, b, MIN(a_len, b_len)))) {
+            ret = a_len - b_len;
+        }
+    } else {
+        memcpy(a_copy, a, a_len);
+        a_copy[a_len] = '\0';
+        memcpy(b_copy, b, b_len);
+        b_copy[b_len] = '\0';
+        ret = pkg_version_cmp(a_copy, b_copy);
+    }
+    if (a_buffer != a_copy) {
+        free(a_copy);
+    }
+    if (b_buffer != b_copy) {
+        free(b_copy);
+    }
+
+    return ret;
+}
+
+/**
+ * The hook of sqlite_open: the statements and the index on the versions
+ * depend on pkg_version_cmp and the collation pkg_version
+ */
+static bool history_db_register(sqlite3 *db, char **error)
+{
+    bool ok;
+
+    ok = false;
+    do {
+        if (SQLITE_OK != sqlite3_create_function(db, "pkg_version_cmp", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, history_pkg_version_cmp, NULL, NULL)) {
+            set_generic_error(error, "can't register function pkg_version_cmp: %s", sqlite3_errmsg(db));
+            break;
+        }
+        if (SQLITE_OK != sqlite3_create_collation(db, "pkg_version", SQLITE_UTF8, NULL, history_pkg_version_collation)) {
+            set_generic_error(error, "can't register collation pkg_version: %s", sqlite3_errmsg(db));
+            break;
+        }
+        ok = true;
+    } while (false);
+
+    return ok;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * NOTE:
+ * - when the database is already at the current version of the schema
+ *   (the common case: every hook and every pkg history), the existence of
+ *   each table is not checked, they are assumed to be there. If a statement
+ *   can't be prepared, the full check is done anyway. The environment
+ *   variable HISTORY_CHECK_SCHEMA forces the full check.
+ * - the environment variable HISTORY_TIMINGS prints on stderr the time
+ *   spent by each step
+ */
+pkg_error_t history_db_open(const char *path, int mode, const sqlite_open_options_t *options, sqlite_db_t **db, char **error)
+{
+    pkg_error_t status;
+    bool fast_path, timings;
+    double started_at, opened_at, checked_at, prepared_at;
+
+    *db = NULL;
+    timings = env_get_option("HISTORY_TIMINGS", false);
+    started_at = opened_at = checked_at = prepared_at = timings ? now_ms() : 0;
+    do {
+        bool prepared;
+
+        if (EPKG_OK != (status = sqlite_open(path, mode, options, history_db_register, db, error))) {
+            break;
+        }
+        status = EPKG_FATAL;
+        if (sqlite_is_readonly(*db) && sqlite_get_user_version(*db) < HISTORY_VERSION_NUMBER) {
+            // the schema has to be upgraded before being usable: it requires write access
+            if (0 != geteuid()) {
+                set_generic_error(error, "the database %s was created by a previous version of the plugin and has to be upgraded by root first", path);
+                break;
+            }
+            sqlite_close(*db);
+            if (EPKG_OK != (status = sqlite_open(path, mode | PKGDB_MODE_WRITE, options, history_db_register, db, error))) {
+                break;
+            }
+            status = EPKG_FATAL;
+        }
+        if (timings) {
+            opened_at = now_ms();
+        }
+        fast_path = HISTORY_VERSION_NUMBER == sqlite_get_user_version(*db) && !env_get_option("HISTORY_CHECK_SCHEMA", false);
+        if (!fast_path && !history_db_create_or_migrate(*db, error)) {
+            break;
+        }
+        // temporary: they don't outlive the connection and can be created by a read-only one
+        if (!sqlite_exec(*db, CREATE_TABLE_SEARCHED CREATE_TABLE_MATCHED_VERSIONS CREATE_TABLE_JAIL_LINES CREATE_TABLE_CHANGED_PATHS, error)) {
+            break;
+        }
+        // for ON DELETE CASCADE (after the migrations: ENCODE_LINES drops a table referencing TABLE_COMMANDS)
+        if (!sqlite_exec(*db, "PRAGMA foreign_keys = ON", error)) {
+            break;
+        }
+        if (!fast_path && !sqlite_is_readonly(*db) && !sqlite_set_user_version(*db, HISTORY_VERSION_NUMBER, error)) {
+            break;
+        }
+        if (timings) {
+            checked_at = now_ms();
+        }
+        if (!(prepared = sqlite_stmt_prepare(*db, history_statements, ARRAY_SIZE(history_statements), error)) && fast_path) {
+            // the schema is not the expected one (a table was dropped?): check it for good
+            error_free(error);
+            fast_path = false;
+            prepared = history_db_create_or_migrate(*db, error) && sqlite_stmt_prepare(*db, history_statements, ARRAY_SIZE(history_statements), error);
+        }
+        if (!prepared) {
+            break;
+        }
+        if (timings) {
+            prepared_at = now_ms();
+            fprintf(
+                stderr,
+                "[TIMING] %s: open %.3f ms, schema %.3f ms (%s), statements %.3f ms, total %.3f ms\n",
+                path,
+                opened_at - started_at,
+                checked_at - opened_at,
+                fast_path ? "version matches" : "checked",
+                prepared_at - checked_at,
+                prepared_at - started_at
+            );
+        }
+        status = EPKG_OK;
+    } while (false);
+    if (EPKG_OK != status && NULL != *db) {
+        sqlite_close(*db);
+        *db = NULL;
+    }
+
+    return status;
+}
+
+void history_db_close(sqlite_db_t *db)
+{
+    sqlite_stmt_finalize(history_statements, ARRAY_SIZE(history_statements));
+    sqlite_close(db);
+}
+
+/**
+ * A dictionary table (its statements) with the identifiers already
+ * resolved by the current batch: the strings are not copied, they are
+ * expected to live as long as the cache
+ */
+typedef struct {
+    int find, create;
+    HashTable cache;
+} dictionary_t;
+
+enum {
+    DICTIONARY_REPOSITORIES,
+    DICTIONARY_NAMES,
+    DICTIONARY_ORIGINS,
+    DICTIONARY_VERSIONS,
+    _DICTIONARY_COUNT,
+};
+
+static bool dictionary_resolve(sqlite_db_t *db, dictionary_t *dictionary, const char *value, int *id, char **error)
+{
+    int ret;
+    ht_hash_t h;
+    void *cached;
+
+    *id = 0;
+    if (NULL == value) {
+        return true;
+    }
+    h = hashtable_hash(&dictionary->cache, value);
+    if (hashtable_quick_get(&dictionary->cache, h, value, &cached)) {
+        *id = (int) (intptr_t) cached;
+        return true;
+    }
+    statement_bind(&history_statements[dictionary->find], value);
+    if (-1 == (ret = statement_fetch(db, &history_statements[dictionary->find], error, id))) {
+        return false;
+    }
+    if (0 == ret) {
+        statement_bind(&history_statements[dictionary->create], value);
+        if (-1 == statement_fetch(db, &history_statements[dictionary->create], error)) {
+            return false;
+        }
+        *id = sqlite_last_insert_id(db);
+    }
+    hashtable_quick_put(&dictionary->cache, 0, h, value, (intptr_t) *id, NULL);
+
+    return true;
+}
+
+/**
+ * Resolves (and adds when new) the strings of lines to their identifiers
+ * in the dictionary tables. Each distinct string costs a single lookup for
+ * the whole batch, the next ones are answered by a hashtable.
+ *
+ * NOTE: has to be called inside a transaction
+ */
+bool history_db_resolve_lines(sqlite_db_t *db, const history_line_t *lines, size_t lines_count, history_line_ids_t *ids, char **error)
+{
+    bool ok;
+    size_t i;
+    dictionary_t dictionaries[_DICTIONARY_COUNT] = {
+        [ DICTIONARY_REPOSITORIES ] = { STMT_FIND_REPOSITORY, STMT_CREATE_REPOSITORY, { 0 } },
+        [ DICTIONARY_NAMES ] = { STMT_FIND_NAME, STMT_CREATE_NAME, { 0 } },
+        [ DICTIONARY_ORIGINS ] = { STMT_FIND_ORIGIN, STMT_CREATE_ORIGIN, { 0 } },
+        [ DICTIONARY_VERSIONS ] = { STMT_FIND_VERSION, STMT_CREATE_VERSION, { 0 } },
+    };
+
+    ok = true;
+    for (i = 0; i < ARRAY_SIZE(dictionaries); i++) {
+        hashtable_init(&dictionaries[i].cache, lines_count, ascii_hash_cs, ascii_equal_cs, NULL, NULL, NULL);
+    }
+    for (i = 0; ok && i < lines_count; i++) {
+        ok = dictionary_resolve(db, &dictionaries[DICTIONARY_REPOSITORIES], lines[i].repo, &ids[i].repo, error)
+            && dictionary_resolve(db, &dictionaries[DICTIONARY_NAMES], lines[i].name, &ids[i].name, error)
+            && dictionary_resolve(db, &dictionaries[DICTIONARY_ORIGINS], lines[i].origin, &ids[i].origin, error)
+            && dictionary_resolve(db, &dictionaries[DICTIONARY_VERSIONS], lines[i].old_version, &ids[i].old_version, error)
+            && dictionary_resolve(db, &dictionaries[DICTIONARY_VERSIONS], lines[i].new_version, &ids[i].new_version, error)
+        ;
+    }
+    for (i = 0; i < ARRAY_SIZE(dictionaries); i++) {
+        hashtable_destroy(&dictionaries[i].cache);
+    }
+
+    return ok;
+}
+
+static bool history_db_insert_lines(sqlite_db_t *db, int command_id, const history_line_t *lines, const history_line_ids_t *ids, size_t lines_count, char **error)
+{
+    size_t i, b;
+    bool ok;
+
+    ok = true;
+    for (i = b = 0; ok && b < ARRAY_SIZE(line_batches); b++) {
+        sqlite_statement_t *stmt;
+
+        stmt = &history_statements[line_batches[b].statement];
+        while (ok && lines_count - i >= line_batches[b].rows) {
+            size_t row;
+
+            statement_reset(stmt);
+            for (row = 0; row < line_batches[b].rows; row++, i++) {
+                statement_bind_at(
+                    stmt, row * STR_LEN(LINE_INPUT_BINDS), STR_LEN(LINE_INPUT_BINDS),
+                    ids[i].repo, ids[i].name, ids[i].origin, ids[i].old_version, ids[i].new_version, lines[i].operation, command_id,
+                    lines[i].new_flatsize, lines[i].old_flatsize
+                );
+            }
+            ok = -1 != statement_fetch(db, stmt, error);
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * Inserts a command line, run at inserted_at, and its package operations
+ * (their strings already resolved by history_db_resolve_lines to ids) with
+ * the changes to their files, if tracked
+ *
+ * NOTE: has to be called inside a transaction
+ */
+bool history_db_insert_command(sqlite_db_t *db, time_t inserted_at, const char *command, const history_timings_t *timings, const history_line_t *lines, const history_line_ids_t *ids, size_t lines_count, char **error)
+{
+    history_timings_t unknown = HISTORY_TIMINGS_UNKNOWN;
+
+    if (NULL == timings) {
+        timings = &unknown;
+    }
+    statement_bind(&history_statements[STMT_CREATE_COMMAND], inserted_at, command, timings->started_at, timings->finished_at, timings->fetch_duration, (int) lines_count);
+    if (-1 == statement_fetch(db, &history_statements[STMT_CREATE_COMMAND], error)) {
+        return false;
+    }
+
+    if (!history_db_insert_lines(db, sqlite_last_insert_id(db), lines, ids, lines_count, error)) {
+        return false;
+    }
+    if (0 == lines_count) {
+        return true;
+    }
+
+    // the lines of the command were given consecutive identifiers, up to the last inserted one
+    return history_files_record(db, sqlite_last_insert_id(db) - (int) lines_count + 1, lines, ids, lines_count, error);
+}
+
+/**
+ * Records, in a single transaction, the command line and its package operations
+ */
+bool history_db_record(sqlite_db_t *db, const char *command, const history_timings_t *timings, const history_line_t *lines, size_t lines_count, char **error)
+{
+    bool ok;
+    history_line_ids_t *ids;
+
+    ok = false;
+    ids = NULL;
+    do {
+        if (NULL == (ids = malloc(sizeof(*ids) * MAX(lines_count, 1)))) {
+            set_malloc_error(error, sizeof(*ids) * MAX(lines_count, 1));
+            break;
+        }
+        if (!sqlite_transaction_begin(db, error)) {
+            break;
+        }
+        if (!history_db_resolve_lines(db, lines, lines_count, ids, error)) {
+            sqlite_transaction_rollback(db, NULL);
+            break;
+        }
+        if (!history_db_insert_command(db, time(NULL), command, timings, lines, ids, lines_count, error)) {
+            sqlite_transaction_rollback(db, NULL);
+            break;
+        }
+        if (!sqlite_transaction_commit(db, error)) {
+            break;
+        }
+        ok = true;
+    } while (false);
+    free(ids);
+
+    return ok;
+}
+
+/**
+ * Computes the bounds of the range of names which can match pattern as a
+ * glob: [prefix ; prefix + "\xFF"[ where prefix is the part of the pattern
+ * before its first special character (no valid UTF-8 string contains the
+ * byte 0xFF so it sorts after all the names starting with prefix)
+ */
+static bool glob_bounds(const char *pattern, char *lower, char *upper, const char * const bounds_end, char **error)
+{
+    size_t prefix_len;
+
+    prefix_len = strcspn(pattern, "*?[");
+    if (((size_t) (bounds_end - upper)) < prefix_len + STR_SIZE("\xFF")) {
+        set_generic_error(error, "pattern '%s' is too long", pattern);
+        return false;
+    }
+    memcpy(lower, pattern, prefix_len);
+    lower[prefix_len] = '\0';
+    memcpy(upper, pattern, prefix_len);
+    upper[prefix_len] = '\xFF';
+    upper[prefix_len + 1] = '\0';
+
+    return true;
+}
+
+/**
+ * Replaces the packages (names or patterns) searched by the STMT_SEARCH_*
+ * statements
+ */
+bool history_db_set_searched(sqlite_db_t *db, const char **patterns, size_t patterns_count, char **error)
+{
+    bool ok;
+    size_t i;
+
+    statement_reset(&history_statements[STMT_CLEAR_SEARCHED]);
+    ok = -1 != statement_fetch(db, &history_statements[STMT_CLEAR_SEARCHED], error);
+    for (i = 0; ok && i < patterns_count; i++) {
+        char lower[1024], upper[1024];
+
+        if (!(ok = glob_bounds(patterns[i], lower, upper, upper + STR_SIZE(upper), error))) {
+            break;
+        }
+        statement_bind(&history_statements[STMT_CREATE_SEARCHED], patterns[i], lower, upper);
+        ok = -1 != statement_fetch(db, &history_statements[STMT_CREATE_SEARCHED], error);
+    }
+
+    return ok;
+}
+
+/**
+ * Operators of a constraint on the versions, the longest first
+ */
+static const struct {
+    const char *operator;
+    size_t operator_len;
+    int statement;
+} version_operators[] = {
+    { "<=", STR_LEN("<="), STMT_MATCH_VERSIONS_LE },
+    { ">=", STR_LEN(">="), STMT_MATCH_VERSIONS_GE },
+    { "<", STR_LEN("<"), STMT_MATCH_VERSIONS_LT },
+    { ">", STR_LEN(">"), STMT_MATCH_VERSIONS_GT },
+    { "=", STR_LEN("="), STMT_MATCH_VERSIONS_EQ },
+};
+
+/**
+ * Sets the versions matched by the listings (see MATCHED_VERSIONS) to
+ * the ones satisfying constraint: an operator among <, <=, =, >= and >
+ * (= if none) followed by a version, compared as pkg does (3.0.9 < 3.0.12)
+ */
+bool history_db_set_versions(sqlite_db_t *db, const char *constraint, char **error)
+{
+    size_t i;
+    int statement;
+    const char *version;
+
+    version = constraint;
+    statement = STMT_MATCH_VERSIONS_EQ;
+    for (i = 0; i < ARRAY_SIZE(version_operators); i++) {
+        if (0 == strncmp(constraint, version_operators[i].operator, version_operators[i].operator_len)) {
+            version += version_operators[i].operator_len;
+            statement = version_operators[i].statement;
+            break;
+        }
+    }
+    while (' ' == *version) {
+        ++version;
+    }
+    if ('\0' == *version) {
+        set_generic_error(error, "no version given in the constraint '%s'", constraint);
+        return false;
+    }
+    statement_reset(&history_statements[STMT_CLEAR_MATCHED_VERSIONS]);
+    if (-1 == statement_fetch(db, &history_statements[STMT_CLEAR_MATCHED_VERSIONS], error)) {
+        return false;
+    }
+    statement_bind(&history_statements[statement], version);
+
+    return -1 != statement_fetch(db, &history_statements[statement], error);
+}
+
+/**
+ * Fetches the checkpoint given by statement (STMT_LAST_CHECKPOINT or
+ * STMT_CHECKPOINT_BEFORE, already bound), when there is none the
+ * position is before the first command
+ */
+static bool fetch_checkpoint(sqlite_db_t *db, int statement, history_checkpoint_t *checkpoint, char **error)
+{
+    int ret;
+
+    if (-1 == (ret = statement_fetch(db, &history_statements[statement], error, &checkpoint->id, &checkpoint->inserted_at, &checkpoint->command_id))) {
+        return false;
+    }
+    if (0 == ret) {
+        checkpoint->id = 0;
+        checkpoint->inserted_at = (time_t) -1;
+        checkpoint->command_id = -1;
+    }
+
+    return true;
+}
+
+/**
+ * Takes a checkpoint at the position of next (its id is set) from the
+ * previous one, last, by replaying the commands in between
+ */
+static bool create_checkpoint(sqlite_db_t *db, const history_checkpoint_t *last, history_checkpoint_t *next, char **error)
+{
+    statement_bind(&history_statements[STMT_CREATE_CHECKPOINT], next->inserted_at, next->command_id);
+    if (-1 == statement_fetch(db, &history_statements[STMT_CREATE_CHECKPOINT], error)) {
+        return false;
+    }
+    next->id = sqlite_last_insert_id(db);
+    statement_bind(&history_statements[STMT_CREATE_CHECKPOINT_PACKAGES], last->inserted_at, last->command_id, next->inserted_at, next->command_id, last->id, next->id);
+
+    return -1 != statement_fetch(db, &history_statements[STMT_CREATE_CHECKPOINT_PACKAGES], error);
+}
+
+/**
+ * Sets *boundary to the last command (the greatest position) to delete
+ * according to retention, *found to false if there is none
+ */
+static bool retention_boundary(sqlite_db_t *db, const history_retention_t *retention, history_cursor_t *boundary, bool *found, char **error)
+{
+    int ret;
+    history_cursor_t position;
+
+    *found = false;
+    if (retention->max_age > 0) {
+        statement_bind(&history_statements[STMT_RETENTION_BY_AGE], time(NULL) - ((time_t) retention->max_age) * 86400, RETENTION_BATCH_SIZE);
+        if (-1 == (ret = statement_fetch(db, &history_statements[STMT_RETENTION_BY_AGE], error, &position.inserted_at, &position.id))) {
+            return false;
+        }
+        if (1 == ret) {
+            *boundary = position;
+            *found = true;
+        }
+    }
+    if (retention->max_commands > 0) {
+        statement_bind(&history_statements[STMT_RETENTION_BY_COUNT], retention->max_commands - 1, RETENTION_BATCH_SIZE);
+        if (-1 == (ret = statement_fetch(db, &history_statements[STMT_RETENTION_BY_COUNT], error, &position.inserted_at, &position.id))) {
+            return false;
+        }
+        if (1 == ret && (!*found || position.inserted_at > boundary->inserted_at || (position.inserted_at == boundary->inserted_at && position.id > boundary->id))) {
+            *boundary = position;
+            *found = true;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Deletes, in a transaction, (at most RETENTION_BATCH_SIZE of) the commands
+ * out of the retention policy then releases some free pages.
+ *
+ * pkg history at replays the commands from a checkpoint, so the deletion
+ * always stops at one: the deletion is delayed to the closest preceding
+ * checkpoint if it follows the first command, the commands after it are
+ * deleted once the next (periodic) checkpoint is passed. Without a later
+ * checkpoint (they are disabled or the retention keeps less commands than
+ * the interval between two of them), one is taken at the last command to
+ * delete.
+ */
+bool history_db_apply_retention(sqlite_db_t *db, const history_retention_t *retention, char **error)
+{
+    bool ok;
+    int step;
+
+    ok = false;
+    do {
+        int ret;
+        bool found;
+        history_cursor_t boundary, first;
+        history_checkpoint_t before, last;
+
+        if (!sqlite_transaction_begin(db, error)) {
+            break;
+        }
+        if (!retention_boundary(db, retention, &boundary, &found, error)) {
+            sqlite_transaction_rollback(db, NULL);
+            break;
+        }
+        if (found) {
+            statement_reset(&history_statements[STMT_FIRST_COMMAND]);
+            if (-1 == (ret = statement_fetch(db, &history_statements[STMT_FIRST_COMMAND], error, &first.inserted_at, &first.id))) {
+                sqlite_transaction_rollback(db, NULL);
+                break;
+            }
+            statement_bind(&history_statements[STMT_CHECKPOINT_BEFORE], boundary.inserted_at, boundary.id);
+            if (!fetch_checkpoint(db, STMT_CHECKPOINT_BEFORE, &before, error)) {
+                sqlite_transaction_rollback(db, NULL);
+                break;
+            }
+            statement_reset(&history_statements[STMT_LAST_CHECKPOINT]);
+            if (!fetch_checkpoint(db, STMT_LAST_CHECKPOINT, &last, error)) {
+                sqlite_transaction_rollback(db, NULL);
+                break;
+            }
+            if (0 != before.id && (before.inserted_at > first.inserted_at || (before.inserted_at == first.inserted_at && before.command_id >= first.id))) {
+                // down to the closest checkpoint
+                boundary.inserted_at = before.inserted_at;
+                boundary.id = before.command_id;
+            } else if (last.id != before.id) {
+                // wait for the next checkpoint
+                found = false;
+            } else if (before.inserted_at != boundary.inserted_at || before.command_id != boundary.id) {
+                history_checkpoint_t next;
+
+                next.inserted_at = boundary.inserted_at;
+                next.command_id = boundary.id;
+                if (!create_checkpoint(db, &before, &next, error)) {
+                    sqlite_transaction_rollback(db, NULL);
+                    break;
+                }
+            }
+        }
+        if (found) {
+            statement_bind(&history_statements[STMT_RETENTION_DELETE], boundary.inserted_at, boundary.id);
+            if (-1 == statement_fetch(db, &history_statements[STMT_RETENTION_DELETE], error)) {
+                sqlite_transaction_rollback(db, NULL);
+                break;
+            }
+            statement_bind(&history_statements[STMT_RETENTION_CHECKPOINTS], boundary.inserted_at, boundary.id);
+            if (-1 == statement_fetch(db, &history_statements[STMT_RETENTION_CHECKPOINTS], error)) {
+                sqlite_transaction_rollback(db, NULL);
+                break;
+            }
+        }
+        if (!sqlite_transaction_commit(db, error)) {
+            break;
+        }
+        // step until the pages are released (at most INCREMENTAL_VACUUM_PAGES)
+        statement_reset(&history_statements[STMT_INCREMENTAL_VACUUM]);
+        do {
+            step = statement_fetch(db, &history_statements[STMT_INCREMENTAL_VACUUM], error);
+        } while (1 == step);
+        ok = -1 != step;
+    } while (false);
+
+    return ok;
+}
+
+/**
+ * Takes a checkpoint every interval commands after the last one, at most
+ * max_count (0 for no limit) of them: the hook catches up a little on each
+ * pkg operation after an upgrade of the plugin or an import
+ */
+bool history_db_create_checkpoints(sqlite_db_t *db, int interval, int max_count, char **error)
+{
+    bool ok;
+    int count;
+
+    assert(interval > 0);
+
+    ok = false;
+    do {
+        int ret;
+        history_checkpoint_t last, next;
+
+        ret = 0;
+        if (!sqlite_transaction_begin(db, error)) {
+            break;
+        }
+        statement_reset(&history_statements[STMT_LAST_CHECKPOINT]);
+        if (!fetch_checkpoint(db, STMT_LAST_CHECKPOINT, &last, error)) {
+            sqlite_transaction_rollback(db, NULL);
+            break;
+        }
+        for (count = 0; 0 == max_count || count < max_count; count++) {
+            statement_bind(&history_statements[STMT_NEXT_CHECKPOINT], last.inserted_at, last.command_id, interval);
+            if (-1 == (ret = statement_fetch(db, &history_statements[STMT_NEXT_CHECKPOINT], error, &next.inserted_at, &next.command_id))) {
+                break;
+            }
+            if (0 == ret) {
+                break;
+            }
+            if (!create_checkpoint(db, &last, &next, error)) {
+                ret = -1;
+                break;
+            }
+            last = next;
+        }
+        if (-1 == ret) {
+            sqlite_transaction_rollback(db, NULL);
+            break;
+        }
+        if (!sqlite_transaction_commit(db, error)) {
+            break;
+        }
+        ok = true;
+    } while (false);
+
+    return ok;
+}
+
+/**
+ * Sets it to iterate on the packages installed at time (name, version,
+ * origin and repository, sorted by name): from the closest checkpoint,
+ * if any, the lines recorded up to time are replayed
+ */
+bool history_db_installed_at(sqlite_db_t *db, time_t at, Iterator *it, const char **name, const char **version, const char **origin, const char **repo, char **error)
+{
+    history_checkpoint_t checkpoint;
+
+    statement_bind(&history_statements[STMT_CHECKPOINT_BEFORE], at, INT_MAX);
+    if (!fetch_checkpoint(db, STMT_CHECKPOINT_BEFORE, &checkpoint, error)) {
+        return false;
+    }
+    statement_bind(&history_statements[STMT_INSTALLED_AT], checkpoint.inserted_at, checkpoint.command_id, at, INT_MAX, checkpoint.id);
+    statement_to_iterator(it, &history_statements[STMT_INSTALLED_AT], name, version, origin, repo);
+
+    return true;
+}
+
+/**
+ * Drops the triggers which maintain the statistics on each insertion or
+ * deletion of a line, for a bulk insertion (in a transaction): the lines
+ * inserted until history_db_stats_resume have to be counted by
+ * history_db_stats_add
+ */
+bool history_db_stats_suspend(sqlite_db_t *db, char **error)
+{
+    return sqlite_exec(db, "DROP TRIGGER " TABLE_STATS_DAYS "_insert;\nDROP TRIGGER " TABLE_STATS_DAYS "_delete;", error);
+}
+
+/**
+ * Counts the lines l inserted while the triggers were suspended which
+ * match condition, an SQL expression
+ */
+bool history_db_stats_add(sqlite_db_t *db, const char *condition, char **error)
+{
+    return sqlite_execf(db, error, ADD_STATS_DAYS ADD_STATS_PACKAGES ADD_STATS_REPOSITORIES, condition, condition, condition);
+}
+
+bool history_db_stats_resume(sqlite_db_t *db, char **error)
+{
+    return sqlite_exec(db, CREATE_STATS_LINE_TRIGGERS, error);
+}
+
+/**
+ * Iterates on the hosts running the packages names (at version if not NULL)
+ */
+bool history_db_hosts_running(sqlite_db_t *db, const char **names, size_t names_count, const char *version, Iterator *it, const char **host, const char **name, const char **installed_version, time_t *since, char **error)
+{
+    if (!history_db_set_searched(db, names, names_count, error)) {
+        return false;
+    }
+    if (NULL != version && !history_db_set_versions(db, version, error)) {
+        return false;
+    }
+    statement_bind(&history_statements[STMT_HOSTS_RUNNING], NULL == version);
+    statement_to_iterator(it, &history_statements[STMT_HOSTS_RUNNING], host, name, installed_version, since);
+
+    return true;
+}
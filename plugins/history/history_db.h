@@ -0,0 +1,302 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <pkg.h>
+
+#include "sqlite/sqlite.h"
+
+#define STRINGIFY(s) #s
+#define STRINGIFY_EXPAND(s) STRINGIFY(s)
+
+#define TABLE_COMMANDS "history_commands"
+#define TABLE_PACKAGES "history_lines"
+#define TABLE_OPERATIONS "history_operations"
+#define TABLE_REPOSITORIES "history_repositories"
+#define TABLE_NAMES "history_names"
+#define TABLE_ORIGINS "history_origins"
+#define TABLE_VERSIONS "history_versions"
+#define TABLE_HOSTS "history_hosts"
+#define TABLE_COMMANDS_FTS TABLE_COMMANDS "_fts"
+#define TABLE_NAMES_FTS TABLE_NAMES "_fts"
+#define TABLE_ORIGINS_FTS TABLE_ORIGINS "_fts"
+// NOTE: replaced by TABLE_NAMES_FTS and TABLE_ORIGINS_FTS in 0.9.4
+#define TABLE_PACKAGES_FTS TABLE_PACKAGES "_fts"
+#define TABLE_STATS_DAYS "history_stats_days"
+#define TABLE_STATS_PACKAGES "history_stats_packages"
+#define TABLE_STATS_REPOSITORIES "history_stats_repositories"
+#define TABLE_CHECKPOINTS "history_checkpoints"
+#define TABLE_CHECKPOINT_PACKAGES "history_checkpoint_packages"
+#define TABLE_FILES "history_files"
+#define TABLE_DIRECTORIES "history_directories"
+#define TABLE_PATHS "history_paths"
+#define TABLE_PATH_LINES "history_path_lines"
+#define TABLE_LAST_FILES "history_last_files"
+#define TABLE_SPOOL "history_spool"
+
+/**
+ * Wall-clock duration, in milliseconds, of a command (the expression of
+ * the index on it)
+ */
+#define COMMAND_DURATION "finished_at - started_at"
+
+/**
+ * Temporary table (private to the connection) holding the searched
+ * packages, see history_db_set_searched. lower and upper bound the index
+ * range of the names matching pattern as a glob.
+ */
+#define TABLE_SEARCHED "history_searched"
+#define CREATE_TABLE_SEARCHED \
+    "CREATE TEMP TABLE " TABLE_SEARCHED "(\n" \
+    "    pattern TEXT NOT NULL PRIMARY KEY,\n" \
+    "    lower TEXT NOT NULL,\n" \
+    "    upper TEXT NOT NULL\n" \
+    ");"
+
+/**
+ * Temporary table (private to the connection) holding the identifiers of
+ * the versions matching the constraint (< 3.0.12) given to
+ * history_db_set_versions
+ */
+#define TABLE_MATCHED_VERSIONS "history_matched_versions"
+#define CREATE_TABLE_MATCHED_VERSIONS \
+    "CREATE TEMP TABLE " TABLE_MATCHED_VERSIONS "(\n" \
+    "    version_id INTEGER NOT NULL PRIMARY KEY\n" \
+    ");"
+
+/**
+ * Temporary table (private to the connection) holding the lines read from
+ * the histories of the jails, by history_jails_collect, with the index of
+ * the jail they come from
+ */
+#define TABLE_JAIL_LINES "history_jail_lines"
+#define JAIL_LINES_COLUMNS \
+    "jail_id, command_id, inserted_at, command, line_id, name, origin, repo, old_version, new_version, operation_id"
+#define CREATE_TABLE_JAIL_LINES \
+    "CREATE TEMP TABLE " TABLE_JAIL_LINES "(\n" \
+    "    jail_id INT NOT NULL,\n" \
+    "    command_id INT NOT NULL,\n" \
+    "    inserted_at INT NOT NULL,\n" \
+    "    command TEXT NOT NULL,\n" \
+    "    line_id INT NOT NULL,\n" \
+    "    name TEXT,\n" \
+    "    origin TEXT,\n" \
+    "    repo TEXT,\n" \
+    "    old_version TEXT,\n" \
+    "    new_version TEXT,\n" \
+    "    operation_id INT NOT NULL\n" \
+    ");"
+
+/**
+ * Temporary table (private to the connection) holding the paths added or
+ * removed by the lines being recorded, indexed at once by
+ * history_files_record
+ */
+#define TABLE_CHANGED_PATHS "history_changed_paths"
+#define CREATE_TABLE_CHANGED_PATHS \
+    "CREATE TEMP TABLE " TABLE_CHANGED_PATHS "(\n" \
+    "    line_id INT NOT NULL,\n" \
+    "    directory TEXT NOT NULL,\n" \
+    "    name TEXT NOT NULL\n" \
+    ");"
+
+#if 0
+enum {
+    PKG_SHIFT_OP_INSTALL,
+    PKG_SHIFT_OP_DEINSTALL,
+    PKG_SHIFT_OP_UPGRADE,
+};
+#else
+// can't expand PKG_OP_INSTALL to 1<<0 with an enum
+# define PKG_SHIFT_OP_INSTALL 0
+# define PKG_SHIFT_OP_DEINSTALL 1
+# define PKG_SHIFT_OP_UPGRADE 2
+#endif
+
+#define PKG_OP_INSTALL   (1<<PKG_SHIFT_OP_INSTALL)
+#define PKG_OP_DEINSTALL (1<<PKG_SHIFT_OP_DEINSTALL)
+#define PKG_OP_UPGRADE   (1<<PKG_SHIFT_OP_UPGRADE)
+#define PKG_OP_REMOVE    PKG_OP_DEINSTALL
+#define PKG_OP_ALL       (PKG_OP_INSTALL | PKG_OP_DEINSTALL | PKG_OP_UPGRADE)
+
+/**
+ * Listing statements come by pair: the rows older than a cursor then the rows
+ * newer than it (see STMT_BEFORE)
+ */
+#define KEYSET_STMTS(name) \
+    name, name ## _BEFORE
+
+#define STMT_BEFORE(statement) \
+    ((statement) + 1)
+
+enum {
+    STMT_CREATE_COMMAND,
+    STMT_CREATE_LINE,
+    STMT_CREATE_LINES_8,
+    STMT_CREATE_LINES_64,
+    STMT_FIND_REPOSITORY,
+    STMT_CREATE_REPOSITORY,
+    STMT_FIND_NAME,
+    STMT_CREATE_NAME,
+    STMT_FIND_ORIGIN,
+    STMT_CREATE_ORIGIN,
+    STMT_FIND_VERSION,
+    STMT_CREATE_VERSION,
+    STMT_CLEAR_SEARCHED,
+    STMT_CREATE_SEARCHED,
+    STMT_CLEAR_MATCHED_VERSIONS,
+    STMT_MATCH_VERSIONS_LT,
+    STMT_MATCH_VERSIONS_LE,
+    STMT_MATCH_VERSIONS_EQ,
+    STMT_MATCH_VERSIONS_GE,
+    STMT_MATCH_VERSIONS_GT,
+    KEYSET_STMTS(STMT_LIST_LINE),
+    STMT_LIST_JAIL_LINES,
+    STMT_LAST_LINE,
+    STMT_FOLLOW_LINE,
+    KEYSET_STMTS(STMT_SEARCH_LINE_EXACT),
+    KEYSET_STMTS(STMT_SEARCH_LINE_EXACT_CI),
+    KEYSET_STMTS(STMT_SEARCH_LINE_GLOB),
+#ifdef WITH_FTS
+    KEYSET_STMTS(STMT_SEARCH_LINE_SUBSTRING),
+#endif /* WITH_FTS */
+#ifdef WITH_REGEX
+    KEYSET_STMTS(STMT_SEARCH_LINE_REGEX),
+#endif /* WITH_REGEX */
+    STMT_STATS_BY_DAY,
+    STMT_STATS_BY_WEEK,
+    STMT_STATS_BY_MONTH,
+    STMT_SLOWEST_COMMANDS,
+    STMT_GROWTH_BY_PACKAGE,
+    STMT_GROWTH_BY_COMMAND,
+    STMT_STATS_TOP_PACKAGES,
+    STMT_STATS_REPOSITORIES,
+    STMT_RETENTION_BY_AGE,
+    STMT_RETENTION_BY_COUNT,
+    STMT_RETENTION_DELETE,
+    STMT_RETENTION_CHECKPOINTS,
+    STMT_INCREMENTAL_VACUUM,
+    STMT_OLDEST_COMMAND,
+    STMT_FIRST_COMMAND,
+    STMT_LAST_CHECKPOINT,
+    STMT_CHECKPOINT_BEFORE,
+    STMT_NEXT_CHECKPOINT,
+    STMT_CREATE_CHECKPOINT,
+    STMT_CREATE_CHECKPOINT_PACKAGES,
+    STMT_INSTALLED_AT,
+    STMT_HOSTS_RUNNING,
+    STMT_FILES_OF_NAME,
+    STMT_LAST_FILES_OF_NAME,
+    STMT_SET_LAST_FILES,
+    STMT_CREATE_FILES,
+    STMT_CREATE_CHANGED_PATH,
+    STMT_CREATE_CHANGED_DIRECTORIES,
+    STMT_CREATE_CHANGED_PATHS,
+    STMT_CREATE_PATH_LINES,
+    STMT_CLEAR_CHANGED_PATHS,
+    STMT_WHICH,
+    STMT_WHICH_PREFIX,
+    STMT_SPOOL_FOLDED,
+    STMT_SPOOL_SET_FOLDED,
+    STMT_SPOOL_CLEAR,
+    STMT_COUNT,
+};
+
+/**
+ * Position, in the listings, of a row: (inserted_at, id) of the last row of a
+ * page to get the next one or of the first row to get the previous one
+ */
+typedef struct {
+    time_t inserted_at;
+    int id;
+} history_cursor_t;
+
+/**
+ * A package operation to record, the strings are not copied, they are
+ * expected to live (at least) until the end of history_db_record
+ */
+typedef struct {
+    int operation;
+    const char *repo;
+    const char *name;
+    const char *origin;
+    const char *old_version;
+    const char *new_version;
+    /**
+     * the installed (flat) sizes, in bytes, of the packages of new_version
+     * (the removed one for a deletion) and old_version, -1 if unknown
+     */
+    int64_t new_flatsize;
+    int64_t old_flatsize;
+    /**
+     * the files of the package after the operation (none for a deletion),
+     * NULL if they are not tracked (see history_files.c)
+     */
+    const char * const *files;
+    size_t files_count;
+} history_line_t;
+
+/**
+ * The identifiers, in the dictionary tables, of the strings of a
+ * history_line_t (0 for a NULL repo or old_version)
+ */
+typedef struct {
+    int repo;
+    int name;
+    int origin;
+    int old_version;
+    int new_version;
+} history_line_ids_t;
+
+/**
+ * When a command ran, as UNIX timestamps in milliseconds (0 if unknown),
+ * and the time it spent fetching packages (-1 if nothing was fetched)
+ */
+typedef struct {
+    int64_t started_at;
+    int64_t finished_at;
+    int64_t fetch_duration;
+} history_timings_t;
+
+#define HISTORY_TIMINGS_UNKNOWN \
+    { .started_at = 0, .finished_at = 0, .fetch_duration = -1 }
+
+/**
+ * Retention policy: the commands (with their lines) older than max_age
+ * days or beyond the max_commands most recent ones are deleted (0 for no
+ * limit)
+ */
+typedef struct {
+    int max_age;
+    int max_commands;
+} history_retention_t;
+
+/**
+ * Position of a checkpoint: the installed packages after the command
+ * (inserted_at, command_id) and all the previous ones
+ */
+typedef struct {
+    int id;
+    time_t inserted_at;
+    int command_id;
+} history_checkpoint_t;
+
+extern sqlite_statement_t history_statements[STMT_COUNT];
+
+pkg_error_t history_db_open(const char *, int, const sqlite_open_options_t *, sqlite_db_t **, char **);
+void history_db_close(sqlite_db_t *);
+
+bool history_db_resolve_lines(sqlite_db_t *, const history_line_t *, size_t, history_line_ids_t *, char **);
+bool history_db_insert_command(sqlite_db_t *, time_t, const char *, const history_timings_t *, const history_line_t *, const history_line_ids_t *, size_t, char **);
+bool history_db_record(sqlite_db_t *, const char *, const history_timings_t *, const history_line_t *, size_t, char **);
+bool history_db_set_searched(sqlite_db_t *, const char **, size_t, char **);
+bool history_db_set_versions(sqlite_db_t *, const char *, char **);
+bool history_db_apply_retention(sqlite_db_t *, const history_retention_t *, char **);
+bool history_db_create_checkpoints(sqlite_db_t *, int, int, char **);
+bool history_db_stats_suspend(sqlite_db_t *, char **);
+bool history_db_stats_add(sqlite_db_t *, const char *, char **);
+bool history_db_stats_resume(sqlite_db_t *, char **);
+bool history_db_installed_at(sqlite_db_t *, time_t, Iterator *, const char **, const char **, const char **, const char **, char **);
+bool history_db_hosts_running(sqlite_db_t *, const char **, size_t, const char *, Iterator *, const char **, const char **, const char **, time_t *, char **);
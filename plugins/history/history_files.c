@@ -0,0 +1,693 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "error/error.h"
+#include "history_db.h"
+#include "history_files.h"
+
+/**
+ * Tracking of the files of the packages: for each line, the paths added
+ * and removed by the operation, relative to the previous list of files of
+ * the package, are stored in TABLE_FILES as a blob:
+ * - varint count of added paths
+ * - varint count of removed paths
+ * - the added paths then the removed ones, each sorted and front coded:
+ *   varint length of the prefix shared with the previous path of the same
+ *   section, varint length of the rest of the path, the rest of the path
+ * where a varint is an unsigned LEB128. An upgrade usually changes a few
+ * versioned paths (a shared library, the directories of a python module):
+ * it costs a few bytes, and the paths, sharing long prefixes, take little
+ * more than their distinct suffixes. The blobs are only front coded, not
+ * compressed.
+ *
+ * The last list of files of each package is kept whole, in the same
+ * format (all its paths as added), in TABLE_LAST_FILES: the hook reads
+ * and, if it changed, rewrites a single row per package instead of
+ * replaying all of its changes.
+ *
+ * Each changed path is indexed (TABLE_PATH_LINES) for history_files_which
+ * to find the lines which added or removed it without decoding the other
+ * ones.
+ *
+ * NOTE:
+ * - a line without change has no row in TABLE_FILES
+ * - the first line of a package recorded with its files (installation of
+ *   the plugin) has all of them as added
+ * - the last list of a package recorded before 0.9.11 is rebuilt once, by
+ *   replaying its changes, on its next operation. If its oldest lines were
+ *   deleted by the retention policy, the files it never changed since are
+ *   missing from this list: its next line has them as added again
+ * - only the lines of the local host (not merged) are recorded
+ */
+
+#define VARINT_MAX_SIZE 10
+
+typedef struct {
+    unsigned char *data;
+    size_t size, allocated;
+} files_buffer_t;
+
+/**
+ * A sorted list of paths, which owns them or not
+ */
+typedef struct {
+    const char **paths;
+    size_t count, allocated;
+    bool owned;
+} files_list_t;
+
+static void files_list_init(files_list_t *list, bool owned)
+{
+    list->paths = NULL;
+    list->count = list->allocated = 0;
+    list->owned = owned;
+}
+
+static void files_list_clear(files_list_t *list)
+{
+    if (list->owned) {
+        size_t i;
+
+        for (i = 0; i < list->count; i++) {
+            free((void *) list->paths[i]);
+        }
+    }
+    list->count = 0;
+}
+
+static void files_list_free(files_list_t *list)
+{
+    files_list_clear(list);
+    free(list->paths);
+    list->paths = NULL;
+    list->allocated = 0;
+}
+
+static bool files_list_reserve(files_list_t *list, size_t count, char **error)
+{
+    if (count > list->allocated) {
+        size_t allocated;
+        const char **paths;
+
+        allocated = MAX(count, list->allocated * 2);
+        if (NULL == (paths = realloc(list->paths, sizeof(*paths) * allocated))) {
+            set_malloc_error(error, sizeof(*paths) * allocated);
+            return false;
+        }
+        list->paths = paths;
+        list->allocated = allocated;
+    }
+
+    return true;
+}
+
+/**
+ * Appends path (copied if list owns its paths)
+ */
+static bool files_list_append(files_list_t *list, const char *path, size_t path_len, char **error)
+{
+    if (!files_list_reserve(list, list->count + 1, error)) {
+        return false;
+    }
+    if (list->owned) {
+        char *copy;
+
+        if (NULL == (copy = malloc(path_len + 1))) {
+            set_malloc_error(error, path_len + 1);
+            return false;
+        }
+        memcpy(copy, path, path_len);
+        copy[path_len] = '\0';
+        path = copy;
+    }
+    list->paths[list->count++] = path;
+
+    return true;
+}
+
+static int path_cmp(const void *a, const void *b)
+{
+    return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+static bool buffer_reserve(files_buffer_t *buffer, size_t size, char **error)
+{
+    if (buffer->size + size > buffer->allocated) {
+        size_t allocated;
+        unsigned char *data;
+
+        allocated = MAX(buffer->size + size, buffer->allocated * 2);
+        if (NULL == (data = realloc(buffer->data, allocated))) {
+            set_malloc_error(error, allocated);
+            return false;
+        }
+        buffer->data = data;
+        buffer->allocated = allocated;
+    }
+
+    return true;
+}
+
+static void buffer_append_varint(files_buffer_t *buffer, size_t value)
+{
+    do {
+        unsigned char byte;
+
+        byte = value & 0x7F;
+        value >>= 7;
+        buffer->data[buffer->size++] = byte | (0 == value ? 0 : 0x80);
+    } while (0 != value);
+}
+
+static bool read_varint(const unsigned char **r, const unsigned char *end, size_t *value)
+{
+    int shift;
+
+    *value = 0;
+    for (shift = 0; *r < end && shift < 64; shift += 7) {
+        unsigned char byte;
+
+        byte = *(*r)++;
+        *value |= ((size_t) (byte & 0x7F)) << shift;
+        if (0 == (byte & 0x80)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Appends to buffer a section of paths (sorted), front coded
+ */
+static bool encode_paths(files_buffer_t *buffer, const char * const *paths, size_t count, char **error)
+{
+    size_t i;
+    const char *previous;
+
+    previous = "";
+    for (i = 0; i < count; i++) {
+        size_t prefix_len, suffix_len;
+
+        for (prefix_len = 0; '\0' != previous[prefix_len] && previous[prefix_len] == paths[i][prefix_len]; prefix_len++)
+            ;
+        suffix_len = strlen(paths[i] + prefix_len);
+        if (!buffer_reserve(buffer, 2 * VARINT_MAX_SIZE + suffix_len, error)) {
+            return false;
+        }
+        buffer_append_varint(buffer, prefix_len);
+        buffer_append_varint(buffer, suffix_len);
+        memcpy(buffer->data + buffer->size, paths[i] + prefix_len, suffix_len);
+        buffer->size += suffix_len;
+        previous = paths[i];
+    }
+
+    return true;
+}
+
+/**
+ * Calls visitor on each path of blob, the added ones then the removed
+ * ones, with a NUL terminated copy of it (which doesn't outlive the call).
+ * Returns false if the blob is malformed or visitor returned false.
+ */
+static bool files_decode(const sqlite_blob_t *blob, bool (*visitor)(void *, const char *, size_t, bool), void *data)
+{
+    bool ok;
+    int section;
+    char *path;
+    size_t counts[2], path_size;
+    const unsigned char *r, *end;
+
+    r = (const unsigned char *) blob->data;
+    end = r + blob->size;
+    if (NULL == r || !read_varint(&r, end, &counts[0]) || !read_varint(&r, end, &counts[1])) {
+        return false;
+    }
+    ok = true;
+    path = NULL;
+    path_size = 0;
+    for (section = 0; ok && section < 2; section++) {
+        size_t i, path_len;
+
+        path_len = 0;
+        for (i = 0; ok && i < counts[section]; i++) {
+            size_t prefix_len, suffix_len;
+
+            if (!(ok = read_varint(&r, end, &prefix_len) && read_varint(&r, end, &suffix_len))) {
+                break;
+            }
+            if (!(ok = prefix_len <= path_len && suffix_len <= (size_t) (end - r))) {
+                break;
+            }
+            if (prefix_len + suffix_len + 1 > path_size) {
+                char *tmp;
+
+                path_size = MAX(prefix_len + suffix_len + 1, 2 * path_size);
+                if (!(ok = NULL != (tmp = realloc(path, path_size)))) {
+                    break;
+                }
+                path = tmp;
+            }
+            memcpy(path + prefix_len, r, suffix_len);
+            r += suffix_len;
+            path_len = prefix_len + suffix_len;
+            path[path_len] = '\0';
+            ok = visitor(data, path, path_len, 0 == section);
+        }
+    }
+    free(path);
+
+    return ok && r == end;
+}
+
+/**
+ * The changes of a line being replayed, see files_replay
+ */
+typedef struct {
+    files_list_t added, removed;
+    char **error;
+} files_delta_t;
+
+static bool delta_visitor(void *data, const char *path, size_t path_len, bool added)
+{
+    files_delta_t *delta;
+
+    delta = (files_delta_t *) data;
+
+    return files_list_append(added ? &delta->added : &delta->removed, path, path_len, delta->error);
+}
+
+/**
+ * Applies delta to current (both sorted): current = (current - removed) + added
+ */
+static bool files_apply(files_list_t *current, files_delta_t *delta, char **error)
+{
+    size_t i, a, r;
+    files_list_t next;
+
+    files_list_init(&next, true);
+    if (!files_list_reserve(&next, current->count + delta->added.count, error)) {
+        return false;
+    }
+    for (i = a = r = 0; i < current->count || a < delta->added.count; ) {
+        int cmp;
+
+        if (i == current->count) {
+            cmp = 1;
+        } else if (a == delta->added.count) {
+            cmp = -1;
+        } else {
+            cmp = strcmp(current->paths[i], delta->added.paths[a]);
+        }
+        if (cmp > 0) {
+            // moved from the delta to the list
+            next.paths[next.count++] = delta->added.paths[a];
+            delta->added.paths[a++] = NULL;
+            continue;
+        }
+        while (r < delta->removed.count && strcmp(delta->removed.paths[r], current->paths[i]) < 0) {
+            ++r;
+        }
+        if (0 == cmp || (r < delta->removed.count && 0 == strcmp(delta->removed.paths[r], current->paths[i]))) {
+            free((void *) current->paths[i++]);
+        } else {
+            next.paths[next.count++] = current->paths[i++];
+        }
+    }
+    // the paths were moved to next or freed
+    current->count = 0;
+    files_list_free(current);
+    *current = next;
+
+    return true;
+}
+
+/**
+ * Rebuilds, into current, the last list of files of the package name_id
+ * from its recorded changes
+ */
+static bool files_replay(sqlite_db_t *db, int name_id, files_list_t *current, char **error)
+{
+    int ret;
+    bool ok;
+    sqlite_blob_t blob;
+    files_delta_t delta;
+
+    ret = 0;
+    ok = true;
+    files_list_clear(current);
+    files_list_init(&delta.added, true);
+    files_list_init(&delta.removed, true);
+    delta.error = error;
+    statement_bind(&history_statements[STMT_FILES_OF_NAME], name_id);
+    while (ok && 1 == (ret = statement_fetch(db, &history_statements[STMT_FILES_OF_NAME], error, &blob))) {
+        files_list_clear(&delta.added);
+        files_list_clear(&delta.removed);
+        if (!files_decode(&blob, delta_visitor, &delta)) {
+            if (NULL == *error) {
+                set_generic_error(error, "the changes to the files of a package are corrupted");
+            }
+            ok = false;
+            break;
+        }
+        ok = files_apply(current, &delta, error);
+    }
+    files_list_free(&delta.added);
+    files_list_free(&delta.removed);
+
+    return ok && -1 != ret;
+}
+
+typedef struct {
+    files_list_t *list;
+    char **error;
+} files_load_t;
+
+static bool load_visitor(void *data, const char *path, size_t path_len, bool UNUSED(added))
+{
+    files_load_t *load;
+
+    load = (files_load_t *) data;
+
+    return files_list_append(load->list, path, path_len, load->error);
+}
+
+/**
+ * Loads, into current, the last list of files of the package name_id.
+ * stored is set to false if it isn't stored (recorded before 0.9.11): it
+ * is rebuilt from the changes of the package.
+ */
+static bool files_last(sqlite_db_t *db, int name_id, files_list_t *current, bool *stored, char **error)
+{
+    int ret;
+    files_load_t load;
+    sqlite_blob_t blob;
+
+    files_list_clear(current);
+    statement_bind(&history_statements[STMT_LAST_FILES_OF_NAME], name_id);
+    if (-1 == (ret = statement_fetch(db, &history_statements[STMT_LAST_FILES_OF_NAME], error, &blob))) {
+        return false;
+    }
+    if (!(*stored = 1 == ret)) {
+        return files_replay(db, name_id, current, error);
+    }
+    load.list = current;
+    load.error = error;
+    // the paths are copied: the blob doesn't outlive the reset
+    ret = files_decode(&blob, load_visitor, &load);
+    statement_reset(&history_statements[STMT_LAST_FILES_OF_NAME]);
+    if (!ret) {
+        if (NULL == *error) {
+            set_generic_error(error, "the files of a package are corrupted");
+        }
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Writes into buffer a blob of the changes (added and removed, both
+ * sorted)
+ */
+static bool files_encode(files_buffer_t *buffer, const files_list_t *added, const files_list_t *removed, char **error)
+{
+    buffer->size = 0;
+    if (!buffer_reserve(buffer, 2 * VARINT_MAX_SIZE, error)) {
+        return false;
+    }
+    buffer_append_varint(buffer, added->count);
+    buffer_append_varint(buffer, removed->count);
+
+    return encode_paths(buffer, added->paths, added->count, error) && encode_paths(buffer, removed->paths, removed->count, error);
+}
+
+/**
+ * Inserts into TABLE_CHANGED_PATHS the paths of the line line_id
+ */
+static bool insert_changed_paths(sqlite_db_t *db, int line_id, const char * const *paths, size_t count, char **error)
+{
+    size_t i;
+    char *directory;
+    size_t directory_size;
+
+    directory = NULL;
+    directory_size = 0;
+    for (i = 0; i < count; i++) {
+        const char *name;
+        size_t directory_len;
+
+        // the directory keeps its trailing slash: the paths under "/usr/local/lib/" are the directories starting with it
+        name = strrchr(paths[i], '/');
+        name = NULL == name ? paths[i] : name + 1;
+        directory_len = name - paths[i];
+        if (directory_len + 1 > directory_size) {
+            char *tmp;
+
+            directory_size = MAX(directory_len + 1, 2 * directory_size);
+            if (NULL == (tmp = realloc(directory, directory_size))) {
+                set_malloc_error(error, directory_size);
+                free(directory);
+                return false;
+            }
+            directory = tmp;
+        }
+        memcpy(directory, paths[i], directory_len);
+        directory[directory_len] = '\0';
+        statement_bind(&history_statements[STMT_CREATE_CHANGED_PATH], line_id, directory, name);
+        if (-1 == statement_fetch(db, &history_statements[STMT_CREATE_CHANGED_PATH], error)) {
+            free(directory);
+            return false;
+        }
+    }
+    free(directory);
+
+    return true;
+}
+
+/**
+ * Computes the changes between previous and next (both sorted), into
+ * added (the paths of next missing from previous) and removed (the paths
+ * of previous missing from next)
+ */
+static bool files_diff(const files_list_t *previous, const files_list_t *next, files_list_t *added, files_list_t *removed, char **error)
+{
+    size_t p, n;
+
+    for (p = n = 0; p < previous->count || n < next->count; ) {
+        int cmp;
+
+        if (p == previous->count) {
+            cmp = 1;
+        } else if (n == next->count) {
+            cmp = -1;
+        } else {
+            cmp = strcmp(previous->paths[p], next->paths[n]);
+        }
+        if (cmp < 0) {
+            if (!files_list_append(removed, previous->paths[p], 0, error)) {
+                return false;
+            }
+            ++p;
+        } else if (cmp > 0) {
+            if (!files_list_append(added, next->paths[n], 0, error)) {
+                return false;
+            }
+            ++n;
+        } else {
+            ++p;
+            ++n;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Records the changes to the files of the lines (whose files are tracked)
+ * of a command, the first of them being line first_line_id and the next
+ * ones following it
+ *
+ * NOTE: has to be called inside a transaction, after the lines are inserted
+ */
+bool history_files_record(sqlite_db_t *db, int first_line_id, const history_line_t *lines, const history_line_ids_t *ids, size_t lines_count, char **error)
+{
+    bool ok, changed;
+    size_t i;
+    files_buffer_t buffer;
+    files_list_t previous, next, added, removed, none;
+
+    ok = true;
+    changed = false;
+    buffer.data = NULL;
+    buffer.size = buffer.allocated = 0;
+    files_list_init(&none, false);
+    files_list_init(&previous, true);
+    files_list_init(&next, false);
+    files_list_init(&added, false);
+    files_list_init(&removed, false);
+    for (i = 0; ok && i < lines_count; i++) {
+        size_t j;
+        int line_id;
+        bool stored;
+        sqlite_blob_t blob;
+
+        if (NULL == lines[i].files) {
+            continue;
+        }
+        line_id = first_line_id + (int) i;
+        if (!(ok = files_last(db, ids[i].name, &previous, &stored, error))) {
+            break;
+        }
+        files_list_clear(&next);
+        if (!(ok = files_list_reserve(&next, lines[i].files_count, error))) {
+            break;
+        }
+        memcpy(next.paths, lines[i].files, sizeof(*next.paths) * lines[i].files_count);
+        qsort(next.paths, lines[i].files_count, sizeof(*next.paths), path_cmp);
+        // without duplicates
+        for (j = next.count = 0; j < lines[i].files_count; j++) {
+            if (0 == next.count || 0 != strcmp(next.paths[next.count - 1], next.paths[j])) {
+                next.paths[next.count++] = next.paths[j];
+            }
+        }
+        files_list_clear(&added);
+        files_list_clear(&removed);
+        if (!(ok = files_diff(&previous, &next, &added, &removed, error))) {
+            break;
+        }
+        if (0 == added.count && 0 == removed.count) {
+            if (stored) {
+                continue;
+            }
+        } else {
+            if (!(ok = files_encode(&buffer, &added, &removed, error))) {
+                break;
+            }
+            blob.data = buffer.data;
+            blob.size = buffer.size;
+            statement_bind(&history_statements[STMT_CREATE_FILES], line_id, (int) added.count, (int) removed.count, &blob);
+            if (!(ok = -1 != statement_fetch(db, &history_statements[STMT_CREATE_FILES], error))) {
+                break;
+            }
+            if (!(ok = insert_changed_paths(db, line_id, added.paths, added.count, error) && insert_changed_paths(db, line_id, removed.paths, removed.count, error))) {
+                break;
+            }
+            changed = true;
+        }
+        // the new last list: the whole list as added
+        if (!(ok = files_encode(&buffer, &next, &none, error))) {
+            break;
+        }
+        blob.data = buffer.data;
+        blob.size = buffer.size;
+        statement_bind(&history_statements[STMT_SET_LAST_FILES], ids[i].name, &blob);
+        ok = -1 != statement_fetch(db, &history_statements[STMT_SET_LAST_FILES], error);
+    }
+    if (ok && changed) {
+        static const int statements[] = {
+            STMT_CREATE_CHANGED_DIRECTORIES,
+            STMT_CREATE_CHANGED_PATHS,
+            STMT_CREATE_PATH_LINES,
+        };
+
+        for (i = 0; ok && i < ARRAY_SIZE(statements); i++) {
+            statement_reset(&history_statements[statements[i]]);
+            ok = -1 != statement_fetch(db, &history_statements[statements[i]], error);
+        }
+    }
+    // on error, the rollback of the transaction empties it
+    if (ok && changed) {
+        statement_reset(&history_statements[STMT_CLEAR_CHANGED_PATHS]);
+        ok = -1 != statement_fetch(db, &history_statements[STMT_CLEAR_CHANGED_PATHS], error);
+    }
+    files_list_free(&previous);
+    files_list_free(&next);
+    files_list_free(&added);
+    files_list_free(&removed);
+    free(buffer.data);
+
+    return ok;
+}
+
+/**
+ * Sets it to iterate on the lines which added or removed path, oldest
+ * first: their date, command line, package (name and versions), the path
+ * and the changes of the line (see history_files_find). A path ending with
+ * a slash is a directory: the lines which changed a path under it.
+ */
+bool history_files_which(sqlite_db_t *UNUSED(db), const char *path, Iterator *it, time_t *inserted_at, const char **command, const char **name, const char **old_version, const char **new_version, const char **changed_path, sqlite_blob_t *files, char **error)
+{
+    int statement;
+    char *directory;
+    const char *basename;
+    size_t directory_len;
+
+    if ('\0' == *path) {
+        set_generic_error(error, "an empty path was given");
+        return false;
+    }
+    basename = strrchr(path, '/');
+    basename = NULL == basename ? path : basename + 1;
+    directory_len = basename - path;
+    if (NULL == (directory = malloc(directory_len + STR_SIZE("\xFF")))) {
+        set_malloc_error(error, directory_len + STR_SIZE("\xFF"));
+        return false;
+    }
+    memcpy(directory, path, directory_len);
+    if ('\0' == *basename) {
+        // as glob_bounds: no valid UTF-8 string contains the byte 0xFF, the directories under path are in [path ; path + "\xFF"[
+        directory[directory_len] = '\xFF';
+        directory[directory_len + 1] = '\0';
+        statement = STMT_WHICH_PREFIX;
+        statement_bind(&history_statements[statement], path, directory);
+    } else {
+        directory[directory_len] = '\0';
+        statement = STMT_WHICH;
+        statement_bind(&history_statements[statement], directory, basename);
+    }
+    // the strings are copied by sqlite when bound
+    free(directory);
+    statement_to_iterator(it, &history_statements[statement], inserted_at, command, name, old_version, new_version, changed_path, files);
+
+    return true;
+}
+
+typedef struct {
+    const char *path;
+    bool found, added;
+} files_search_t;
+
+static bool search_visitor(void *data, const char *path, size_t UNUSED(path_len), bool added)
+{
+    files_search_t *search;
+
+    search = (files_search_t *) data;
+    if (0 == strcmp(path, search->path)) {
+        search->found = true;
+        search->added = added;
+        // stop there
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Looks for path in the changes to the files of a line: sets added to true if
+ * it was added, false if it was removed. Returns false if path is not
+ * part of them.
+ */
+bool history_files_find(const sqlite_blob_t *files, const char *path, bool *added)
+{
+    files_search_t search;
+
+    search.path = path;
+    search.found = search.added = false;
+    files_decode(files, search_visitor, &search);
+    *added = search.added;
+
+    return search.found;
+}
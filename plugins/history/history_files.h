@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "history_db.h"
+
+bool history_files_record(sqlite_db_t *, int, const history_line_t *, const history_line_ids_t *, size_t, char **);
+bool history_files_which(sqlite_db_t *, const char *, Iterator *, time_t *, const char **, const char **, const char **, const char **, const char **, sqlite_blob_t *, char **);
+bool history_files_find(const sqlite_blob_t *, const char *, bool *);
@@ -0,0 +1,614 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "common.h"
+#include "error/error.h"
+#include "history_db.h"
+#include "history_generator.h"
+
+/**
+ * Generation of synthetic histories, for the benchmarks: the statements
+ * have to be timed on databases of the size of the ones of the users (or
+ * of a fleet, see history_merge) without waiting for years of upgrades.
+ *
+ * The history is coherent: a package is installed before being upgraded
+ * and its version always goes forward (an upgrade bumps the revision, then
+ * the patch, the minor or the major), it can be deinstalled then installed
+ * again. The popularity of the packages follows a Zipf distribution, a few
+ * of them (the libraries) appear in most upgrades when the bulk of them
+ * rarely change. The commands are, as in real life:
+ * - a first one installing a quarter of the packages
+ * - 70% of "pkg upgrade", of a variable size (their average gives the
+ *   requested average of lines by command)
+ * - 22% of "pkg install" of a package and a few dependencies, which turn
+ *   into deletions once every package is installed
+ * - 8% of "pkg delete" or "pkg autoremove"
+ * spread over the time range, with durations growing with their size.
+ *
+ * The names are built from syllables, with the prefixes of the ports tree
+ * (py311-, p5-, ...), and the origins from its categories. The
+ * repositories are mostly "FreeBSD", a few packages come from a "local"
+ * one. The files of a package are a binary, a documentation, a shared
+ * library versioned by the major and data files by the minor: the major
+ * and minor upgrades change some of them.
+ *
+ * The commands are inserted, as history_import does, through
+ * history_db_insert_command in transactions of GENERATOR_BATCH_SIZE
+ * operations, the checkpoints are created at the end.
+ */
+
+#define GENERATOR_BATCH_SIZE 10000
+#define GENERATOR_DEFAULT_RANGE (3 * 365 * 86400)
+// exponent of the Zipf distribution of the popularity of the packages
+#define GENERATOR_ZIPF_EXPONENT 1.1
+
+#define NAME_SIZE 64
+#define ORIGIN_SIZE 96
+#define VERSION_SIZE 32
+#define COMMAND_SIZE 128
+// count of files of a package, at least the binary, the documentation and the library
+#define FILES_MIN 3
+#define FILES_MAX 16
+
+typedef struct {
+    char name[NAME_SIZE];
+    char origin[ORIGIN_SIZE];
+    const char *repo;
+    unsigned int major, minor, patch, revision, epoch;
+    unsigned int files;
+    bool installed;
+    // last command in which the package appears, to not have it twice in a command
+    size_t command;
+} generator_package_t;
+
+/**
+ * The operations of the commands of a transaction, as in history_import,
+ * with the storage of their strings
+ */
+typedef struct {
+    history_line_t lines[GENERATOR_BATCH_SIZE];
+    history_line_ids_t ids[GENERATOR_BATCH_SIZE];
+    char versions[GENERATOR_BATCH_SIZE][2][VERSION_SIZE];
+    // the files of each line: their array then their strings, in a single allocation
+    char *files[GENERATOR_BATCH_SIZE];
+    size_t lines_count;
+    struct {
+        time_t at;
+        history_timings_t timings;
+        char command[COMMAND_SIZE];
+        size_t first, count;
+    } commands[GENERATOR_BATCH_SIZE];
+    size_t commands_count;
+} generator_batch_t;
+
+typedef struct {
+    uint64_t state;
+    size_t packages_count;
+    generator_package_t *packages;
+    // cumulative distribution of the popularity of the packages
+    double *popularity;
+    size_t installed_count;
+} generator_t;
+
+static const char *prefixes[] = {
+    "", "", "", "", "", "", "", "", "lib", "py311-", "py39-", "p5-", "rubygem-", "php83-", "hs-", "R-cran-",
+};
+
+static const char *syllables[] = {
+    "ka", "lo", "mi", "ne", "ro", "su", "ta", "vi", "ga", "de", "xo", "pu", "fe", "zi", "bo", "wy",
+};
+
+static const char *categories[] = {
+    "archivers", "databases", "devel", "editors", "graphics", "lang", "mail", "math",
+    "multimedia", "net", "security", "shells", "sysutils", "textproc", "www", "x11",
+};
+
+/**
+ * xorshift64*: the histories only have to be reproducible, not random
+ */
+static uint64_t generator_next(generator_t *generator)
+{
+    generator->state ^= generator->state >> 12;
+    generator->state ^= generator->state << 25;
+    generator->state ^= generator->state >> 27;
+
+    return generator->state * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+// uniform in [0 ; n[
+static size_t generator_below(generator_t *generator, size_t n)
+{
+    return (size_t) (generator_next(generator) % n);
+}
+
+// uniform in [0 ; 1[
+static double generator_uniform(generator_t *generator)
+{
+    return (double) (generator_next(generator) >> 11) / (double) (UINT64_C(1) << 53);
+}
+
+// exponential of the given mean, at least 1
+static size_t generator_exponential(generator_t *generator, double mean)
+{
+    size_t value;
+
+    value = (size_t) (-mean * log(1.0 - generator_uniform(generator)) + 0.5);
+
+    return 0 == value ? 1 : value;
+}
+
+static generator_package_t *generator_popular_package(generator_t *generator)
+{
+    double u;
+    size_t lower, upper;
+
+    u = generator_uniform(generator);
+    lower = 0;
+    upper = generator->packages_count - 1;
+    while (lower < upper) {
+        size_t middle;
+
+        middle = lower + (upper - lower) / 2;
+        if (generator->popularity[middle] < u) {
+            lower = middle + 1;
+        } else {
+            upper = middle;
+        }
+    }
+
+    return &generator->packages[lower];
+}
+
+static bool package_eligible(const generator_package_t *package, size_t command, bool installed)
+{
+    return package->command != command && package->installed == installed;
+}
+
+/**
+ * Picks, by popularity, a package not already in the command and
+ * (un)installed as asked. The popular ones are soon all part of a large
+ * upgrade: after a few draws, any package will do. Returns NULL if there
+ * is none.
+ */
+static generator_package_t *generator_pick(generator_t *generator, size_t command, bool installed)
+{
+    size_t i, first;
+    int attempt;
+    generator_package_t *package;
+
+    package = NULL;
+    for (attempt = 0; attempt < 16; attempt++) {
+        package = generator_popular_package(generator);
+        if (package_eligible(package, command, installed)) {
+            break;
+        }
+    }
+    if (!package_eligible(package, command, installed)) {
+        first = generator_below(generator, generator->packages_count);
+        for (i = 0; i < generator->packages_count; i++) {
+            package = &generator->packages[(first + i) % generator->packages_count];
+            if (package_eligible(package, command, installed)) {
+                break;
+            }
+        }
+        if (i == generator->packages_count) {
+            return NULL;
+        }
+    }
+    package->command = command;
+
+    return package;
+}
+
+static void package_version(const generator_package_t *package, char *buffer)
+{
+    int len;
+
+    len = snprintf(buffer, VERSION_SIZE, "%u.%u.%u", package->major, package->minor, package->patch);
+    if (0 != package->revision) {
+        len += snprintf(buffer + len, VERSION_SIZE - len, "_%u", package->revision);
+    }
+    if (0 != package->epoch) {
+        snprintf(buffer + len, VERSION_SIZE - len, ",%u", package->epoch);
+    }
+}
+
+static void package_bump(generator_t *generator, generator_package_t *package)
+{
+    size_t draw;
+
+    draw = generator_below(generator, 100);
+    if (draw < 30) {
+        ++package->revision;
+    } else {
+        package->revision = 0;
+        if (draw < 80) {
+            ++package->patch;
+        } else if (draw < 96) {
+            ++package->minor;
+            package->patch = 0;
+        } else {
+            ++package->major;
+            package->minor = package->patch = 0;
+        }
+    }
+}
+
+/**
+ * Installed size of package at its current version: its files grow with
+ * the major and minor versions (computed, so the histories generated from
+ * a seed stay the same)
+ */
+static int64_t package_flatsize(const generator_package_t *package)
+{
+    return (int64_t) package->files * (INT64_C(32768) + INT64_C(1024) * (16 * package->major + package->minor));
+}
+
+// the files of a deleted package
+static const char * const no_files[1] = { NULL };
+
+/**
+ * Lists the files of package at its current version into a single
+ * allocation (to free), NULL if it fails
+ */
+static char *package_files(const generator_package_t *package, char **error)
+{
+    char *block, *w, *end;
+    const char **files;
+    unsigned int i;
+    size_t size;
+    // longest path: "/usr/local/share/" name "/" minor "." minor "/data" i
+    const size_t path_size = STR_SIZE("/usr/local/share/") + NAME_SIZE + 3 * STR_SIZE("4294967295") + STR_SIZE("/data");
+
+    size = sizeof(*files) * package->files + path_size * package->files;
+    if (NULL == (block = malloc(size))) {
+        set_malloc_error(error, size);
+        return NULL;
+    }
+    files = (const char **) block;
+    w = block + sizeof(*files) * package->files;
+    end = block + size;
+    for (i = 0; i < package->files; i++) {
+        files[i] = w;
+        if (0 == i) {
+            w += snprintf(w, end - w, "/usr/local/bin/%s", package->name) + 1;
+        } else if (1 == i) {
+            w += snprintf(w, end - w, "/usr/local/share/doc/%s/README", package->name) + 1;
+        } else if (2 == i) {
+            w += snprintf(w, end - w, "/usr/local/lib/lib%s.so.%u", package->name, package->major) + 1;
+        } else {
+            w += snprintf(w, end - w, "/usr/local/share/%s/%u.%u/data%u", package->name, package->major, package->minor, i) + 1;
+        }
+    }
+
+    return block;
+}
+
+static bool generator_init(generator_t *generator, size_t packages_count, uint64_t seed, char **error)
+{
+    size_t i;
+    double sum;
+
+    // xorshift can't leave 0
+    generator->state = 0 == seed ? UINT64_C(0x9E3779B97F4A7C15) : seed;
+    generator->packages_count = packages_count;
+    generator->installed_count = 0;
+    generator->popularity = NULL;
+    if (NULL == (generator->packages = calloc(packages_count, sizeof(*generator->packages)))) {
+        set_malloc_error(error, sizeof(*generator->packages) * packages_count);
+        return false;
+    }
+    if (NULL == (generator->popularity = malloc(sizeof(*generator->popularity) * packages_count))) {
+        set_malloc_error(error, sizeof(*generator->popularity) * packages_count);
+        free(generator->packages);
+        return false;
+    }
+    sum = 0.0;
+    for (i = 0; i < packages_count; i++) {
+        int len;
+        size_t n, k, base;
+        char word[NAME_SIZE];
+        generator_package_t *package;
+
+        package = &generator->packages[i];
+        // the digits of i in base ARRAY_SIZE(syllables), at least 2 syllables: unique names
+        len = 0;
+        k = 0;
+        n = i;
+        base = ARRAY_SIZE(syllables);
+        do {
+            len += snprintf(word + len, STR_SIZE(word) - len, "%s", syllables[n % base]);
+            n /= base;
+            ++k;
+        } while (n > 0 || k < 2);
+        snprintf(package->name, STR_SIZE(package->name), "%s%s", prefixes[generator_below(generator, ARRAY_SIZE(prefixes))], word);
+        snprintf(package->origin, STR_SIZE(package->origin), "%s/%s", categories[generator_below(generator, ARRAY_SIZE(categories))], package->name);
+        package->repo = 0 == generator_below(generator, 20) ? "local" : "FreeBSD";
+        package->major = (unsigned int) generator_below(generator, 20);
+        package->minor = (unsigned int) generator_below(generator, 30);
+        package->patch = (unsigned int) generator_below(generator, 10);
+        package->epoch = 0 == generator_below(generator, 25) ? 1 : 0;
+        package->files = FILES_MIN + (unsigned int) generator_below(generator, FILES_MAX - FILES_MIN + 1);
+        package->command = SIZE_MAX;
+        sum += 1.0 / pow((double) (i + 1), GENERATOR_ZIPF_EXPONENT);
+        generator->popularity[i] = sum;
+    }
+    for (i = 0; i < packages_count; i++) {
+        generator->popularity[i] /= sum;
+    }
+
+    return true;
+}
+
+static void generator_fini(generator_t *generator)
+{
+    free(generator->packages);
+    free(generator->popularity);
+}
+
+static void batch_free_files(generator_batch_t *batch)
+{
+    size_t i;
+
+    for (i = 0; i < batch->lines_count; i++) {
+        free(batch->files[i]);
+    }
+}
+
+static bool batch_flush(sqlite_db_t *db, generator_batch_t *batch, history_generator_stats_t *stats, char **error)
+{
+    size_t i;
+
+    if (0 == batch->commands_count) {
+        return true;
+    }
+    if (!sqlite_transaction_begin(db, error)) {
+        return false;
+    }
+    if (!history_db_resolve_lines(db, batch->lines, batch->lines_count, batch->ids, error)) {
+        sqlite_transaction_rollback(db, NULL);
+        return false;
+    }
+    for (i = 0; i < batch->commands_count; i++) {
+        if (!history_db_insert_command(db, batch->commands[i].at, batch->commands[i].command, &batch->commands[i].timings, batch->lines + batch->commands[i].first, batch->ids + batch->commands[i].first, batch->commands[i].count, error)) {
+            sqlite_transaction_rollback(db, NULL);
+            return false;
+        }
+    }
+    if (!sqlite_transaction_commit(db, error)) {
+        return false;
+    }
+    stats->commands += batch->commands_count;
+    stats->operations += batch->lines_count;
+    batch_free_files(batch);
+    batch->lines_count = batch->commands_count = 0;
+
+    return true;
+}
+
+/**
+ * Appends to the current command of the batch an operation on package
+ * (which is updated accordingly), returns false if its files can't be
+ * allocated
+ */
+static bool batch_append(generator_t *generator, generator_batch_t *batch, generator_package_t *package, int operation, history_generator_stats_t *stats, char **error)
+{
+    history_line_t *line;
+    char (*versions)[VERSION_SIZE];
+
+    line = &batch->lines[batch->lines_count];
+    versions = batch->versions[batch->lines_count];
+    line->operation = operation;
+    line->name = package->name;
+    line->origin = package->origin;
+    line->old_version = NULL;
+    line->old_flatsize = -1;
+    line->repo = package->repo;
+    switch (operation) {
+        case PKG_OP_INSTALL:
+            package->installed = true;
+            ++generator->installed_count;
+            ++stats->installs;
+            break;
+        case PKG_OP_UPGRADE:
+            package_version(package, versions[1]);
+            line->old_version = versions[1];
+            line->old_flatsize = package_flatsize(package);
+            package_bump(generator, package);
+            ++stats->upgrades;
+            break;
+        case PKG_OP_DEINSTALL:
+            package->installed = false;
+            --generator->installed_count;
+            line->repo = NULL;
+            ++stats->deinstalls;
+            break;
+    }
+    package_version(package, versions[0]);
+    line->new_version = versions[0];
+    line->new_flatsize = package_flatsize(package);
+    if (PKG_OP_DEINSTALL == operation) {
+        batch->files[batch->lines_count] = NULL;
+        line->files = no_files;
+        line->files_count = 0;
+    } else {
+        if (NULL == (batch->files[batch->lines_count] = package_files(package, error))) {
+            return false;
+        }
+        line->files = (const char * const *) batch->files[batch->lines_count];
+        line->files_count = package->files;
+    }
+    ++batch->lines_count;
+    ++batch->commands[batch->commands_count].count;
+
+    return true;
+}
+
+/**
+ * Generates the command-th command, count is the count of operations of a
+ * "pkg upgrade" (the first command installs as many packages), returns:
+ * + -1 on error
+ * + 0 if it has no operation (nothing left to install or to delete)
+ * + 1 if it was generated
+ */
+static int generate_command(generator_t *generator, generator_batch_t *batch, size_t command, size_t count, history_generator_stats_t *stats, char **error)
+{
+    bool ok;
+    size_t i, draw;
+    char *buffer;
+    generator_package_t *package;
+
+    ok = true;
+    draw = 0 == command ? 8 : generator_below(generator, 100);
+    // everything is installed: remove something instead
+    if (draw >= 8 && draw < 30 && generator->installed_count == generator->packages_count) {
+        draw = 0;
+    }
+    buffer = batch->commands[batch->commands_count].command;
+    batch->commands[batch->commands_count].first = batch->lines_count;
+    batch->commands[batch->commands_count].count = 0;
+    if (draw < 8) {
+        // delete a package and, sometimes, its orphaned dependencies
+        count = 1 + (0 == generator_below(generator, 3) ? 1 + generator_below(generator, 3) : 0);
+        for (i = 0; ok && i < count && NULL != (package = generator_pick(generator, command, true)); i++) {
+            if (0 == i) {
+                snprintf(buffer, COMMAND_SIZE, count > 1 ? "pkg autoremove -y" : "pkg delete -y %s", package->name);
+            }
+            ok = batch_append(generator, batch, package, PKG_OP_DEINSTALL, stats, error);
+        }
+    } else if (draw < 30) {
+        // install a package and its missing dependencies
+        if (0 != command) {
+            count = 1 + generator_below(generator, 5);
+        }
+        for (i = 0; ok && i < count && NULL != (package = generator_pick(generator, command, false)); i++) {
+            if (0 == i) {
+                snprintf(buffer, COMMAND_SIZE, "pkg install -y %s", package->name);
+            }
+            ok = batch_append(generator, batch, package, PKG_OP_INSTALL, stats, error);
+        }
+    } else {
+        // an upgrade brings a new dependency from time to time
+        snprintf(buffer, COMMAND_SIZE, "pkg upgrade -y");
+        for (i = 0; ok && i < count; i++) {
+            bool install;
+
+            install = 0 == generator->installed_count || 0 == generator_below(generator, 20);
+            if (NULL == (package = generator_pick(generator, command, !install))) {
+                if (!install || NULL == (package = generator_pick(generator, command, true))) {
+                    break;
+                }
+                install = false;
+            }
+            ok = batch_append(generator, batch, package, install ? PKG_OP_INSTALL : PKG_OP_UPGRADE, stats, error);
+        }
+    }
+    if (!ok) {
+        return -1;
+    }
+    if (0 == batch->commands[batch->commands_count].count) {
+        return 0;
+    }
+    ++batch->commands_count;
+
+    return 1;
+}
+
+/**
+ * Fills db with a history shaped by options
+ */
+bool history_generate(sqlite_db_t *db, const history_generator_options_t *options, history_generator_stats_t *stats, char **error)
+{
+    bool ok;
+    double mean;
+    time_t from, to;
+    size_t command, generated;
+    generator_t generator;
+    generator_batch_t *batch;
+
+    memset(stats, 0, sizeof(*stats));
+    if (0 == options->packages) {
+        set_generic_error(error, "a history needs at least one package");
+        return false;
+    }
+    if (0 == options->from && 0 == options->to) {
+        to = time(NULL);
+        from = to - GENERATOR_DEFAULT_RANGE;
+    } else {
+        from = options->from;
+        to = options->to;
+    }
+    if (to < from) {
+        set_generic_error(error, "the time range of the history ends before it starts");
+        return false;
+    }
+    if (NULL == (batch = malloc(sizeof(*batch)))) {
+        set_malloc_error(error, sizeof(*batch));
+        return false;
+    }
+    if (!generator_init(&generator, options->packages, options->seed, error)) {
+        free(batch);
+        return false;
+    }
+    ok = true;
+    batch->lines_count = batch->commands_count = 0;
+    // the deletions have 1.5 operations, the installations 3: the upgrades make up the difference
+    mean = ((double) options->lines - 0.08 * 1.5 - 0.22 * 3.0) / 0.70;
+    if (mean < 1.0) {
+        mean = 1.0;
+    }
+    // the draws don't depend on the batches: a same seed gives a same history
+    for (command = generated = 0; ok && generated < options->commands; command++) {
+        int ret;
+        size_t count;
+        int64_t duration;
+        history_timings_t *timings;
+
+        if (0 == command) {
+            count = MAX(options->packages / 4, 1);
+        } else {
+            count = generator_exponential(&generator, mean);
+        }
+        count = MIN(count, (size_t) GENERATOR_BATCH_SIZE);
+        if (batch->lines_count + count > GENERATOR_BATCH_SIZE || GENERATOR_BATCH_SIZE == batch->commands_count) {
+            if (!(ok = batch_flush(db, batch, stats, error))) {
+                break;
+            }
+        }
+        ret = generate_command(&generator, batch, command, count, stats, error);
+        if (-1 == ret) {
+            ok = false;
+            break;
+        }
+        if (0 == ret) {
+            // everything or nothing installed: try something else
+            if (command > 16 * (options->commands + 1)) {
+                set_generic_error(error, "can't generate %zu commands over %zu packages", options->commands, options->packages);
+                ok = false;
+            }
+            continue;
+        }
+        batch->commands[batch->commands_count - 1].at = from + (time_t) ((double) (to - from) * (double) generated / (double) options->commands);
+        count = batch->commands[batch->commands_count - 1].count;
+        timings = &batch->commands[batch->commands_count - 1].timings;
+        duration = 500 + (int64_t) count * (60 + (int64_t) generator_below(&generator, 200)) + (int64_t) generator_below(&generator, 2000);
+        timings->finished_at = (int64_t) batch->commands[batch->commands_count - 1].at * 1000;
+        timings->started_at = timings->finished_at - duration;
+        timings->fetch_duration = 0 == generator_below(&generator, 3) ? -1 : duration / 2;
+        ++generated;
+    }
+    if (ok) {
+        ok = batch_flush(db, batch, stats, error);
+    }
+    if (ok && 0 != options->checkpoint_interval) {
+        ok = history_db_create_checkpoints(db, options->checkpoint_interval, 0, error);
+    }
+    generator_fini(&generator);
+    // the ones of the lines which weren't flushed
+    batch_free_files(batch);
+    free(batch);
+
+    return ok;
+}
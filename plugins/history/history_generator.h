@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "history_db.h"
+
+/**
+ * Shape of a synthetic history (see history_generate)
+ */
+typedef struct {
+    // count of commands
+    size_t commands;
+    // average count of package operations by command
+    size_t lines;
+    // count of distinct packages
+    size_t packages;
+    // time range of the commands, the last 3 years if both are 0
+    time_t from, to;
+    // the same seed gives the same history
+    uint64_t seed;
+    // count of commands between two checkpoints (0 for none)
+    int checkpoint_interval;
+} history_generator_options_t;
+
+#define HISTORY_GENERATOR_DEFAULTS \
+    { .commands = 20000, .lines = 15, .packages = 2000, .from = 0, .to = 0, .seed = 1, .checkpoint_interval = 100 }
+
+/**
+ * Counters of a run of history_generate
+ */
+typedef struct {
+    size_t commands;
+    size_t operations;
+    size_t installs;
+    size_t upgrades;
+    size_t deinstalls;
+} history_generator_stats_t;
+
+bool history_generate(sqlite_db_t *, const history_generator_options_t *, history_generator_stats_t *, char **);
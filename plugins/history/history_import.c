@@ -0,0 +1,776 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/param.h> /* MAXPATHLEN */
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "error/error.h"
+#include "date.h"
+#include "history_db.h"
+#include "history_import.h"
+
+/**
+ * Import of the package operations logged by pkg to syslog (SYSLOG, enabled
+ * by default) before the plugin was installed. syslogd (in its default, BSD,
+ * format) writes them as:
+ *
+ * Nov 15 16:12:22 host pkg[1234]: firefox-83.0_2,2 installed
+ * Nov 15 16:12:22 host pkg[1234]: firefox-83.0_2,2 deinstalled
+ * Nov 15 16:12:22 host pkg[1234]: firefox upgraded: 83.0,2 -> 83.0_2,2
+ *
+ * (downgrades and reinstallations are logged as upgrades, with the words
+ * "downgraded" and "reinstalled")
+ *
+ * The logs are split in chunks, at line boundaries, parsed concurrently by
+ * a pool of threads. The operations are then grouped into commands (the
+ * consecutive lines of a same pkg process) and inserted, in order, by the
+ * calling thread in transactions of IMPORT_BATCH_SIZE operations.
+ *
+ * NOTE:
+ * - the logs give neither the origin nor the repository of the packages:
+ *   the origin is recorded as an empty string, the repository as NULL
+ * - the year isn't logged: the last operation of a file is dated in the
+ *   year of its last modification (the current one for the standard input),
+ *   the previous ones go back a year each time the month decreases (the
+ *   logs are expected in chronological order)
+ * - only the operations older than the first command of the history are
+ *   imported, the next ones were recorded by the plugin itself (so
+ *   importing twice the same logs is harmless)
+ */
+
+#define IMPORT_CHUNK_SIZE (4 * 1024 * 1024)
+#define IMPORT_BATCH_SIZE 10000
+// maximum count of threads, the default is the count of online processors
+#define IMPORT_MAX_THREADS 64
+
+#define SYSLOG_DATE_LEN STR_LEN("Nov 15 16:12:22")
+#define SYSLOG_DATE_YEAR_OFFSET STR_LEN("Nov 15")
+/**
+ * The year given to the date scanner in place of the unknown one: a leap
+ * year, so Feb 29 is valid
+ */
+#define SYSLOG_DATE_LEAP_YEAR " 2000"
+
+#define PKG_TAG " pkg["
+
+/**
+ * A date as logged by syslogd, its components are the ones of a struct tm
+ */
+typedef struct {
+    unsigned char mon, mday, hour, min, sec;
+} syslog_date_t;
+
+/**
+ * An operation read from the logs, the strings belong to the chunk
+ */
+typedef struct {
+    /**
+     * The date, set by import_date_records once all the chunks of the file
+     * are parsed, or (time_t) -1 if it doesn't exist in the inferred year
+     */
+    time_t at;
+    int pid;
+    int operation;
+    const char *name;
+    const char *old_version;
+    const char *new_version;
+    // the local time logged, without the year
+    syslog_date_t date;
+} import_record_t;
+
+typedef struct {
+    const char *path;
+    // the last modification of the file (or now for the standard input)
+    time_t mtime;
+    const char *start, *end;
+    /**
+     * Results of the parsing: the records and their strings, copied (NUL
+     * terminated) into a buffer of the size of the chunk
+     */
+    char *strings, *strings_w;
+    import_record_t *records;
+    size_t records_count, records_allocated;
+    size_t lines, invalid;
+    char *error;
+} import_chunk_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    // index of the next chunk to parse
+    size_t next;
+    size_t chunks_count;
+    import_chunk_t *chunks;
+} import_queue_t;
+
+typedef struct {
+    const char *path;
+    time_t mtime;
+    char *data;
+    size_t size;
+    bool mapped;
+} import_file_t;
+
+/**
+ * The last date parsed by a thread: successive lines are very likely to
+ * share their date (to the second)
+ */
+typedef struct {
+    char string[SYSLOG_DATE_LEN];
+    syslog_date_t date;
+    bool valid;
+} date_cache_t;
+
+/**
+ * Parses the date ("Nov 15 16:12:22") at the start of a line, the year
+ * is inferred later, by import_date_records
+ */
+static bool parse_syslog_date(const char *string, date_cache_t *cache, syslog_date_t *date)
+{
+    struct tm tm;
+    char buffer[STR_SIZE(SYSLOG_DATE_LEAP_YEAR) + SYSLOG_DATE_LEN];
+
+    if (cache->valid && 0 == memcmp(cache->string, string, SYSLOG_DATE_LEN)) {
+        *date = cache->date;
+        return true;
+    }
+    // "Nov 15 2000 16:12:22"
+    snprintf(buffer, STR_SIZE(buffer), "%.*s" SYSLOG_DATE_LEAP_YEAR "%.*s", (int) SYSLOG_DATE_YEAR_OFFSET, string, (int) (SYSLOG_DATE_LEN - SYSLOG_DATE_YEAR_OFFSET), string + SYSLOG_DATE_YEAR_OFFSET);
+    if (!parse_date_tm(buffer, &tm, NULL)) {
+        return false;
+    }
+    date->mon = (unsigned char) tm.tm_mon;
+    date->mday = (unsigned char) tm.tm_mday;
+    date->hour = (unsigned char) tm.tm_hour;
+    date->min = (unsigned char) tm.tm_min;
+    date->sec = (unsigned char) tm.tm_sec;
+    memcpy(cache->string, string, SYSLOG_DATE_LEN);
+    cache->date = *date;
+    cache->valid = true;
+
+    return true;
+}
+
+/**
+ * Dates the records of the chunks [chunks ; chunks + chunks_count[ of a
+ * same file. Its last record is in the year of mtime, the previous ones go
+ * back a year each time the month (read backwards) increases.
+ */
+static void import_date_records(import_chunk_t *chunks, size_t chunks_count, time_t mtime)
+{
+    size_t i;
+    struct tm tm;
+    time_t cached_at;
+    int year, next_mon;
+    syslog_date_t cached_date;
+
+    if (NULL == localtime_r(&mtime, &tm)) {
+        tm.tm_year = 70;
+        tm.tm_mon = 11;
+    }
+    year = tm.tm_year;
+    next_mon = tm.tm_mon;
+    cached_at = (time_t) -1;
+    memset(&cached_date, 0, sizeof(cached_date));
+    for (i = chunks_count; i-- > 0; ) {
+        size_t r;
+
+        for (r = chunks[i].records_count; r-- > 0; ) {
+            import_record_t *record;
+
+            record = &chunks[i].records[r];
+            if (record->date.mon > next_mon) {
+                --year;
+                // the cache is for a given year
+                cached_at = (time_t) -1;
+            }
+            next_mon = record->date.mon;
+            if (((time_t) -1) != cached_at && 0 == memcmp(&cached_date, &record->date, sizeof(cached_date))) {
+                record->at = cached_at;
+                continue;
+            }
+            memset(&tm, 0, sizeof(tm));
+            tm.tm_year = year;
+            tm.tm_mon = record->date.mon;
+            tm.tm_mday = record->date.mday;
+            tm.tm_hour = record->date.hour;
+            tm.tm_min = record->date.min;
+            tm.tm_sec = record->date.sec;
+            // syslogd logs the local time
+            tm.tm_isdst = -1;
+            record->at = mktime(&tm);
+            // Feb 29 of a year which isn't a leap one
+            if (tm.tm_mday != record->date.mday) {
+                record->at = (time_t) -1;
+            }
+            cached_date = record->date;
+            cached_at = record->at;
+        }
+    }
+}
+
+/**
+ * Copies the string [start ; end[ to the strings of chunk
+ */
+static const char *chunk_strndup(import_chunk_t *chunk, const char *start, const char *end)
+{
+    char *copy;
+
+    copy = chunk->strings_w;
+    memcpy(copy, start, end - start);
+    copy[end - start] = '\0';
+    chunk->strings_w += end - start + 1;
+
+    return copy;
+}
+
+static const char *memrchr_s(const char *start, const char *end, char c)
+{
+    while (end-- > start) {
+        if (c == *end) {
+            return end;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Messages (after "pkg[pid]: ") which are the ends of installations or
+ * deinstallations: "<name>-<version><suffix>"
+ */
+static const struct {
+    const char *suffix;
+    size_t suffix_len;
+    int operation;
+} package_messages[] = {
+    { S(" deinstalled"), PKG_OP_DEINSTALL },
+    { S(" installed"), PKG_OP_INSTALL },
+};
+
+/**
+ * Messages which are the ends of upgrades: "<name><infix><old> -> <new>"
+ */
+static const struct {
+    const char *infix;
+    size_t infix_len;
+} upgrade_messages[] = {
+    { S(" upgraded: ") },
+    { S(" downgraded: ") },
+    { S(" reinstalled: ") },
+};
+
+static bool parse_message(import_chunk_t *chunk, const char *message, const char *end, import_record_t *record)
+{
+    size_t i;
+    const char *p, *arrow;
+
+    // pkg appends a space to the upgrades
+    while (end > message && (' ' == end[-1] || '\r' == end[-1])) {
+        --end;
+    }
+    for (i = 0; i < ARRAY_SIZE(package_messages); i++) {
+        if (((size_t) (end - message)) > package_messages[i].suffix_len && 0 == memcmp(end - package_messages[i].suffix_len, package_messages[i].suffix, package_messages[i].suffix_len)) {
+            end -= package_messages[i].suffix_len;
+            // versions can't contain a dash, names can
+            if (NULL == (p = memrchr_s(message, end, '-')) || p == message || p + 1 == end) {
+                return false;
+            }
+            record->operation = package_messages[i].operation;
+            record->name = chunk_strndup(chunk, message, p);
+            record->old_version = NULL;
+            record->new_version = chunk_strndup(chunk, p + 1, end);
+            return true;
+        }
+    }
+    for (i = 0; i < ARRAY_SIZE(upgrade_messages); i++) {
+        if (NULL != (p = memmem(message, end - message, upgrade_messages[i].infix, upgrade_messages[i].infix_len)) && p != message) {
+            const char *versions;
+
+            versions = p + upgrade_messages[i].infix_len;
+            if (NULL == (arrow = memmem(versions, end - versions, S(" -> "))) || arrow == versions || arrow + STR_LEN(" -> ") == end) {
+                return false;
+            }
+            record->operation = PKG_OP_UPGRADE;
+            record->name = chunk_strndup(chunk, message, p);
+            record->old_version = chunk_strndup(chunk, versions, arrow);
+            record->new_version = chunk_strndup(chunk, arrow + STR_LEN(" -> "), end);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool chunk_append(import_chunk_t *chunk, const import_record_t *record)
+{
+    if (chunk->records_count == chunk->records_allocated) {
+        size_t allocated;
+        import_record_t *records;
+
+        allocated = 0 == chunk->records_allocated ? 1024 : chunk->records_allocated * 2;
+        if (NULL == (records = realloc(chunk->records, sizeof(*records) * allocated))) {
+            set_malloc_error(&chunk->error, sizeof(*records) * allocated);
+            return false;
+        }
+        chunk->records = records;
+        chunk->records_allocated = allocated;
+    }
+    chunk->records[chunk->records_count++] = *record;
+
+    return true;
+}
+
+/**
+ * Parses the lines of chunk: "<date> <host> pkg[<pid>]: <message>", the other
+ * ones are ignored
+ */
+static void parse_chunk(import_chunk_t *chunk)
+{
+    const char *line, *eol;
+    date_cache_t cache = { .valid = false };
+
+    if (NULL == (chunk->strings_w = chunk->strings = malloc(chunk->end - chunk->start + 1))) {
+        set_malloc_error(&chunk->error, (size_t) (chunk->end - chunk->start + 1));
+        return;
+    }
+    for (line = chunk->start; line < chunk->end; line = eol + 1) {
+        const char *p;
+        import_record_t record;
+
+        if (NULL == (eol = memchr(line, '\n', chunk->end - line))) {
+            eol = chunk->end;
+        }
+        if (((size_t) (eol - line)) <= SYSLOG_DATE_LEN || NULL == (p = memmem(line + SYSLOG_DATE_LEN, eol - line - SYSLOG_DATE_LEN, S(PKG_TAG)))) {
+            continue;
+        }
+        ++chunk->lines;
+        record.pid = 0;
+        for (p += STR_LEN(PKG_TAG); p < eol && *p >= '0' && *p <= '9'; p++) {
+            record.pid = record.pid * 10 + *p - '0';
+        }
+        if (((size_t) (eol - p)) < STR_LEN("]: ") || 0 != memcmp(p, "]: ", STR_LEN("]: "))) {
+            ++chunk->invalid;
+            continue;
+        }
+        if (!parse_message(chunk, p + STR_LEN("]: "), eol, &record) || !parse_syslog_date(line, &cache, &record.date)) {
+            ++chunk->invalid;
+            continue;
+        }
+        if (!chunk_append(chunk, &record)) {
+            break;
+        }
+    }
+}
+
+static void *import_worker(void *data)
+{
+    import_queue_t *queue;
+
+    queue = (import_queue_t *) data;
+    while (true) {
+        size_t i;
+
+        pthread_mutex_lock(&queue->mutex);
+        i = queue->next;
+        if (queue->next < queue->chunks_count) {
+            ++queue->next;
+        }
+        pthread_mutex_unlock(&queue->mutex);
+        if (i >= queue->chunks_count) {
+            break;
+        }
+        parse_chunk(&queue->chunks[i]);
+    }
+
+    return NULL;
+}
+
+/**
+ * Reads the whole content of fd (a pipe or anything which can't be mapped)
+ */
+static bool read_all(int fd, import_file_t *file, char **error)
+{
+    size_t allocated;
+
+    allocated = 0;
+    file->size = 0;
+    file->data = NULL;
+    while (true) {
+        ssize_t read_len;
+
+        if (file->size == allocated) {
+            char *data;
+
+            allocated = 0 == allocated ? IMPORT_CHUNK_SIZE : allocated * 2;
+            if (NULL == (data = realloc(file->data, allocated))) {
+                set_malloc_error(error, allocated);
+                return false;
+            }
+            file->data = data;
+        }
+        if (-1 == (read_len = read(fd, file->data + file->size, allocated - file->size))) {
+            if (EINTR == errno) {
+                continue;
+            }
+            set_system_error(error, "read(2) failed on %s", file->path);
+            return false;
+        }
+        if (0 == read_len) {
+            break;
+        }
+        file->size += (size_t) read_len;
+    }
+
+    return true;
+}
+
+/**
+ * Maps (or reads) the file at path, "-" for the standard input
+ */
+static bool import_file_open(import_file_t *file, const char *path, char **error)
+{
+    int fd;
+    bool ok;
+    struct stat st;
+
+    ok = false;
+    file->path = path;
+    file->mtime = time(NULL);
+    file->data = NULL;
+    file->size = 0;
+    file->mapped = false;
+    if (0 == strcmp(path, "-")) {
+        fd = STDIN_FILENO;
+    } else if (-1 == (fd = open(path, O_RDONLY))) {
+        set_system_error(error, "open(2) failed on %s", path);
+        return false;
+    }
+    do {
+        if (-1 == fstat(fd, &st)) {
+            set_system_error(error, "fstat(2) failed on %s", path);
+            break;
+        }
+        if (S_ISREG(st.st_mode)) {
+            file->mtime = st.st_mtime;
+            if (0 == st.st_size) {
+                ok = true;
+                break;
+            }
+            if (MAP_FAILED != (file->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))) {
+                file->size = (size_t) st.st_size;
+                file->mapped = true;
+                madvise(file->data, file->size, MADV_SEQUENTIAL);
+                ok = true;
+                break;
+            }
+            file->data = NULL;
+        }
+        ok = read_all(fd, file, error);
+    } while (false);
+    if (STDIN_FILENO != fd) {
+        close(fd);
+    }
+
+    return ok;
+}
+
+static void import_file_close(import_file_t *file)
+{
+    if (NULL != file->data) {
+        if (file->mapped) {
+            munmap(file->data, file->size);
+        } else {
+            free(file->data);
+        }
+        file->data = NULL;
+    }
+}
+
+/**
+ * Splits file in chunks of about IMPORT_CHUNK_SIZE bytes, ending on a line
+ * boundary
+ */
+static bool split_file(const import_file_t *file, import_chunk_t **chunks, size_t *chunks_count, size_t *chunks_allocated, char **error)
+{
+    const char *p, *end;
+
+    end = file->data + file->size;
+    for (p = file->data; p < end; ) {
+        const char *chunk_end;
+
+        if (((size_t) (end - p)) <= IMPORT_CHUNK_SIZE || NULL == (chunk_end = memchr(p + IMPORT_CHUNK_SIZE, '\n', end - p - IMPORT_CHUNK_SIZE))) {
+            chunk_end = end;
+        } else {
+            ++chunk_end;
+        }
+        if (*chunks_count == *chunks_allocated) {
+            size_t allocated;
+            import_chunk_t *tmp;
+
+            allocated = 0 == *chunks_allocated ? 16 : *chunks_allocated * 2;
+            if (NULL == (tmp = realloc(*chunks, sizeof(*tmp) * allocated))) {
+                set_malloc_error(error, sizeof(*tmp) * allocated);
+                return false;
+            }
+            *chunks = tmp;
+            *chunks_allocated = allocated;
+        }
+        memset(&(*chunks)[*chunks_count], 0, sizeof(**chunks));
+        (*chunks)[*chunks_count].path = file->path;
+        (*chunks)[*chunks_count].mtime = file->mtime;
+        (*chunks)[*chunks_count].start = p;
+        (*chunks)[*chunks_count].end = chunk_end;
+        ++*chunks_count;
+        p = chunk_end;
+    }
+
+    return true;
+}
+
+/**
+ * The operations of the commands of a transaction, the commands are the
+ * ranges [first ; first + count[ of lines
+ */
+typedef struct {
+    history_line_t lines[IMPORT_BATCH_SIZE];
+    history_line_ids_t ids[IMPORT_BATCH_SIZE];
+    size_t lines_count;
+    struct {
+        time_t at;
+        int pid;
+        const char *path;
+        size_t first, count;
+    } commands[IMPORT_BATCH_SIZE];
+    size_t commands_count;
+} import_batch_t;
+
+static bool batch_flush(sqlite_db_t *db, import_batch_t *batch, history_import_stats_t *stats, char **error)
+{
+    bool ok;
+    size_t i;
+
+    if (0 == batch->lines_count) {
+        return true;
+    }
+    ok = false;
+    do {
+        if (!sqlite_transaction_begin(db, error)) {
+            break;
+        }
+        // a single lookup per distinct string for the whole batch
+        if (!history_db_resolve_lines(db, batch->lines, batch->lines_count, batch->ids, error)) {
+            sqlite_transaction_rollback(db, NULL);
+            break;
+        }
+        for (i = 0; i < batch->commands_count; i++) {
+            char command[STR_SIZE("pkg[2147483647] (imported from )") + MAXPATHLEN];
+
+            snprintf(command, STR_SIZE(command), "pkg[%d] (imported from %s)", batch->commands[i].pid, batch->commands[i].path);
+            if (!history_db_insert_command(db, batch->commands[i].at, command, NULL, batch->lines + batch->commands[i].first, batch->ids + batch->commands[i].first, batch->commands[i].count, error)) {
+                break;
+            }
+        }
+        if (i < batch->commands_count) {
+            sqlite_transaction_rollback(db, NULL);
+            break;
+        }
+        if (!sqlite_transaction_commit(db, error)) {
+            break;
+        }
+        stats->operations += batch->lines_count;
+        stats->commands += batch->commands_count;
+        ok = true;
+    } while (false);
+    batch->lines_count = batch->commands_count = 0;
+
+    return ok;
+}
+
+/**
+ * Adds record to the batch: to the current command if it comes from the
+ * same process, to a new one otherwise
+ */
+static bool batch_append(sqlite_db_t *db, import_batch_t *batch, const import_chunk_t *chunk, const import_record_t *record, int *previous_pid, history_import_stats_t *stats, char **error)
+{
+    history_line_t *line;
+
+    if (IMPORT_BATCH_SIZE == batch->lines_count) {
+        if (!batch_flush(db, batch, stats, error)) {
+            return false;
+        }
+        // the command goes on in the next batch
+        *previous_pid = -1;
+    }
+    if (0 == batch->commands_count || *previous_pid != record->pid) {
+        batch->commands[batch->commands_count].at = record->at;
+        batch->commands[batch->commands_count].first = batch->lines_count;
+        batch->commands[batch->commands_count].count = 0;
+        batch->commands[batch->commands_count].pid = record->pid;
+        batch->commands[batch->commands_count].path = chunk->path;
+        ++batch->commands_count;
+        *previous_pid = record->pid;
+    }
+    line = &batch->lines[batch->lines_count++];
+    line->operation = record->operation;
+    line->repo = NULL;
+    line->name = record->name;
+    line->origin = "";
+    line->old_version = record->old_version;
+    line->new_version = record->new_version;
+    // the logs don't tell the sizes of the packages
+    line->new_flatsize = line->old_flatsize = -1;
+    line->files = NULL;
+    line->files_count = 0;
+    ++batch->commands[batch->commands_count - 1].count;
+
+    return true;
+}
+
+/**
+ * Imports the package operations logged by pkg in the files at paths,
+ * parsed by (at most) threads_count threads (0 for the count of online
+ * processors)
+ */
+bool history_import(sqlite_db_t *db, const char **paths, size_t paths_count, int threads_count, history_import_stats_t *stats, char **error)
+{
+    bool ok;
+    size_t i, files_count;
+    import_file_t *files;
+    import_batch_t *batch;
+    import_queue_t queue;
+    size_t chunks_allocated;
+
+    ok = false;
+    files_count = 0;
+    batch = NULL;
+    memset(stats, 0, sizeof(*stats));
+    memset(&queue, 0, sizeof(queue));
+    chunks_allocated = 0;
+    if (NULL == (files = calloc(paths_count, sizeof(*files)))) {
+        set_calloc_error(error, paths_count, sizeof(*files));
+        return false;
+    }
+    do {
+        int ret;
+        time_t oldest;
+        int previous_pid;
+        pthread_t threads[IMPORT_MAX_THREADS];
+
+        for (files_count = 0; files_count < paths_count; files_count++) {
+            if (!import_file_open(&files[files_count], paths[files_count], error)) {
+                break;
+            }
+            if (!split_file(&files[files_count], &queue.chunks, &queue.chunks_count, &chunks_allocated, error)) {
+                ++files_count;
+                break;
+            }
+        }
+        if (files_count < paths_count || NULL != *error) {
+            break;
+        }
+        if (threads_count <= 0) {
+            long processors;
+
+            threads_count = (processors = sysconf(_SC_NPROCESSORS_ONLN)) > 0 ? (int) processors : 1;
+        }
+        threads_count = MIN(MIN(threads_count, IMPORT_MAX_THREADS), (int) MAX(queue.chunks_count, (size_t) 1));
+        pthread_mutex_init(&queue.mutex, NULL);
+        for (i = 0; i < (size_t) threads_count; i++) {
+            if (0 != (ret = pthread_create(&threads[i], NULL, import_worker, &queue))) {
+                errno = ret;
+                set_system_error(error, "pthread_create(3) failed");
+                break;
+            }
+        }
+        // if the creation of a thread failed, the previous ones still parse all the chunks
+        while (i-- > 0) {
+            pthread_join(threads[i], NULL);
+        }
+        pthread_mutex_destroy(&queue.mutex);
+        if (NULL != *error) {
+            break;
+        }
+        for (i = 0; i < queue.chunks_count; i++) {
+            if (NULL != queue.chunks[i].error) {
+                *error = queue.chunks[i].error;
+                queue.chunks[i].error = NULL;
+                break;
+            }
+            stats->lines += queue.chunks[i].lines;
+            stats->invalid += queue.chunks[i].invalid;
+        }
+        if (NULL != *error) {
+            break;
+        }
+        // the chunks of a same file follow each other
+        for (i = 0; i < queue.chunks_count; ) {
+            size_t first;
+
+            first = i;
+            while (++i < queue.chunks_count && queue.chunks[i].path == queue.chunks[first].path)
+                ;
+            import_date_records(&queue.chunks[first], i - first, queue.chunks[first].mtime);
+        }
+        statement_reset(&history_statements[STMT_OLDEST_COMMAND]);
+        if (-1 == (ret = statement_fetch(db, &history_statements[STMT_OLDEST_COMMAND], error, &oldest))) {
+            break;
+        }
+        if (0 == ret) {
+            oldest = (time_t) -1;
+        }
+        if (NULL == (batch = malloc(sizeof(*batch)))) {
+            set_malloc_error(error, sizeof(*batch));
+            break;
+        }
+        batch->lines_count = batch->commands_count = 0;
+        previous_pid = -1;
+        for (i = 0; i < queue.chunks_count; i++) {
+            size_t r;
+
+            // a command doesn't span several files
+            if (0 == i || queue.chunks[i - 1].path != queue.chunks[i].path) {
+                previous_pid = -1;
+            }
+            for (r = 0; r < queue.chunks[i].records_count; r++) {
+                if (((time_t) -1) == queue.chunks[i].records[r].at) {
+                    ++stats->invalid;
+                    continue;
+                }
+                if (((time_t) -1) != oldest && queue.chunks[i].records[r].at >= oldest) {
+                    ++stats->skipped;
+                    continue;
+                }
+                if (!batch_append(db, batch, &queue.chunks[i], &queue.chunks[i].records[r], &previous_pid, stats, error)) {
+                    break;
+                }
+            }
+            if (r < queue.chunks[i].records_count) {
+                break;
+            }
+        }
+        if (i < queue.chunks_count || !batch_flush(db, batch, stats, error)) {
+            break;
+        }
+        ok = true;
+    } while (false);
+    free(batch);
+    for (i = 0; i < queue.chunks_count; i++) {
+        free(queue.chunks[i].strings);
+        free(queue.chunks[i].records);
+        if (NULL != queue.chunks[i].error) {
+            error_free(&queue.chunks[i].error);
+        }
+    }
+    free(queue.chunks);
+    for (i = 0; i < files_count; i++) {
+        import_file_close(&files[i]);
+    }
+    free(files);
+
+    return ok;
+}
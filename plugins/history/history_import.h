@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "history_db.h"
+
+/**
+ * Counters of a run of history_import
+ */
+typedef struct {
+    // lines logged by pkg
+    size_t lines;
+    // lines logged by pkg which are not a package operation or can't be parsed
+    size_t invalid;
+    // operations not older than the history (recorded by the plugin)
+    size_t skipped;
+    size_t operations;
+    size_t commands;
+} history_import_stats_t;
+
+bool history_import(sqlite_db_t *, const char **, size_t, int, history_import_stats_t *, char **);
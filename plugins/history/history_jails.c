@@ -0,0 +1,429 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h> /* PRId64 */
+#include <sys/param.h> /* __FreeBSD__ */
+#if defined(__FreeBSD__)
+# include <sys/uio.h>
+# include <sys/jail.h>
+#endif /* FreeBSD */
+
+#include "common.h"
+#include "error/error.h"
+#include "kissc/ascii.h"
+#include "shared/path_join.h"
+#include "history_db.h"
+#include "history_jails.h"
+
+/**
+ * Listing of the histories of the jails of the host at once (pkg history
+ * --jails), each jail having its own history.sqlite under its root.
+ *
+ * The databases are attached to the connection by groups (as many as
+ * sqlite allows, 10 by default). The lines of a group are read by a single
+ * compound query: a branch by jail, each one walking the index on the date
+ * of its commands for its own limit, then UNION ALL with an ORDER BY to
+ * merge them. The merged rows of each group are kept (with the jail they
+ * come from) in TABLE_JAIL_LINES, read in turn, as a whole, by
+ * STMT_LIST_JAIL_LINES: the rows are sorted across all the groups and the
+ * temporary table never holds more than limit rows per group.
+ *
+ * NOTE:
+ * - the jails have to be at the current version of the schema (pkg -j
+ *   <jail> history upgrades it)
+ * - the root of a jail controls its content: its history is looked for
+ *   under the PKG_DBDIR of its own configuration, by a path resolved on the
+ *   host which has to stay in the jail, and attached read-only, its schema
+ *   untrusted (see sqlite_trusted_schema)
+ */
+
+#define JAIL_SCHEMA_FORMAT "history_jail_%zu"
+
+// a table of the jail, the (quoted) name of its schema is the next argument of snprintf
+#define JAIL(table) \
+    "\"%s\"." table
+
+/**
+ * Arguments: the index of the jail, its schema 7 times, whether there is no
+ * package to match (1 or 0), the schema, the collation of the names, then
+ * the ones of JAIL_FILTER
+ */
+#define JAIL_BRANCH \
+    "SELECT * FROM (" \
+    "SELECT %zu AS jail_id, c.id AS command_id, c.inserted_at, c.command, l.id AS line_id," \
+    " n.value AS name, o.value AS origin, r.value AS repo, ov.value AS old_version, nv.value AS new_version, l.operation_id" \
+    " FROM " JAIL(TABLE_COMMANDS) " c" \
+    " JOIN " JAIL(TABLE_PACKAGES) " l ON c.id = l.command_id" \
+    " LEFT JOIN " JAIL(TABLE_NAMES) " n ON n.id = l.name_id" \
+    " LEFT JOIN " JAIL(TABLE_ORIGINS) " o ON o.id = l.origin_id" \
+    " LEFT JOIN " JAIL(TABLE_REPOSITORIES) " r ON r.id = l.repo_id" \
+    " LEFT JOIN " JAIL(TABLE_VERSIONS) " ov ON ov.id = l.old_version_id" \
+    " LEFT JOIN " JAIL(TABLE_VERSIONS) " nv ON nv.id = l.new_version_id" \
+    " WHERE (%d OR l.name_id IN (SELECT id FROM " JAIL(TABLE_NAMES) " WHERE value%s IN (SELECT pattern FROM temp." TABLE_SEARCHED ")))" \
+    JAIL_FILTER \
+    ")"
+
+// arguments: from, to, the operations then the limit (-1 for none)
+#define JAIL_FILTER \
+    " AND (c.inserted_at BETWEEN %" PRId64 " AND %" PRId64 ") AND (l.operation_id & %d) <> 0" \
+    " ORDER BY c.inserted_at DESC, l.id DESC" \
+    " LIMIT %d"
+
+// the order of STMT_LIST_JAIL_LINES
+#define JAIL_LINES_ORDER \
+    " ORDER BY inserted_at DESC, jail_id, line_id DESC"
+
+/**
+ * Appends to w (up to end) the branch of the compound query of the
+ * jail attached as schema, the index of the jail in the array given to
+ * history_jails_collect being jail_id
+ */
+static char *jail_branch(char *w, const char *end, size_t jail_id, const char *schema, const history_jails_filter_t *filter)
+{
+    int written;
+
+    written = snprintf(
+        w, end - w, JAIL_BRANCH,
+        jail_id, schema, schema, schema, schema, schema, schema, schema,
+        (int) !filter->searched, schema, filter->case_sensitive ? "" : " COLLATE NOCASE",
+        (int64_t) filter->from, (int64_t) filter->to, filter->operations, 0 == filter->limit ? -1 : filter->limit
+    );
+
+    return written < 0 || written >= end - w ? NULL : w + written;
+}
+
+/**
+ * Reads the lines matching filter of the count jails attached to db (as
+ * JAIL_SCHEMA_FORMAT 0 to count - 1, the index of the first one in the array
+ * given to history_jails_collect being first) into TABLE_JAIL_LINES
+ */
+static bool collect_group(sqlite_db_t *db, size_t first, size_t count, const history_jails_filter_t *filter, char **error)
+{
+    bool ok;
+    size_t i, query_size;
+    char *query, *w, *end;
+
+    ok = false;
+    // the schemas and the numbers expand a branch by less than 512 bytes
+    query_size = count * (STR_SIZE(JAIL_BRANCH) + STR_SIZE(" UNION ALL ") + 512);
+    if (NULL == (query = malloc(query_size))) {
+        set_malloc_error(error, query_size);
+        return false;
+    }
+    w = query;
+    end = query + query_size;
+    for (i = 0; i < count; i++) {
+        char schema[STR_SIZE(JAIL_SCHEMA_FORMAT) + 20];
+
+        snprintf(schema, STR_SIZE(schema), JAIL_SCHEMA_FORMAT, i);
+        if (0 != i) {
+            memcpy(w, " UNION ALL ", STR_LEN(" UNION ALL "));
+            w += STR_LEN(" UNION ALL ");
+        }
+        if (NULL == (w = jail_branch(w, end, first + i, schema, filter))) {
+            set_generic_error(error, "the query of the jails overflowed its buffer of %zu bytes", query_size);
+            break;
+        }
+    }
+    if (i == count) {
+        ok = sqlite_execf(
+            db, error,
+            "INSERT INTO temp." TABLE_JAIL_LINES "(" JAIL_LINES_COLUMNS ") %s" JAIL_LINES_ORDER " LIMIT %d",
+            query, 0 == filter->limit ? -1 : filter->limit
+        );
+    }
+    free(query);
+
+    return ok;
+}
+
+/**
+ * Collects into TABLE_JAIL_LINES, to be read by STMT_LIST_JAIL_LINES, the
+ * lines matching filter of the histories of the count jails
+ */
+bool history_jails_collect(sqlite_db_t *db, const history_jail_t *jails, size_t count, const history_jails_filter_t *filter, char **error)
+{
+    bool ok, trusted;
+    size_t first, group_size;
+
+    if (!sqlite_exec(db, "DELETE FROM temp." TABLE_JAIL_LINES, error)) {
+        return false;
+    }
+    // the schemas of the jails are not trusted, db only reads while they are attached
+    if (!sqlite_trusted_schema(db, false, &trusted, error)) {
+        return false;
+    }
+    ok = true;
+    group_size = (size_t) sqlite_attached_limit(db);
+    for (first = 0; ok && first < count; first += group_size) {
+        size_t i, attached;
+        char schema[STR_SIZE(JAIL_SCHEMA_FORMAT) + 20];
+
+        attached = 0;
+        for (i = first; i < count && i < first + group_size; i++) {
+            user_version_t version;
+
+            snprintf(schema, STR_SIZE(schema), JAIL_SCHEMA_FORMAT, i - first);
+            if (!(ok = sqlite_attach(db, jails[i].path, schema, error))) {
+                break;
+            }
+            ++attached;
+            if (!(ok = sqlite_attached_user_version(db, schema, &version, error))) {
+                break;
+            }
+            if (HISTORY_VERSION_NUMBER != version) {
+                set_generic_error(error, "the history of the jail %s (%s) is at version %" PRId64 " of the schema instead of %d, run pkg -j %s history to upgrade it", jails[i].name, jails[i].path, version, HISTORY_VERSION_NUMBER, jails[i].name);
+                ok = false;
+                break;
+            }
+        }
+        if (ok) {
+            ok = collect_group(db, first, attached, filter, error);
+        }
+        for (i = 0; i < attached; i++) {
+            snprintf(schema, STR_SIZE(schema), JAIL_SCHEMA_FORMAT, i);
+            sqlite_detach(db, schema, NULL);
+        }
+    }
+    // back for the triggers (FTS5) of the main schema
+    if (!sqlite_trusted_schema(db, trusted, NULL, ok ? error : NULL)) {
+        ok = false;
+    }
+
+    return ok;
+}
+
+#if defined(__FreeBSD__)
+/**
+ * Tells if the jail name is part of selection: "all" or a comma separated
+ * list of names
+ */
+static bool jail_selected(const char *selection, const char *name)
+{
+    size_t name_len;
+    const char *p, *comma;
+
+    if (0 == strcmp(selection, "all")) {
+        return true;
+    }
+    name_len = strlen(name);
+    for (p = selection; '\0' != *p; p = '\0' == *comma ? comma : comma + 1) {
+        if (NULL == (comma = strchr(p, ','))) {
+            comma = p + strlen(p);
+        }
+        if ((size_t) (comma - p) == name_len && 0 == memcmp(p, name, name_len)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * The configuration of pkg in a jail, relative to its root, and the default
+ * of PKG_DBDIR
+ */
+#define JAIL_PKG_CONF "/usr/local/etc/pkg.conf"
+#define JAIL_DEFAULT_DBDIR "/var/db/pkg"
+
+/**
+ * Resolves path, under the root (itself resolved) of a jail, into resolved
+ * (MAXPATHLEN bytes). The content of the jail is controlled by its own root
+ * but its paths resolve on the host: a path which a symlink takes out of
+ * the root is refused. found is set to false if path doesn't exist.
+ */
+static bool jail_resolve(const char *root, const char *path, char *resolved, bool *found, char **error)
+{
+    size_t root_len;
+
+    *found = false;
+    if (NULL == realpath(path, resolved)) {
+        if (ENOENT == errno || ENOTDIR == errno) {
+            return true;
+        }
+        set_system_error(error, "realpath(3) failed for %s", path);
+        return false;
+    }
+    *found = true;
+    root_len = strlen(root);
+    // a root of "/" is a prefix of any path
+    if (1 != root_len && (0 != strncmp(resolved, root, root_len) || ('/' != resolved[root_len] && '\0' != resolved[root_len]))) {
+        set_generic_error(error, "%s resolves to %s, outside of the root %s of its jail", path, resolved, root);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Reads into dbdir (MAXPATHLEN bytes) the PKG_DBDIR of the jail which root
+ * is given: the one set by its pkg.conf, else the default of pkg.
+ *
+ * NOTE: pkg.conf is not parsed as UCL, only a line PKG_DBDIR [=:] value
+ * (quoted or not) is looked for
+ */
+static bool jail_dbdir(const char *root, char *dbdir, char **error)
+{
+    FILE *fp;
+    bool found;
+    char path[MAXPATHLEN], resolved[MAXPATHLEN], line[MAXPATHLEN + 64];
+
+    strcpy(dbdir, JAIL_DEFAULT_DBDIR);
+    if (!path_join(path, path + STR_SIZE(path), error, root, JAIL_PKG_CONF, NULL) || !jail_resolve(root, path, resolved, &found, error)) {
+        return false;
+    }
+    if (!found) {
+        return true;
+    }
+    if (NULL == (fp = fopen(resolved, "r"))) {
+        set_system_error(error, "fopen(3) failed for %s", resolved);
+        return false;
+    }
+    while (NULL != fgets(line, STR_SIZE(line), fp)) {
+        char *p;
+        size_t value_len;
+
+        p = line + strspn(line, " \t");
+        if (0 != ascii_strncasecmp(p, "PKG_DBDIR", STR_LEN("PKG_DBDIR"))) {
+            continue;
+        }
+        p += STR_LEN("PKG_DBDIR");
+        if (' ' != *p && '\t' != *p && '=' != *p && ':' != *p && '"' != *p && '\'' != *p) {
+            continue;
+        }
+        p += strspn(p, " \t=:");
+        if ('"' == *p || '\'' == *p) {
+            char *quote;
+
+            if (NULL == (quote = strchr(p + 1, *p))) {
+                continue;
+            }
+            ++p;
+            value_len = quote - p;
+        } else {
+            value_len = strcspn(p, " \t;,#\r\n");
+        }
+        // a relative (or empty) PKG_DBDIR is ignored
+        if ('/' == *p && value_len < MAXPATHLEN) {
+            memcpy(dbdir, p, value_len);
+            dbdir[value_len] = '\0';
+        }
+    }
+    fclose(fp);
+
+    return true;
+}
+#endif /* FreeBSD */
+
+/**
+ * Finds the running jails of selection ("all" or a comma separated list of
+ * names) which have a history, under the PKG_DBDIR of their own pkg.conf in
+ * their root. The array (to free) of the count jails found is written to
+ * jails.
+ *
+ * NOTE:
+ * - a jail without a history (no pkg or no plugin in it) is skipped
+ *   but, when the jails are named, all of them have to be running.
+ * - a history which a symlink takes out of the root of its jail is an error
+ */
+bool history_jails_find(const char *selection, history_jail_t **jails, size_t *count, char **error)
+{
+#if defined(__FreeBSD__)
+    bool ok;
+    int jid, lastjid;
+    size_t allocated, selected;
+    struct iovec iov[6];
+    history_jail_t jail;
+
+    ok = true;
+    *count = 0;
+    *jails = NULL;
+    allocated = 0;
+    selected = 0;
+    lastjid = 0;
+    iov[0].iov_base = (void *) "lastjid";
+    iov[0].iov_len = STR_SIZE("lastjid");
+    iov[1].iov_base = &lastjid;
+    iov[1].iov_len = sizeof(lastjid);
+    iov[2].iov_base = (void *) "name";
+    iov[2].iov_len = STR_SIZE("name");
+    iov[3].iov_base = jail.name;
+    iov[3].iov_len = STR_SIZE(jail.name);
+    iov[4].iov_base = (void *) "path";
+    iov[4].iov_len = STR_SIZE("path");
+    iov[5].iov_base = jail.path;
+    iov[5].iov_len = STR_SIZE(jail.path);
+    while (ok && -1 != (jid = jail_get(iov, ARRAY_SIZE(iov), 0))) {
+        bool found;
+        char root[MAXPATHLEN], dbdir[MAXPATHLEN], path[MAXPATHLEN];
+
+        lastjid = jid;
+        if (!jail_selected(selection, jail.name)) {
+            continue;
+        }
+        ++selected;
+        if (NULL == realpath(jail.path, root)) {
+            set_system_error(error, "realpath(3) failed for the root %s of the jail %s", jail.path, jail.name);
+            ok = false;
+            break;
+        }
+        if (!(ok = jail_dbdir(root, dbdir, error))) {
+            break;
+        }
+        if (!(ok = path_join(path, path + STR_SIZE(path), error, root, dbdir, "history.sqlite", NULL))) {
+            break;
+        }
+        // attached by its resolved path, checked to be in the jail
+        if (!(ok = jail_resolve(root, path, jail.path, &found, error))) {
+            break;
+        }
+        if (!found) {
+            continue;
+        }
+        if (*count == allocated) {
+            history_jail_t *tmp;
+
+            allocated = MAX((size_t) 8, allocated * 2);
+            if (!(ok = NULL != (tmp = realloc(*jails, sizeof(*tmp) * allocated)))) {
+                set_malloc_error(error, sizeof(*tmp) * allocated);
+                break;
+            }
+            *jails = tmp;
+        }
+        jail.jid = jid;
+        (*jails)[(*count)++] = jail;
+    }
+    if (ok && ENOENT != errno) {
+        set_system_error(error, "jail_get failed");
+        ok = false;
+    }
+    if (ok && 0 != strcmp(selection, "all")) {
+        size_t expected;
+        const char *p;
+
+        for (expected = 1, p = selection; NULL != (p = strchr(p, ',')); p++) {
+            ++expected;
+        }
+        if (selected != expected) {
+            set_generic_error(error, "only %zu of the %zu jails of '%s' are running", selected, expected, selection);
+            ok = false;
+        }
+    }
+    if (!ok) {
+        free(*jails);
+        *jails = NULL;
+        *count = 0;
+    }
+
+    return ok;
+#else
+    (void) selection; // quiet warning unused parameter 'selection' outside of FreeBSD
+
+    *jails = NULL;
+    *count = 0;
+    set_generic_error(error, "jails are only supported on FreeBSD");
+
+    return false;
+#endif /* FreeBSD */
+}
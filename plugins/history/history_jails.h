@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/param.h> /* MAXHOSTNAMELEN, MAXPATHLEN */
+
+#include "history_db.h"
+
+/**
+ * A running jail and the path, as seen from the host, of its history
+ */
+typedef struct {
+    int jid;
+    char name[MAXHOSTNAMELEN];
+    char path[MAXPATHLEN];
+} history_jail_t;
+
+/**
+ * The lines to collect from the histories of the jails: the ones of the
+ * operations, between from and to, and, if searched, of the packages of
+ * TABLE_SEARCHED (matched exactly, case insensitively unless
+ * case_sensitive), at most limit (0 for no limit)
+ */
+typedef struct {
+    int operations;
+    time_t from, to;
+    int limit;
+    bool searched, case_sensitive;
+} history_jails_filter_t;
+
+bool history_jails_find(const char *, history_jail_t **, size_t *, char **);
+bool history_jails_collect(sqlite_db_t *, const history_jail_t *, size_t, const history_jails_filter_t *, char **);
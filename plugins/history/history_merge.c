@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h> /* PRId64 */
+
+#include "common.h"
+#include "error/error.h"
+#include "history_db.h"
+#include "history_merge.h"
+
+/**
+ * Merge of the histories of several hosts into a single database, to query
+ * them at once (see STMT_HOSTS_RUNNING).
+ *
+ * The sources are attached to the connection by groups (as many as sqlite
+ * allows, 10 by default) and each group is merged in a transaction. For
+ * each source, set-wise:
+ * 1. the strings missing from the dictionaries are added, sorted
+ * 2. its commands are hashed: their dates, their command line and the
+ *    content (not the identifiers, which differ from a database to another)
+ *    of their lines
+ * 3. the ones whose (host, hash) is already in the database are skipped,
+ *    so merging again a source (or a newer copy of it) only adds its new
+ *    commands
+ * 4. the others are inserted, sorted by date, then their lines, sorted by
+ *    command: the indexes of the database are appended to rather than
+ *    updated at random
+ * 5. the changes to the files of these lines (see history_files.c) are
+ *    copied with the paths they changed, the lines being mapped by their
+ *    rank in the insertion order (they get consecutive identifiers)
+ *
+ * The triggers maintaining the statistics are suspended for the
+ * transaction, the merged lines are counted at once by source instead.
+ *
+ * NOTE:
+ * - the sources are attached read-only: they are never created, upgraded
+ *   or written. They have to be at the current version of the schema, all
+ *   of them are checked before any is merged
+ * - the checkpoints are not taken, they make no sense across hosts
+ */
+
+#define SOURCE_SCHEMA_FORMAT "history_source_%zu"
+// a source being checked (see merge_check_source)
+#define CHECKED_SCHEMA "history_checked"
+
+#define TABLE_MERGED "history_merged"
+
+#define CREATE_TABLE_MERGED \
+    "CREATE TEMP TABLE IF NOT EXISTS " TABLE_MERGED "(\n" \
+    "    source_id INTEGER NOT NULL PRIMARY KEY,\n" \
+    "    host_id INT NOT NULL,\n" \
+    "    content_hash INT NOT NULL,\n" \
+    "    target_id INT NULL\n" \
+    ");\n" \
+    "CREATE INDEX IF NOT EXISTS temp." TABLE_MERGED "_hash_index ON " TABLE_MERGED "(host_id, content_hash);"
+
+#define TABLE_MERGED_LINES "history_merged_lines"
+
+#define CREATE_TABLE_MERGED_LINES \
+    "CREATE TEMP TABLE IF NOT EXISTS " TABLE_MERGED_LINES "(\n" \
+    "    rank INTEGER NOT NULL PRIMARY KEY,\n" \
+    "    source_id INT NOT NULL,\n" \
+    "    target_id INT NULL\n" \
+    ");"
+
+// a table of the source, the (quoted) name of its schema is the next argument of sqlite_execf
+#define SOURCE(table) \
+    "\"%w\"." table
+
+#define MERGE_DICTIONARY(table) \
+    "INSERT OR IGNORE INTO main." table "(value) SELECT value FROM " SOURCE(table) " ORDER BY value"
+
+// arguments: the host, then the schema
+#define MERGE_HOSTS \
+    "INSERT OR IGNORE INTO main." TABLE_HOSTS "(value) VALUES(%Q);\n" \
+    MERGE_DICTIONARY(TABLE_HOSTS)
+
+// arguments: the schema 8 times then the host
+#define MERGE_HASH_COMMANDS \
+    "DELETE FROM temp." TABLE_MERGED ";\n" \
+    "INSERT INTO temp." TABLE_MERGED "(source_id, host_id, content_hash)" \
+    " SELECT c.id, h.id, fnv1a64(c.inserted_at, c.started_at, c.finished_at, c.command, (" \
+    "SELECT group_concat(line_hash) FROM (" \
+    "SELECT fnv1a64(l.operation_id, r.value, n.value, o.value, ov.value, nv.value) AS line_hash" \
+    " FROM " SOURCE(TABLE_PACKAGES) " l" \
+    " LEFT JOIN " SOURCE(TABLE_REPOSITORIES) " r ON r.id = l.repo_id" \
+    " JOIN " SOURCE(TABLE_NAMES) " n ON n.id = l.name_id" \
+    " JOIN " SOURCE(TABLE_ORIGINS) " o ON o.id = l.origin_id" \
+    " LEFT JOIN " SOURCE(TABLE_VERSIONS) " ov ON ov.id = l.old_version_id" \
+    " JOIN " SOURCE(TABLE_VERSIONS) " nv ON nv.id = l.new_version_id" \
+    " WHERE l.command_id = c.id ORDER BY l.id" \
+    ")))" \
+    " FROM " SOURCE(TABLE_COMMANDS) " c" \
+    " JOIN main." TABLE_HOSTS " h ON h.value = COALESCE((SELECT value FROM " SOURCE(TABLE_HOSTS) " WHERE id = c.host_id), %Q)"
+
+// no argument: the commands already merged (or twice in the source) are skipped
+#define MERGE_SKIP_DUPLICATES \
+    "DELETE FROM temp." TABLE_MERGED \
+    " WHERE EXISTS(SELECT 1 FROM main." TABLE_COMMANDS " c WHERE c.host_id = " TABLE_MERGED ".host_id AND c.content_hash = " TABLE_MERGED ".content_hash)" \
+    " OR source_id > (SELECT MIN(m.source_id) FROM temp." TABLE_MERGED " m WHERE m.host_id = " TABLE_MERGED ".host_id AND m.content_hash = " TABLE_MERGED ".content_hash)"
+
+// argument: the schema
+#define MERGE_COMMANDS \
+    "INSERT INTO main." TABLE_COMMANDS "(inserted_at, command, started_at, finished_at, fetch_duration, jobs_count, host_id, content_hash)" \
+    " SELECT c.inserted_at, c.command, c.started_at, c.finished_at, c.fetch_duration, c.jobs_count, m.host_id, m.content_hash" \
+    " FROM temp." TABLE_MERGED " m" \
+    " JOIN " SOURCE(TABLE_COMMANDS) " c ON c.id = m.source_id" \
+    " ORDER BY c.inserted_at, c.id"
+
+// no argument: the identifiers given to the merged commands, found back through the content hash index
+#define MERGE_MAP_COMMANDS \
+    "UPDATE temp." TABLE_MERGED " SET target_id = (" \
+    "SELECT c.id FROM main." TABLE_COMMANDS " c WHERE c.host_id = " TABLE_MERGED ".host_id AND c.content_hash = " TABLE_MERGED ".content_hash" \
+    ")"
+
+// arguments: the schema 6 times
+#define MERGE_LINES \
+    "INSERT INTO main." TABLE_PACKAGES "(command_id, operation_id, repo_id, name_id, origin_id, old_version_id, new_version_id, new_flatsize, old_flatsize)" \
+    " SELECT m.target_id, l.operation_id, tr.id, tn.id, tto.id, tov.id, tnv.id, l.new_flatsize, l.old_flatsize" \
+    " FROM temp." TABLE_MERGED " m" \
+    " JOIN " SOURCE(TABLE_PACKAGES) " l ON l.command_id = m.source_id" \
+    " LEFT JOIN " SOURCE(TABLE_REPOSITORIES) " r ON r.id = l.repo_id" \
+    " LEFT JOIN main." TABLE_REPOSITORIES " tr ON tr.value = r.value" \
+    " JOIN " SOURCE(TABLE_NAMES) " n ON n.id = l.name_id" \
+    " JOIN main." TABLE_NAMES " tn ON tn.value = n.value" \
+    " JOIN " SOURCE(TABLE_ORIGINS) " o ON o.id = l.origin_id" \
+    " JOIN main." TABLE_ORIGINS " tto ON tto.value = o.value" \
+    " LEFT JOIN " SOURCE(TABLE_VERSIONS) " ov ON ov.id = l.old_version_id" \
+    " LEFT JOIN main." TABLE_VERSIONS " tov ON tov.value = ov.value" \
+    " JOIN " SOURCE(TABLE_VERSIONS) " nv ON nv.id = l.new_version_id" \
+    " JOIN main." TABLE_VERSIONS " tnv ON tnv.value = nv.value" \
+    " ORDER BY m.target_id, l.id"
+
+// argument: the schema, the lines are ranked in the order of MERGE_LINES
+#define MERGE_RANK_LINES \
+    "DELETE FROM temp." TABLE_MERGED_LINES ";\n" \
+    "INSERT INTO temp." TABLE_MERGED_LINES "(rank, source_id)" \
+    " SELECT ROW_NUMBER() OVER (ORDER BY m.target_id, l.id), l.id" \
+    " FROM temp." TABLE_MERGED " m" \
+    " JOIN " SOURCE(TABLE_PACKAGES) " l ON l.command_id = m.source_id"
+
+// no argument: right after MERGE_LINES, the last inserted line is the last ranked one
+#define MERGE_MAP_LINES \
+    "UPDATE temp." TABLE_MERGED_LINES " SET target_id = rank" \
+    " + (SELECT MAX(id) FROM main." TABLE_PACKAGES ")" \
+    " - (SELECT MAX(rank) FROM temp." TABLE_MERGED_LINES ")"
+
+// arguments: the schema twice
+#define MERGE_PATHS \
+    "INSERT OR IGNORE INTO main." TABLE_PATHS "(directory_id, name)" \
+    " SELECT td.id, p.name" \
+    " FROM " SOURCE(TABLE_PATHS) " p" \
+    " JOIN " SOURCE(TABLE_DIRECTORIES) " d ON d.id = p.directory_id" \
+    " JOIN main." TABLE_DIRECTORIES " td ON td.value = d.value" \
+    " ORDER BY 1, 2"
+
+// argument: the schema
+#define MERGE_FILES \
+    "INSERT INTO main." TABLE_FILES "(line_id, added_count, removed_count, data)" \
+    " SELECT ml.target_id, f.added_count, f.removed_count, f.data" \
+    " FROM temp." TABLE_MERGED_LINES " ml" \
+    " JOIN " SOURCE(TABLE_FILES) " f ON f.line_id = ml.source_id" \
+    " ORDER BY ml.target_id"
+
+// arguments: the schema 3 times
+#define MERGE_PATH_LINES \
+    "INSERT INTO main." TABLE_PATH_LINES "(path_id, line_id)" \
+    " SELECT tp.id, ml.target_id" \
+    " FROM temp." TABLE_MERGED_LINES " ml" \
+    " JOIN " SOURCE(TABLE_PATH_LINES) " pl ON pl.line_id = ml.source_id" \
+    " JOIN " SOURCE(TABLE_PATHS) " p ON p.id = pl.path_id" \
+    " JOIN " SOURCE(TABLE_DIRECTORIES) " d ON d.id = p.directory_id" \
+    " JOIN main." TABLE_DIRECTORIES " td ON td.value = d.value" \
+    " JOIN main." TABLE_PATHS " tp ON tp.directory_id = td.id AND tp.name = p.name" \
+    " ORDER BY 1, 2"
+
+static bool merge_source(sqlite_db_t *db, const char *schema, const char *host, history_merge_stats_t *stats, char **error)
+{
+    bool ok;
+
+    ok = false;
+    do {
+        if (!sqlite_execf(db, error, MERGE_HOSTS, host, schema)) {
+            break;
+        }
+        if (
+            !sqlite_execf(db, error, MERGE_DICTIONARY(TABLE_REPOSITORIES), schema)
+            || !sqlite_execf(db, error, MERGE_DICTIONARY(TABLE_NAMES), schema)
+            || !sqlite_execf(db, error, MERGE_DICTIONARY(TABLE_ORIGINS), schema)
+            || !sqlite_execf(db, error, MERGE_DICTIONARY(TABLE_VERSIONS), schema)
+        ) {
+            break;
+        }
+        if (!sqlite_execf(db, error, MERGE_HASH_COMMANDS, schema, schema, schema, schema, schema, schema, schema, schema, host)) {
+            break;
+        }
+        if (!sqlite_exec(db, MERGE_SKIP_DUPLICATES, error)) {
+            break;
+        }
+        stats->duplicates += sqlite_affected_rows(db);
+        if (!sqlite_execf(db, error, MERGE_COMMANDS, schema)) {
+            break;
+        }
+        stats->commands += sqlite_affected_rows(db);
+        if (!sqlite_exec(db, MERGE_MAP_COMMANDS, error)) {
+            break;
+        }
+        if (!sqlite_execf(db, error, MERGE_RANK_LINES, schema)) {
+            break;
+        }
+        if (!sqlite_execf(db, error, MERGE_LINES, schema, schema, schema, schema, schema, schema)) {
+            break;
+        }
+        stats->operations += sqlite_affected_rows(db);
+        if (!sqlite_exec(db, MERGE_MAP_LINES, error)) {
+            break;
+        }
+        if (
+            !sqlite_execf(db, error, MERGE_DICTIONARY(TABLE_DIRECTORIES), schema)
+            || !sqlite_execf(db, error, MERGE_PATHS, schema, schema)
+            || !sqlite_execf(db, error, MERGE_FILES, schema)
+            || !sqlite_execf(db, error, MERGE_PATH_LINES, schema, schema, schema)
+        ) {
+            break;
+        }
+        if (!history_db_stats_add(db, "l.command_id IN (SELECT target_id FROM temp." TABLE_MERGED ")", error)) {
+            break;
+        }
+        ok = true;
+    } while (false);
+
+    return ok;
+}
+
+/**
+ * Checks that the source at path is a history at the current version of
+ * the schema
+ */
+static bool merge_check_source(sqlite_db_t *db, const char *path, char **error)
+{
+    bool ok;
+    user_version_t version;
+
+    if (!sqlite_attach(db, path, CHECKED_SCHEMA, error)) {
+        return false;
+    }
+    if ((ok = sqlite_attached_user_version(db, CHECKED_SCHEMA, &version, error)) && HISTORY_VERSION_NUMBER != version) {
+        set_generic_error(error, "%s is at version %" PRId64 " of the schema instead of %d (run pkg history of this version on it, as root, to upgrade it)", path, version, HISTORY_VERSION_NUMBER);
+        ok = false;
+    }
+    sqlite_detach(db, CHECKED_SCHEMA, NULL);
+
+    return ok;
+}
+
+/**
+ * Merges the count sources into db
+ */
+bool history_merge(sqlite_db_t *db, const history_merge_source_t *sources, size_t count, history_merge_stats_t *stats, char **error)
+{
+    bool ok;
+    size_t first, group_size;
+
+    ok = true;
+    stats->sources = stats->commands = stats->operations = stats->duplicates = 0;
+    if (!sqlite_exec(db, CREATE_TABLE_MERGED CREATE_TABLE_MERGED_LINES, error)) {
+        return false;
+    }
+    for (first = 0; first < count; first++) {
+        if (!merge_check_source(db, sources[first].path, error)) {
+            return false;
+        }
+    }
+    group_size = (size_t) sqlite_attached_limit(db);
+    for (first = 0; ok && first < count; first += group_size) {
+        size_t i, attached;
+        char schema[STR_SIZE(SOURCE_SCHEMA_FORMAT) + 20];
+
+        attached = 0;
+        do {
+            for (i = first; i < count && i < first + group_size; i++) {
+                snprintf(schema, STR_SIZE(schema), SOURCE_SCHEMA_FORMAT, i - first);
+                if (!(ok = sqlite_attach(db, sources[i].path, schema, error))) {
+                    break;
+                }
+                ++attached;
+            }
+            if (!ok || !(ok = sqlite_transaction_begin(db, error))) {
+                break;
+            }
+            ok = history_db_stats_suspend(db, error);
+            for (i = 0; ok && i < attached; i++) {
+                snprintf(schema, STR_SIZE(schema), SOURCE_SCHEMA_FORMAT, i);
+                ok = merge_source(db, schema, sources[first + i].host, stats, error);
+            }
+            if (ok && (ok = history_db_stats_resume(db, error))) {
+                ok = sqlite_transaction_commit(db, error);
+            } else {
+                sqlite_transaction_rollback(db, NULL);
+            }
+        } while (false);
+        for (i = 0; i < attached; i++) {
+            snprintf(schema, STR_SIZE(schema), SOURCE_SCHEMA_FORMAT, i);
+            sqlite_detach(db, schema, NULL);
+        }
+        if (ok) {
+            stats->sources += attached;
+        }
+    }
+
+    return ok;
+}
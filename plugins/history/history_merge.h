@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "history_db.h"
+
+/**
+ * A database to merge and the name of the host it comes from (given to its
+ * local commands, the ones it merged itself keep their host)
+ */
+typedef struct {
+    const char *path;
+    const char *host;
+} history_merge_source_t;
+
+/**
+ * Counters of a run of history_merge
+ */
+typedef struct {
+    size_t sources;
+    size_t commands;
+    size_t operations;
+    // commands already in the database (merged before)
+    size_t duplicates;
+} history_merge_stats_t;
+
+bool history_merge(sqlite_db_t *, const history_merge_source_t *, size_t, history_merge_stats_t *, char **);
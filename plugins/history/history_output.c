@@ -0,0 +1,864 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h> /* PRId64 */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <langinfo.h>
+
+#include "common.h"
+#include "error/error.h"
+#include "history_db.h"
+#include "history_output.h"
+
+/**
+ * Renderers of the rows of the history:
+ * - the table, for humans, goes through stdio as it always did
+ * - the machine readable formats (one line per package operation) are
+ *   rendered into a single buffer, written to the file descriptor when
+ *   full, without any padding nor formatting (printf) involved
+ */
+
+static const struct {
+    const char *name;
+    history_format_t format;
+} formats[] = {
+    { "table", HISTORY_FORMAT_TABLE },
+    { "jsonl", HISTORY_FORMAT_JSONL },
+    { "csv", HISTORY_FORMAT_CSV },
+    { "tsv", HISTORY_FORMAT_TSV },
+};
+
+bool history_format_parse(const char *name, history_format_t *format)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(formats); i++) {
+        if (0 == strcmp(name, formats[i].name)) {
+            *format = formats[i].format;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#define DEFAULT_TIMESTAMP_FORMAT "%x %X"
+
+char *timestamp_to_localtime(time_t t, const char *format, char *buffer, const char * const buffer_end, char **error)
+{
+    char *w;
+    size_t written;
+    struct tm ltm = { 0 };
+
+    w = NULL;
+    do {
+        if (NULL == localtime_r(&t, &ltm)) {
+            set_generic_error(error, "localtime_r(3) failed");
+            break;
+        }
+        if (0 == (written = strftime(buffer, buffer_end - buffer, NULL == format ? DEFAULT_TIMESTAMP_FORMAT : format, &ltm))) {
+            set_generic_error(error, "strftime(3) failed");
+            break;
+        }
+        w = buffer + written;
+    } while (false);
+
+    return w;
+}
+
+/**
+ * The conversions timestamp_cache_render renders by itself: the numeric
+ * ones, zero padded (%e space padded), and the AM/PM of the locale. The
+ * others (names of the days and months, time zone, flags, modifiers, ...)
+ * are left to strftime.
+ */
+#define ARITHMETIC_CONVERSIONS "HMSIpdemyY%"
+
+/**
+ * Appends format to *w (up to end), the composite conversions being
+ * replaced by their definition (for %x and %X, the one of the locale, as
+ * strftime does). Returns false if format has a conversion out of
+ * ARITHMETIC_CONVERSIONS (or doesn't fit).
+ */
+static bool timestamp_format_expand(const char *format, char **w, const char *end, bool nested)
+{
+    const char *p;
+
+    for (p = format; '\0' != *p; p++) {
+        const char *expansion;
+
+        if ('%' != *p) {
+            if (*w == end) {
+                return false;
+            }
+            *(*w)++ = *p;
+            continue;
+        }
+        expansion = NULL;
+        switch (*++p) {
+            case 'x':
+                expansion = nl_langinfo(D_FMT);
+                break;
+            case 'X':
+                expansion = nl_langinfo(T_FMT);
+                break;
+            case 'T':
+                expansion = "%H:%M:%S";
+                break;
+            case 'D':
+                expansion = "%m/%d/%y";
+                break;
+            case 'R':
+                expansion = "%H:%M";
+                break;
+            case 'F':
+                expansion = "%Y-%m-%d";
+                break;
+        }
+        if (NULL != expansion) {
+            if (nested || !timestamp_format_expand(expansion, w, end, true)) {
+                return false;
+            }
+        } else if ('\0' == *p || NULL == strchr(ARITHMETIC_CONVERSIONS, *p) || end - *w < 2) {
+            return false;
+        } else {
+            *(*w)++ = '%';
+            *(*w)++ = *p;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Prepares cache to render timestamps in format (NULL for the default one
+ * of timestamp_to_localtime), it doesn't need to be released. The locale
+ * is expected to stay the same while cache is in use.
+ */
+void timestamp_cache_init(timestamp_cache_t *cache, const char *format)
+{
+    char *w;
+    const char *am, *pm;
+
+    cache->format = NULL == format ? DEFAULT_TIMESTAMP_FORMAT : format;
+    w = cache->expanded;
+    am = nl_langinfo(AM_STR);
+    pm = nl_langinfo(PM_STR);
+    cache->arithmetic =
+        strlen(am) < sizeof(cache->am) && strlen(pm) < sizeof(cache->pm)
+        && timestamp_format_expand(cache->format, &w, cache->expanded + sizeof(cache->expanded) - 1, false);
+    if (cache->arithmetic) {
+        *w = '\0';
+        strcpy(cache->am, am);
+        strcpy(cache->pm, pm);
+    }
+    // nothing cached: the first timestamp rendered, whatever it is, is out of [start;end[
+    cache->steady = false;
+    cache->start = cache->end = 0;
+}
+
+/**
+ * Caches the day starting at midnight if it is steady: the local time then
+ * runs from 00:00:00 to 23:59:59 of a same day (no change of the offset to
+ * UTC, no leap second)
+ */
+static bool timestamp_cache_day(timestamp_cache_t *cache, time_t midnight)
+{
+    time_t last;
+    struct tm first_tm, last_tm;
+
+    last = midnight + 86400 - 1;
+    if (NULL == localtime_r(&midnight, &first_tm) || NULL == localtime_r(&last, &last_tm)) {
+        return false;
+    }
+    if (
+        0 != first_tm.tm_hour || 0 != first_tm.tm_min || 0 != first_tm.tm_sec
+        || 23 != last_tm.tm_hour || 59 != last_tm.tm_min || 59 != last_tm.tm_sec
+        || first_tm.tm_year != last_tm.tm_year || first_tm.tm_yday != last_tm.tm_yday
+    ) {
+        return false;
+    }
+    cache->steady = true;
+    cache->start = midnight;
+    cache->end = midnight + 86400;
+    cache->midnight = first_tm;
+
+    return true;
+}
+
+/**
+ * Caches the day of t. While the offset to UTC doesn't change, its midnight
+ * is a whole number of days away from the one of the day cached, only the
+ * bounds of the day have to be checked. Otherwise, the midnight is found
+ * from the local time of t.
+ */
+static void timestamp_cache_refresh(timestamp_cache_t *cache, time_t t)
+{
+    time_t midnight;
+    struct tm ltm;
+
+    if (cache->steady) {
+        time_t days;
+
+        days = (t - cache->start) / 86400;
+        // round towards the past
+        if (t < cache->start + days * 86400) {
+            --days;
+        }
+        if (timestamp_cache_day(cache, cache->start + days * 86400)) {
+            return;
+        }
+    }
+    cache->steady = false;
+    // without a midnight, t is on its own
+    cache->start = t;
+    cache->end = t + 1;
+    if (NULL == localtime_r(&t, &ltm)) {
+        return;
+    }
+    midnight = t - (ltm.tm_hour * 3600 + ltm.tm_min * 60 + ltm.tm_sec);
+    if (!timestamp_cache_day(cache, midnight)) {
+        // the bounds of a day which isn't steady are approximative: its timestamps go through localtime_r anyway
+        cache->start = midnight;
+        cache->end = midnight + 86400;
+    }
+}
+
+static char *put_2digits(char *w, int value)
+{
+    *w++ = '0' + value / 10;
+    *w++ = '0' + value % 10;
+
+    return w;
+}
+
+/**
+ * Renders ltm into buffer by the expanded format of cache, as strftime
+ * would (NUL terminated, NULL if it doesn't fit)
+ */
+static char *timestamp_render_arithmetic(const timestamp_cache_t *cache, const struct tm *ltm, char *buffer, const char * const buffer_end)
+{
+    char *w;
+    const char *p, *ampm;
+
+    w = buffer;
+    ampm = ltm->tm_hour < 12 ? cache->am : cache->pm;
+    for (p = cache->expanded; '\0' != *p; p++) {
+        size_t needed;
+
+        // the characters written by the conversion (or the literal character) at p
+        if ('%' != *p) {
+            needed = 1;
+        } else if ('Y' == p[1]) {
+            needed = 4;
+        } else if ('p' == p[1]) {
+            needed = strlen(ampm);
+        } else if ('%' == p[1]) {
+            needed = 1;
+        } else {
+            needed = 2;
+        }
+        // and the NUL after them
+        if ((size_t) (buffer_end - w) <= needed) {
+            return NULL;
+        }
+        if ('%' != *p) {
+            *w++ = *p;
+            continue;
+        }
+        switch (*++p) {
+            case 'H':
+                w = put_2digits(w, ltm->tm_hour);
+                break;
+            case 'M':
+                w = put_2digits(w, ltm->tm_min);
+                break;
+            case 'S':
+                w = put_2digits(w, ltm->tm_sec);
+                break;
+            case 'I':
+                w = put_2digits(w, 0 == ltm->tm_hour % 12 ? 12 : ltm->tm_hour % 12);
+                break;
+            case 'p':
+                memcpy(w, ampm, needed);
+                w += needed;
+                break;
+            case 'd':
+                w = put_2digits(w, ltm->tm_mday);
+                break;
+            case 'e':
+                if (ltm->tm_mday < 10) {
+                    *w++ = ' ';
+                    *w++ = '0' + ltm->tm_mday;
+                } else {
+                    w = put_2digits(w, ltm->tm_mday);
+                }
+                break;
+            case 'm':
+                w = put_2digits(w, ltm->tm_mon + 1);
+                break;
+            case 'y':
+                w = put_2digits(w, (ltm->tm_year + 1900) % 100);
+                break;
+            case 'Y':
+                w = put_2digits(w, (ltm->tm_year + 1900) / 100);
+                w = put_2digits(w, (ltm->tm_year + 1900) % 100);
+                break;
+            case '%':
+                *w++ = '%';
+                break;
+        }
+    }
+    if (w == buffer_end) {
+        return NULL;
+    }
+    *w = '\0';
+
+    return w;
+}
+
+/**
+ * Renders t as timestamp_to_localtime(t, format given to timestamp_cache_init, ...)
+ * would: localtime_r only runs once a day, strftime only if the format (or
+ * the year, out of 1000 to 9999) can't be rendered arithmetically
+ */
+char *timestamp_cache_render(timestamp_cache_t *cache, time_t t, char *buffer, const char * const buffer_end, char **error)
+{
+    int seconds;
+    char *w;
+    size_t written;
+    struct tm ltm;
+
+    if (t < cache->start || t >= cache->end) {
+        timestamp_cache_refresh(cache, t);
+    }
+    if (!cache->steady || t < cache->start || t >= cache->end) {
+        return timestamp_to_localtime(t, cache->format, buffer, buffer_end, error);
+    }
+    seconds = (int) (t - cache->start);
+    ltm = cache->midnight;
+    ltm.tm_hour = seconds / 3600;
+    ltm.tm_min = seconds / 60 % 60;
+    ltm.tm_sec = seconds % 60;
+    // an empty string is an error of strftime too, it has the last word on an output which doesn't fit
+    if (cache->arithmetic && ltm.tm_year >= 1000 - 1900 && ltm.tm_year <= 9999 - 1900 && NULL != (w = timestamp_render_arithmetic(cache, &ltm, buffer, buffer_end)) && w != buffer) {
+        return w;
+    }
+    if (0 == (written = strftime(buffer, buffer_end - buffer, cache->format, &ltm))) {
+        set_generic_error(error, "strftime(3) failed");
+        return NULL;
+    }
+
+    return buffer + written;
+}
+
+/**
+ * timestamp_cache_render for a listing: if t can't be rendered, buffer
+ * gets instead its number of seconds since the Epoch, prefixed by a @
+ * (never an uninitialized buffer). Returns buffer.
+ */
+const char *timestamp_cache_display(timestamp_cache_t *cache, time_t t, char *buffer, const char * const buffer_end)
+{
+    if (NULL == timestamp_cache_render(cache, t, buffer, buffer_end, NULL)) {
+        snprintf(buffer, buffer_end - buffer, "@%" PRId64, (int64_t) t);
+    }
+
+    return buffer;
+}
+
+static const char *operation_names[] = {
+    [PKG_SHIFT_OP_INSTALL] = "Installed",
+    [PKG_SHIFT_OP_DEINSTALL] = "Deleted",
+    [PKG_SHIFT_OP_UPGRADE] = "Upgraded",
+};
+
+// same as the names of TABLE_OPERATIONS
+static const struct {
+    const char *name;
+    size_t name_len;
+} operation_keys[] = {
+    [PKG_SHIFT_OP_INSTALL] = { S("install") },
+    [PKG_SHIFT_OP_DEINSTALL] = { S("deinstall") },
+    [PKG_SHIFT_OP_UPGRADE] = { S("upgrade") },
+};
+
+static int operation_index(int operation)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(operation_names); i++) {
+        if (operation == (1<<i)) {
+            return (int) i;
+        }
+    }
+
+    return -1;
+}
+
+static const char *operation_name(int operation)
+{
+    int i;
+
+    return -1 == (i = operation_index(operation)) ? "???" : operation_names[i];
+}
+
+static void display_command(history_output_t *output, time_t inserted_at, const char *jail, const char *command)
+{
+    char datetime[STR_SIZE("dd/mm/YYYY HH:ii:ss")];
+
+    timestamp_cache_display(&output->dates, inserted_at, datetime, datetime + STR_SIZE(datetime));
+    if (NULL == jail) {
+        printf("On %s: %s\n", datetime, command);
+    } else {
+        printf("On %s in jail %s: %s\n", datetime, jail, command);
+    }
+}
+
+// #define REPO_PADDING_LEN      -20
+#define VERSION_PADDING_LEN   -20
+#define PACKAGE_PADDING_LEN   -40
+#define OPERATION_PADDING_LEN -20
+
+static void display_package_header(void)
+{
+    printf(
+        "\t%*s %*s %*s %*s %s\n",
+        OPERATION_PADDING_LEN, "Operation",
+        PACKAGE_PADDING_LEN, "Package",
+        VERSION_PADDING_LEN, "New version",
+        VERSION_PADDING_LEN, "Old version",
+        /*REPO_PADDING_LEN, */"Repository"
+    );
+}
+
+static void display_package(int operation, const char *name, const char *repo, const char *new_version, const char *old_version)
+{
+    printf(
+        "\t%*s %*s %*s %*s %s\n",
+        OPERATION_PADDING_LEN, operation_name(operation),
+        PACKAGE_PADDING_LEN, name,
+        VERSION_PADDING_LEN, new_version,
+        VERSION_PADDING_LEN, NULL == old_version ? "-" : old_version,
+        /*REPO_PADDING_LEN, */NULL == repo ? "-" : repo
+    );
+}
+
+static void output_table_row(history_output_t *output, const history_row_t *row)
+{
+    if (!output->grouped) {
+        display_command(output, row->inserted_at, output->jails ? row->jail : NULL, row->command);
+        display_package_header();
+    } else if (output->previous_command_id != row->command_id) {
+        if (-1 != output->previous_command_id) {
+            fputc('\n', stdout);
+        }
+        display_command(output, row->inserted_at, output->jails ? row->jail : NULL, row->command);
+        display_package_header();
+    }
+    display_package(row->operation, output->use_origin ? row->origin : row->name, row->repo, row->new_version, row->old_version);
+    if (!output->grouped) {
+        fputc('\n', stdout);
+    }
+    output->previous_command_id = row->command_id;
+}
+
+static bool output_write(int fd, const char *data, size_t data_len, char **error)
+{
+    while (data_len > 0) {
+        ssize_t written;
+
+        if (-1 == (written = write(fd, data, data_len))) {
+            if (EINTR == errno) {
+                continue;
+            }
+            set_system_error(error, "write(2) failed");
+            return false;
+        }
+        data += written;
+        data_len -= (size_t) written;
+    }
+
+    return true;
+}
+
+bool history_output_flush(history_output_t *output, char **error)
+{
+    bool ok;
+
+    if (HISTORY_FORMAT_TABLE == output->format) {
+        ok = 0 == fflush(stdout);
+        if (!ok) {
+            set_system_error(error, "fflush(3) failed");
+        }
+    } else {
+        ok = output_write(output->fd, output->buffer, output->w - output->buffer, error);
+        output->w = output->buffer;
+    }
+
+    return ok;
+}
+
+/**
+ * Makes room for (at least) len bytes in the buffer, returns false if it
+ * can't hold them even once flushed
+ */
+static inline bool output_reserve(history_output_t *output, size_t len, bool *ok, char **error)
+{
+    *ok = true;
+    if (((size_t) (output->buffer_end - output->w)) < len) {
+        *ok = history_output_flush(output, error);
+    }
+
+    return *ok && ((size_t) (output->buffer_end - output->w)) >= len;
+}
+
+static bool output_append_slow(history_output_t *output, const char *data, size_t data_len, char **error)
+{
+    bool ok;
+
+    if (output_reserve(output, data_len, &ok, error)) {
+        memcpy(output->w, data, data_len);
+        output->w += data_len;
+    } else if (ok) {
+        // bigger than the buffer itself (the buffer has just been flushed)
+        ok = output_write(output->fd, data, data_len, error);
+    }
+
+    return ok;
+}
+
+static inline bool output_append(history_output_t *output, const char *data, size_t data_len, char **error)
+{
+    if (((size_t) (output->buffer_end - output->w)) >= data_len) {
+        memcpy(output->w, data, data_len);
+        output->w += data_len;
+        return true;
+    }
+
+    return output_append_slow(output, data, data_len, error);
+}
+
+static inline bool output_char(history_output_t *output, char c, char **error)
+{
+    bool ok;
+
+    if (output_reserve(output, 1, &ok, error)) {
+        *output->w++ = c;
+    }
+
+    return ok;
+}
+
+static bool output_integer(history_output_t *output, int64_t value, char **error)
+{
+    bool ok;
+    uint64_t u;
+    char digits[STR_SIZE("-9223372036854775808")], *p;
+
+    p = digits + STR_SIZE(digits);
+    u = value < 0 ? -(uint64_t) value : (uint64_t) value;
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (0 != u);
+    if (value < 0) {
+        *--p = '-';
+    }
+    if (output_reserve(output, digits + STR_SIZE(digits) - p, &ok, error)) {
+        memcpy(output->w, p, digits + STR_SIZE(digits) - p);
+        output->w += digits + STR_SIZE(digits) - p;
+    }
+
+    return ok;
+}
+
+/**
+ * Characters a JSON string can't contain as is: double quote, backslash and
+ * the control characters
+ */
+static const bool json_escaped[256] = {
+    [0x00] = true, [0x01] = true, [0x02] = true, [0x03] = true, [0x04] = true, [0x05] = true, [0x06] = true, [0x07] = true,
+    [0x08] = true, [0x09] = true, [0x0a] = true, [0x0b] = true, [0x0c] = true, [0x0d] = true, [0x0e] = true, [0x0f] = true,
+    [0x10] = true, [0x11] = true, [0x12] = true, [0x13] = true, [0x14] = true, [0x15] = true, [0x16] = true, [0x17] = true,
+    [0x18] = true, [0x19] = true, [0x1a] = true, [0x1b] = true, [0x1c] = true, [0x1d] = true, [0x1e] = true, [0x1f] = true,
+    ['"'] = true, ['\\'] = true,
+};
+
+/**
+ * Appends string as a JSON string (null for NULL), only the characters
+ * JSON requires to be escaped are
+ */
+static bool output_json_string(history_output_t *output, const char *string, char **error)
+{
+    const unsigned char *p, *start;
+
+    if (NULL == string) {
+        return output_append(output, S("null"), error);
+    }
+    if (!output_char(output, '"', error)) {
+        return false;
+    }
+    for (start = p = (const unsigned char *) string; '\0' != *p; p++) {
+        char escape[STR_SIZE("\\u001f")];
+        size_t escape_len;
+
+        if (!json_escaped[*p]) {
+            continue;
+        }
+        escape[0] = '\\';
+        escape_len = 2;
+        switch (*p) {
+            case '"':
+            case '\\':
+                escape[1] = *p;
+                break;
+            case '\n':
+                escape[1] = 'n';
+                break;
+            case '\r':
+                escape[1] = 'r';
+                break;
+            case '\t':
+                escape[1] = 't';
+                break;
+            default:
+                escape_len = snprintf(escape, STR_SIZE(escape), "\\u%04x", *p);
+                break;
+        }
+        if (!output_append(output, (const char *) start, p - start, error) || !output_append(output, escape, escape_len, error)) {
+            return false;
+        }
+        start = p + 1;
+    }
+
+    return output_append(output, (const char *) start, p - start, error) && output_char(output, '"', error);
+}
+
+/**
+ * Appends string as a CSV field (RFC 4180): enclosed in double quotes, with
+ * double quotes doubled, if it contains a separator, a double quote or a
+ * line break; NULL is an empty field
+ */
+static bool output_csv_string(history_output_t *output, const char *string, char **error)
+{
+    const char *p, *start;
+
+    if (NULL == string) {
+        return true;
+    }
+    if (NULL == strpbrk(string, ",\"\r\n")) {
+        return output_append(output, string, strlen(string), error);
+    }
+    if (!output_char(output, '"', error)) {
+        return false;
+    }
+    for (start = string; NULL != (p = strchr(start, '"')); start = p + 1) {
+        // write the double quote twice: once with the text before it, once on its own
+        if (!output_append(output, start, p - start + 1, error) || !output_char(output, '"', error)) {
+            return false;
+        }
+    }
+
+    return output_append(output, start, strlen(start), error) && output_char(output, '"', error);
+}
+
+/**
+ * Appends string as a TSV field: tabulations, line breaks and backslashes
+ * are escaped by a backslash (\t, \n, \r, \\); NULL is an empty field
+ */
+static bool output_tsv_string(history_output_t *output, const char *string, char **error)
+{
+    size_t len;
+    const char *p;
+
+    if (NULL == string) {
+        return true;
+    }
+    for (p = string; '\0' != p[len = strcspn(p, "\t\n\r\\")]; p += len + 1) {
+        char escape[2];
+
+        escape[0] = '\\';
+        switch (p[len]) {
+            case '\t':
+                escape[1] = 't';
+                break;
+            case '\n':
+                escape[1] = 'n';
+                break;
+            case '\r':
+                escape[1] = 'r';
+                break;
+            default:
+                escape[1] = '\\';
+                break;
+        }
+        if (!output_append(output, p, len, error) || !output_append(output, escape, STR_SIZE(escape), error)) {
+            return false;
+        }
+    }
+
+    return output_append(output, p, len, error);
+}
+
+static const char *operation_key(int operation, size_t *key_len)
+{
+    int i;
+
+    if (-1 == (i = operation_index(operation))) {
+        *key_len = STR_LEN("???");
+        return "???";
+    } else {
+        *key_len = operation_keys[i].name_len;
+        return operation_keys[i].name;
+    }
+}
+
+#define JSON_KEY(key) \
+    S(",\"" key "\":")
+
+static bool output_jsonl_row(history_output_t *output, const history_row_t *row, char **error)
+{
+    size_t key_len;
+    const char *key;
+
+    key = operation_key(row->operation, &key_len);
+
+    return output_append(output, S("{\"command_id\":"), error)
+        && output_integer(output, row->command_id, error)
+        && output_append(output, JSON_KEY("inserted_at"), error)
+        && output_integer(output, (int64_t) row->inserted_at, error)
+        && output_append(output, JSON_KEY("command"), error)
+        && output_json_string(output, row->command, error)
+        && output_append(output, JSON_KEY("id"), error)
+        && output_integer(output, row->line_id, error)
+        && output_append(output, JSON_KEY("operation"), error)
+        && output_char(output, '"', error)
+        && output_append(output, key, key_len, error)
+        && output_char(output, '"', error)
+        && output_append(output, JSON_KEY("name"), error)
+        && output_json_string(output, row->name, error)
+        && output_append(output, JSON_KEY("origin"), error)
+        && output_json_string(output, row->origin, error)
+        && output_append(output, JSON_KEY("repo"), error)
+        && output_json_string(output, row->repo, error)
+        && output_append(output, JSON_KEY("old_version"), error)
+        && output_json_string(output, row->old_version, error)
+        && output_append(output, JSON_KEY("new_version"), error)
+        && output_json_string(output, row->new_version, error)
+        && (!output->jails || (output_append(output, JSON_KEY("jail"), error) && output_json_string(output, row->jail, error)))
+        && output_append(output, S("}\n"), error)
+    ;
+}
+
+#undef JSON_KEY
+
+#define SEPARATED_FIELDS(separator) \
+    "command_id" separator "inserted_at" separator "command" separator "id" separator "operation" separator \
+    "name" separator "origin" separator "repo" separator "old_version" separator "new_version"
+
+static bool output_separated_row(history_output_t *output, const history_row_t *row, char separator, bool (*output_string)(history_output_t *, const char *, char **), char **error)
+{
+    size_t key_len;
+    const char *key;
+
+    key = operation_key(row->operation, &key_len);
+
+    return output_integer(output, row->command_id, error)
+        && output_char(output, separator, error)
+        && output_integer(output, (int64_t) row->inserted_at, error)
+        && output_char(output, separator, error)
+        && output_string(output, row->command, error)
+        && output_char(output, separator, error)
+        && output_integer(output, row->line_id, error)
+        && output_char(output, separator, error)
+        && output_append(output, key, key_len, error)
+        && output_char(output, separator, error)
+        && output_string(output, row->name, error)
+        && output_char(output, separator, error)
+        && output_string(output, row->origin, error)
+        && output_char(output, separator, error)
+        && output_string(output, row->repo, error)
+        && output_char(output, separator, error)
+        && output_string(output, row->old_version, error)
+        && output_char(output, separator, error)
+        && output_string(output, row->new_version, error)
+        && (!output->jails || (output_char(output, separator, error) && output_string(output, row->jail, error)))
+        && output_char(output, '\n', error)
+    ;
+}
+
+/**
+ * Initializes output to render rows in the given format to the file
+ * descriptor fd (the table always goes to stdout), the header of CSV and
+ * TSV is buffered immediately (with a jail column if jails)
+ */
+bool history_output_init(history_output_t *output, history_format_t format, int fd, bool use_origin, bool jails, char **error)
+{
+    bool ok;
+
+    ok = true;
+    output->fd = fd;
+    output->format = format;
+    output->use_origin = use_origin;
+    output->jails = jails;
+    output->w = output->buffer = output->buffer_end = NULL;
+    timestamp_cache_init(&output->dates, NULL);
+    history_output_reset(output, true);
+    if (HISTORY_FORMAT_TABLE != format) {
+        if (NULL == (output->buffer = malloc(HISTORY_OUTPUT_BUFFER_SIZE))) {
+            set_malloc_error(error, (size_t) HISTORY_OUTPUT_BUFFER_SIZE);
+            return false;
+        }
+        output->w = output->buffer;
+        output->buffer_end = output->buffer + HISTORY_OUTPUT_BUFFER_SIZE;
+    }
+    if (HISTORY_FORMAT_CSV == format) {
+        ok = jails ? output_append(output, S(SEPARATED_FIELDS(",") ",jail\n"), error) : output_append(output, S(SEPARATED_FIELDS(",") "\n"), error);
+    } else if (HISTORY_FORMAT_TSV == format) {
+        ok = jails ? output_append(output, S(SEPARATED_FIELDS("\t") "\tjail\n"), error) : output_append(output, S(SEPARATED_FIELDS("\t") "\n"), error);
+    }
+
+    return ok;
+}
+
+/**
+ * Starts a new listing (table only: a blank line is no longer expected
+ * before the next command)
+ */
+void history_output_reset(history_output_t *output, bool grouped)
+{
+    output->grouped = grouped;
+    output->previous_command_id = -1;
+}
+
+bool history_output_row(history_output_t *output, const history_row_t *row, char **error)
+{
+    bool ok;
+
+    ok = true;
+    switch (output->format) {
+        case HISTORY_FORMAT_TABLE:
+            output_table_row(output, row);
+            break;
+        case HISTORY_FORMAT_JSONL:
+            ok = output_jsonl_row(output, row, error);
+            break;
+        case HISTORY_FORMAT_CSV:
+            ok = output_separated_row(output, row, ',', output_csv_string, error);
+            break;
+        case HISTORY_FORMAT_TSV:
+            ok = output_separated_row(output, row, '\t', output_tsv_string, error);
+            break;
+    }
+
+    return ok;
+}
+
+void history_output_close(history_output_t *output)
+{
+    if (NULL != output->buffer) {
+        free(output->buffer);
+        output->w = output->buffer = output->buffer_end = NULL;
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+typedef enum {
+    HISTORY_FORMAT_TABLE,
+    HISTORY_FORMAT_JSONL,
+    HISTORY_FORMAT_CSV,
+    HISTORY_FORMAT_TSV,
+} history_format_t;
+
+/**
+ * Size of the buffer the machine readable formats are rendered into before
+ * being written at once
+ */
+#define HISTORY_OUTPUT_BUFFER_SIZE (256 * 1024)
+
+/**
+ * Renders timestamps as timestamp_to_localtime does, byte for byte, but
+ * without a localtime_r(3) and a strftime(3) for each of them: the
+ * broken-down time of the local midnight is computed once per day (as
+ * long as the offset to UTC doesn't change during it) and the format,
+ * once %x and %X are expanded, is rendered arithmetically when it is only
+ * made of numeric conversions (see timestamp_cache_render)
+ */
+typedef struct {
+    const char *format;
+    // format expanded (the conversions of the locale in place of %x, %X, ...) if arithmetic
+    bool arithmetic;
+    char expanded[128];
+    char am[16], pm[16];
+    /**
+     * the day (from start, the local midnight, to end) cached: if steady,
+     * the local time at start is midnight and the offset to UTC is the
+     * same until end, otherwise the offset changes and the timestamps of
+     * the day go through localtime_r
+     */
+    bool steady;
+    time_t start, end;
+    struct tm midnight;
+} timestamp_cache_t;
+
+char *timestamp_to_localtime(time_t, const char *, char *, const char * const, char **);
+void timestamp_cache_init(timestamp_cache_t *, const char *);
+char *timestamp_cache_render(timestamp_cache_t *, time_t, char *, const char * const, char **);
+const char *timestamp_cache_display(timestamp_cache_t *, time_t, char *, const char * const);
+
+/**
+ * A row of the listings, as fetched by statement_to_iterator: the strings
+ * belong to the statement and are only valid until the next row
+ */
+typedef struct {
+    int command_id;
+    time_t inserted_at;
+    const char *command;
+    int line_id;
+    const char *name;
+    const char *origin;
+    const char *repo;
+    const char *old_version;
+    const char *new_version;
+    int operation;
+    // the jail of the line (pkg history --jails), unset otherwise
+    const char *jail;
+} history_row_t;
+
+typedef struct {
+    int fd;
+    history_format_t format;
+    /**
+     * table only:
+     * - use_origin: display the origin instead of the name of the package
+     * - grouped: rows of a same command share the header of the command
+     *   (the full history) instead of each having its own (searches)
+     * - jails: the rows come from the histories of several jails, their
+     *   jail is given (after the other fields for the machine readable
+     *   formats)
+     */
+    bool use_origin, grouped, jails;
+    int previous_command_id;
+    // the dates of the commands (table only)
+    timestamp_cache_t dates;
+    char *w, *buffer, *buffer_end;
+} history_output_t;
+
+bool history_format_parse(const char *, history_format_t *);
+
+bool history_output_init(history_output_t *, history_format_t, int, bool, bool, char **);
+void history_output_reset(history_output_t *, bool);
+bool history_output_row(history_output_t *, const history_row_t *, char **);
+bool history_output_flush(history_output_t *, char **);
+void history_output_close(history_output_t *);
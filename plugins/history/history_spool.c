@@ -0,0 +1,561 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h> /* flock */
+#include <sys/stat.h>
+
+#include "common.h"
+#include "error/error.h"
+#include "history_db.h"
+#include "history_spool.h"
+
+/**
+ * Spool: when enabled (SPOOL), the hook doesn't touch the database, it
+ * appends a record of the command to a file, with a single write(2) and
+ * fsync(2), which is folded into the database later (by the next run of
+ * pkg history as root or pkg history compact).
+ *
+ * A record is made of:
+ * - a header (spool_header_t)
+ * - the timings of the command (spool_timings_t) if the header has the flag
+ *   SPOOL_FLAG_TIMINGS (records appended since 0.9.6)
+ * - a fixed-layout entry per job (spool_job_t) giving the length of each
+ *   of its strings
+ * - the installed sizes of the packages of each job (spool_flatsizes_t) if
+ *   the header has the flag SPOOL_FLAG_FLATSIZES (records appended since
+ *   0.9.10)
+ * - the strings (NUL terminated): the command line then, for each job, its
+ *   repository, name, origin, old and new versions (a NULL one is omitted)
+ * - padding up to a multiple of SPOOL_ALIGNMENT bytes
+ *
+ * Integers are in the byte order of the host: the spool is not meant to
+ * be moved to another machine.
+ *
+ * NOTE:
+ * - the spool is locked (flock(2)) while a record is appended and while it
+ *   is folded, so a record is never lost between its read and the truncation
+ *   of the spool
+ * - a record is appended by a single write(2): an invalid one is the tail
+ *   of an interrupted write, the records appended after it are found again
+ *   by their magic number
+ * - the size and checksum of the folded spool are committed with the folded
+ *   commands (TABLE_SPOOL): after a crash before the truncation of the
+ *   spool, its start is recognized and not folded again
+ * - the files of the packages are not spooled (the hook doesn't query them
+ *   in this mode): the folded lines don't track them
+ */
+
+#define SPOOL_MAGIC 0x48535031 /* "HSP1" */
+#define SPOOL_ALIGNMENT 8
+#define SPOOL_NULL UINT32_MAX
+
+// flags of spool_header_t
+#define SPOOL_FLAG_TIMINGS (1 << 0)
+#define SPOOL_FLAG_FLATSIZES (1 << 1)
+
+enum {
+    SPOOL_REPO,
+    SPOOL_NAME,
+    SPOOL_ORIGIN,
+    SPOOL_OLD_VERSION,
+    SPOOL_NEW_VERSION,
+    _SPOOL_STRINGS_COUNT,
+};
+
+typedef struct {
+    uint32_t magic;
+    // size of the whole record, padding included
+    uint32_t size;
+    // FNV-1a of the bytes of the record which follow this field
+    uint32_t checksum;
+    uint32_t lines_count;
+    int64_t inserted_at;
+    uint32_t command_length;
+    uint32_t flags;
+} spool_header_t;
+
+typedef struct {
+    int64_t started_at;
+    int64_t finished_at;
+    int64_t fetch_duration;
+} spool_timings_t;
+
+typedef struct {
+    int32_t operation;
+    // lengths of the strings, SPOOL_NULL for NULL
+    uint32_t lengths[_SPOOL_STRINGS_COUNT];
+} spool_job_t;
+
+typedef struct {
+    // -1 if unknown
+    int64_t new_flatsize;
+    int64_t old_flatsize;
+} spool_flatsizes_t;
+
+#define ALIGN(size) \
+    (((size) + SPOOL_ALIGNMENT - 1) & ~((size_t) SPOOL_ALIGNMENT - 1))
+
+#define CHECKSUMMED_OFFSET \
+    (offsetof(spool_header_t, checksum) + sizeof(((spool_header_t *) NULL)->checksum))
+
+static uint32_t fnv1a(const char *data, size_t size)
+{
+    size_t i;
+    uint32_t hash;
+
+    hash = 2166136261u;
+    for (i = 0; i < size; i++) {
+        hash ^= (uint8_t) data[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static const char **line_strings(const history_line_t *line, const char **strings)
+{
+    strings[SPOOL_REPO] = line->repo;
+    strings[SPOOL_NAME] = line->name;
+    strings[SPOOL_ORIGIN] = line->origin;
+    strings[SPOOL_OLD_VERSION] = line->old_version;
+    strings[SPOOL_NEW_VERSION] = line->new_version;
+
+    return strings;
+}
+
+/**
+ * Appends the command, run at inserted_at, and its package operations to
+ * the spool at path (created if needed)
+ */
+bool history_spool_append(const char *path, time_t inserted_at, const char *command, const history_timings_t *timings, const history_line_t *lines, size_t lines_count, char **error)
+{
+    int fd;
+    bool ok;
+    char *record;
+
+    ok = false;
+    fd = -1;
+    record = NULL;
+    do {
+        char *w, *jobs, *flatsizes;
+        size_t i, j, size;
+        ssize_t written;
+        spool_header_t header;
+        spool_timings_t spooled_timings;
+        const char *strings[_SPOOL_STRINGS_COUNT];
+
+        size = sizeof(header) + (NULL == timings ? 0 : sizeof(spooled_timings)) + (sizeof(spool_job_t) + sizeof(spool_flatsizes_t)) * lines_count + strlen(command) + 1;
+        for (i = 0; i < lines_count; i++) {
+            line_strings(&lines[i], strings);
+            for (j = 0; j < _SPOOL_STRINGS_COUNT; j++) {
+                if (NULL != strings[j]) {
+                    size += strlen(strings[j]) + 1;
+                }
+            }
+        }
+        size = ALIGN(size);
+        if (size > UINT32_MAX) {
+            set_generic_error(error, "a command of %zu operations is too large to be spooled", lines_count);
+            break;
+        }
+        if (NULL == (record = calloc(1, size))) {
+            set_malloc_error(error, size);
+            break;
+        }
+        header.magic = SPOOL_MAGIC;
+        header.size = (uint32_t) size;
+        header.checksum = 0;
+        header.lines_count = (uint32_t) lines_count;
+        header.inserted_at = (int64_t) inserted_at;
+        header.command_length = (uint32_t) strlen(command);
+        header.flags = SPOOL_FLAG_FLATSIZES;
+        jobs = record + sizeof(header);
+        if (NULL != timings) {
+            header.flags |= SPOOL_FLAG_TIMINGS;
+            spooled_timings.started_at = timings->started_at;
+            spooled_timings.finished_at = timings->finished_at;
+            spooled_timings.fetch_duration = timings->fetch_duration;
+            memcpy(jobs, &spooled_timings, sizeof(spooled_timings));
+            jobs += sizeof(spooled_timings);
+        }
+        flatsizes = jobs + sizeof(spool_job_t) * lines_count;
+        w = flatsizes + sizeof(spool_flatsizes_t) * lines_count;
+        memcpy(w, command, header.command_length + 1);
+        w += header.command_length + 1;
+        for (i = 0; i < lines_count; i++) {
+            spool_job_t job;
+            spool_flatsizes_t sizes;
+
+            job.operation = (int32_t) lines[i].operation;
+            line_strings(&lines[i], strings);
+            for (j = 0; j < _SPOOL_STRINGS_COUNT; j++) {
+                if (NULL == strings[j]) {
+                    job.lengths[j] = SPOOL_NULL;
+                } else {
+                    job.lengths[j] = (uint32_t) strlen(strings[j]);
+                    memcpy(w, strings[j], job.lengths[j] + 1);
+                    w += job.lengths[j] + 1;
+                }
+            }
+            memcpy(jobs + sizeof(job) * i, &job, sizeof(job));
+            sizes.new_flatsize = lines[i].new_flatsize;
+            sizes.old_flatsize = lines[i].old_flatsize;
+            memcpy(flatsizes + sizeof(sizes) * i, &sizes, sizeof(sizes));
+        }
+        memcpy(record, &header, sizeof(header));
+        header.checksum = fnv1a(record + CHECKSUMMED_OFFSET, size - CHECKSUMMED_OFFSET);
+        memcpy(record + offsetof(spool_header_t, checksum), &header.checksum, sizeof(header.checksum));
+        if (-1 == (fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644))) {
+            set_system_error(error, "open(2) failed for %s", path);
+            break;
+        }
+        if (-1 == flock(fd, LOCK_EX)) {
+            set_system_error(error, "flock(2) failed for %s", path);
+            break;
+        }
+        if (-1 == (written = write(fd, record, size))) {
+            set_system_error(error, "write(2) failed for %s", path);
+            break;
+        }
+        if (((size_t) written) != size) {
+            set_generic_error(error, "short write on %s: %zd bytes written out of %zu", path, written, size);
+            break;
+        }
+        if (-1 == fsync(fd)) {
+            set_system_error(error, "fsync(2) failed for %s", path);
+            break;
+        }
+        ok = true;
+    } while (false);
+    if (-1 != fd) {
+        close(fd);
+    }
+    free(record);
+
+    return ok;
+}
+
+/**
+ * returns true if there is nothing to fold: no spool or an empty one
+ */
+bool history_spool_is_empty(const char *path)
+{
+    struct stat st;
+
+    return -1 == stat(path, &st) || 0 == st.st_size;
+}
+
+/**
+ * Buffers of the lines of the record being folded and of their identifiers
+ */
+typedef struct {
+    history_line_t *lines;
+    history_line_ids_t *ids;
+    size_t allocated;
+} spool_lines_t;
+
+static bool spool_lines_reserve(spool_lines_t *sl, size_t count, char **error)
+{
+    if (count > sl->allocated) {
+        void *tmp;
+
+        if (NULL == (tmp = realloc(sl->lines, sizeof(*sl->lines) * count))) {
+            set_malloc_error(error, sizeof(*sl->lines) * count);
+            return false;
+        }
+        sl->lines = tmp;
+        if (NULL == (tmp = realloc(sl->ids, sizeof(*sl->ids) * count))) {
+            set_malloc_error(error, sizeof(*sl->ids) * count);
+            return false;
+        }
+        sl->ids = tmp;
+        sl->allocated = count;
+    }
+
+    return true;
+}
+
+/**
+ * Checks the record at the start of [r ; end[ and points the strings of its
+ * lines into it.
+ *
+ * returns
+ * + -1 on error
+ * + 0 if the record is invalid or incomplete
+ * + 1 if the record is valid
+ */
+static int spool_record_parse(const char *r, const char *end, spool_header_t *header, history_timings_t *timings, spool_lines_t *sl, const char **command, char **error)
+{
+    size_t i, j, job_size;
+    const char *s, *jobs, *flatsizes, *strings_end;
+
+    if (((size_t) (end - r)) < sizeof(*header)) {
+        return 0;
+    }
+    memcpy(header, r, sizeof(*header));
+    if (
+        SPOOL_MAGIC != header->magic
+        || header->size < sizeof(*header)
+        || 0 != header->size % SPOOL_ALIGNMENT
+        || header->size > (size_t) (end - r)
+        || header->checksum != fnv1a(r + CHECKSUMMED_OFFSET, header->size - CHECKSUMMED_OFFSET)
+    ) {
+        return 0;
+    }
+    jobs = r + sizeof(*header);
+    if (HAS_FLAG(header->flags, SPOOL_FLAG_TIMINGS)) {
+        spool_timings_t spooled_timings;
+
+        if (header->size < sizeof(*header) + sizeof(spooled_timings)) {
+            return 0;
+        }
+        memcpy(&spooled_timings, jobs, sizeof(spooled_timings));
+        timings->started_at = spooled_timings.started_at;
+        timings->finished_at = spooled_timings.finished_at;
+        timings->fetch_duration = spooled_timings.fetch_duration;
+        jobs += sizeof(spooled_timings);
+    } else {
+        history_timings_t unknown = HISTORY_TIMINGS_UNKNOWN;
+
+        *timings = unknown;
+    }
+    job_size = sizeof(spool_job_t) + (HAS_FLAG(header->flags, SPOOL_FLAG_FLATSIZES) ? sizeof(spool_flatsizes_t) : 0);
+    if (header->lines_count > ((size_t) (r + header->size - jobs)) / job_size) {
+        return 0;
+    }
+    if (!spool_lines_reserve(sl, header->lines_count, error)) {
+        return -1;
+    }
+    strings_end = r + header->size;
+    flatsizes = jobs + sizeof(spool_job_t) * header->lines_count;
+    s = jobs + job_size * header->lines_count;
+    // each string has to lie inside the record and be terminated
+    if (header->command_length >= (size_t) (strings_end - s) || '\0' != s[header->command_length]) {
+        return 0;
+    }
+    *command = s;
+    s += header->command_length + 1;
+    for (i = 0; i < header->lines_count; i++) {
+        spool_job_t job;
+        history_line_t *line;
+        const char *strings[_SPOOL_STRINGS_COUNT];
+
+        memcpy(&job, jobs + sizeof(job) * i, sizeof(job));
+        for (j = 0; j < _SPOOL_STRINGS_COUNT; j++) {
+            if (SPOOL_NULL == job.lengths[j]) {
+                strings[j] = NULL;
+            } else {
+                if (job.lengths[j] >= (size_t) (strings_end - s) || '\0' != s[job.lengths[j]]) {
+                    return 0;
+                }
+                strings[j] = s;
+                s += job.lengths[j] + 1;
+            }
+        }
+        line = &sl->lines[i];
+        line->operation = job.operation;
+        line->repo = strings[SPOOL_REPO];
+        line->name = strings[SPOOL_NAME];
+        line->origin = strings[SPOOL_ORIGIN];
+        line->old_version = strings[SPOOL_OLD_VERSION];
+        line->new_version = strings[SPOOL_NEW_VERSION];
+        if (HAS_FLAG(header->flags, SPOOL_FLAG_FLATSIZES)) {
+            spool_flatsizes_t sizes;
+
+            memcpy(&sizes, flatsizes + sizeof(sizes) * i, sizeof(sizes));
+            line->new_flatsize = sizes.new_flatsize;
+            line->old_flatsize = sizes.old_flatsize;
+        } else {
+            line->new_flatsize = line->old_flatsize = -1;
+        }
+        line->files = NULL;
+        line->files_count = 0;
+        if (NULL == line->name || NULL == line->origin || NULL == line->new_version) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Returns the first record, at or after r, starting by the magic number
+ * (end if there is none)
+ */
+static char *spool_resync(char *r, char *end)
+{
+    char *p;
+    uint32_t magic;
+
+    magic = SPOOL_MAGIC;
+    if (NULL == (p = memmem(r, end - r, &magic, sizeof(magic)))) {
+        p = end;
+    }
+
+    return p;
+}
+
+/**
+ * Sets *skipped to the size of the start of the spool, in buffer, already
+ * folded by a run interrupted before its truncation (0 if none)
+ */
+static bool spool_folded(sqlite_db_t *db, const char *buffer, size_t size, size_t *skipped, char **error)
+{
+    int ret;
+    int64_t folded_size, checksum;
+    sqlite_statement_t *stmt;
+
+    *skipped = 0;
+    stmt = &history_statements[STMT_SPOOL_FOLDED];
+    statement_reset(stmt);
+    ret = statement_fetch(db, stmt, error, &folded_size, &checksum);
+    statement_reset(stmt);
+    if (-1 == ret) {
+        return false;
+    }
+    if (1 == ret && folded_size > 0 && ((uint64_t) folded_size) <= size && ((uint32_t) checksum) == fnv1a(buffer, (size_t) folded_size)) {
+        *skipped = (size_t) folded_size;
+    }
+
+    return true;
+}
+
+/**
+ * Inserts, in a single transaction, the commands of the spool at path
+ * into the database then empties the spool
+ */
+bool history_spool_fold(sqlite_db_t *db, const char *path, history_spool_stats_t *stats, char **error)
+{
+    int fd;
+    bool ok;
+    char *buffer;
+    spool_lines_t sl;
+
+    ok = false;
+    fd = -1;
+    buffer = NULL;
+    sl.lines = NULL;
+    sl.ids = NULL;
+    sl.allocated = 0;
+    memset(stats, 0, sizeof(*stats));
+    do {
+        int ret;
+        size_t size;
+        struct stat st;
+        char *r, *end;
+
+        if (-1 == (fd = open(path, O_RDWR | O_CLOEXEC))) {
+            if (ENOENT == errno) {
+                ok = true;
+            } else {
+                set_system_error(error, "open(2) failed for %s", path);
+            }
+            break;
+        }
+        if (-1 == flock(fd, LOCK_EX)) {
+            set_system_error(error, "flock(2) failed for %s", path);
+            break;
+        }
+        if (-1 == fstat(fd, &st)) {
+            set_system_error(error, "fstat(2) failed for %s", path);
+            break;
+        }
+        if (0 == st.st_size) {
+            ok = true;
+            break;
+        }
+        size = (size_t) st.st_size;
+        if (NULL == (buffer = malloc(size))) {
+            set_malloc_error(error, size);
+            break;
+        }
+        for (r = buffer, end = buffer + size; r < end; ) {
+            ssize_t read_bytes;
+
+            if (-1 == (read_bytes = read(fd, r, end - r))) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                break;
+            }
+            if (0 == read_bytes) {
+                break;
+            }
+            r += read_bytes;
+        }
+        if (r != end) {
+            set_system_error(error, "read(2) failed for %s", path);
+            break;
+        }
+        if (!sqlite_transaction_begin(db, error)) {
+            break;
+        }
+        if (!spool_folded(db, buffer, size, &stats->skipped, error)) {
+            sqlite_transaction_rollback(db, NULL);
+            break;
+        }
+        ret = 1;
+        for (r = buffer + stats->skipped; r < end; ) {
+            const char *command;
+            spool_header_t header;
+            history_timings_t timings;
+
+            if (-1 == (ret = spool_record_parse(r, end, &header, &timings, &sl, &command, error))) {
+                break;
+            }
+            if (0 == ret) {
+                // the tail of an interrupted write: skip it up to the next record
+                char *next;
+
+                next = spool_resync(r + 1, end);
+                stats->discarded += next - r;
+                r = next;
+                continue;
+            }
+            if (!history_db_resolve_lines(db, sl.lines, header.lines_count, sl.ids, error)) {
+                ret = -1;
+                break;
+            }
+            if (!history_db_insert_command(db, (time_t) header.inserted_at, command, &timings, sl.lines, sl.ids, header.lines_count, error)) {
+                ret = -1;
+                break;
+            }
+            ++stats->commands;
+            stats->operations += header.lines_count;
+            r += header.size;
+        }
+        if (-1 == ret) {
+            sqlite_transaction_rollback(db, NULL);
+            break;
+        }
+        statement_bind(&history_statements[STMT_SPOOL_SET_FOLDED], (int64_t) size, (int64_t) fnv1a(buffer, size));
+        if (-1 == statement_fetch(db, &history_statements[STMT_SPOOL_SET_FOLDED], error)) {
+            sqlite_transaction_rollback(db, NULL);
+            break;
+        }
+        if (!sqlite_transaction_commit(db, error)) {
+            break;
+        }
+        if (-1 == ftruncate(fd, 0)) {
+            set_system_error(error, "ftruncate(2) failed for %s", path);
+            break;
+        }
+        // the spool no longer starts by the folded records
+        statement_reset(&history_statements[STMT_SPOOL_CLEAR]);
+        if (-1 == statement_fetch(db, &history_statements[STMT_SPOOL_CLEAR], error)) {
+            break;
+        }
+        ok = true;
+    } while (false);
+    if (-1 != fd) {
+        close(fd);
+    }
+    free(buffer);
+    free(sl.lines);
+    free(sl.ids);
+
+    return ok;
+}
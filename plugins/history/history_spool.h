@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "history_db.h"
+
+/**
+ * Counters of a run of history_spool_fold
+ */
+typedef struct {
+    size_t commands;
+    size_t operations;
+    // bytes of the spool which don't form a valid record (interrupted writes)
+    size_t discarded;
+    // bytes at the start of the spool folded by a run interrupted before truncating it
+    size_t skipped;
+} history_spool_stats_t;
+
+bool history_spool_append(const char *, time_t, const char *, const history_timings_t *, const history_line_t *, size_t, char **);
+bool history_spool_is_empty(const char *);
+bool history_spool_fold(sqlite_db_t *, const char *, history_spool_stats_t *, char **);
@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <limits.h> /* PATH_MAX */
+#include <unistd.h>
+#include <time.h>
+
+#include "common.h"
+#include "history_testing.h"
+
+/**
+ * Helpers shared by the benchmarks and the tests (linked to each of them
+ * by history_executable)
+ */
+
+/**
+ * Monotonic time, in milliseconds, to measure durations
+ */
+double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * Deletes the scratch database at path and its WAL files, which are kept
+ * on close (SQLITE_FCNTL_PERSIST_WAL)
+ */
+void remove_database(const char *path)
+{
+    char buffer[PATH_MAX];
+
+    unlink(path);
+    snprintf(buffer, STR_SIZE(buffer), "%s-wal", path);
+    unlink(buffer);
+    snprintf(buffer, STR_SIZE(buffer), "%s-shm", path);
+    unlink(buffer);
+}
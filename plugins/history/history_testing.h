@@ -0,0 +1,4 @@
+#pragma once
+
+double now_ms(void);
+void remove_database(const char *);
@@ -1,7 +1,13 @@
 #include <stdlib.h> /* atoi */
+#include <inttypes.h> /* PRIi64 */
 #include <sysexits.h> /* EX_USAGE */
 #include <getopt.h>
 #include <time.h>
+#include <unistd.h> /* STDOUT_FILENO */
+#include <sys/param.h> /* MAXHOSTNAMELEN */
+#ifdef WITH_REGEX
+# include <regex.h>
+#endif /* WITH_REGEX */
 #include <pkg.h>
 
 #include "common.h"
@@ -14,368 +20,1310 @@
 #include "kissc/parsenum.h"
 #include "kissc/stpcpy_sp.h"
 #include "date.h"
+#include "history_db.h"
+#include "history_files.h"
+#include "history_import.h"
+#include "history_jails.h"
+#include "history_merge.h"
+#include "history_output.h"
+#include "history_spool.h"
 
 static struct pkg_plugin *self;
 
 static char DESCRIPTION[] = "Keep track of operations on packages";
 
-#define TABLE_COMMANDS "history_commands"
-#define TABLE_PACKAGES "history_lines"
-#define TABLE_OPERATIONS "history_operations"
-
-enum {
-    STMT_CREATE_COMMAND,
-    STMT_CREATE_LINE,
-    STMT_LIST_LINE,
-    STMT_SEARCH_LINE_EXACT,
-    STMT_SEARCH_LINE_EXACT_CI,
-    STMT_SEARCH_LINE_GLOB,
-#ifdef WITH_REGEX
-    STMT_SEARCH_LINE_REGEX,
-#endif /* WITH_REGEX */
+#define CFG_BUSY_TIMEOUT "BUSY_TIMEOUT"
+#define DEFAULT_BUSY_TIMEOUT 5000 /* ms */
+#define CFG_RETENTION_MAX_AGE "RETENTION_MAX_AGE"
+#define DEFAULT_RETENTION_MAX_AGE 0 /* days, no limit */
+#define CFG_RETENTION_MAX_COMMANDS "RETENTION_MAX_COMMANDS"
+#define DEFAULT_RETENTION_MAX_COMMANDS 0 /* no limit */
+#define CFG_CHECKPOINT_INTERVAL "CHECKPOINT_INTERVAL"
+#define DEFAULT_CHECKPOINT_INTERVAL 100 /* commands */
+#define CFG_SPOOL "SPOOL"
+#define CFG_MMAP_SIZE "MMAP_SIZE"
+#define DEFAULT_MMAP_SIZE 256 /* MiB */
+#define CFG_CACHE_SIZE "CACHE_SIZE"
+#define DEFAULT_CACHE_SIZE 64 /* MiB */
+#define CFG_IMMUTABLE "IMMUTABLE"
+#define CFG_FILES "FILES"
+
+/**
+ * Maximum count of checkpoints taken by a run of the hook: a whole history
+ * (upgrade of the plugin) is caught up over several runs of pkg
+ */
+#define CHECKPOINTS_PER_RUN 10
+
+static sqlite_open_options_t open_options = {
+    .busy_timeout = DEFAULT_BUSY_TIMEOUT,
+    .wal = true,
 };
 
+/**
+ * Options of the read-only connections of pkg history: the database is
+ * memory mapped and the page cache larger, for the scans of a big history
+ * (the hook, which only appends a few rows, keeps the defaults)
+ */
+static sqlite_open_options_t query_options = {
+    .busy_timeout = DEFAULT_BUSY_TIMEOUT,
+    .wal = true,
+    .mmap_size = DEFAULT_MMAP_SIZE * 1024 * 1024,
+    .cache_size = DEFAULT_CACHE_SIZE * 1024,
+    .immutable = false,
+};
+
+static history_retention_t retention = {
+    .max_age = DEFAULT_RETENTION_MAX_AGE,
+    .max_commands = DEFAULT_RETENTION_MAX_COMMANDS,
+};
+
+static int checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+
+/**
+ * When true, the hook appends the commands to the spool (see
+ * history_spool.c) instead of recording them into the database
+ */
+static bool spool = false;
+
+/**
+ * When true, the hook records the files added and removed by each
+ * operation (see history_files.c), for pkg history which
+ */
+static bool track_files = true;
+
+/**
+ * State of the pkg process kept from a hook to the next: the PRE_* hooks
+ * timestamp the start of the job (and of the fetching of its packages) for
+ * the POST_* one which records it. The command line doesn't change for the
+ * life of the process, it is read once.
+ */
+static struct {
+    // 0 until the first PRE_* hook of the job
+    int64_t started_at;
+    int64_t fetch_started_at;
+    // -1 until a POST_FETCH hook
+    int64_t fetch_duration;
+    bool has_cmd;
+    char cmd[ARG_MAX];
+} job = { 0, 0, -1, false, "" };
+
 typedef struct {
     int limit;
     int statement;
     int operations;
     bool use_origin;
+    history_format_t format;
     time_t from, to;
+    /**
+     * with before = false, display the rows older than cursor (the default
+     * cursor is past the most recent row), newer than cursor otherwise
+     */
+    bool before, has_cursor;
+    history_cursor_t cursor;
+    // list the slowest commands instead of the operations
+    bool slowest;
+    // constraint on the new version of the lines (see history_db_set_versions), NULL for none
+    const char *versions;
+    // the jails to list the histories of ("all" or their names, see history_jails_find), NULL for the host
+    const char *jails;
+    // wait for the lines recorded after the one of identifier follow_from (-1 for the last one) instead of listing them
+    bool follow;
+    int follow_from;
 } query_options_t;
 
-#define STRINGIFY(s) #s
-#define STRINGIFY_EXPAND(s) STRINGIFY(s)
+/**
+ * Count of rows fetched at once when there is no limit (--limit=0)
+ */
+#define PAGE_SIZE 1000
 
-#if 0
-enum {
-    PKG_SHIFT_OP_INSTALL,
-    PKG_SHIFT_OP_DEINSTALL,
-    PKG_SHIFT_OP_UPGRADE,
-};
-#else
-// can't expand PKG_OP_INSTALL to 1<<0 with an enum
-# define PKG_SHIFT_OP_INSTALL 0
-# define PKG_SHIFT_OP_DEINSTALL 1
-# define PKG_SHIFT_OP_UPGRADE 2
-#endif
+/**
+ * Interval, in milliseconds, between two checks for changes by --follow:
+ * doubled, from FOLLOW_POLL_MIN, while the database doesn't change, up to
+ * FOLLOW_POLL_MAX (so new operations show up within a second)
+ */
+#define FOLLOW_POLL_MIN 25
+#define FOLLOW_POLL_MAX 500
 
-#define PKG_OP_INSTALL   (1<<PKG_SHIFT_OP_INSTALL)
-#define PKG_OP_DEINSTALL (1<<PKG_SHIFT_OP_DEINSTALL)
-#define PKG_OP_UPGRADE   (1<<PKG_SHIFT_OP_UPGRADE)
-#define PKG_OP_REMOVE    PKG_OP_DEINSTALL
-#define PKG_OP_ALL       (PKG_OP_INSTALL | PKG_OP_DEINSTALL | PKG_OP_UPGRADE)
-
-#define STMT_SEARCH_LINE_BY_NAME(operator, after_placeholder) \
-    DECL_STMT( \
-        " SELECT c.inserted_at, c.command, l.name, l.origin, l.repo, l.old_version, l.new_version, l.operation_id" \
-        " FROM " TABLE_COMMANDS " c JOIN " TABLE_PACKAGES " l ON c.id = l.command_id" \
-        " WHERE l.name " operator " ? " after_placeholder \
-        " AND (l.operation_id & ?) <> 0" \
-        " AND (inserted_at BETWEEN ? AND ?)" \
-        " ORDER BY c.inserted_at DESC" \
-        " LIMIT ?", \
-        "siiii", \
-        "issssssi" \
-    )
-
-static sqlite_statement_t statements[] = {
-    [ STMT_CREATE_COMMAND ] = DECL_STMT(
-        "INSERT INTO " TABLE_COMMANDS "(inserted_at, command) VALUES(strftime('%s', 'now'), ?)",
-        "s",
-        ""
-    ),
-    [ STMT_CREATE_LINE ] = DECL_STMT(
-        "INSERT INTO " TABLE_PACKAGES "(repo, name, origin, old_version, new_version, operation_id, command_id) VALUES(?, ?, ?, ?, ?, ?, ?)",
-        "sssssii",
-        ""
-    ),
-    [ STMT_LIST_LINE ] = DECL_STMT(
-        " SELECT c.id, c.inserted_at, c.command, l.name, l.origin, l.repo, l.old_version, l.new_version, l.operation_id"
-        " FROM " TABLE_COMMANDS " c"
-        " LEFT JOIN " TABLE_PACKAGES " l ON c.id = l.command_id"
-        " WHERE (c.inserted_at BETWEEN ? AND ?) AND (l.operation_id & ?) <> 0"
-        " ORDER BY c.inserted_at DESC, l.name"
-        " LIMIT ?",
-        "ttii",
-        /* c */ "its" /* l */ "sssssi"
-    ),
-    [ STMT_SEARCH_LINE_EXACT ] = STMT_SEARCH_LINE_BY_NAME("=", ""),
-    [ STMT_SEARCH_LINE_EXACT_CI ] = STMT_SEARCH_LINE_BY_NAME("=", "COLLATE NOCASE"),
-    [ STMT_SEARCH_LINE_GLOB ] = STMT_SEARCH_LINE_BY_NAME("GLOB", ""),
-#ifdef WITH_REGEX
-    [ STMT_SEARCH_LINE_REGEX ] = STMT_SEARCH_LINE_BY_NAME("REGEXP"),
-#endif /* WITH_REGEX */
-};
+/**
+ * Applies the retention policy and takes the next checkpoints, at most
+ * max_checkpoints (0 for no limit), after new commands were recorded
+ */
+static bool db_maintain(sqlite_db_t *db, int max_checkpoints, char **error)
+{
+    if ((retention.max_age > 0 || retention.max_commands > 0) && !history_db_apply_retention(db, &retention, error)) {
+        return false;
+    }
+    if (checkpoint_interval > 0 && !history_db_create_checkpoints(db, checkpoint_interval, max_checkpoints, error)) {
+        return false;
+    }
+
+    return true;
+}
 
-static pkg_error_t db_open(sqlite_db_t **db, int mode, char **error)
+/**
+ * NOTE: as root, the commands left in the spool by the hook are folded into
+ * the database first (the counters are written to folded, if not NULL)
+ */
+static pkg_error_t db_open(sqlite_db_t **db, int mode, history_spool_stats_t *folded, char **error)
 {
     pkg_error_t status;
 
     status = EPKG_FATAL;
+    if (NULL != folded) {
+        memset(folded, 0, sizeof(*folded));
+    }
     do {
-        char dbpath[MAXPATHLEN];
+        bool fold;
+        char dbpath[MAXPATHLEN], spoolpath[MAXPATHLEN];
 
         if (!path_join(dbpath, dbpath + STR_SIZE(dbpath), error, pkg_dbdir(), "history.sqlite", NULL)) {
             break;
         }
-        status = sqlite_open(dbpath, mode, db, error);
-        if (EPKG_OK == status) {
-            status = EPKG_FATAL;
-            if (!sqlite_create_or_migrate(*db, TABLE_COMMANDS, "CREATE TABLE " TABLE_COMMANDS "(\n\
-                id INTEGER NOT NULL PRIMARY KEY,\n\
-                inserted_at INT NOT NULL,\n\
-                command TEXT NOT NULL\n\
-            );\n\
-            CREATE INDEX " TABLE_COMMANDS "_inserted_at ON " TABLE_COMMANDS "(inserted_at);", NULL, 0, error)) {
-                break;
-            }
-            if (!sqlite_create_or_migrate(*db, TABLE_OPERATIONS, "CREATE TABLE " TABLE_OPERATIONS "(\n\
-                id INTEGER NOT NULL,\n\
-                name TEXT NOT NULL,\n\
-                PRIMARY KEY(id)\n\
-            );\n\
-            INSERT INTO " TABLE_OPERATIONS "(id, name) VALUES(" STRINGIFY_EXPAND(PKG_OP_INSTALL) ", 'install');\n\
-            INSERT INTO " TABLE_OPERATIONS "(id, name) VALUES(" STRINGIFY_EXPAND(PKG_OP_DEINSTALL) ", 'deinstall');\n\
-            INSERT INTO " TABLE_OPERATIONS "(id, name) VALUES(" STRINGIFY_EXPAND(PKG_OP_UPGRADE) ", 'upgrade');", NULL, 0, error)) {
-                break;
-            }
-            if (!sqlite_create_or_migrate(*db, TABLE_PACKAGES, "CREATE TABLE " TABLE_PACKAGES "(\n\
-                id INTEGER NOT NULL PRIMARY KEY,\n\
-                -- NOTE: repo is NULL on deletion\n\
-                repo TEXT NULL,\n\
-                name TEXT NOT NULL,\n\
-                origin TEXT NOT NULL,\n\
-                old_version TEXT NULL,\n\
-                new_version TEXT NOT NULL,\n\
-                command_id INT NOT NULL REFERENCES " TABLE_COMMANDS "(id) ON UPDATE CASCADE ON DELETE CASCADE,\n\
-                operation_id INT NOT NULL REFERENCES " TABLE_OPERATIONS "(id) ON UPDATE CASCADE ON DELETE CASCADE\n\
-            );\n\
-            CREATE INDEX " TABLE_PACKAGES "_command_id_index ON " TABLE_PACKAGES "(command_id);\n\
-            CREATE INDEX " TABLE_PACKAGES "_operation_id_index ON " TABLE_PACKAGES "(operation_id);", NULL, 0, error)) {
-                break;
-            }
-            if (HAS_FLAG(PKGDB_MODE_WRITE, mode) && !sqlite_set_user_version(*db, HISTORY_VERSION_NUMBER, error)) {
-                break;
-            }
-        } else if (EPKG_ENODB == status) {
-            pkg_plugin_info(self, "the database used by plugin %s does not yet exist and can only be initialized by root", NAME);
+        if (!path_join(spoolpath, spoolpath + STR_SIZE(spoolpath), error, pkg_dbdir(), "history.spool", NULL)) {
             break;
+        }
+        if ((fold = 0 == geteuid() && !history_spool_is_empty(spoolpath))) {
+            mode |= PKGDB_MODE_WRITE;
+        }
+        if (EPKG_ENODB == (status = history_db_open(dbpath, mode, HAS_FLAG(mode, PKGDB_MODE_WRITE) ? &open_options : &query_options, db, error))) {
+            pkg_plugin_info(self, "the database used by plugin %s does not yet exist and can only be initialized by root", NAME);
+            status = EPKG_FATAL;
+        }
+        if (EPKG_OK == status && fold) {
+            history_spool_stats_t stats;
+
+            if (!history_spool_fold(*db, spoolpath, &stats, error) || !db_maintain(*db, CHECKPOINTS_PER_RUN, error)) {
+                history_db_close(*db);
+                *db = NULL;
+                status = EPKG_FATAL;
+                break;
+            }
+            if (0 != stats.discarded) {
+                pkg_plugin_info(self, "%zu bytes of %s, left by an interrupted write, were discarded", stats.discarded, spoolpath);
+            }
+            if (0 != stats.skipped) {
+                pkg_plugin_info(self, "%zu bytes at the start of %s, already folded by an interrupted run, were skipped", stats.skipped, spoolpath);
+            }
+            if (NULL != folded) {
+                *folded = stats;
+            }
+        }
+    } while (false);
+
+    return status;
+}
+
+static int handle_hooks(void *, struct pkgdb *);
+
+static void display_cursors(FILE *fp, const query_options_t *qo, int rows, const history_cursor_t *first, const history_cursor_t *last)
+{
+    // there is something newer if we didn't start from the top
+    if (qo->has_cursor) {
+        fprintf(fp, "\nNewer operations: --before=%jd:%d\n", (intmax_t) first->inserted_at, first->id);
+    }
+    // there is something older if the page is full or we were going up
+    if (qo->before || (0 != qo->limit && rows == qo->limit)) {
+        fprintf(fp, "%sOlder operations: --after=%jd:%d\n", qo->has_cursor ? "" : "\n", (intmax_t) last->inserted_at, last->id);
+    }
+}
+
+/**
+ * Displays the history or the result of the search of the packages set by
+ * history_db_set_searched (searched = true), page
+ * after page of at most PAGE_SIZE rows if there is no limit: the cursor
+ * is moved to the last row of the page to fetch the next one
+ *
+ * The cursors go to stderr for the machine readable formats to not mix
+ * them with the rows.
+ */
+static bool display_history(const query_options_t *qo, history_output_t *output, bool searched, char **error)
+{
+    bool ok;
+    int rows, page_rows, page_limit;
+    sqlite_statement_t *stmt;
+    history_cursor_t cursor, first, last;
+
+    ok = true;
+    rows = 0;
+    cursor = qo->cursor;
+    first.inserted_at = last.inserted_at = 0;
+    first.id = last.id = 0;
+    page_limit = 0 == qo->limit ? PAGE_SIZE : qo->limit;
+    stmt = &history_statements[searched ? qo->statement : STMT_LIST_LINE];
+    if (qo->before) {
+        stmt = &history_statements[STMT_BEFORE(searched ? qo->statement : STMT_LIST_LINE)];
+    }
+    history_output_reset(output, !searched);
+    do {
+        Iterator it;
+        time_t from, to;
+        history_row_t row;
+
+        page_rows = 0;
+        // narrow the range of the index on inserted_at to the cursor
+        from = qo->before ? MAX(qo->from, cursor.inserted_at) : qo->from;
+        to = qo->before ? qo->to : MIN(qo->to, cursor.inserted_at);
+        if (searched) {
+            statement_bind(stmt, qo->operations, from, to, NULL == qo->versions, cursor.inserted_at, cursor.id, page_limit);
+        } else {
+            statement_bind(stmt, from, to, qo->operations, NULL == qo->versions, cursor.inserted_at, cursor.id, page_limit);
+        }
+        statement_to_iterator(&it, stmt, &row.command_id, &row.inserted_at, &row.command, &row.line_id, &row.name, &row.origin, &row.repo, &row.old_version, &row.new_version, &row.operation);
+        for (iterator_first(&it); ok && iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+            ok = history_output_row(output, &row, error);
+            if (0 == rows + page_rows) {
+                first.inserted_at = row.inserted_at;
+                first.id = row.line_id;
+            }
+            last.inserted_at = row.inserted_at;
+            last.id = row.line_id;
+            ++page_rows;
+        }
+        iterator_close(&it);
+        rows += page_rows;
+        cursor = last;
+    } while (ok && 0 == qo->limit && page_rows == page_limit);
+    if (ok) {
+        ok = history_output_flush(output, error);
+    }
+    if (ok) {
+        if (HISTORY_FORMAT_TABLE != qo->format) {
+            if (0 != rows) {
+                display_cursors(stderr, qo, rows, &first, &last);
+            }
+        } else if (0 == rows) {
+            printf("nothing to show\n");
+        } else {
+            display_cursors(stdout, qo, rows, &first, &last);
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * Displays the operations recorded in the histories of the count jails,
+ * merged and newest first, restricted to the packages set by
+ * history_db_set_searched if searched. The lines are collected by
+ * history_jails_collect and then read at once: there is no cursor since
+ * the identifiers of the lines are only unique to a jail.
+ */
+static bool display_jails(const query_options_t *qo, history_output_t *output, sqlite_db_t *db, const history_jail_t *jails, size_t count, bool searched, char **error)
+{
+    bool ok;
+    Iterator it;
+    int rows, jail_id;
+    history_row_t row;
+    history_jails_filter_t filter;
+
+    rows = 0;
+    filter.operations = qo->operations;
+    filter.from = qo->from;
+    filter.to = qo->to;
+    filter.limit = qo->limit;
+    filter.searched = searched;
+    filter.case_sensitive = STMT_SEARCH_LINE_EXACT == qo->statement;
+    if (!(ok = history_jails_collect(db, jails, count, &filter, error))) {
+        return false;
+    }
+    // the commands of the jails are interleaved: each row comes with its own
+    history_output_reset(output, false);
+    statement_bind(&history_statements[STMT_LIST_JAIL_LINES], 0 == qo->limit ? -1 : qo->limit);
+    statement_to_iterator(&it, &history_statements[STMT_LIST_JAIL_LINES], &jail_id, &row.command_id, &row.inserted_at, &row.command, &row.line_id, &row.name, &row.origin, &row.repo, &row.old_version, &row.new_version, &row.operation);
+    for (iterator_first(&it); ok && iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+        row.jail = jails[jail_id].name;
+        ok = history_output_row(output, &row, error);
+        ++rows;
+    }
+    iterator_close(&it);
+    if (ok) {
+        ok = history_output_flush(output, error);
+    }
+    if (ok && HISTORY_FORMAT_TABLE == qo->format && 0 == rows) {
+        printf("nothing to show\n");
+    }
+
+    return ok;
+}
+
+/**
+ * Streams, oldest first and until pkg history is interrupted, the lines
+ * recorded after the one of identifier qo->follow_from (-1 for the last
+ * one), restricted to the packages set by history_db_set_searched (by name)
+ * if searched. The database is only read again when an other connection
+ * committed to it (PRAGMA data_version, polled with a backoff) and then
+ * from the last line seen, by primary key.
+ *
+ * NOTE: the commands spooled by the hook (SPOOL = true) only show up once
+ * folded into the database
+ */
+static bool follow_history(const query_options_t *qo, history_output_t *output, sqlite_db_t *db, bool searched, char **error)
+{
+    bool ok, changed;
+    int last_id, interval;
+    int64_t version, seen_version;
+
+    last_id = qo->follow_from;
+    if (-1 == last_id) {
+        if (1 != statement_fetch(db, &history_statements[STMT_LAST_LINE], error, &last_id)) {
+            return false;
+        }
+        // end the read transaction, the changes wouldn't be seen otherwise
+        statement_reset(&history_statements[STMT_LAST_LINE]);
+    }
+    // the version is read before the lines so a commit in between is not missed
+    if (!(ok = sqlite_data_version(db, &seen_version, error))) {
+        return false;
+    }
+    changed = true;
+    interval = FOLLOW_POLL_MIN;
+    history_output_reset(output, true);
+    while (ok) {
+        if (changed) {
+            Iterator it;
+            history_row_t row;
+            sqlite_statement_t *stmt;
+
+            stmt = &history_statements[STMT_FOLLOW_LINE];
+            statement_bind(stmt, last_id, qo->operations, !searched, STMT_SEARCH_LINE_EXACT_CI == qo->statement, NULL == qo->versions);
+            statement_to_iterator(&it, stmt, &row.command_id, &row.inserted_at, &row.command, &row.line_id, &row.name, &row.origin, &row.repo, &row.old_version, &row.new_version, &row.operation);
+            for (iterator_first(&it); ok && iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+                ok = history_output_row(output, &row, error);
+                last_id = row.line_id;
+            }
+            iterator_close(&it);
+            if (!ok || !(ok = history_output_flush(output, error))) {
+                break;
+            }
+            interval = FOLLOW_POLL_MIN;
         } else {
+            struct timespec delay;
+
+            delay.tv_sec = interval / 1000;
+            delay.tv_nsec = (long) (interval % 1000) * 1000000L;
+            nanosleep(&delay, NULL);
+            interval = MIN(interval * 2, FOLLOW_POLL_MAX);
+        }
+        if ((ok = sqlite_data_version(db, &version, error))) {
+            changed = version != seen_version;
+            seen_version = version;
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * Parses a cursor as displayed by display_cursors: <inserted_at>:<id>
+ */
+static bool parse_cursor(const char *string, history_cursor_t *cursor, char **error)
+{
+    bool ok;
+    const char *colon;
+
+    ok = false;
+    do {
+        int64_t inserted_at;
+        int32_t min, id;
+
+        min = 0;
+        if (NULL == (colon = strchr(string, ':'))) {
+            set_generic_error(error, "invalid cursor '%s': <timestamp>:<id> expected", string);
             break;
         }
-        if (!sqlite_stmt_prepare(*db, statements, ARRAY_SIZE(statements), error)) {
+        if (PARSE_NUM_NO_ERR != strntoint64_t(string, colon, NULL, 10, NULL, NULL, &inserted_at)) {
+            set_generic_error(error, "invalid cursor '%s': integer expected as timestamp", string);
             break;
         }
-        status = EPKG_OK;
+        if (PARSE_NUM_NO_ERR != strtoint32_t(colon + 1, NULL, 10, &min, NULL, &id)) {
+            set_generic_error(error, "invalid cursor '%s': positive integer expected as id", string);
+            break;
+        }
+        cursor->inserted_at = (time_t) inserted_at;
+        cursor->id = (int) id;
+        ok = true;
     } while (false);
 
-    return status;
+    return ok;
 }
 
-static int handle_hooks(void *, struct pkgdb *);
+/**
+ * Writes a duration in milliseconds as [[h]m]s.mmm into buffer
+ */
+static void format_duration(int64_t duration, char *buffer, size_t buffer_size)
+{
+    int64_t seconds;
+
+    seconds = duration / 1000;
+    if (seconds >= 3600) {
+        snprintf(buffer, buffer_size, "%" PRIi64 "h%02" PRIi64 "m%02" PRIi64 "s", seconds / 3600, seconds / 60 % 60, seconds % 60);
+    } else if (seconds >= 60) {
+        snprintf(buffer, buffer_size, "%" PRIi64 "m%02" PRIi64 ".%03" PRIi64 "s", seconds / 60, seconds % 60, duration % 1000);
+    } else {
+        snprintf(buffer, buffer_size, "%" PRIi64 ".%03" PRIi64 "s", seconds, duration % 1000);
+    }
+}
+
+#define SLOWEST_DURATION_PADDING_LEN 14
+#define SLOWEST_JOBS_PADDING_LEN 8
+
+/**
+ * Lists the commands (in the range of dates and with one of the operations
+ * of qo) from the slowest one
+ */
+static void display_slowest(const query_options_t *qo)
+{
+    int id, jobs_count;
+    Iterator it;
+    time_t inserted_at;
+    const char *command;
+    timestamp_cache_t dates;
+    int64_t started_at, duration, fetch_duration;
+
+    timestamp_cache_init(&dates, NULL);
+    printf("%*s %*s %*s  %-*s %s\n", SLOWEST_DURATION_PADDING_LEN, "Duration", SLOWEST_DURATION_PADDING_LEN, "Fetch", SLOWEST_JOBS_PADDING_LEN, "Packages", (int) STR_LEN("dd/mm/YY HH:ii:ss"), "Started", "Command");
+    statement_bind(&history_statements[STMT_SLOWEST_COMMANDS], qo->from, qo->to, qo->operations, 0 == qo->limit ? -1 : qo->limit);
+    statement_to_iterator(&it, &history_statements[STMT_SLOWEST_COMMANDS], &id, &inserted_at, &command, &started_at, &duration, &fetch_duration, &jobs_count);
+    for (iterator_first(&it); iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+        char datetime[STR_SIZE("dd/mm/YYYY HH:ii:ss")], total[32], fetch[32];
+
+        format_duration(duration, total, STR_SIZE(total));
+        if (-1 == fetch_duration) {
+            strcpy(fetch, "-");
+        } else {
+            format_duration(fetch_duration, fetch, STR_SIZE(fetch));
+        }
+        timestamp_cache_display(&dates, (time_t) (started_at / 1000), datetime, datetime + STR_SIZE(datetime));
+        printf("%*s %*s %*d  %s %s\n", SLOWEST_DURATION_PADDING_LEN, total, SLOWEST_DURATION_PADDING_LEN, fetch, SLOWEST_JOBS_PADDING_LEN, jobs_count, datetime, command);
+    }
+    iterator_close(&it);
+}
+
+static void query_options_init(query_options_t *qo)
+{
+    qo->limit = 100;
+    qo->operations = 0;
+    qo->to = time(NULL);
+    qo->from = (time_t) 0;
+    qo->use_origin = false;
+    qo->format = HISTORY_FORMAT_TABLE;
+    qo->statement = STMT_SEARCH_LINE_EXACT_CI;
+    qo->before = qo->has_cursor = false;
+    qo->slowest = false;
+    qo->versions = NULL;
+    qo->jails = NULL;
+    qo->follow = false;
+    qo->follow_from = -1;
+    qo->cursor.inserted_at = qo->to;
+    qo->cursor.id = INT_MAX;
+}
+
+/**
+ * The options -s and -x only exist when their statements are built in: a
+ * build without them rejects them as unknown
+ */
+#ifdef WITH_FTS
+# define SUBSTRING_OPTION "s"
+#else
+# define SUBSTRING_OPTION ""
+#endif /* WITH_FTS */
+
+#ifdef WITH_REGEX
+# define REGEX_OPTION "x"
+#else
+# define REGEX_OPTION ""
+#endif /* WITH_REGEX */
+
+static char optstr[] = "a:b:CdF:f:giJ:n:oS" SUBSTRING_OPTION "ut:v:w" REGEX_OPTION;
+
+static struct option long_options[] = {
+    { "glob",             no_argument,       NULL, 'g' },
+    { "case-sensitive",   no_argument,       NULL, 'C' },
+#ifdef WITH_FTS
+    { "substring",        no_argument,       NULL, 's' },
+#endif /* WITH_FTS */
+#ifdef WITH_REGEX
+    { "regex",            no_argument,       NULL, 'x' },
+#endif /* WITH_REGEX */
+    { "delete",           no_argument,       NULL, 'd' },
+    { "install",          no_argument,       NULL, 'i' },
+    { "upgrade",          no_argument,       NULL, 'u' },
+    { "limit",            required_argument, NULL, 'n' },
+    { "from",             required_argument, NULL, 'f' },
+    { "to",               required_argument, NULL, 't' },
+    { "version",          required_argument, NULL, 'v' },
+    { "after",            required_argument, NULL, 'a' },
+    { "before",           required_argument, NULL, 'b' },
+    { "format",           required_argument, NULL, 'F' },
+    { "slowest",          no_argument,       NULL, 'S' },
+    { "jails",            required_argument, NULL, 'J' },
+    { "follow",           optional_argument, NULL, 'w' },
+    { NULL,               no_argument,       NULL, 0   },
+};
+
+static void usage(void)
+{
+    fputs("usage: pkg history [-Cgdi" SUBSTRING_OPTION "u" REGEX_OPTION "] [-n count] [-f date] [-t date] [-v version] [-a cursor | -b cursor] [-F format] [package ...]\n", stderr);
+    fputs("       pkg history --slowest [-diu] [-n count] [-f date] [-t date]\n", stderr);
+    fputs("       pkg history --jails=all|jail,... [-Cdiu] [-n count] [-f date] [-t date] [-F format] [package ...]\n", stderr);
+    fputs("       pkg history --follow[=id] [-Cdiu] [-v version] [-F format] [package ...]\n", stderr);
+    fputs("       pkg history stats [-n count] [-f date] [-t date]\n", stderr);
+    fputs("       pkg history import [-j count] logfile ...\n", stderr);
+    fputs("       pkg history at date\n", stderr);
+    fputs("       pkg history compact\n", stderr);
+    fputs("       pkg history merge database [host=]source ...\n", stderr);
+    fputs("       pkg history hosts [-v version] database package ...\n", stderr);
+    fputs("       pkg history which path ...\n", stderr);
+    fputs("       pkg history growth [-n count] [-f date] [-t date]\n", stderr);
+    fputs("(the operations on any of the given packages are displayed together, newest first; a package named like a subcommand is given after --)\n", stderr);
+    fputs("-C, --case-sensitive\n", stderr);
+    fputs("\tmatching case sensitively against *package* (default is to ignore case except for -g/--glob and -x/--regex)\n", stderr);
+    fputs("-g, --glob\n", stderr);
+    fputs("\ttreat *package* as a shell glob pattern\n", stderr);
+#ifdef WITH_FTS
+    fputs("-s, --substring\n", stderr);
+    fputs("\tsearch the packages (name or origin) and the commands containing *package* (at least 3 characters, case insensitively)\n", stderr);
+#endif /* WITH_FTS */
+#ifdef WITH_REGEX
+    fputs("-x, --regex\n", stderr);
+    fputs("\ttreat *package* as an extended regular expression (see re_format(7))\n", stderr);
+#endif /* WITH_REGEX */
+    fputs("-d, --delete\n", stderr);
+    fputs("\tdon't show the full history, only include package deletions\n", stderr);
+    fputs("-i, --insert\n", stderr);
+    fputs("\tdon't show the full history, only include package installations\n", stderr);
+    fputs("-u, --upgrade\n", stderr);
+    fputs("\tdon't show the full history, only include package upgrades\n", stderr);
+    fputs("-n *count*, --limit=*count*\n", stderr);
+    fputs("\tdisplay at most *count* pkg operations (0 for no limit)\n", stderr);
+    fputs("-f *date*, --from=*date*\n", stderr);
+    fputs("\tthe search begins from *date*\n", stderr);
+    fputs("-t *date*, --to=date\n", stderr);
+    fputs("\tthe search ends at *date*\n", stderr);
+    fputs("-v *version*, --version=*version*\n", stderr);
+    fputs("\tonly the operations whose (new) version is *version* or, if prefixed by <, <=, >= or >, older/newer than it (compared as pkg does)\n", stderr);
+    fputs("-a *cursor*, --after=*cursor*\n", stderr);
+    fputs("\tdisplay the operations older than *cursor* (as printed after \"Older operations:\")\n", stderr);
+    fputs("-b *cursor*, --before=*cursor*\n", stderr);
+    fputs("\tdisplay the operations newer than *cursor* (as printed after \"Newer operations:\")\n", stderr);
+    fputs("-F *format*, --format=*format*\n", stderr);
+    fputs("\toutput format, one of: table (default), jsonl, csv or tsv (one line per operation, cursors go to stderr)\n", stderr);
+    fputs("-S, --slowest\n", stderr);
+    fputs("\tlist the commands which took the longest, from their first to their last hook (those recorded since 0.9.6)\n", stderr);
+    fputs("-J *jails*, --jails=*jails*\n", stderr);
+    fputs("\tlist, merged, the histories of the running jails, all of them or the given ones (comma separated names), instead of the one of the host\n", stderr);
+    fputs("-w, --follow[=*id*]\n", stderr);
+    fputs("\twait for the operations to come and display them as they are recorded, oldest first (or the ones after the operation *id*, as output by jsonl, csv and tsv)\n", stderr);
+}
+
+#define STATS_DEFAULT_LIMIT 10
+
+static const struct {
+    int statement;
+    const char *title;
+} stats_periods[] = {
+    { STMT_STATS_BY_DAY, "Day" },
+    { STMT_STATS_BY_WEEK, "Week" },
+    { STMT_STATS_BY_MONTH, "Month" },
+};
+
+#define STATS_KEY_PADDING_LEN -40
+#define STATS_COUNT_PADDING_LEN 12
+
+static void display_stats_header(const char *title)
+{
+    printf("%*s %*s %*s %*s\n", STATS_KEY_PADDING_LEN, title, STATS_COUNT_PADDING_LEN, "Installed", STATS_COUNT_PADDING_LEN, "Deleted", STATS_COUNT_PADDING_LEN, "Upgraded");
+}
+
+static void display_stats_row(const char *key, int installed, int deleted, int upgraded)
+{
+    printf("%*s %*d %*d %*d\n", STATS_KEY_PADDING_LEN, key, STATS_COUNT_PADDING_LEN, installed, STATS_COUNT_PADDING_LEN, deleted, STATS_COUNT_PADDING_LEN, upgraded);
+}
+
+/**
+ * Displays the statistics from the summary tables: operations per day, week
+ * and month (the most recent ones in the [from ; to] range), the most
+ * upgraded packages and the operations per repository
+ */
+static void display_stats(time_t from, time_t to, int limit)
+{
+    size_t i;
+    Iterator it;
+    const char *key;
+    int installed, deleted, upgraded, count;
+
+    for (i = 0; i < ARRAY_SIZE(stats_periods); i++) {
+        statement_bind(&history_statements[stats_periods[i].statement], from, to, limit);
+        statement_to_iterator(&it, &history_statements[stats_periods[i].statement], &key, &installed, &deleted, &upgraded);
+        display_stats_header(stats_periods[i].title);
+        for (iterator_first(&it); iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+            display_stats_row(key, installed, deleted, upgraded);
+        }
+        iterator_close(&it);
+        fputc('\n', stdout);
+    }
+    printf("%*s %*s\n", STATS_KEY_PADDING_LEN, "Most upgraded packages", STATS_COUNT_PADDING_LEN, "Upgrades");
+    statement_bind(&history_statements[STMT_STATS_TOP_PACKAGES], PKG_OP_UPGRADE, limit);
+    statement_to_iterator(&it, &history_statements[STMT_STATS_TOP_PACKAGES], &key, &count);
+    for (iterator_first(&it); iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+        printf("%*s %*d\n", STATS_KEY_PADDING_LEN, key, STATS_COUNT_PADDING_LEN, count);
+    }
+    iterator_close(&it);
+    fputc('\n', stdout);
+    display_stats_header("Repository");
+    statement_bind(&history_statements[STMT_STATS_REPOSITORIES]);
+    statement_to_iterator(&it, &history_statements[STMT_STATS_REPOSITORIES], &key, &installed, &deleted, &upgraded);
+    for (iterator_first(&it); iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+        display_stats_row('\0' == *key ? "-" : key, installed, deleted, upgraded);
+    }
+    iterator_close(&it);
+}
 
-char *timestamp_to_localtime(time_t t, const char *format, char *buffer, const char * const buffer_end, char **error)
+static char stats_optstr[] = "f:n:t:";
+
+static struct option stats_long_options[] = {
+    { "limit",            required_argument, NULL, 'n' },
+    { "from",             required_argument, NULL, 'f' },
+    { "to",               required_argument, NULL, 't' },
+    { NULL,               no_argument,       NULL, 0   },
+};
+
+static void stats_usage(void)
+{
+    fputs("usage: pkg history stats [-n count] [-f date] [-t date]\n", stderr);
+    fputs("-n *count*, --limit=*count*\n", stderr);
+    fputs("\tdisplay at most *count* days, weeks, months and packages (default is " STRINGIFY_EXPAND(STATS_DEFAULT_LIMIT) ")\n", stderr);
+    fputs("-f *date*, --from=*date*\n", stderr);
+    fputs("\tthe days, weeks and months begin from *date*\n", stderr);
+    fputs("-t *date*, --to=date\n", stderr);
+    fputs("\tthe days, weeks and months end at *date*\n", stderr);
+}
+
+static int pkg_history_stats(int argc, char **argv)
 {
-    char *w;
-    size_t written;
-    struct tm ltm = { 0 };
+    int ch, limit;
+    char *error;
+    time_t from, to;
+    sqlite_db_t *db;
+
+    db = NULL;
+    error = NULL;
+    from = (time_t) 0;
+    to = time(NULL);
+    limit = STATS_DEFAULT_LIMIT;
+    while (-1 != (ch = getopt_long(argc, argv, stats_optstr, stats_long_options, NULL))) {
+        switch (ch) {
+            case 'n':
+            {
+                int32_t min, max, val;
+
+                min = 1;
+                max = INT_MAX;
+                if (PARSE_NUM_NO_ERR != strtoint32_t((const char *) optarg, NULL, 10, &min, &max, &val)) {
+                    set_generic_error(&error, "parameter --limit/-n is invalid: integer expected in range of [1;%d]", INT_MAX);
+                    goto invalid_argument;
+                }
+                limit = (int) val;
+                break;
+            }
+            case 'f':
+                if (!parse_date(optarg, &from, &error)) {
+                    goto invalid_argument;
+                }
+                break;
+            case 't':
+                if (!parse_date(optarg, &to, &error)) {
+                    goto invalid_argument;
+                }
+                break;
+            default:
+                stats_usage();
+                return EX_USAGE;
+        }
+    }
+    if (EPKG_OK == db_open(&db, PKGDB_MODE_READ, NULL, &error)) {
+        display_stats(from, to, limit);
+        history_db_close(db);
+    }
+invalid_argument:
+    if (NULL != error) {
+        pkg_plugin_error(self, "%s", error);
+        error_free(&error);
+    }
+
+    return EPKG_OK;
+}
+
+static char import_optstr[] = "j:";
 
-    w = NULL;
+static struct option import_long_options[] = {
+    { "jobs",             required_argument, NULL, 'j' },
+    { NULL,               no_argument,       NULL, 0   },
+};
+
+static void import_usage(void)
+{
+    fputs("usage: pkg history import [-j count] logfile ...\n", stderr);
+    fputs("(imports the package operations logged by pkg to syslog before the plugin was installed, - reads the standard input)\n", stderr);
+    fputs("-j *count*, --jobs=*count*\n", stderr);
+    fputs("\tparse the logs with *count* threads (default is the count of processors)\n", stderr);
+}
+
+static int pkg_history_import(int argc, char **argv)
+{
+    int ch, jobs;
+    char *error;
+    sqlite_db_t *db;
+    history_import_stats_t stats;
+
+    db = NULL;
+    jobs = 0;
+    error = NULL;
+    while (-1 != (ch = getopt_long(argc, argv, import_optstr, import_long_options, NULL))) {
+        switch (ch) {
+            case 'j':
+            {
+                int32_t min, max, val;
+
+                min = 1;
+                max = INT_MAX;
+                if (PARSE_NUM_NO_ERR != strtoint32_t((const char *) optarg, NULL, 10, &min, &max, &val)) {
+                    set_generic_error(&error, "parameter --jobs/-j is invalid: integer expected in range of [1;%d]", INT_MAX);
+                    goto invalid_argument;
+                }
+                jobs = (int) val;
+                break;
+            }
+            default:
+                import_usage();
+                return EX_USAGE;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc < 1) {
+        import_usage();
+        return EX_USAGE;
+    }
+    if (EPKG_OK == db_open(&db, PKGDB_MODE_READ | PKGDB_MODE_WRITE, NULL, &error)) {
+        if (history_import(db, (const char **) argv, (size_t) argc, jobs, &stats, &error)) {
+            printf("%zu operations imported as %zu commands (%zu lines logged by pkg: %zu not understood, %zu already in the history)\n", stats.operations, stats.commands, stats.lines, stats.invalid, stats.skipped);
+            // the imported commands precede (and invalidated) the checkpoints: take them all again
+            if (checkpoint_interval > 0) {
+                history_db_create_checkpoints(db, checkpoint_interval, 0, &error);
+            }
+        }
+        history_db_close(db);
+    }
+invalid_argument:
+    if (NULL != error) {
+        pkg_plugin_error(self, "%s", error);
+        error_free(&error);
+    }
+
+    return EPKG_OK;
+}
+
+#define AT_NAME_PADDING_LEN -40
+#define AT_VERSION_PADDING_LEN -20
+#define AT_ORIGIN_PADDING_LEN -40
+
+static void at_usage(void)
+{
+    fputs("usage: pkg history at date\n", stderr);
+    fputs("(displays the packages which were installed at *date*)\n", stderr);
+}
+
+static int pkg_history_at(int argc, char **argv)
+{
+    char *error;
+    time_t at;
+    sqlite_db_t *db;
+
+    db = NULL;
+    error = NULL;
+    if (2 != argc) {
+        at_usage();
+        return EX_USAGE;
+    }
+    if (parse_date(argv[1], &at, &error) && EPKG_OK == db_open(&db, PKGDB_MODE_READ, NULL, &error)) {
+        Iterator it;
+        const char *name, *version, *origin, *repo;
+
+        if (history_db_installed_at(db, at, &it, &name, &version, &origin, &repo, &error)) {
+            printf("%*s %*s %*s %s\n", AT_NAME_PADDING_LEN, "Package", AT_VERSION_PADDING_LEN, "Version", AT_ORIGIN_PADDING_LEN, "Origin", "Repository");
+            for (iterator_first(&it); iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+                printf("%*s %*s %*s %s\n", AT_NAME_PADDING_LEN, name, AT_VERSION_PADDING_LEN, version, AT_ORIGIN_PADDING_LEN, '\0' == *origin ? "-" : origin, NULL == repo ? "-" : repo);
+            }
+            iterator_close(&it);
+        }
+        history_db_close(db);
+    }
+    if (NULL != error) {
+        pkg_plugin_error(self, "%s", error);
+        error_free(&error);
+    }
+
+    return EPKG_OK;
+}
+
+static int pkg_history_compact(int argc, char **UNUSED(argv))
+{
+    char *error;
+    sqlite_db_t *db;
+    history_spool_stats_t folded;
+
+    db = NULL;
+    error = NULL;
+    if (1 != argc) {
+        fputs("usage: pkg history compact\n", stderr);
+        fputs("(folds the commands spooled by the hook into the database)\n", stderr);
+        return EX_USAGE;
+    }
+    if (EPKG_OK == db_open(&db, PKGDB_MODE_READ | PKGDB_MODE_WRITE, &folded, &error)) {
+        // catch up with the checkpoints of all the folded commands
+        if (db_maintain(db, 0, &error)) {
+            printf("%zu commands (%zu operations) folded from the spool\n", folded.commands, folded.operations);
+        }
+        history_db_close(db);
+    }
+    if (NULL != error) {
+        pkg_plugin_error(self, "%s", error);
+        error_free(&error);
+    }
+
+    return EPKG_OK;
+}
+
+static void merge_usage(void)
+{
+    fputs("usage: pkg history merge database [host=]source ...\n", stderr);
+    fputs("(merges the histories *source* of other hosts into *database*, created if needed, to query them at once with pkg history hosts)\n", stderr);
+    fputs("the host of a source is *host* if given, else the name of its directory when it is named history.sqlite (eg hosts/foo/history.sqlite), else its name without its extension\n", stderr);
+}
+
+/**
+ * Splits a source of pkg history merge, [host=]path, in its path and the
+ * name of its host (written to buffer when guessed from the path)
+ */
+static bool merge_parse_source(char *arg, history_merge_source_t *source, char *buffer, size_t buffer_size, char **error)
+{
+    char *p;
+    const char *base, *end;
+
+    if (NULL != (p = strchr(arg, '=')) && p != arg && NULL == memchr(arg, '/', p - arg)) {
+        *p = '\0';
+        source->host = arg;
+        source->path = p + 1;
+        return true;
+    }
+    source->path = arg;
+    end = arg + strlen(arg);
+    if (NULL == (base = strrchr(arg, '/'))) {
+        base = arg;
+    } else {
+        ++base;
+    }
+    if (0 == strcmp(base, "history.sqlite") && base - arg >= 2) {
+        // the directory: from the previous / (if any) to the one before base
+        end = base - 1;
+        for (base = end; base > arg && '/' != base[-1]; base--)
+            ;
+    } else if (NULL != (p = strrchr(base, '.')) && p != base) {
+        end = p;
+    }
+    if (base == end || (size_t) (end - base) >= buffer_size) {
+        set_generic_error(error, "can't guess the host of %s, use host=%s", arg, arg);
+        return false;
+    }
+    memcpy(buffer, base, end - base);
+    buffer[end - base] = '\0';
+    source->host = buffer;
+
+    return true;
+}
+
+static int pkg_history_merge(int argc, char **argv)
+{
+    char *error;
+    sqlite_db_t *db;
+    char (*hosts)[MAXHOSTNAMELEN];
+    history_merge_source_t *sources;
+
+    db = NULL;
+    error = NULL;
+    hosts = NULL;
+    sources = NULL;
+    if (argc < 3) {
+        merge_usage();
+        return EX_USAGE;
+    }
+    argc -= 2;
     do {
-        if (NULL == localtime_r(&t, &ltm)) {
-            set_generic_error(error, "localtime_r(3) failed");
+        int i;
+        history_merge_stats_t stats;
+
+        if (NULL == (sources = malloc(sizeof(*sources) * argc)) || NULL == (hosts = malloc(sizeof(*hosts) * argc))) {
+            set_malloc_error(&error, (sizeof(*sources) + sizeof(*hosts)) * argc);
+            break;
+        }
+        for (i = 0; i < argc; i++) {
+            if (!merge_parse_source(argv[2 + i], &sources[i], hosts[i], STR_SIZE(hosts[i]), &error)) {
+                break;
+            }
+            if (0 != access(sources[i].path, R_OK)) {
+                set_system_error(&error, "can't read %s", sources[i].path);
+                break;
+            }
+        }
+        if (i < argc) {
             break;
         }
-        if (0 == (written = strftime(buffer, buffer_end - buffer, NULL == format ? "%x %X" : format, &ltm))) {
-            set_generic_error(error, "strftime(3) failed");
+        if (EPKG_OK != history_db_open(argv[1], PKGDB_MODE_READ | PKGDB_MODE_WRITE | PKGDB_MODE_CREATE, &open_options, &db, &error)) {
             break;
         }
-        w = buffer + written;
+        if (history_merge(db, sources, (size_t) argc, &stats, &error)) {
+            printf("%zu commands (%zu operations) merged from %zu databases, %zu commands were already merged\n", stats.commands, stats.operations, stats.sources, stats.duplicates);
+        }
     } while (false);
+    if (NULL != db) {
+        history_db_close(db);
+    }
+    free(sources);
+    free(hosts);
+    if (NULL != error) {
+        pkg_plugin_error(self, "%s", error);
+        error_free(&error);
+    }
 
-    return w;
+    return EPKG_OK;
 }
 
-static const char *operation_names[] = {
-    [PKG_SHIFT_OP_INSTALL] = "Installed",
-    [PKG_SHIFT_OP_DEINSTALL] = "Deleted",
-    [PKG_SHIFT_OP_UPGRADE] = "Upgraded",
+#define HOSTS_HOST_PADDING_LEN -30
+#define HOSTS_NAME_PADDING_LEN -30
+#define HOSTS_VERSION_PADDING_LEN -20
+
+static void hosts_usage(void)
+{
+    fputs("usage: pkg history hosts [-v version] database package ...\n", stderr);
+    fputs("(displays the hosts, of a database built by pkg history merge, on which *package* is installed, - being the local host)\n", stderr);
+    fputs("-v *version*, --version=*version*\n", stderr);
+    fputs("\tonly the hosts running *version* of *package* or, if prefixed by <, <=, >= or >, a version older/newer than it\n", stderr);
+}
+
+static char hosts_optstr[] = "v:";
+
+static struct option hosts_long_options[] = {
+    { "version",          required_argument, NULL, 'v' },
+    { NULL,               no_argument,       NULL, 0   },
 };
 
-static const char *operation_name(int operation)
+static int pkg_history_hosts(int argc, char **argv)
+{
+    int ch;
+    char *error;
+    sqlite_db_t *db;
+    const char *version;
+
+    db = NULL;
+    error = NULL;
+    version = NULL;
+    while (-1 != (ch = getopt_long(argc, argv, hosts_optstr, hosts_long_options, NULL))) {
+        switch (ch) {
+            case 'v':
+                version = optarg;
+                break;
+            default:
+                hosts_usage();
+                return EX_USAGE;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc < 2) {
+        hosts_usage();
+        return EX_USAGE;
+    }
+    if (EPKG_OK == history_db_open(argv[0], PKGDB_MODE_READ, &query_options, &db, &error)) {
+        Iterator it;
+        time_t since;
+        timestamp_cache_t dates;
+        const char *host, *name, *installed_version;
+
+        timestamp_cache_init(&dates, NULL);
+        if (history_db_hosts_running(db, (const char **) argv + 1, (size_t) argc - 1, version, &it, &host, &name, &installed_version, &since, &error)) {
+            printf("%*s %*s %*s %s\n", HOSTS_HOST_PADDING_LEN, "Host", HOSTS_NAME_PADDING_LEN, "Package", HOSTS_VERSION_PADDING_LEN, "Version", "Since");
+            for (iterator_first(&it); iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+                char datetime[STR_SIZE("dd/mm/YYYY HH:ii:ss")];
+
+                timestamp_cache_display(&dates, since, datetime, datetime + STR_SIZE(datetime));
+                printf("%*s %*s %*s %s\n", HOSTS_HOST_PADDING_LEN, NULL == host ? "-" : host, HOSTS_NAME_PADDING_LEN, name, HOSTS_VERSION_PADDING_LEN, installed_version, datetime);
+            }
+            iterator_close(&it);
+        }
+        history_db_close(db);
+    }
+    if (NULL != error) {
+        pkg_plugin_error(self, "%s", error);
+        error_free(&error);
+    }
+
+    return EPKG_OK;
+}
+
+#define WHICH_DATE_PADDING_LEN -17
+#define WHICH_CHANGE_PADDING_LEN -8
+#define WHICH_NAME_PADDING_LEN -30
+#define WHICH_VERSION_PADDING_LEN -20
+
+static void which_usage(void)
+{
+    fputs("usage: pkg history which path ...\n", stderr);
+    fputs("(displays the operations, oldest first, which added or removed *path* or, if it ends with a /, a path under it)\n", stderr);
+}
+
+static int pkg_history_which(int argc, char **argv)
 {
-    size_t i;
-    const char *name;
+    char *error;
+    sqlite_db_t *db;
 
-    name = "???";
-    for (i = 0; i < ARRAY_SIZE(operation_names); i++) {
-        if (operation == (1<<i)) {
-            name = operation_names[i];
-            break;
-        }
+    db = NULL;
+    error = NULL;
+    if (argc < 2) {
+        which_usage();
+        return EX_USAGE;
     }
+    if (EPKG_OK == db_open(&db, PKGDB_MODE_READ, NULL, &error)) {
+        int i;
+        timestamp_cache_t dates;
 
-    return name;
-}
+        timestamp_cache_init(&dates, NULL);
+        printf("%*s %*s %*s %*s %s\n", WHICH_DATE_PADDING_LEN, "Date", WHICH_CHANGE_PADDING_LEN, "Change", WHICH_NAME_PADDING_LEN, "Package", WHICH_VERSION_PADDING_LEN, "Version", "Path");
+        for (i = 1; i < argc; i++) {
+            Iterator it;
+            time_t inserted_at;
+            sqlite_blob_t files;
+            const char *command, *name, *old_version, *new_version, *path;
 
-static void display_command(time_t inserted_at, const char *command)
-{
-    char datetime[STR_SIZE("dd/mm/YYYY HH:ii:ss")];
+            if (!history_files_which(db, argv[i], &it, &inserted_at, &command, &name, &old_version, &new_version, &path, &files, &error)) {
+                break;
+            }
+            for (iterator_first(&it); iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+                bool added;
+                char datetime[STR_SIZE("dd/mm/YYYY HH:ii:ss")];
+
+                if (!history_files_find(&files, path, &added)) {
+                    // the index and the changes of the line disagree, shouldn't happen
+                    continue;
+                }
+                timestamp_cache_display(&dates, inserted_at, datetime, datetime + STR_SIZE(datetime));
+                // a removed file belonged to the previous version, if any
+                printf(
+                    "%*s %*s %*s %*s %s\n",
+                    WHICH_DATE_PADDING_LEN, datetime,
+                    WHICH_CHANGE_PADDING_LEN, added ? "added" : "removed",
+                    WHICH_NAME_PADDING_LEN, name,
+                    WHICH_VERSION_PADDING_LEN, added || NULL == old_version ? new_version : old_version,
+                    path
+                );
+            }
+            iterator_close(&it);
+        }
+        history_db_close(db);
+    }
+    if (NULL != error) {
+        pkg_plugin_error(self, "%s", error);
+        error_free(&error);
+    }
 
-    timestamp_to_localtime(inserted_at, NULL, datetime, datetime + STR_SIZE(datetime), NULL);
-    printf("On %s: %s\n", datetime, command);
+    return EPKG_OK;
 }
 
-// #define REPO_PADDING_LEN      -20
-#define VERSION_PADDING_LEN   -20
-#define PACKAGE_PADDING_LEN   -40
-#define OPERATION_PADDING_LEN -20
+#define GROWTH_DEFAULT_LIMIT 10
 
-static void display_package_header(void)
-{
-    printf(
-        "\t%*s %*s %*s %*s %s\n",
-        OPERATION_PADDING_LEN, "Operation",
-        PACKAGE_PADDING_LEN, "Package",
-        VERSION_PADDING_LEN, "New version",
-        VERSION_PADDING_LEN, "Old version",
-        /*REPO_PADDING_LEN, */"Repository"
-    );
-}
+#define GROWTH_KEY_PADDING_LEN -40
+#define GROWTH_SIZE_PADDING_LEN 12
+#define GROWTH_COUNT_PADDING_LEN 10
 
-static void display_package(int operation, const char *name, const char *repo, const char *new_version, const char *old_version)
+/**
+ * Writes a count of bytes, signed (+ for a growth), in the largest binary
+ * unit (B, KiB, MiB, ...) it has an integral part of into buffer
+ */
+static void format_size(int64_t size, char *buffer, size_t buffer_size)
 {
-    printf(
-        "\t%*s %*s %*s %*s %s\n",
-        OPERATION_PADDING_LEN, operation_name(operation),
-        PACKAGE_PADDING_LEN, name,
-        VERSION_PADDING_LEN, new_version,
-        VERSION_PADDING_LEN, NULL == old_version ? "-" : old_version,
-        /*REPO_PADDING_LEN, */NULL == repo ? "-" : repo
-    );
-}
+    size_t unit;
+    double value;
+    const char *sign;
+    static const char * const units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
 
-static void display_history_full(const query_options_t *qo)
-{
-    Iterator it;
-    time_t inserted_at;
-    int operation, command_id, previous_command_id;
-    char *command, *name, *repo, *old_version, *new_version;
-
-    previous_command_id = -1;
-    statement_bind(&statements[STMT_LIST_LINE], qo->from, qo->to, qo->operations, qo->limit);
-    statement_to_iterator(&it, &statements[STMT_LIST_LINE], &command_id, &inserted_at, &command, qo->use_origin ? NULL : &name, qo->use_origin ? &name : NULL, &repo, &old_version, &new_version, &operation);
-    iterator_first(&it);
-    if (iterator_is_valid(&it, NULL, NULL)) {
-        do {
-            if (previous_command_id != command_id) {
-                if (-1 != previous_command_id) {
-                    fputc('\n', stdout);
-                }
-                display_command(inserted_at, command);
-                display_package_header();
-            }
-            if (NULL == name) {
-                printf("no operation\n");
-            } else {
-                display_package(operation, name, repo, new_version, old_version);
-            }
-            previous_command_id = command_id;
-            iterator_next(&it);
-        } while (iterator_is_valid(&it, NULL, NULL));
+    sign = size > 0 ? "+" : size < 0 ? "-" : "";
+    value = size < 0 ? -(double) size : (double) size;
+    for (unit = 0; value >= 1024.0 && unit < ARRAY_SIZE(units) - 1; unit++) {
+        value /= 1024.0;
+    }
+    if (0 == unit) {
+        snprintf(buffer, buffer_size, "%s%.0f %s", sign, value, units[unit]);
     } else {
-        printf("nothing to show\n");
+        snprintf(buffer, buffer_size, "%s%.1f %s", sign, value, units[unit]);
     }
-    iterator_close(&it);
 }
 
-static void display_history_search(const query_options_t *qo, const char *searched)
+/**
+ * Displays the packages then the commands which grew the installed size
+ * the most between from and to (at most limit of each)
+ */
+static void display_growth(time_t from, time_t to, int limit)
 {
     Iterator it;
-    int operation;
+    timestamp_cache_t dates;
+    int id, operations_count;
     time_t inserted_at;
-    char *command, *name, *repo, *old_version, *new_version;
-
-    statement_bind(&statements[qo->statement], searched, qo->operations, qo->from, qo->to, qo->limit);
-    statement_to_iterator(&it, &statements[qo->statement], &inserted_at, &command, qo->use_origin ? NULL : &name, qo->use_origin ? &name : NULL, &repo, &old_version, &new_version, &operation);
-    iterator_first(&it);
-    if (iterator_is_valid(&it, NULL, NULL)) {
-        do {
-            display_command(inserted_at, command);
-            display_package_header();
-            display_package(operation, name, repo, new_version, old_version);
-            printf("\n");
-            iterator_next(&it);
-        } while (iterator_is_valid(&it, NULL, NULL));
-    } else {
-        printf("nothing to show\n");
+    int64_t growth;
+    const char *name, *command;
+
+    printf("%*s %*s %*s\n", GROWTH_KEY_PADDING_LEN, "Package", GROWTH_SIZE_PADDING_LEN, "Growth", GROWTH_COUNT_PADDING_LEN, "Operations");
+    statement_bind(&history_statements[STMT_GROWTH_BY_PACKAGE], from, to, limit);
+    statement_to_iterator(&it, &history_statements[STMT_GROWTH_BY_PACKAGE], &name, &growth, &operations_count);
+    for (iterator_first(&it); iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+        char size[32];
+
+        format_size(growth, size, STR_SIZE(size));
+        printf("%*s %*s %*d\n", GROWTH_KEY_PADDING_LEN, name, GROWTH_SIZE_PADDING_LEN, size, GROWTH_COUNT_PADDING_LEN, operations_count);
     }
     iterator_close(&it);
-}
+    fputc('\n', stdout);
+    timestamp_cache_init(&dates, NULL);
+    printf("%*s %*s  %-*s %s\n", GROWTH_SIZE_PADDING_LEN, "Growth", GROWTH_COUNT_PADDING_LEN, "Operations", (int) STR_LEN("dd/mm/YY HH:ii:ss"), "Date", "Command");
+    statement_bind(&history_statements[STMT_GROWTH_BY_COMMAND], from, to, limit);
+    statement_to_iterator(&it, &history_statements[STMT_GROWTH_BY_COMMAND], &id, &inserted_at, &command, &growth, &operations_count);
+    for (iterator_first(&it); iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+        char size[32], datetime[STR_SIZE("dd/mm/YYYY HH:ii:ss")];
 
-static void query_options_init(query_options_t *qo)
-{
-    qo->limit = 100;
-    qo->operations = 0;
-    qo->to = time(NULL);
-    qo->from = (time_t) 0;
-    qo->use_origin = false;
-    qo->statement = STMT_SEARCH_LINE_EXACT_CI;
+        format_size(growth, size, STR_SIZE(size));
+        timestamp_cache_display(&dates, inserted_at, datetime, datetime + STR_SIZE(datetime));
+        printf("%*s %*d  %s %s\n", GROWTH_SIZE_PADDING_LEN, size, GROWTH_COUNT_PADDING_LEN, operations_count, datetime, command);
+    }
+    iterator_close(&it);
 }
 
-static char optstr[] = "Cdf:gin:out:";
+static char growth_optstr[] = "f:n:t:";
 
-static struct option long_options[] = {
-    { "glob",             no_argument,       NULL, 'g' },
-    { "case-sensitive",   no_argument,       NULL, 'C' },
-#ifdef WITH_REGEX
-    { "regex",            no_argument,       NULL, 'x' },
-#endif /* WITH_REGEX */
-    { "delete",           no_argument,       NULL, 'd' },
-    { "install",          no_argument,       NULL, 'i' },
-    { "upgrade",          no_argument,       NULL, 'u' },
+static struct option growth_long_options[] = {
     { "limit",            required_argument, NULL, 'n' },
     { "from",             required_argument, NULL, 'f' },
     { "to",               required_argument, NULL, 't' },
     { NULL,               no_argument,       NULL, 0   },
 };
 
-static void usage(void)
+static void growth_usage(void)
 {
-    fputs("usage: pkg history [-Cgdiu] [-n count] [-f date] [-t date] [package]\n", stderr);
-    fputs("-C, --case-sensitive\n", stderr);
-    fputs("\tmatching case sensitively against *package* (default is to ignore case except for -g/--glob)\n", stderr);
-    fputs("-g, --glob\n", stderr);
-    fputs("\ttreat *package* as a shell glob pattern\n", stderr);
-#ifdef WITH_REGEX
-    fputs("-x, --regex\n", stderr);
-    fputs("\ttreat *package* as a regular expression\n", stderr);
-#endif /* WITH_REGEX */
-    fputs("-d, --delete\n", stderr);
-    fputs("\tdon't show the full history, only include package deletions\n", stderr);
-    fputs("-i, --insert\n", stderr);
-    fputs("\tdon't show the full history, only include package installations\n", stderr);
-    fputs("-u, --upgrade\n", stderr);
-    fputs("\tdon't show the full history, only include package upgrades\n", stderr);
+    fputs("usage: pkg history growth [-n count] [-f date] [-t date]\n", stderr);
+    fputs("(displays the packages then the commands which grew the installed size the most, from the operations recorded with their sizes)\n", stderr);
     fputs("-n *count*, --limit=*count*\n", stderr);
-    fputs("\tdisplay at most *count* pkg operations\n", stderr);
+    fputs("\tdisplay at most *count* packages and commands (default is " STRINGIFY_EXPAND(GROWTH_DEFAULT_LIMIT) ")\n", stderr);
     fputs("-f *date*, --from=*date*\n", stderr);
-    fputs("\tthe search begins from *date*\n", stderr);
+    fputs("\tonly consider the commands run from *date*\n", stderr);
     fputs("-t *date*, --to=date\n", stderr);
-    fputs("\tthe search ends at *date*\n", stderr);
+    fputs("\tonly consider the commands run until *date*\n", stderr);
+}
+
+static int pkg_history_growth(int argc, char **argv)
+{
+    int ch, limit;
+    char *error;
+    time_t from, to;
+    sqlite_db_t *db;
+
+    db = NULL;
+    error = NULL;
+    from = (time_t) 0;
+    to = time(NULL);
+    limit = GROWTH_DEFAULT_LIMIT;
+    while (-1 != (ch = getopt_long(argc, argv, growth_optstr, growth_long_options, NULL))) {
+        switch (ch) {
+            case 'n':
+            {
+                int32_t min, max, val;
+
+                min = 1;
+                max = INT_MAX;
+                if (PARSE_NUM_NO_ERR != strtoint32_t((const char *) optarg, NULL, 10, &min, &max, &val)) {
+                    set_generic_error(&error, "parameter --limit/-n is invalid: integer expected in range of [1;%d]", INT_MAX);
+                    goto invalid_argument;
+                }
+                limit = (int) val;
+                break;
+            }
+            case 'f':
+                if (!parse_date(optarg, &from, &error)) {
+                    goto invalid_argument;
+                }
+                break;
+            case 't':
+                if (!parse_date(optarg, &to, &error)) {
+                    goto invalid_argument;
+                }
+                break;
+            default:
+                growth_usage();
+                return EX_USAGE;
+        }
+    }
+    if (EPKG_OK == db_open(&db, PKGDB_MODE_READ, NULL, &error)) {
+        display_growth(from, to, limit);
+        history_db_close(db);
+    }
+invalid_argument:
+    if (NULL != error) {
+        pkg_plugin_error(self, "%s", error);
+        error_free(&error);
+    }
+
+    return EPKG_OK;
 }
 
+/**
+ * Subcommands of pkg history, given as its first argument (use -- to
+ * search a package named like one of them)
+ */
+static const struct {
+    const char *name;
+    int (*main)(int, char **);
+} subcommands[] = {
+    { "stats", pkg_history_stats },
+    { "import", pkg_history_import },
+    { "at", pkg_history_at },
+    { "compact", pkg_history_compact },
+    { "merge", pkg_history_merge },
+    { "hosts", pkg_history_hosts },
+    { "which", pkg_history_which },
+    { "growth", pkg_history_growth },
+};
+
 static int pkg_history_main(int argc, char **argv)
 {
     int ch;
+    bool dated;
     char *error;
     sqlite_db_t *db;
     //pkg_error_t status;
     query_options_t qo;
+    history_output_t output;
+
+    if (argc > 1) {
+        size_t i;
+
+        for (i = 0; i < ARRAY_SIZE(subcommands); i++) {
+            if (0 == strcmp(argv[1], subcommands[i].name)) {
+                return subcommands[i].main(argc - 1, argv + 1);
+            }
+        }
+    }
 
     db = NULL;
     error = NULL;
     //status = EPKG_FATAL;
+    dated = false;
     query_options_init(&qo);
     while (-1 != (ch = getopt_long(argc, argv, optstr, long_options, NULL))) {
         switch (ch) {
@@ -388,13 +1336,18 @@ static int pkg_history_main(int argc, char **argv)
             case 'u':
                 qo.operations |= PKG_OP_UPGRADE;
                 break;
-            /* last of C/g/x option wins */
+            /* last of C/g/s/x option wins */
             case 'C':
                 qo.statement = STMT_SEARCH_LINE_EXACT;
                 break;
             case 'g':
                 qo.statement = STMT_SEARCH_LINE_GLOB;
                 break;
+#ifdef WITH_FTS
+            case 's':
+                qo.statement = STMT_SEARCH_LINE_SUBSTRING;
+                break;
+#endif /* WITH_FTS */
 #ifdef WITH_REGEX
             case 'x':
                 qo.statement = STMT_SEARCH_LINE_REGEX;
@@ -407,10 +1360,10 @@ static int pkg_history_main(int argc, char **argv)
             {
                 int32_t min, max, val;
 
-                min = 1;
+                min = 0;
                 max = INT_MAX;
                 if (PARSE_NUM_NO_ERR != strtoint32_t((const char *) optarg, NULL, 10, &min, &max, &val)) {
-                    set_generic_error(&error, "parameter --count/-n is invalid: integer expected in range of [1;%d]", INT_MAX);
+                    set_generic_error(&error, "parameter --count/-n is invalid: integer expected in range of [0;%d]", INT_MAX);
                     goto invalid_argument;
                 }
                 qo.limit = (int) val;
@@ -420,11 +1373,50 @@ static int pkg_history_main(int argc, char **argv)
                 if (!parse_date(optarg, &qo.from, &error)) {
                     goto invalid_argument;
                 }
+                dated = true;
                 break;
             case 't':
                 if (!parse_date(optarg, &qo.to, &error)) {
                     goto invalid_argument;
                 }
+                dated = true;
+                break;
+            case 'F':
+                if (!history_format_parse(optarg, &qo.format)) {
+                    set_generic_error(&error, "parameter --format/-F is invalid: table, jsonl, csv or tsv expected");
+                    goto invalid_argument;
+                }
+                break;
+            case 'S':
+                qo.slowest = true;
+                break;
+            case 'v':
+                qo.versions = optarg;
+                break;
+            case 'J':
+                qo.jails = optarg;
+                break;
+            case 'w':
+                qo.follow = true;
+                if (NULL != optarg) {
+                    int32_t min, max, val;
+
+                    min = 0;
+                    max = INT_MAX;
+                    if (PARSE_NUM_NO_ERR != strtoint32_t((const char *) optarg, NULL, 10, &min, &max, &val)) {
+                        set_generic_error(&error, "parameter --follow/-w is invalid: integer expected in range of [0;%d]", INT_MAX);
+                        goto invalid_argument;
+                    }
+                    qo.follow_from = (int) val;
+                }
+                break;
+            case 'a':
+            case 'b':
+                if (!parse_cursor(optarg, &qo.cursor, &error)) {
+                    goto invalid_argument;
+                }
+                qo.has_cursor = true;
+                qo.before = 'b' == ch;
                 break;
             default:
                 usage();
@@ -438,28 +1430,105 @@ static int pkg_history_main(int argc, char **argv)
     if (0 == qo.operations) {
         qo.operations = PKG_OP_ALL;
     }
+    if (!qo.has_cursor) {
+        // --to may have been given after query_options_init
+        qo.cursor.inserted_at = qo.to;
+    } else if (qo.before && 0 == qo.limit) {
+        set_generic_error(&error, "parameter --before/-b is invalid: a limit is required (-n/--limit)");
+        goto invalid_argument;
+    }
+#ifdef WITH_FTS
+    // trigrams can't match less than 3 characters
+    if (STMT_SEARCH_LINE_SUBSTRING == qo.statement) {
+        int i;
+
+        for (i = 0; i < argc; i++) {
+            if (strlen(argv[i]) < 3) {
+                set_generic_error(&error, "parameter --substring/-s is invalid: at least 3 characters are expected, got '%s'", argv[i]);
+                goto invalid_argument;
+            }
+        }
+    }
+#endif /* WITH_FTS */
+#ifdef WITH_REGEX
+    // the errors of REGEXP would end the listing silently, check the patterns first
+    if (STMT_SEARCH_LINE_REGEX == qo.statement) {
+        int i;
+
+        for (i = 0; i < argc; i++) {
+            int ret;
+            regex_t re;
+
+            if (0 != (ret = regcomp(&re, argv[i], REG_EXTENDED | REG_NOSUB))) {
+                char buffer[256];
+
+                regerror(ret, &re, buffer, STR_SIZE(buffer));
+                set_generic_error(&error, "parameter --regex/-x is invalid: '%s' is not a valid regular expression (%s)", argv[i], buffer);
+                goto invalid_argument;
+            }
+            regfree(&re);
+        }
+    }
+#endif /* WITH_REGEX */
+    if (qo.slowest && (0 != argc || qo.has_cursor || HISTORY_FORMAT_TABLE != qo.format || NULL != qo.versions)) {
+        set_generic_error(&error, "parameter --slowest/-S is invalid: it can't be combined with packages, a cursor, a format nor a version");
+        goto invalid_argument;
+    }
+    if (NULL != qo.jails && (qo.slowest || qo.has_cursor || NULL != qo.versions || (STMT_SEARCH_LINE_EXACT != qo.statement && STMT_SEARCH_LINE_EXACT_CI != qo.statement))) {
+        set_generic_error(&error, "parameter --jails/-J is invalid: it can't be combined with --slowest, a cursor, a version nor -g/-s/-x (packages are matched by name)");
+        goto invalid_argument;
+    }
+    if (qo.follow && (qo.slowest || NULL != qo.jails || qo.has_cursor || dated || (STMT_SEARCH_LINE_EXACT != qo.statement && STMT_SEARCH_LINE_EXACT_CI != qo.statement))) {
+        set_generic_error(&error, "parameter --follow/-w is invalid: it can't be combined with --slowest, --jails, a cursor, dates nor -g/-s/-x (packages are matched by name)");
+        goto invalid_argument;
+    }
+    if (qo.follow) {
+        // an immutable database is never checked for changes
+        query_options.immutable = false;
+    }
+    output.buffer = NULL;
     do {
-        if (EPKG_OK != db_open(&db, PKGDB_MODE_READ, &error)) {
+        if (EPKG_OK != db_open(&db, PKGDB_MODE_READ, NULL, &error)) {
             break;
         }
-        if (0 == argc) {
-            display_history_full(&qo);
-#if 1
-        } else if (1 == argc) {
-            display_history_search(&qo, argv[0]);
-#else
-        } else {
-            int i;
+        if (qo.slowest) {
+            display_slowest(&qo);
+            break;
+        }
+        if (!history_output_init(&output, qo.format, STDOUT_FILENO, qo.use_origin, NULL != qo.jails, &error)) {
+            break;
+        }
+        if (0 != argc && !history_db_set_searched(db, (const char **) argv, (size_t) argc, &error)) {
+            break;
+        }
+        if (NULL != qo.versions && !history_db_set_versions(db, qo.versions, &error)) {
+            break;
+        }
+        if (NULL != qo.jails) {
+            size_t jails_count;
+            history_jail_t *jails;
 
-            for (i = 0; i < argc; i++) {
-                display_history_search(&qo, argv[i]);
+            if (!history_jails_find(qo.jails, &jails, &jails_count, &error)) {
+                break;
             }
-#endif
+            if (0 == jails_count) {
+                set_generic_error(&error, "no running jail of '%s' has a history", qo.jails);
+            } else {
+                display_jails(&qo, &output, db, jails, jails_count, 0 != argc, &error);
+            }
+            free(jails);
+            break;
+        }
+        if (qo.follow) {
+            follow_history(&qo, &output, db, 0 != argc, &error);
+            break;
         }
+        display_history(&qo, &output, 0 != argc, &error);
         //status = EPKG_OK;
     } while (false);
+    history_output_close(&output);
     if (NULL != db) {
-        sqlite_close(db);
+        history_db_close(db);
     }
 invalid_argument: // TODO: kill me
     if (/*EPKG_OK != status && */NULL != error) {
@@ -470,26 +1539,150 @@ invalid_argument: // TODO: kill me
     return EPKG_OK;
 }
 
-static int handle_hooks(void *data, struct pkgdb *UNUSED(_db))
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Returns the command line of the pkg process, joined, read (with
+ * kvm(3)) on the first call only
+ */
+static const char *pkg_cmd_line(char **error)
+{
+    if (!job.has_cmd) {
+        char **args;
+
+        if (NULL == (args = get_pkg_cmd_line(STR_SIZE(job.cmd), NULL, error))) {
+            return NULL;
+        }
+        if (!argv_join((const char **) args, job.cmd, job.cmd + STR_SIZE(job.cmd), error)) {
+            return NULL;
+        }
+        job.has_cmd = true;
+    }
+
+    return job.cmd;
+}
+
+/**
+ * PRE_* hooks: the job starts (with the fetching of its packages or with
+ * their installation/removal, whichever comes first)
+ */
+static int handle_pre_hooks(void *UNUSED(data), struct pkgdb *UNUSED(_db))
+{
+    char *error;
+
+    error = NULL;
+    if (0 == job.started_at) {
+        job.started_at = now_ms();
+    }
+    // read it now, from outside the POST_* hook which has to write the database
+    if (NULL == pkg_cmd_line(&error)) {
+        pkg_plugin_error(self, "%s", error);
+        error_free(&error);
+    }
+
+    return EPKG_OK;
+}
+
+static int handle_pre_fetch(void *data, struct pkgdb *db)
+{
+    job.fetch_started_at = now_ms();
+
+    return handle_pre_hooks(data, db);
+}
+
+static int handle_post_fetch(void *UNUSED(data), struct pkgdb *UNUSED(_db))
+{
+    if (0 != job.fetch_started_at) {
+        job.fetch_duration = MAX(job.fetch_duration, 0) + now_ms() - job.fetch_started_at;
+        job.fetch_started_at = 0;
+    }
+
+    return EPKG_OK;
+}
+
+/**
+ * Sets the files of line to the ones of the package, as installed in the
+ * local database, after the operation (none for a deletion). pkg receives
+ * the package, it has to be freed (by pkg_free) after the recording since
+ * the paths of line->files belong to it.
+ */
+static bool line_files(struct pkgdb *db, history_line_t *line, struct pkg **pkg, char **error)
+{
+    bool ok;
+    struct pkgdb_it *it;
+    static const char * const no_files[1] = { NULL };
+
+    *pkg = NULL;
+    if (PKG_OP_DEINSTALL == line->operation) {
+        line->files = no_files;
+        line->files_count = 0;
+        return true;
+    }
+    ok = true;
+    if (NULL == (it = pkgdb_query(db, line->name, MATCH_EXACT))) {
+        set_generic_error(error, "pkgdb_query failed");
+        return false;
+    }
+    // a package missing from the database (the operation failed?) is simply not tracked
+    if (EPKG_OK == pkgdb_it_next(it, pkg, PKG_LOAD_FILES)) {
+        size_t count;
+        const char **files;
+        struct pkg_file *file;
+
+        count = 0;
+        file = NULL;
+        while (EPKG_OK == pkg_files(*pkg, &file)) {
+            ++count;
+        }
+        // + 1 to not malloc(0) for a package without files
+        if (NULL == (files = malloc(sizeof(*files) * (count + 1)))) {
+            set_malloc_error(error, sizeof(*files) * (count + 1));
+            ok = false;
+        } else {
+            line->files_count = 0;
+            while (EPKG_OK == pkg_files(*pkg, &file)) {
+                files[line->files_count++] = file->path;
+            }
+            line->files = files;
+        }
+    }
+    pkgdb_it_free(it);
+
+    return ok;
+}
+
+static int handle_hooks(void *data, struct pkgdb *_db)
 {
     char *error;
     sqlite_db_t *db;
     pkg_error_t status;
+    size_t lines_count;
+    struct pkg **pkgs;
+    history_line_t *lines;
 
     db = NULL;
+    pkgs = NULL;
     error = NULL;
+    lines = NULL;
+    lines_count = 0;
     status = EPKG_FATAL;
     do {
         void *iter;
-        char cmd[ARG_MAX];
+        const char *cmd;
         pkg_jobs_t job_type;
-        char **args;
+        history_timings_t timings;
         struct pkg_jobs *jobs;
         struct pkg *new_pkg, *old_pkg;
-        int command_id, operation, solved_type, fetch_status;
+        int solved_type, jobs_count;
 
         iter = NULL;
-        fetch_status = 0;
         jobs = (struct pkg_jobs *) data;
 #if 0
         // record the run of pkg even if it does nothing? (we are in POST so the hook might not even run)
@@ -499,45 +1692,40 @@ static int handle_hooks(void *data, struct pkgdb *UNUSED(_db))
         }
 #endif
         job_type = pkg_jobs_type(jobs);
-        if (EPKG_OK != db_open(&db, PKGDB_MODE_READ | PKGDB_MODE_WRITE, &error)) {
-            break;
-        }
-        if (NULL == (args = get_pkg_cmd_line(STR_SIZE(cmd), NULL, &error))) {
-            break;
-        }
-        if (!argv_join((const char **) args, cmd, cmd + STR_SIZE(cmd), &error)) {
-            break;
-        }
-        if (!sqlite_transaction_begin(db, &error)) {
+        jobs_count = pkg_jobs_count(jobs);
+        if (jobs_count > 0 && NULL == (lines = calloc(jobs_count, sizeof(*lines)))) {
+            set_calloc_error(&error, (size_t) jobs_count, sizeof(*lines));
             break;
         }
-        statement_bind(&statements[STMT_CREATE_COMMAND], cmd);
-        statement_fetch(db, &statements[STMT_CREATE_COMMAND], &error);
-        command_id = sqlite_last_insert_id(db);
-        while (pkg_jobs_iter(jobs, &iter, &new_pkg, &old_pkg, &solved_type)) {
-            const char *name, *origin, *new_version, *old_version, *repo;
-
-            name = origin = new_version = old_version = repo = NULL;
-            get_string(new_pkg, PKG_ATTR_NAME, &name);
-            get_string(new_pkg, PKG_ATTR_ORIGIN, &origin);
-            get_string(new_pkg, PKG_ATTR_VERSION, &new_version);
-            get_string(new_pkg, PKG_ATTR_REPONAME, &repo);
+        // decode the jobs before touching the database
+        while (((int) lines_count) < jobs_count && pkg_jobs_iter(jobs, &iter, &new_pkg, &old_pkg, &solved_type)) {
+            history_line_t *line;
+
+            line = &lines[lines_count++];
+            line->name = line->origin = line->new_version = line->old_version = line->repo = NULL;
+            get_string(new_pkg, PKG_ATTR_NAME, &line->name);
+            get_string(new_pkg, PKG_ATTR_ORIGIN, &line->origin);
+            get_string(new_pkg, PKG_ATTR_VERSION, &line->new_version);
+            get_string(new_pkg, PKG_ATTR_REPONAME, &line->repo);
+            get_integer(new_pkg, PKG_ATTR_FLATSIZE, &line->new_flatsize);
+            line->old_flatsize = -1;
             if (NULL != old_pkg) {
-                get_string(old_pkg, PKG_ATTR_VERSION, &old_version);
+                get_string(old_pkg, PKG_ATTR_VERSION, &line->old_version);
+                get_integer(old_pkg, PKG_ATTR_FLATSIZE, &line->old_flatsize);
             }
             switch (job_type) { // TODO: plutôt considérer solved_type ?
                 case PKG_JOBS_INSTALL:
-                    operation = PKG_OP_INSTALL;
+                    line->operation = PKG_OP_INSTALL;
                     break;
                 case PKG_JOBS_DEINSTALL:
                 case PKG_JOBS_AUTOREMOVE:
-                    operation = PKG_OP_DEINSTALL;
+                    line->operation = PKG_OP_DEINSTALL;
                     break;
                 case PKG_JOBS_UPGRADE:
                     if (PKG_SOLVED_INSTALL == solved_type) {
-                        operation = PKG_OP_INSTALL;
+                        line->operation = PKG_OP_INSTALL;
                     } else {
-                        operation = PKG_OP_UPGRADE;
+                        line->operation = PKG_OP_UPGRADE;
                     }
                     break;
                 case PKG_JOBS_FETCH:
@@ -545,21 +1733,71 @@ static int handle_hooks(void *data, struct pkgdb *UNUSED(_db))
                     assert(false);
                     break;
             }
-            statement_bind(&statements[STMT_CREATE_LINE], repo, name, origin, old_version, new_version, operation, command_id);
-            if (-1 == (fetch_status = statement_fetch(db, &statements[STMT_CREATE_LINE], &error))) {
+        }
+        if (NULL == (cmd = pkg_cmd_line(&error))) {
+            break;
+        }
+        timings.started_at = job.started_at;
+        timings.finished_at = now_ms();
+        timings.fetch_duration = job.fetch_duration;
+        // the next job of the process (if any) starts afresh
+        job.started_at = job.fetch_started_at = 0;
+        job.fetch_duration = -1;
+        if (spool) {
+            char spoolpath[MAXPATHLEN];
+
+            if (!path_join(spoolpath, spoolpath + STR_SIZE(spoolpath), &error, pkg_dbdir(), "history.spool", NULL)) {
+                break;
+            }
+            if (!history_spool_append(spoolpath, time(NULL), cmd, &timings, lines, lines_count, &error)) {
+                break;
+            }
+            status = EPKG_OK;
+            break;
+        }
+        if (track_files && lines_count > 0) {
+            size_t i;
+
+            if (NULL == (pkgs = calloc(lines_count, sizeof(*pkgs)))) {
+                set_calloc_error(&error, lines_count, sizeof(*pkgs));
+                break;
+            }
+            for (i = 0; i < lines_count; i++) {
+                if (!line_files(_db, &lines[i], &pkgs[i], &error)) {
+                    break;
+                }
+            }
+            if (i < lines_count) {
                 break;
             }
         }
-        if (0 != fetch_status) {
+        if (EPKG_OK != db_open(&db, PKGDB_MODE_READ | PKGDB_MODE_WRITE, NULL, &error)) {
+            break;
+        }
+        if (!history_db_record(db, cmd, &timings, lines, lines_count, &error)) {
             break;
         }
-        if (!sqlite_transaction_commit(db, &error)) {
+        if (!db_maintain(db, CHECKPOINTS_PER_RUN, &error)) {
             break;
         }
         status = EPKG_OK;
     } while (false);
+    if (NULL != pkgs) {
+        size_t i;
+
+        for (i = 0; i < lines_count; i++) {
+            if (NULL != pkgs[i]) {
+                free((void *) lines[i].files);
+                pkg_free(pkgs[i]);
+            }
+        }
+        free(pkgs);
+    }
+    if (NULL != lines) {
+        free(lines);
+    }
     if (NULL != db) {
-        sqlite_close(db);
+        history_db_close(db);
     }
     if (/*EPKG_OK != status && */NULL != error) {
         pkg_plugin_error(self, "%s", error);
@@ -569,24 +1807,25 @@ static int handle_hooks(void *data, struct pkgdb *UNUSED(_db))
     return status;
 }
 
-#define H(value) \
-    {value, #value}
+#define H(value, callback) \
+    {value, #value, callback}
 
 static const struct {
     pkg_plugin_hook_t value;
     const char *name;
+    pkg_plugin_callback callback;
 } hooks[] = {
-//     H(PKG_PLUGIN_HOOK_PRE_INSTALL),
-    H(PKG_PLUGIN_HOOK_POST_INSTALL),
-//     H(PKG_PLUGIN_HOOK_PRE_DEINSTALL),
-    H(PKG_PLUGIN_HOOK_POST_DEINSTALL),
-//     H(PKG_PLUGIN_HOOK_PRE_FETCH),
-//     H(PKG_PLUGIN_HOOK_POST_FETCH),
+    H(PKG_PLUGIN_HOOK_PRE_INSTALL, handle_pre_hooks),
+    H(PKG_PLUGIN_HOOK_POST_INSTALL, handle_hooks),
+    H(PKG_PLUGIN_HOOK_PRE_DEINSTALL, handle_pre_hooks),
+    H(PKG_PLUGIN_HOOK_POST_DEINSTALL, handle_hooks),
+    H(PKG_PLUGIN_HOOK_PRE_FETCH, handle_pre_fetch),
+    H(PKG_PLUGIN_HOOK_POST_FETCH, handle_post_fetch),
 //     H(PKG_PLUGIN_HOOK_EVENT),
-//     H(PKG_PLUGIN_HOOK_PRE_UPGRADE),
-    H(PKG_PLUGIN_HOOK_POST_UPGRADE),
-//     H(PKG_PLUGIN_HOOK_PRE_AUTOREMOVE),
-    H(PKG_PLUGIN_HOOK_POST_AUTOREMOVE),
+    H(PKG_PLUGIN_HOOK_PRE_UPGRADE, handle_pre_hooks),
+    H(PKG_PLUGIN_HOOK_POST_UPGRADE, handle_hooks),
+    H(PKG_PLUGIN_HOOK_PRE_AUTOREMOVE, handle_pre_hooks),
+    H(PKG_PLUGIN_HOOK_POST_AUTOREMOVE, handle_hooks),
 //     PKG_PLUGIN_HOOK_PKGDB_CLOSE_RW,
 };
 
@@ -602,8 +1841,42 @@ int pkg_plugin_init(struct pkg_plugin *p)
     pkg_plugin_set(p, PKG_PLUGIN_DESC, DESCRIPTION);
     pkg_plugin_set(p, PKG_PLUGIN_VERSION, HISTORY_VERSION_STRING);
 
+    pkg_plugin_conf_add(p, PKG_INT, CFG_BUSY_TIMEOUT, STRINGIFY_EXPAND(DEFAULT_BUSY_TIMEOUT));
+    pkg_plugin_conf_add(p, PKG_INT, CFG_RETENTION_MAX_AGE, STRINGIFY_EXPAND(DEFAULT_RETENTION_MAX_AGE));
+    pkg_plugin_conf_add(p, PKG_INT, CFG_RETENTION_MAX_COMMANDS, STRINGIFY_EXPAND(DEFAULT_RETENTION_MAX_COMMANDS));
+    pkg_plugin_conf_add(p, PKG_INT, CFG_CHECKPOINT_INTERVAL, STRINGIFY_EXPAND(DEFAULT_CHECKPOINT_INTERVAL));
+    pkg_plugin_conf_add(p, PKG_BOOL, CFG_SPOOL, "false");
+    pkg_plugin_conf_add(p, PKG_INT, CFG_MMAP_SIZE, STRINGIFY_EXPAND(DEFAULT_MMAP_SIZE));
+    pkg_plugin_conf_add(p, PKG_INT, CFG_CACHE_SIZE, STRINGIFY_EXPAND(DEFAULT_CACHE_SIZE));
+    pkg_plugin_conf_add(p, PKG_BOOL, CFG_IMMUTABLE, "false");
+    pkg_plugin_conf_add(p, PKG_BOOL, CFG_FILES, "false");
+    pkg_plugin_parse(p);
+
+    {
+        const pkg_object *config;
+        int64_t busy_timeout, max_age, max_commands, interval, mmap_size, cache_size;
+
+        config = pkg_plugin_conf(p);
+        busy_timeout = pkg_object_int(pkg_object_find(config, CFG_BUSY_TIMEOUT));
+        open_options.busy_timeout = (int) MIN(MAX(busy_timeout, 0), INT_MAX);
+        query_options.busy_timeout = open_options.busy_timeout;
+        mmap_size = pkg_object_int(pkg_object_find(config, CFG_MMAP_SIZE));
+        query_options.mmap_size = MIN(MAX(mmap_size, 0), INT64_MAX / (1024 * 1024)) * 1024 * 1024;
+        cache_size = pkg_object_int(pkg_object_find(config, CFG_CACHE_SIZE));
+        query_options.cache_size = (int) MIN(MAX(cache_size, 0), INT_MAX / 1024) * 1024;
+        query_options.immutable = pkg_object_bool(pkg_object_find(config, CFG_IMMUTABLE));
+        max_age = pkg_object_int(pkg_object_find(config, CFG_RETENTION_MAX_AGE));
+        retention.max_age = (int) MIN(MAX(max_age, 0), INT_MAX);
+        max_commands = pkg_object_int(pkg_object_find(config, CFG_RETENTION_MAX_COMMANDS));
+        retention.max_commands = (int) MIN(MAX(max_commands, 0), INT_MAX);
+        interval = pkg_object_int(pkg_object_find(config, CFG_CHECKPOINT_INTERVAL));
+        checkpoint_interval = (int) MIN(MAX(interval, 0), INT_MAX);
+        spool = pkg_object_bool(pkg_object_find(config, CFG_SPOOL));
+        track_files = pkg_object_bool(pkg_object_find(config, CFG_FILES));
+    }
+
     for (i = 0; i < ARRAY_SIZE(hooks); i++) {
-        if (EPKG_OK != pkg_plugin_hook_register(p, hooks[i].value, handle_hooks)) {
+        if (EPKG_OK != pkg_plugin_hook_register(p, hooks[i].value, hooks[i].callback)) {
             pkg_plugin_error(p, "failed to hook %s (%d)", hooks[i].name, hooks[i].value);
             return EPKG_FATAL;
         }
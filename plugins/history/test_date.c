@@ -53,6 +53,12 @@ struct {
     { "Jan 08 99 8PM", true, 99, 0, 8, 20, 0, 0, },
     { "Jan 08 99 07:55PM", true, 99, 0, 8, 19, 55, 0, },
     { "Jan 08 99 07:61PM", false, 0, 0, 0, 0, 0, 0, },
+    { "Mar 08", true, CURRENT, 2, 8, 0, 0, 0, },
+    { "Mar 08 99 16:12:22", true, 99, 2, 8, 16, 12, 22, },
+    { "8 Mar", true, CURRENT, 2, 8, 0, 0, 0, },
+    { "8 Mar 99", true, 99, 2, 8, 0, 0, 0, },
+    { "1999 Mar 08", true, 99, 2, 8, 0, 0, 0, },
+    { "1999 Marc 08", false, 0, 0, 0, 0, 0, 0, },
     { "Feb 29 99 06:01:02 PM", false, 0, 0, 0, 0, 0, 0, },
     { "Feb 29 20 06:01:02 PM", true, 20, 1, 29, 18, 1, 2, },
     { "01-23-1999 machin", false, 0, 0, 0, 0, 0, 0, },
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h> /* PATH_MAX */
+#include <unistd.h>
+
+#include "common.h"
+#include "error/error.h"
+#include "history_db.h"
+#include "history_testing.h"
+
+/**
+ * Records a history of random operations, applying a retention policy and
+ * taking checkpoints after each command as the hook does, then checks that
+ * the packages listed by history_db_installed_at after each remaining
+ * command are the ones of a full replay of the history. Commands merged
+ * from another host are interleaved: they must not be replayed.
+ */
+
+#define RED(str) "\33[1;31m" str "\33[0m"
+#define GREEN(str) "\33[1;32m" str "\33[0m"
+
+#define PACKAGES_COUNT 24
+#define COMMANDS_COUNT 400
+#define MAX_LINES_PER_COMMAND 3
+#define CHECKPOINT_INTERVAL 7
+#define FOREIGN_COMMAND_INTERVAL 10
+#define BASE_TIME ((time_t) 1600000000)
+
+static const history_retention_t retention = {
+    .max_age = 0,
+    .max_commands = 150,
+};
+
+static const char *versions[] = { "1.0", "1.1", "2.0", "2.1_1", "3.0" };
+
+/**
+ * The installed version of each package (NULL if it isn't installed) after
+ * each command
+ */
+static const char *replayed[COMMANDS_COUNT][PACKAGES_COUNT];
+static char names[PACKAGES_COUNT][STR_SIZE("package-99")];
+
+static unsigned int seed = 42;
+
+static unsigned int next_random(void)
+{
+    seed = seed * 1103515245 + 12345;
+
+    return (seed >> 16) & 0x7FFF;
+}
+
+static bool insert_command(sqlite_db_t *db, time_t at, const history_line_t *lines, size_t lines_count, bool foreign, char **error)
+{
+    bool ok;
+    history_line_ids_t ids[MAX_LINES_PER_COMMAND];
+
+    ok = false;
+    do {
+        if (!sqlite_transaction_begin(db, error)) {
+            break;
+        }
+        if (!history_db_resolve_lines(db, lines, lines_count, ids, error) || !history_db_insert_command(db, at, foreign ? "pkg delete -a" : "pkg upgrade", NULL, lines, ids, lines_count, error)) {
+            sqlite_transaction_rollback(db, NULL);
+            break;
+        }
+        if (foreign && !sqlite_exec(db, "UPDATE " TABLE_COMMANDS " SET host_id = (SELECT id FROM " TABLE_HOSTS " WHERE value = 'other') WHERE id = (SELECT MAX(id) FROM " TABLE_COMMANDS ")", error)) {
+            sqlite_transaction_rollback(db, NULL);
+            break;
+        }
+        ok = sqlite_transaction_commit(db, error);
+    } while (false);
+
+    return ok;
+}
+
+/**
+ * Records the command c: a few random operations, replayed into replayed[c]
+ */
+static bool record_command(sqlite_db_t *db, size_t c, char **error)
+{
+    size_t i, lines_count;
+    history_line_t lines[MAX_LINES_PER_COMMAND];
+    const char **installed;
+
+    installed = replayed[c];
+    if (c > 0) {
+        memcpy(installed, replayed[c - 1], sizeof(replayed[c]));
+    }
+    lines_count = 1 + next_random() % MAX_LINES_PER_COMMAND;
+    for (i = 0; i < lines_count; i++) {
+        size_t p;
+
+        // distinct packages: a command doesn't operate twice on the same one
+        p = (next_random() % (PACKAGES_COUNT / MAX_LINES_PER_COMMAND)) * MAX_LINES_PER_COMMAND + i;
+        memset(&lines[i], 0, sizeof(lines[i]));
+        lines[i].name = names[p];
+        lines[i].origin = "category/port";
+        lines[i].new_flatsize = lines[i].old_flatsize = -1;
+        if (NULL == installed[p]) {
+            lines[i].operation = PKG_OP_INSTALL;
+            lines[i].repo = "FreeBSD";
+            lines[i].new_version = installed[p] = versions[next_random() % ARRAY_SIZE(versions)];
+        } else if (0 == next_random() % 3) {
+            lines[i].operation = PKG_OP_DEINSTALL;
+            lines[i].new_version = installed[p];
+            installed[p] = NULL;
+        } else {
+            lines[i].operation = PKG_OP_UPGRADE;
+            lines[i].repo = "FreeBSD";
+            lines[i].old_version = installed[p];
+            lines[i].new_version = installed[p] = versions[next_random() % ARRAY_SIZE(versions)];
+        }
+    }
+
+    return insert_command(db, BASE_TIME + c * 60, lines, lines_count, false, error);
+}
+
+/**
+ * Records, between two local commands, the deletion of all the packages
+ * on another host
+ */
+static bool record_foreign_command(sqlite_db_t *db, size_t c, char **error)
+{
+    size_t i;
+    history_line_t lines[MAX_LINES_PER_COMMAND];
+
+    for (i = 0; i < ARRAY_SIZE(lines); i++) {
+        memset(&lines[i], 0, sizeof(lines[i]));
+        lines[i].operation = PKG_OP_DEINSTALL;
+        lines[i].name = names[i];
+        lines[i].origin = "category/port";
+        lines[i].new_version = versions[0];
+        lines[i].new_flatsize = lines[i].old_flatsize = -1;
+    }
+
+    return insert_command(db, BASE_TIME + c * 60 + 30, lines, ARRAY_SIZE(lines), true, error);
+}
+
+/**
+ * Compares the packages listed by history_db_installed_at after the
+ * command c to replayed[c]
+ */
+static bool check_installed_at(sqlite_db_t *db, size_t c, char **error)
+{
+    Iterator it;
+    bool match;
+    size_t p, count, expected;
+    const char *name, *version, *origin, *repo;
+
+    if (!history_db_installed_at(db, BASE_TIME + c * 60, &it, &name, &version, &origin, &repo, error)) {
+        return false;
+    }
+    match = true;
+    count = 0;
+    for (iterator_first(&it); iterator_is_valid(&it, NULL, NULL); iterator_next(&it)) {
+        ++count;
+        for (p = 0; p < PACKAGES_COUNT && 0 != strcmp(names[p], name); p++)
+            ;
+        if (PACKAGES_COUNT == p || NULL == replayed[c][p] || 0 != strcmp(replayed[c][p], version)) {
+            printf("[ " RED("FAILED") " ] after command %zu: %s-%s is not installed\n", c, name, version);
+            match = false;
+        }
+    }
+    iterator_close(&it);
+    for (expected = p = 0; p < PACKAGES_COUNT; p++) {
+        expected += NULL != replayed[c][p];
+    }
+    if (count != expected) {
+        printf("[ " RED("FAILED") " ] after command %zu: %zu packages installed, %zu expected\n", c, count, expected);
+        match = false;
+    }
+
+    return match;
+}
+
+int main(void)
+{
+    int ret;
+    char *error;
+    char path[] = "/tmp/test_installed_at.XXXXXX";
+
+    error = NULL;
+    ret = EXIT_FAILURE;
+    do {
+        int fd;
+        size_t c;
+        bool ok;
+        time_t first;
+        sqlite_db_t *db;
+
+        if (-1 == (fd = mkstemp(path))) {
+            set_system_error(&error, "mkstemp(3) failed");
+            break;
+        }
+        close(fd);
+        if (EPKG_OK != history_db_open(path, PKGDB_MODE_READ | PKGDB_MODE_WRITE | PKGDB_MODE_CREATE, NULL, &db, &error)) {
+            break;
+        }
+        for (c = 0; c < PACKAGES_COUNT; c++) {
+            snprintf(names[c], STR_SIZE(names[c]), "package-%zu", c);
+        }
+        ok = sqlite_exec(db, "INSERT INTO " TABLE_HOSTS "(value) VALUES('other')", &error);
+        for (c = 0; ok && c < COMMANDS_COUNT; c++) {
+            ok = record_command(db, c, &error)
+                && (0 != c % FOREIGN_COMMAND_INTERVAL || record_foreign_command(db, c, &error))
+                && history_db_apply_retention(db, &retention, &error)
+                && history_db_create_checkpoints(db, CHECKPOINT_INTERVAL, 10, &error)
+            ;
+        }
+        statement_reset(&history_statements[STMT_OLDEST_COMMAND]);
+        if (!ok || 1 != statement_fetch(db, &history_statements[STMT_OLDEST_COMMAND], &error, &first)) {
+            history_db_close(db);
+            break;
+        }
+        if (first <= BASE_TIME) {
+            printf("[ " RED("FAILED") " ] the retention policy deleted no command\n");
+            ok = false;
+        }
+        // the first command after the ones deleted
+        for (c = (size_t) (first - BASE_TIME + 59) / 60; ok && c < COMMANDS_COUNT; c++) {
+            ok = check_installed_at(db, c, &error);
+        }
+        history_db_close(db);
+        if (ok) {
+            printf("[ " GREEN("OK") " ] packages installed after the commands %zu to %d\n", (size_t) (first - BASE_TIME + 59) / 60, COMMANDS_COUNT - 1);
+            ret = EXIT_SUCCESS;
+        }
+    } while (false);
+    remove_database(path);
+    if (NULL != error) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+    }
+
+    return ret;
+}
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h> /* PATH_MAX */
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "error/error.h"
+#include "history_db.h"
+#include "history_testing.h"
+
+/**
+ * Runs EXPLAIN QUERY PLAN on each statement of the history plugin and
+ * fails if one of them has to scan a table instead of using an index.
+ */
+
+#define RED(str) "\33[1;31m" str "\33[0m"
+#define GREEN(str) "\33[1;32m" str "\33[0m"
+
+/**
+ * Tables small by design which can be scanned: the searched packages, the
+ * matched versions, the lines collected from the jails (a page per group
+ * of jails), the paths changed by the lines being recorded, the summary
+ * tables of the statistics (a row per bucket) and the folded spool (a
+ * single row)
+ */
+static const char *scannable_tables[] = {
+    TABLE_SEARCHED,
+    TABLE_MATCHED_VERSIONS,
+    TABLE_JAIL_LINES,
+    TABLE_CHANGED_PATHS,
+    TABLE_STATS_DAYS,
+    TABLE_STATS_PACKAGES,
+    TABLE_STATS_REPOSITORIES,
+    TABLE_SPOOL,
+};
+
+static bool scannable_table(const char *detail)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(scannable_tables); i++) {
+        if (NULL != strstr(detail, scannable_tables[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Statements which walk an index on purpose, for a bounded count of entries
+ * (LIMIT/OFFSET): retention by count looks for the oldest command to keep,
+ * the first command is the start of the index on the dates, the slowest
+ * commands come from the end of the index on their duration
+ */
+static const int index_walks[] = {
+    STMT_RETENTION_BY_COUNT,
+    STMT_FIRST_COMMAND,
+    STMT_SLOWEST_COMMANDS,
+};
+
+static bool index_walk(size_t statement, const char *detail)
+{
+    size_t i;
+
+    if (NULL == strstr(detail, " USING COVERING INDEX ") && NULL == strstr(detail, " USING INDEX ")) {
+        return false;
+    }
+    for (i = 0; i < ARRAY_SIZE(index_walks); i++) {
+        if (statement == (size_t) index_walks[i]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Statements which scan a dictionary on purpose (a row per distinct value,
+ * not per operation): a regular expression can't use an index
+ */
+static bool dictionary_scan(size_t statement)
+{
+#ifdef WITH_REGEX
+    return STMT_SEARCH_LINE_REGEX == statement || STMT_BEFORE(STMT_SEARCH_LINE_REGEX) == statement;
+#else
+    return false;
+#endif /* WITH_REGEX */
+}
+
+#ifdef WITH_REGEX
+/**
+ * REGEXP is registered by sqlite_open, the plans are checked on a bare
+ * connection: a stub is enough for the statements to be prepared
+ */
+static void regexp_stub(sqlite3_context *context, int UNUSED(argc), sqlite3_value **UNUSED(argv))
+{
+    sqlite3_result_int(context, 0);
+}
+#endif /* WITH_REGEX */
+
+/**
+ * Same for the collation pkg_version (registered by history_db_open): only
+ * its name matters to the planner
+ */
+static int pkg_version_stub(void *UNUSED(data), int a_len, const void *a, int b_len, const void *b)
+{
+    int ret;
+
+    if (0 == (ret = memcmp(a, b, MIN(a_len, b_len)))) {
+        ret = a_len - b_len;
+    }
+
+    return ret;
+}
+
+/**
+ * returns true if detail is a search on a virtual table with a constraint
+ * (eg "SCAN f VIRTUAL TABLE INDEX 0:M3" for a MATCH on a FTS5 table, an
+ * empty string after the colon means a full scan)
+ */
+static bool virtual_table_index_search(const char *detail)
+{
+    const char *p;
+
+    if (NULL == (p = strstr(detail, "VIRTUAL TABLE INDEX "))) {
+        return false;
+    }
+    if (NULL == (p = strchr(p, ':'))) {
+        return false;
+    }
+
+    return '\0' != p[1];
+}
+
+/**
+ * returns true if detail is the scan of a table materialized earlier in
+ * the plan (a CTE used several times or which can't be flattened, like a
+ * window function) or of the rows of a co-routine (a subquery in FROM
+ * with a LIMIT), its own plan is checked on its own rows
+ */
+static bool materialized_scan(const char *detail, char materialized[][64], size_t materialized_count)
+{
+    size_t i;
+
+    for (i = 0; i < materialized_count; i++) {
+        if (0 == strncmp(detail + STR_LEN("SCAN "), materialized[i], strlen(materialized[i])) && '\0' == detail[STR_LEN("SCAN ") + strlen(materialized[i])]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * returns true if the plan of stmt doesn't involve a full scan
+ */
+static bool check_plan(sqlite3 *db, size_t statement)
+{
+    bool ok;
+    char *query;
+    sqlite3_stmt *explain;
+    size_t materialized_count;
+    char materialized[8][64];
+    const sqlite_statement_t *stmt;
+
+    ok = true;
+    materialized_count = 0;
+    stmt = &history_statements[statement];
+    query = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", stmt->statement);
+    assert(NULL != query);
+    if (SQLITE_OK != sqlite3_prepare_v2(db, query, -1, &explain, NULL)) {
+        printf("[ " RED("FAILED") " ] %s: %s\n", stmt->statement, sqlite3_errmsg(db));
+        ok = false;
+    } else {
+        while (SQLITE_ROW == sqlite3_step(explain)) {
+            const char *detail;
+
+            // columns are: id, parent, notused, detail
+            detail = (const char *) sqlite3_column_text(explain, 3);
+            debug("%s", detail);
+            if (0 == strncmp(detail, "MATERIALIZE ", STR_LEN("MATERIALIZE ")) && materialized_count < ARRAY_SIZE(materialized)) {
+                snprintf(materialized[materialized_count++], ARRAY_SIZE(materialized[0]), "%s", detail + STR_LEN("MATERIALIZE "));
+            }
+            if (0 == strncmp(detail, "CO-ROUTINE ", STR_LEN("CO-ROUTINE ")) && materialized_count < ARRAY_SIZE(materialized)) {
+                snprintf(materialized[materialized_count++], ARRAY_SIZE(materialized[0]), "%s", detail + STR_LEN("CO-ROUTINE "));
+            }
+            /**
+             * scanning literals (SELECT without FROM, multi-row VALUES), the (bounded) result
+             * of a subquery or a CTE, a small table or a virtual table through its index (MATCH) is fine
+             */
+            if (
+                0 == strncmp(detail, "SCAN ", STR_LEN("SCAN "))
+                && NULL == strstr(detail, "CONSTANT ROW")
+                && NULL == strstr(detail, "VALUES CLAUSE")
+                && NULL == strstr(detail, "subquery")
+                && !scannable_table(detail)
+                && !index_walk(statement, detail)
+                && !dictionary_scan(statement)
+                && !virtual_table_index_search(detail)
+                && !materialized_scan(detail, materialized, materialized_count)
+            ) {
+                printf("[ " RED("FAILED") " ] %s: %s\n", stmt->statement, detail);
+                ok = false;
+            }
+        }
+        sqlite3_finalize(explain);
+    }
+    if (ok) {
+        printf("[ " GREEN("OK") " ] %s\n", stmt->statement);
+    }
+    sqlite3_free(query);
+
+    return ok;
+}
+
+int main(void)
+{
+    int ret;
+    char *error;
+    char path[] = "/tmp/test_query_plan.XXXXXX";
+
+    error = NULL;
+    ret = EXIT_FAILURE;
+    do {
+        int fd;
+        size_t i;
+        bool ok;
+        sqlite3 *db;
+        sqlite_db_t *dbh;
+
+        if (-1 == (fd = mkstemp(path))) {
+            set_system_error(&error, "mkstemp(3) failed");
+            break;
+        }
+        close(fd);
+        // let the plugin create its schema
+        if (EPKG_OK != history_db_open(path, PKGDB_MODE_READ | PKGDB_MODE_WRITE | PKGDB_MODE_CREATE, NULL, &dbh, &error)) {
+            break;
+        }
+        history_db_close(dbh);
+        if (SQLITE_OK != sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL)) {
+            set_generic_error(&error, "can't open sqlite database %s: %s", path, sqlite3_errmsg(db));
+            sqlite3_close(db);
+            break;
+        }
+#ifdef WITH_REGEX
+        sqlite3_create_function(db, "regexp", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, regexp_stub, NULL, NULL);
+#endif /* WITH_REGEX */
+        sqlite3_create_collation(db, "pkg_version", SQLITE_UTF8, NULL, pkg_version_stub);
+        // the temporary tables of history_db_open don't outlive its connection
+        if (SQLITE_OK != sqlite3_exec(db, CREATE_TABLE_SEARCHED CREATE_TABLE_MATCHED_VERSIONS CREATE_TABLE_JAIL_LINES CREATE_TABLE_CHANGED_PATHS, NULL, NULL, NULL)) {
+            set_generic_error(&error, "can't create temporary tables: %s", sqlite3_errmsg(db));
+            sqlite3_close(db);
+            break;
+        }
+        ok = true;
+        for (i = 0; i < ARRAY_SIZE(history_statements); i++) {
+            ok &= check_plan(db, i);
+        }
+        sqlite3_close(db);
+        if (ok) {
+            ret = EXIT_SUCCESS;
+        }
+    } while (false);
+    remove_database(path);
+    if (NULL != error) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+    }
+
+    return ret;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <locale.h>
+#include <time.h>
+
+#include "common.h"
+#include "history_output.h"
+
+/**
+ * Renders timestamps by timestamp_to_localtime and by timestamp_cache_render
+ * and checks that both give the same bytes, or both fail, for each format
+ * and each size of buffer up to a bit more than the one of the listings,
+ * in a few time zones (changes of the offset to UTC included) and locales
+ * (the ones with a 4 digits year in %x if installed).
+ */
+
+#define RED(str) "\33[1;31m" str "\33[0m"
+#define GREEN(str) "\33[1;32m" str "\33[0m"
+
+// the size of the buffers of the listings
+#define LISTING_BUFFER_SIZE STR_SIZE("dd/mm/YYYY HH:ii:ss")
+#define MAX_BUFFER_SIZE (LISTING_BUFFER_SIZE + 8)
+
+#define FIRST_TIMESTAMP ((time_t) 1577836800) /* 2020-01-01 00:00:00 UTC */
+#define LAST_TIMESTAMP ((time_t) 1640995200) /* 2022-01-01 00:00:00 UTC */
+// prime, for the timestamps to fall at any time of the day
+#define TIMESTAMP_STEP 7919
+
+static const char *time_zones[] = {
+    "UTC",
+    "Europe/Paris",
+    "America/New_York",
+    // an offset which changes by 30 minutes
+    "Australia/Lord_Howe",
+};
+
+static const char *locales[] = {
+    "C",
+    "en_US.UTF-8",
+    "fr_FR.UTF-8",
+    // the one of the environment, as pkg does
+    "",
+};
+
+static const char *formats[] = {
+    NULL,
+    "%d/%m/%Y %H:%M:%S",
+    "%m/%d/%Y %I:%M:%S %p",
+    "%F %T",
+    "%e %R %%",
+};
+
+/**
+ * Compares the renderings of the timestamps in format for the current time
+ * zone and locale, returns the count of mismatches
+ */
+static size_t check_format(const char *format, const char *time_zone, const char *locale)
+{
+    time_t t;
+    size_t mismatches;
+    timestamp_cache_t cache;
+
+    mismatches = 0;
+    timestamp_cache_init(&cache, format);
+    for (t = FIRST_TIMESTAMP; t < LAST_TIMESTAMP; t += TIMESTAMP_STEP) {
+        size_t size;
+
+        for (size = 1; size <= MAX_BUFFER_SIZE; size++) {
+            char *expected_end, *rendered_end;
+            char expected[MAX_BUFFER_SIZE], rendered[MAX_BUFFER_SIZE];
+
+            memset(rendered, 'Z', sizeof(rendered));
+            expected_end = timestamp_to_localtime(t, format, expected, expected + size, NULL);
+            rendered_end = timestamp_cache_render(&cache, t, rendered, rendered + size, NULL);
+            if ((NULL == expected_end) != (NULL == rendered_end) || (NULL != expected_end && (0 != strcmp(expected, rendered) || expected_end - expected != rendered_end - rendered))) {
+                printf(
+                    "[ " RED("FAILED") " ] %jd in a buffer of %zu bytes (format: %s, TZ: %s, locale: %s) is rendered '%.*s' by the cache instead of '%s'\n",
+                    (intmax_t) t, size, NULL == format ? "default" : format, time_zone, locale,
+                    NULL == rendered_end ? 0 : (int) (rendered_end - rendered), rendered, NULL == expected_end ? "(an error)" : expected
+                );
+                ++mismatches;
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+int main(void)
+{
+    size_t i, j, k, checked, mismatches;
+
+    checked = mismatches = 0;
+    for (i = 0; i < ARRAY_SIZE(time_zones); i++) {
+        setenv("TZ", time_zones[i], 1);
+        tzset();
+        for (j = 0; j < ARRAY_SIZE(locales); j++) {
+            // a locale which isn't installed is skipped
+            if (NULL == setlocale(LC_ALL, locales[j])) {
+                continue;
+            }
+            for (k = 0; k < ARRAY_SIZE(formats); k++) {
+                mismatches += check_format(formats[k], time_zones[i], locales[j]);
+                ++checked;
+            }
+        }
+    }
+    if (0 == mismatches) {
+        printf("[ " GREEN("OK") " ] timestamps rendered the same by the cache for %zu combinations of time zone, locale and format\n", checked);
+    }
+
+    return 0 == mismatches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -74,3 +74,18 @@ void get_string(struct pkg *pkg, pkg_attr attr, const char **value)
     pkg_get(pkg, attr, value);
 #endif /* pkg_get_string */
 }
+
+void get_integer(struct pkg *pkg, pkg_attr attr, int64_t *value)
+{
+    assert(NULL != pkg);
+    assert(NULL != value);
+    assert(attr >= 0 && attr <= PKG_ATTR_NUM_FIELDS);
+
+    // unknown, if pkg doesn't set it, rather than a valid 0
+    *value = -1;
+#ifdef pkg_get_int
+    pkg_get_int(pkg, attr, *value);
+#else
+    pkg_get(pkg, attr, value);
+#endif /* pkg_get_int */
+}
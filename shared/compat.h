@@ -67,3 +67,4 @@ enum {
 
 void get_string(struct pkg *, pkg_attr, const char **);
 void get_stringlist(struct pkg *, pkg_attr, struct pkg_stringlist **);
+void get_integer(struct pkg *, pkg_attr, int64_t *);
@@ -1,7 +1,13 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <string.h>
+#include <limits.h> /* PATH_MAX */
+#ifdef WITH_REGEX
+# include <regex.h>
+#endif /* WITH_REGEX */
 #include <sys/stat.h> /* stat */
 #include <unistd.h> /* geteuid */
 
@@ -26,9 +32,28 @@
 #define set_sqlite_stmt_error(error, db, stmt) \
     set_generic_error(error, "%s for %s", sqlite3_errmsg(db), (stmt)->statement)
 
+#ifdef WITH_REGEX
+/**
+ * A pattern compiled for REGEXP, shared by the cache of the connection and
+ * the auxiliary data of the calls which use it
+ */
+typedef struct {
+    int refcount;
+    char *pattern;
+    regex_t regex;
+} sqlite_regex_t;
+
+# define REGEX_CACHE_SIZE 8
+#endif /* WITH_REGEX */
+
 struct sqlite_db_t {
     sqlite3 *db;
     user_version_t user_version;
+#ifdef WITH_REGEX
+    // round-robin cache of the last patterns compiled by REGEXP
+    size_t regex_next;
+    sqlite_regex_t *regexes[REGEX_CACHE_SIZE];
+#endif /* WITH_REGEX */
 };
 
 typedef enum {
@@ -39,6 +64,7 @@ typedef enum {
     SQLITE_TYPE_INT64,
     SQLITE_TYPE_TIME,
     SQLITE_TYPE_STRING,
+    SQLITE_TYPE_BLOB,
     SQLITE_TYPE_IGNORE,
 } sqlite_bind_type_t;
 
@@ -155,6 +181,36 @@ static void string_output_bind(sqlite3_stmt *stmt, int no, void *ptr, bool copy)
     VOIDP_TO_X(ptr, char *) = uv;
 }
 
+static void blob_input_bind(sqlite3_stmt *stmt, int no, va_list *ap)
+{
+    const sqlite_blob_t *blob;
+
+    blob = va_arg(*ap, const sqlite_blob_t *);
+    if (NULL == blob) {
+        sqlite3_bind_null(stmt, no);
+    } else {
+        sqlite3_bind_blob64(stmt, no, blob->data, blob->size, SQLITE_TRANSIENT);
+    }
+}
+
+static void blob_output_bind(sqlite3_stmt *stmt, int no, void *ptr, bool copy)
+{
+    sqlite_blob_t *blob;
+
+    blob = (sqlite_blob_t *) ptr;
+    // sqlite3_column_bytes after sqlite3_column_blob: the value is not converted in between
+    blob->data = sqlite3_column_blob(stmt, no);
+    blob->size = (size_t) sqlite3_column_bytes(stmt, no);
+    if (copy && NULL != blob->data) {
+        void *data;
+
+        if (NULL != (data = malloc(blob->size))) {
+            memcpy(data, blob->data, blob->size);
+        }
+        blob->data = data;
+    }
+}
+
 typedef enum {
     SQLITE_ID_BOOL    = (uint8_t) 'b',
     SQLITE_ID_BOOLEAN = SQLITE_TYPE_BOOL,
@@ -162,6 +218,7 @@ typedef enum {
     SQLITE_ID_INT64   = (uint8_t) 'I',
     SQLITE_ID_TIME    = (uint8_t) 't',
     SQLITE_ID_STRING  = (uint8_t) 's',
+    SQLITE_ID_BLOB    = (uint8_t) 'B',
     SQLITE_ID_IGNORE  = (uint8_t) '-',
 } sqlite_id_type_t;
 
@@ -179,9 +236,10 @@ typedef struct {
 static sqlite_type_callback_t sqlite_type_callbacks[] = {
     [ SQLITE_TYPE_BOOL ]   = { SQLITE_ID_BOOL, SQLITE_TYPE_BOOL, bool_input_bind, bool_output_bind, },
     [ SQLITE_TYPE_INT ]    = { SQLITE_ID_INT, SQLITE_TYPE_INT, int_input_bind, int_output_bind, },
-    [ SQLITE_TYPE_INT64 ]  = { SQLITE_ID_INT, SQLITE_TYPE_INT, int64_input_bind, int64_output_bind, },
+    [ SQLITE_TYPE_INT64 ]  = { SQLITE_ID_INT64, SQLITE_TYPE_INT64, int64_input_bind, int64_output_bind, },
     [ SQLITE_TYPE_TIME ]   = { SQLITE_ID_TIME, SQLITE_TYPE_TIME, time_t_input_bind, time_t_output_bind, },
     [ SQLITE_TYPE_STRING ] = { SQLITE_ID_STRING, SQLITE_TYPE_STRING, string_intput_bind, string_output_bind, },
+    [ SQLITE_TYPE_BLOB ]   = { SQLITE_ID_BLOB, SQLITE_TYPE_BLOB, blob_input_bind, blob_output_bind, },
     [ SQLITE_TYPE_IGNORE ] = { SQLITE_ID_IGNORE, SQLITE_TYPE_IGNORE, NULL, ignore_output_bind, },
 };
 
@@ -191,6 +249,7 @@ static const sqlite_type_callback_t *sqlite_type_callbacks2[256] = {
     [ SQLITE_ID_INT64 ]  = &sqlite_type_callbacks[SQLITE_TYPE_INT64],
     [ SQLITE_ID_TIME ]   = &sqlite_type_callbacks[SQLITE_TYPE_TIME],
     [ SQLITE_ID_STRING ] = &sqlite_type_callbacks[SQLITE_TYPE_STRING],
+    [ SQLITE_ID_BLOB ]   = &sqlite_type_callbacks[SQLITE_TYPE_BLOB],
     [ SQLITE_ID_IGNORE ] = &sqlite_type_callbacks[SQLITE_TYPE_IGNORE],
 };
 
@@ -299,24 +358,50 @@ void statement_to_iterator(Iterator *it, sqlite_statement_t *stmt, ...)
     );
 }
 
-void statement_bind(sqlite_statement_t *stmt, ...)
+static void statement_vbind(sqlite_statement_t *stmt, size_t offset, size_t count, va_list *ap)
 {
-    va_list ap;
     const char *p;
 
-    sqlite3_reset(stmt->prepared);
-    sqlite3_clear_bindings(stmt->prepared);
-    assert(strlen(stmt->input_binds) == ((size_t) sqlite3_bind_parameter_count(stmt->prepared)));
-
-    va_start(ap, stmt);
-    for (p = stmt->input_binds; '\0' != *p; p++) {
+    assert(offset + count <= strlen(stmt->input_binds));
+    for (p = stmt->input_binds + offset; p < stmt->input_binds + offset + count; p++) {
         const sqlite_type_callback_t *sqlite_type_callback;
 
         sqlite_type_callback = sqlite_type_callbacks2[(uint8_t) *p];
         assert(NULL != sqlite_type_callback);
         assert(NULL != sqlite_type_callback->set_input_bind);
-        sqlite_type_callback->set_input_bind(stmt->prepared, p - stmt->input_binds + 1, &ap);
+        sqlite_type_callback->set_input_bind(stmt->prepared, p - stmt->input_binds + 1, ap);
     }
+}
+
+void statement_reset(sqlite_statement_t *stmt)
+{
+    sqlite3_reset(stmt->prepared);
+    sqlite3_clear_bindings(stmt->prepared);
+    assert(strlen(stmt->input_binds) == ((size_t) sqlite3_bind_parameter_count(stmt->prepared)));
+}
+
+void statement_bind(sqlite_statement_t *stmt, ...)
+{
+    va_list ap;
+
+    statement_reset(stmt);
+    va_start(ap, stmt);
+    statement_vbind(stmt, 0, strlen(stmt->input_binds), &ap);
+    va_end(ap);
+}
+
+/**
+ * Binds count parameters of stmt starting from the (0-based) parameter offset
+ * without resetting the statement (call statement_reset first).
+ * Intended to bind rows one after the other of a multi-row statement like
+ * INSERT INTO ... VALUES(?, ?), (?, ?), ...
+ */
+void statement_bind_at(sqlite_statement_t *stmt, size_t offset, size_t count, ...)
+{
+    va_list ap;
+
+    va_start(ap, count);
+    statement_vbind(stmt, offset, count, &ap);
     va_end(ap);
 }
 
@@ -380,7 +465,10 @@ static pkg_error_t check_db_file(const char *path, char **error)
     }
 }
 
-static bool sqlite_execf(sqlite3 *db, char **error, const char *query, ...)
+/**
+ * Formats query with sqlite3_mprintf (%Q, %w, ...) then executes it
+ */
+bool sqlite_execf(sqlite_db_t *dbh, char **error, const char *query, ...)
 {
     int retval;
     va_list ap;
@@ -391,7 +479,7 @@ static bool sqlite_execf(sqlite3 *db, char **error, const char *query, ...)
     buffer = sqlite3_vmprintf(query, ap);
     assert(NULL != buffer); // malloc failed
     va_end(ap);
-    if (SQLITE_OK != (retval = sqlite3_exec(db, buffer, NULL, NULL, &errmsg))) {
+    if (SQLITE_OK != (retval = sqlite3_exec(dbh->db, buffer, NULL, NULL, &errmsg))) {
         set_sqlite_exec_error(error, errmsg, buffer);
         sqlite3_free(errmsg);
     }
@@ -404,7 +492,132 @@ static bool sqlite_execf(sqlite3 *db, char **error, const char *query, ...)
 
 bool sqlite_set_user_version(sqlite_db_t *dbh, user_version_t user_version, char **error)
 {
-    return sqlite_execf(dbh->db, error, "PRAGMA user_version = %" PRId64 ";", user_version);
+    return sqlite_execf(dbh, error, "PRAGMA user_version = %" PRId64 ";", user_version);
+}
+
+#ifdef WITH_REGEX
+static void sqlite_regex_release(void *ptr)
+{
+    sqlite_regex_t *re;
+
+    re = (sqlite_regex_t *) ptr;
+    if (NULL != re && 0 == --re->refcount) {
+        regfree(&re->regex);
+        free(re->pattern);
+        free(re);
+    }
+}
+
+/**
+ * Implements X REGEXP Y (called as regexp(Y, X)) with regex(3) (extended
+ * syntax, case sensitive)
+ *
+ * The compiled pattern is kept as auxiliary data of the call, which sqlite
+ * preserves from a row to the next when the pattern is a constant (a
+ * literal or a parameter). When it is not (a column, like the searched
+ * patterns), it is found back in the cache of the connection instead: a
+ * pattern is compiled once per statement either way, not once per row.
+ */
+static void sqlite_regexp(sqlite3_context *context, int UNUSED(argc), sqlite3_value **argv)
+{
+    sqlite_regex_t *re;
+    const char *pattern, *string;
+
+    pattern = (const char *) sqlite3_value_text(argv[0]);
+    string = (const char *) sqlite3_value_text(argv[1]);
+    if (NULL == pattern || NULL == string) {
+        return;
+    }
+    if (NULL == (re = sqlite3_get_auxdata(context, 0))) {
+        size_t i;
+        sqlite_db_t *dbh;
+
+        dbh = sqlite3_user_data(context);
+        for (i = 0; i < ARRAY_SIZE(dbh->regexes); i++) {
+            if (NULL != dbh->regexes[i] && 0 == strcmp(dbh->regexes[i]->pattern, pattern)) {
+                re = dbh->regexes[i];
+                break;
+            }
+        }
+        if (NULL == re) {
+            int ret;
+
+            if (NULL == (re = malloc(sizeof(*re))) || NULL == (re->pattern = strdup(pattern))) {
+                free(re);
+                sqlite3_result_error_nomem(context);
+                return;
+            }
+            if (0 != (ret = regcomp(&re->regex, pattern, REG_EXTENDED | REG_NOSUB))) {
+                char buffer[256], *message;
+
+                regerror(ret, &re->regex, buffer, sizeof(buffer));
+                message = sqlite3_mprintf("invalid regular expression '%s': %s", pattern, buffer);
+                sqlite3_result_error(context, NULL == message ? buffer : message, -1);
+                sqlite3_free(message);
+                free(re->pattern);
+                free(re);
+                return;
+            }
+            // the cache holds a reference
+            re->refcount = 1;
+            sqlite_regex_release(dbh->regexes[dbh->regex_next]);
+            dbh->regexes[dbh->regex_next] = re;
+            dbh->regex_next = (dbh->regex_next + 1) % ARRAY_SIZE(dbh->regexes);
+        }
+        // and the auxiliary data another one (released by sqlite, immediately if it can't keep it)
+        ++re->refcount;
+        sqlite3_set_auxdata(context, 0, re, sqlite_regex_release);
+        if (NULL == (re = sqlite3_get_auxdata(context, 0))) {
+            sqlite3_result_error_nomem(context);
+            return;
+        }
+    }
+    sqlite3_result_int(context, 0 == regexec(&re->regex, string, 0, NULL, 0));
+}
+#endif /* WITH_REGEX */
+
+#define FNV1A64_OFFSET_BASIS UINT64_C(0xcbf29ce484222325)
+#define FNV1A64_PRIME UINT64_C(0x100000001b3)
+
+static uint64_t fnv1a64(uint64_t hash, const unsigned char *bytes, size_t length)
+{
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= FNV1A64_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * Implements fnv1a64(X, ...): the 64 bits FNV-1a hash of the text of its
+ * arguments. Each one is followed by a NUL byte and a NULL is hashed as a
+ * single 0xFF byte, so ('ab', 'c'), ('a', 'bc') and ('', NULL) don't collide
+ * by construction.
+ */
+static void sqlite_fnv1a64(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    int i;
+    uint64_t hash;
+
+    hash = FNV1A64_OFFSET_BASIS;
+    for (i = 0; i < argc; i++) {
+        if (SQLITE_NULL == sqlite3_value_type(argv[i])) {
+            hash = fnv1a64(hash, (const unsigned char *) "\xFF", 1);
+        } else {
+            const unsigned char *text;
+
+            if (NULL == (text = sqlite3_value_text(argv[i]))) {
+                sqlite3_result_error_nomem(context);
+                return;
+            }
+            // with its terminating NUL
+            hash = fnv1a64(hash, text, sqlite3_value_bytes(argv[i]) + 1);
+        }
+    }
+    sqlite3_result_int64(context, (sqlite3_int64) hash);
 }
 
 static int sqlite_trace_callback(unsigned UNUSED(trace), void *UNUSED(context), void *p, void *UNUSED(x))
@@ -420,15 +633,66 @@ static int sqlite_trace_callback(unsigned UNUSED(trace), void *UNUSED(context),
     return 0;
 }
 
+/**
+ * Tells if the WAL of the database path is empty or missing
+ */
+static bool sqlite_wal_is_empty(const char *path)
+{
+    char buffer[PATH_MAX];
+    struct stat sb;
+
+    if (snprintf(buffer, STR_SIZE(buffer), "%s-wal", path) >= (int) STR_SIZE(buffer)) {
+        return false;
+    }
+    if (0 == stat(buffer, &sb)) {
+        return 0 == sb.st_size;
+    } else {
+        return ENOENT == errno;
+    }
+}
+
+/**
+ * Builds the URI file:path?parameters (path being escaped)
+ */
+static char *sqlite_file_uri(const char *path, const char *parameters)
+{
+    char *uri, *w;
+    const char *r;
+
+    // a path starting with // would be taken for an authority
+    while ('/' == path[0] && '/' == path[1]) {
+        ++path;
+    }
+    if (NULL != (uri = malloc(STR_SIZE("file:") + strlen(path) * STR_LEN("%XX") + STR_LEN("?") + strlen(parameters)))) {
+        w = stpcpy(uri, "file:");
+        for (r = path; '\0' != *r; r++) {
+            if ('%' == *r || '?' == *r || '#' == *r) {
+                w += sprintf(w, "%%%02X", (unsigned char) *r);
+            } else {
+                *w++ = *r;
+            }
+        }
+        *w++ = '?';
+        strcpy(w, parameters);
+    }
+
+    return uri;
+}
+
 /**
  * NOTE:
  * - mode is PKGDB_MODE_READ and/or PKGDB_MODE_WRITE
+ * - PKGDB_MODE_CREATE can be added to mode to create/write the database whoever the current user is
+ *   (not intended to be used on the databases of pkg, only on scratch ones like for benchmarks)
+ * - options can be NULL to keep the defaults of sqlite (no busy timeout, rollback journal)
+ * - hook, if not NULL, is called on the new connection to register the
+ *   functions and collations the schema of the caller depends on
  * - Possible returned values are:
  *   + EPKG_ENODB if database doesn't exist but current user can't create it
  *   + EPKG_OK on success
  *   + EPKG_FATAL on error
  */
-pkg_error_t sqlite_open(const char *path, int mode, sqlite_db_t **dbh, char **error)
+pkg_error_t sqlite_open(const char *path, int mode, const sqlite_open_options_t *options, sqlite_open_hook_t hook, sqlite_db_t **dbh, char **error)
 {
     pkg_error_t status;
 
@@ -443,7 +707,9 @@ pkg_error_t sqlite_open(const char *path, int mode, sqlite_db_t **dbh, char **er
         if (EPKG_FATAL == (db_state = check_db_file(path, error))) {
             break;
         }
-        if (0 == geteuid()) {
+        if (HAS_FLAG(mode, PKGDB_MODE_CREATE)) {
+            flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+        } else if (0 == geteuid()) {
             if (EPKG_ENODB == db_state) {
                 flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
             } else {
@@ -459,14 +725,80 @@ pkg_error_t sqlite_open(const char *path, int mode, sqlite_db_t **dbh, char **er
         }
         tmp->db = NULL;
         tmp->user_version = -1;
+#ifdef WITH_REGEX
+        tmp->regex_next = 0;
+        memset(tmp->regexes, 0, sizeof(tmp->regexes));
+#endif /* WITH_REGEX */
         if (SQLITE_OK != sqlite3_initialize()) {
             set_generic_error(error, "can't initialize sqlite");
             break;
         }
-        if (SQLITE_OK != sqlite3_open_v2(path, &tmp->db, flags, NULL)) {
+        // SQLITE_OPEN_URI either way: sqlite_attach attaches through an URI (path itself doesn't start by file:)
+        if (NULL != options && options->immutable && !HAS_FLAG(flags, SQLITE_OPEN_READWRITE) && sqlite_wal_is_empty(path)) {
+            int ret;
+            char *uri;
+
+            if (NULL == (uri = sqlite_file_uri(path, "immutable=1"))) {
+                set_malloc_error(error, strlen(path));
+                break;
+            }
+            ret = sqlite3_open_v2(uri, &tmp->db, flags | SQLITE_OPEN_URI, NULL);
+            free(uri);
+            if (SQLITE_OK != ret) {
+                set_generic_error(error, "can't open sqlite database %s: %s", path, sqlite3_errmsg(tmp->db));
+                break;
+            }
+        } else if (SQLITE_OK != sqlite3_open_v2(path, &tmp->db, flags | SQLITE_OPEN_URI, NULL)) {
             set_generic_error(error, "can't open sqlite database %s: %s", path, sqlite3_errmsg(tmp->db));
             break;
         }
+        if (NULL != options) {
+            sqlite3_busy_timeout(tmp->db, options->busy_timeout);
+            if (0 != options->mmap_size && !sqlite_execf(tmp, error, "PRAGMA mmap_size = %" PRId64, options->mmap_size)) {
+                break;
+            }
+            // a negative cache_size is in KiB, a positive one in pages
+            if (0 != options->cache_size && !sqlite_execf(tmp, error, "PRAGMA cache_size = -%d", options->cache_size)) {
+                break;
+            }
+            if (options->wal && HAS_FLAG(flags, SQLITE_OPEN_READWRITE)) {
+                int persist;
+
+                if (!sqlite_execf(tmp, error, "PRAGMA journal_mode = WAL")) {
+                    break;
+                }
+                if (!sqlite_execf(tmp, error, "PRAGMA synchronous = NORMAL")) {
+                    break;
+                }
+                /**
+                 * Keep the -wal and -shm files when the last connection is closed: else an unprivileged
+                 * user, who can't create them in the (root owned) directory, can't read the database
+                 */
+                persist = 1;
+                sqlite3_file_control(tmp->db, NULL, SQLITE_FCNTL_PERSIST_WAL, &persist);
+                /**
+                 * But truncate the WAL once checkpointed, instead of keeping it at the size of the largest
+                 * transaction: an empty WAL also tells, for immutable, that the database is self-contained
+                 */
+                if (!sqlite_execf(tmp, error, "PRAGMA journal_size_limit = 0")) {
+                    break;
+                }
+            }
+        }
+#ifdef WITH_REGEX
+        if (SQLITE_OK != sqlite3_create_function(tmp->db, "regexp", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, tmp, sqlite_regexp, NULL, NULL)) {
+            set_generic_error(error, "can't register function regexp: %s", sqlite3_errmsg(tmp->db));
+            break;
+        }
+#endif /* WITH_REGEX */
+        if (SQLITE_OK != sqlite3_create_function(tmp->db, "fnv1a64", -1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, sqlite_fnv1a64, NULL, NULL)) {
+            set_generic_error(error, "can't register function fnv1a64: %s", sqlite3_errmsg(tmp->db));
+            break;
+        }
+        // the functions and collations of the caller, before its schema is read
+        if (NULL != hook && !hook(tmp->db, error)) {
+            break;
+        }
         // preprepare own statement
         if (!sqlite_stmt_prepare(tmp, statements, ARRAY_SIZE(statements), error)) {
             break;
@@ -490,15 +822,34 @@ pkg_error_t sqlite_open(const char *path, int mode, sqlite_db_t **dbh, char **er
 
 void sqlite_close(sqlite_db_t *dbh)
 {
+#ifdef WITH_REGEX
+    size_t i;
+#endif /* WITH_REGEX */
+
     assert(NULL != dbh);
     assert(NULL != dbh->db);
 
     sqlite_stmt_finalize(statements, ARRAY_SIZE(statements));
     sqlite3_close(dbh->db);
+#ifdef WITH_REGEX
+    for (i = 0; i < ARRAY_SIZE(dbh->regexes); i++) {
+        sqlite_regex_release(dbh->regexes[i]);
+    }
+#endif /* WITH_REGEX */
     free(dbh);
     sqlite3_shutdown();
 }
 
+bool sqlite_is_readonly(sqlite_db_t *dbh)
+{
+    return 1 == sqlite3_db_readonly(dbh->db, "main");
+}
+
+user_version_t sqlite_get_user_version(sqlite_db_t *dbh)
+{
+    return dbh->user_version;
+}
+
 int sqlite_last_insert_id(sqlite_db_t *dbh)
 {
     return sqlite3_last_insert_rowid(dbh->db);
@@ -531,6 +882,10 @@ bool sqlite_create_or_migrate(sqlite_db_t *dbh, const char *table_name, const ch
                 ret = sqlite3_exec(dbh->db, create_stmt, NULL, NULL, &errmsg);
                 break;
             case SQLITE_ROW:
+                // a read-only connection can't migrate the schema: leave it to the next writer
+                if (sqlite_is_readonly(dbh)) {
+                    break;
+                }
                 for (i = 0; SQLITE_OK == ret && i < migrations_count; i++) {
                     if (migrations[i].version > dbh->user_version) {
                         ret = sqlite3_exec(dbh->db, migrations[i].statement, NULL, NULL, &errmsg);
@@ -579,11 +934,12 @@ void sqlite_stmt_finalize(sqlite_statement_t *statements, size_t count)
     for (i = 0; i < count; i++) {
         if (NULL != statements[i].prepared) {
             sqlite3_finalize(statements[i].prepared);
+            statements[i].prepared = NULL;
         }
     }
 }
 
-static bool sqlite_exec(sqlite_db_t *dbh, const char *query, char **error)
+bool sqlite_exec(sqlite_db_t *dbh, const char *query, char **error)
 {
     int ret;
     char *errmsg;
@@ -599,6 +955,122 @@ static bool sqlite_exec(sqlite_db_t *dbh, const char *query, char **error)
     return SQLITE_OK == ret;
 }
 
+/**
+ * Maximum count of databases which can be attached at once to a connection
+ * (SQLITE_MAX_ATTACHED, 10 by default)
+ */
+int sqlite_attached_limit(sqlite_db_t *dbh)
+{
+    return sqlite3_limit(dbh->db, SQLITE_LIMIT_ATTACHED, -1);
+}
+
+/**
+ * Reads the user_version of the attached database schema
+ */
+bool sqlite_attached_user_version(sqlite_db_t *dbh, const char *schema, user_version_t *user_version, char **error)
+{
+    bool ok;
+    char *buffer;
+    sqlite3_stmt *stmt;
+
+    ok = false;
+    stmt = NULL;
+    do {
+        if (NULL == (buffer = sqlite3_mprintf("PRAGMA \"%w\".user_version", schema))) {
+            set_malloc_error(error, strlen(schema));
+            break;
+        }
+        if (SQLITE_OK != sqlite3_prepare_v2(dbh->db, buffer, -1, &stmt, NULL) || SQLITE_ROW != sqlite3_step(stmt)) {
+            set_generic_error(error, "%s for %s", sqlite3_errmsg(dbh->db), buffer);
+            break;
+        }
+        *user_version = sqlite3_column_int64(stmt, 0);
+        ok = true;
+    } while (false);
+    sqlite3_finalize(stmt);
+    sqlite3_free(buffer);
+
+    return ok;
+}
+
+/**
+ * Reads the data_version of the main database: it changes each time an
+ * other connection commits a transaction to it (but not for the commits
+ * of dbh itself)
+ */
+bool sqlite_data_version(sqlite_db_t *dbh, int64_t *data_version, char **error)
+{
+    bool ok;
+    sqlite3_stmt *stmt;
+
+    ok = false;
+    stmt = NULL;
+    do {
+        if (SQLITE_OK != sqlite3_prepare_v2(dbh->db, "PRAGMA data_version", -1, &stmt, NULL) || SQLITE_ROW != sqlite3_step(stmt)) {
+            set_generic_error(error, "%s for PRAGMA data_version", sqlite3_errmsg(dbh->db));
+            break;
+        }
+        *data_version = sqlite3_column_int64(stmt, 0);
+        ok = true;
+    } while (false);
+    sqlite3_finalize(stmt);
+
+    return ok;
+}
+
+/**
+ * Sets trusted_schema (for the whole connection) to trusted, its previous
+ * value is written to previous if not NULL. Off, the views, triggers and
+ * indexes of the schemas (attached ones included) can only call the
+ * functions and virtual tables flagged innocuous: not the ones registered
+ * by sqlite_open or its hook, nor FTS5.
+ */
+bool sqlite_trusted_schema(sqlite_db_t *dbh, bool trusted, bool *previous, char **error)
+{
+    bool ok;
+    sqlite3_stmt *stmt;
+
+    ok = false;
+    stmt = NULL;
+    do {
+        if (NULL != previous) {
+            if (SQLITE_OK != sqlite3_prepare_v2(dbh->db, "PRAGMA trusted_schema", -1, &stmt, NULL) || SQLITE_ROW != sqlite3_step(stmt)) {
+                set_generic_error(error, "%s for PRAGMA trusted_schema", sqlite3_errmsg(dbh->db));
+                break;
+            }
+            *previous = 0 != sqlite3_column_int(stmt, 0);
+        }
+        ok = sqlite_execf(dbh, error, "PRAGMA trusted_schema = %d", (int) trusted);
+    } while (false);
+    sqlite3_finalize(stmt);
+
+    return ok;
+}
+
+/**
+ * Attaches the database at path as schema, read-only: it is neither
+ * created nor written through dbh
+ */
+bool sqlite_attach(sqlite_db_t *dbh, const char *path, const char *schema, char **error)
+{
+    bool ok;
+    char *uri;
+
+    if (NULL == (uri = sqlite_file_uri(path, "mode=ro"))) {
+        set_malloc_error(error, strlen(path));
+        return false;
+    }
+    ok = sqlite_execf(dbh, error, "ATTACH DATABASE %Q AS \"%w\"", uri, schema);
+    free(uri);
+
+    return ok;
+}
+
+bool sqlite_detach(sqlite_db_t *dbh, const char *schema, char **error)
+{
+    return sqlite_execf(dbh, error, "DETACH DATABASE \"%w\"", schema);
+}
+
 bool sqlite_transaction_begin(sqlite_db_t *dbh, char **error)
 {
     return sqlite_exec(dbh, "BEGIN", error);
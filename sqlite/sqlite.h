@@ -6,6 +6,8 @@ typedef int64_t user_version_t;
 
 typedef struct sqlite_db_t sqlite_db_t;
 
+struct sqlite3;
+
 typedef struct {
     user_version_t version;
     const char *statement;
@@ -21,8 +23,58 @@ typedef struct {
 #define DECL_STMT(sql, inbinds, outbinds) \
     { sql, inbinds, outbinds, NULL }
 
+/**
+ * A BLOB, bound (B) by address: as input, a NULL address binds NULL; as
+ * output, data is NULL for a NULL value
+ */
+typedef struct {
+    const void *data;
+    size_t size;
+} sqlite_blob_t;
+
+typedef struct {
+    /**
+     * Time, in milliseconds, to wait for a lock held by another connection
+     * before giving up with SQLITE_BUSY (0 to fail immediately)
+     */
+    int busy_timeout;
+    /**
+     * When the database is opened for writing, switch it to WAL journaling
+     * (readers and the writer no longer block each others) with synchronous
+     * set to NORMAL (no fsync on commit, only on checkpoints)
+     */
+    bool wal;
+    /**
+     * Size, in bytes, of the memory mapping of the database (0 to keep the
+     * default of sqlite, no mapping): its pages are read in place from the
+     * page cache of the kernel instead of through read(2) and a copy
+     */
+    int64_t mmap_size;
+    /**
+     * Size, in KiB, of the page cache of the connection (0 to keep the
+     * default of sqlite, 2 MiB)
+     */
+    int cache_size;
+    /**
+     * When the database is opened read-only, open it immutable: no locks
+     * and no look at the WAL. Only safe if no other process writes to it
+     * meanwhile, so it is ignored if the WAL is not empty (not all the
+     * commits are in the database itself).
+     */
+    bool immutable;
+} sqlite_open_options_t;
+
+/**
+ * Called by sqlite_open on the raw connection, before the database is
+ * read: registers the functions and collations of a schema
+ */
+typedef bool (*sqlite_open_hook_t)(struct sqlite3 *, char **);
+
 void sqlite_close(sqlite_db_t *);
-pkg_error_t sqlite_open(const char *, int, sqlite_db_t **, char **);
+pkg_error_t sqlite_open(const char *, int, const sqlite_open_options_t *, sqlite_open_hook_t, sqlite_db_t **, char **);
+
+bool sqlite_is_readonly(sqlite_db_t *);
+user_version_t sqlite_get_user_version(sqlite_db_t *);
 
 int sqlite_affected_rows(sqlite_db_t *);
 int sqlite_last_insert_id(sqlite_db_t *);
@@ -33,10 +85,23 @@ bool sqlite_stmt_prepare(sqlite_db_t *, sqlite_statement_t *, size_t, char **);
 bool sqlite_set_user_version(sqlite_db_t *, user_version_t, char **);
 bool sqlite_create_or_migrate(sqlite_db_t *, const char *, const char *, sqlite_migration_t *, size_t, char **);
 
+void statement_reset(sqlite_statement_t *);
 void statement_bind(sqlite_statement_t *, ...);
+void statement_bind_at(sqlite_statement_t *, size_t, size_t, ...);
 int statement_fetch(sqlite_db_t *, sqlite_statement_t *, char **, ...);
 void statement_to_iterator(Iterator *, sqlite_statement_t *, ...);
 
+bool sqlite_exec(sqlite_db_t *, const char *, char **);
+bool sqlite_execf(sqlite_db_t *, char **, const char *, ...);
+
+int sqlite_attached_limit(sqlite_db_t *);
+bool sqlite_trusted_schema(sqlite_db_t *, bool, bool *, char **);
+bool sqlite_attach(sqlite_db_t *, const char *, const char *, char **);
+bool sqlite_detach(sqlite_db_t *, const char *, char **);
+bool sqlite_attached_user_version(sqlite_db_t *, const char *, user_version_t *, char **);
+
+bool sqlite_data_version(sqlite_db_t *, int64_t *, char **);
+
 bool sqlite_transaction_begin(sqlite_db_t *, char **);
 bool sqlite_transaction_commit(sqlite_db_t *, char **);
 bool sqlite_transaction_rollback(sqlite_db_t *, char **);